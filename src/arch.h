@@ -81,8 +81,11 @@
 #define ElfXX_Rela Elf64_Rela
 #define ElfXX_Shdr Elf64_Shdr
 #define ElfXX_Ehdr Elf64_Ehdr
+#define ElfXX_Phdr Elf64_Phdr
 #define ElfXX_Dyn Elf64_Dyn
 #define elfxx_getshdr elf64_getshdr
+#define elfxx_getehdr elf64_getehdr
+#define elfxx_getphdr elf64_getphdr
 #define elfxx_newehdr elf64_newehdr
 #define ELFXX_R_TYPE ELF64_R_TYPE
 #define ELFXX_R_SYM ELF64_R_SYM
@@ -110,8 +113,11 @@
 #define ElfXX_Rela Elf32_Rela
 #define ElfXX_Shdr Elf32_Shdr
 #define ElfXX_Ehdr Elf32_Ehdr
+#define ElfXX_Phdr Elf32_Phdr
 #define ElfXX_Dyn Elf32_Dyn
 #define elfxx_getshdr elf32_getshdr
+#define elfxx_getehdr elf32_getehdr
+#define elfxx_getphdr elf32_getphdr
 #define elfxx_newehdr elf32_newehdr
 #define ELFXX_R_TYPE ELF32_R_TYPE
 #define ELFXX_R_SYM ELF32_R_SYM
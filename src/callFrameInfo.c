@@ -318,9 +318,10 @@ void buildFDERawData(CallFrameInfo* cfi,FDE* fde,uint* cieOffsets,addr_t* lsdaPo
   assert(fde->cie);
   
 
+  int numInstructions;
+  RegInstruction* instructions=getFDEInstructions(fde,&numInstructions);
   DwarfInstructions rawInstructions=
-    serializeDwarfRegInstructions(fde->instructions,
-                                  fde->numInstructions);
+    serializeDwarfRegInstructions(instructions,numInstructions);
 
   if(cfi->isEHFrame)
   {
@@ -447,12 +448,6 @@ void buildFDERawData(CallFrameInfo* cfi,FDE* fde,uint* cieOffsets,addr_t* lsdaPo
   destroyRawInstructions(rawInstructions);
 }
 
-typedef struct
-{
-  int32 initialLocation;
-  int32 fdeAddress;
-} EhFrameHdrTableEntry;
-
 
 int compareEhFrameHdrTableEntries(const void* a_,const void* b_)
 {
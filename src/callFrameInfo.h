@@ -59,13 +59,23 @@
 #include "dwarf_instr.h"
 #include <libelf.h>
 #include "elfutil.h"
+#include "util/arena.h"
 
+//one entry of the binary search table in .eh_frame_hdr when it is
+//encoded as DW_EH_PE_datarel | DW_EH_PE_sdata4
+typedef struct
+{
+  int32 initialLocation;
+  int32 fdeAddress;
+} EhFrameHdrTableEntry;
 
 typedef struct CallFrameInfo
 {
   struct FDE* fdes;//for relocatable and executable objects, these
                    //will be sorted by lowpc
   int numFDEs;
+  struct FDE** fdesByOffset;//the fdes sorted by offset, only for
+                            //call frame information read from a binary
   struct CIE* cies;
   int numCIEs;
   bool isEHFrame;
@@ -80,6 +90,10 @@ typedef struct CallFrameInfo
   //1) DW_EH_PE_datarel | DW_EH_PE_sdata4
   //2) DW_EH_PE_omit 
   byte hdrTableEncoding;
+  //the table itself, pointing into the section data, if it was read
+  //from a binary and has the first encoding above
+  EhFrameHdrTableEntry* hdrTable;
+  int hdrTableCount;
   
   //exception handling table, info that would be stored in
   //.gcc_except_frame
@@ -127,14 +141,23 @@ typedef struct CIE
   byte fdeLSDAPointerEncoding;
   byte personalityPointerEncoding;
   addr_t personalityFunction;
+
+  //where the instructions of FDEs using this CIE are decoded into
+  //when they are first asked for. NULL if the CIE wasn't read from a
+  //binary
+  Arena* arena;
 } CIE;
 
 
 typedef struct FDE
 {
   CIE* cie;
+  //use getFDEInstructions rather than reading these directly, an
+  //FDE read from a binary only has rawInstructions until then
   RegInstruction* instructions;
   int numInstructions;
+  byte* rawInstructions;
+  int rawInstructionsLen;
   int memSize;//size of memory area the FDE describes. Used when
               //fixing up pointers to know how much mem to
               //allocate. Has no meaning if this FDE wasn't read from
@@ -150,6 +173,10 @@ typedef struct FDE
   
   bool hasLSDAPointer;
   idx_t lsdaIdx;
+
+  //the dwarf VM compiles an FDE describing a type transformation
+  //the first time it is used. Allocated from the patch's arena
+  struct TransformProgram* transformProgram;
 } FDE;
 
 //struct for raw data returned from buildCallFrameSectionData
@@ -231,6 +258,7 @@ void parseFDEAugmentationData(FDE* fde,addr_t augDataAddress,byte* augmentationD
 //writes out mapping from lsda indices to addresses
 ExceptTable parseExceptFrame(Elf_Scn* scn,addr_t* lsdaPointers,int numLSDAPointers);
 
-
+//the FDE's instructions, decoding them first if they haven't been
+RegInstruction* getFDEInstructions(FDE* fde,int* numInstructions);
 
 #endif
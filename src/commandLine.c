@@ -61,7 +61,7 @@
 void configureFromCommandLine(int argc,char** argv)
 {
   int opt;
-  while((opt=getopt(argc,argv,"hcslrHgpo:"))>0)
+  while((opt=getopt(argc,argv,"hcslrHgpMo:"))>0)
   {
     switch(opt)
     {
@@ -109,6 +109,9 @@ void configureFromCommandLine(int argc,char** argv)
     case 'H':
       setFlag(EKCF_EH_FRAME,true);
       break;
+    case 'M':
+      setFlag(EKCF_NO_MMAP,true);
+      break;
     case 'r':
       //this is a debug option at the moment. It is not intended to be
       //used generally. It's functionality may change from time to
@@ -151,11 +154,18 @@ void configureFromCommandLine(int argc,char** argv)
   {
     if(argc-optind<2)
     {
-      death("Usage to apply patch: katana -p [OPTIOJNS] PATCH_FILE PID\nSee the man page for a description of options\n");
+      death("Usage to apply patch: katana -p [OPTIOJNS] PATCH_FILE [PATCH_FILE...] PID\nSee the man page for a description of options\n");
     }
+    //several patches catch the target up through a series of
+    //releases, all applied while it is stopped once
     config.objectName=argv[optind];
-    printf("patch file is %s\n",config.objectName);
-    config.pid=atoi(argv[optind+1]);
+    config.patchNames=argv+optind;
+    config.numPatches=argc-optind-1;
+    for(int i=0;i<config.numPatches;i++)
+    {
+      printf("patch file is %s\n",config.patchNames[i]);
+    }
+    config.pid=atoi(argv[argc-1]);
     fprintf(stderr,"pid is %i\n",config.pid);
   }
   else if(EKM_INFO==config.mode)
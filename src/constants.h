@@ -63,3 +63,8 @@
 #define EH_FRAME_HDR_VERSION 1
 
 #define SHT_KATANA_UNSAFE_FUNCTIONS SHT_LOUSER+0x1
+#define SHT_KATANA_PLAN SHT_LOUSER+0x2
+
+//alignment in the patch object of sections the target maps directly
+//rather than having them copied in. At least the page size
+#define PATCH_MAPPED_SECTION_ALIGN 0x1000
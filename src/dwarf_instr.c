@@ -137,6 +137,23 @@ void addInstruction(DwarfInstructions* instrs,DwarfInstruction* instr)
     addBytes(instrs,bytes,1+instr->arg1NumBytes+instr->arg2NumBytes+instr->arg3NumBytes);
     free(bytes);
     break;
+  case DW_CFA_KATANA_fixups_array:
+    {
+      int len=1+instr->arg1NumBytes+instr->arg2NumBytes+instr->arg3NumBytes+instr->arg4NumBytes;
+      bytes=zmalloc(len);
+      bytes[0]=instr->opcode;
+      byte* pos=bytes+1;
+      memcpy(pos,instr->arg1Bytes,instr->arg1NumBytes);
+      pos+=instr->arg1NumBytes;
+      memcpy(pos,instr->arg2Bytes,instr->arg2NumBytes);
+      pos+=instr->arg2NumBytes;
+      memcpy(pos,instr->arg3Bytes,instr->arg3NumBytes);
+      pos+=instr->arg3NumBytes;
+      memcpy(pos,instr->arg4Bytes,instr->arg4NumBytes);
+      addBytes(instrs,bytes,len);
+      free(bytes);
+    }
+    break;
     
   //location has no meaning (yet anyway) in patches. We do support more
   //general purpose dwarf manipulation though, so we'll support these
@@ -323,6 +340,13 @@ void printInstruction(FILE* file,RegInstruction inst,int printFlags)
     fprintf(file,"fde#%lu ",(unsigned long)inst.arg3);
     fprintf(file,"\n");
     break;
+  case DW_CFA_KATANA_fixups_array:
+    fprintf(file,"DW_CFA_KATANA_fixups_array ");
+    printReg(file,inst.arg1Reg,printFlags);
+    fprintf(file," ");
+    printReg(file,inst.arg2Reg,printFlags);
+    fprintf(file," fde#%lu x%lu\n",(unsigned long)inst.arg3,(unsigned long)inst.arg4);
+    break;
 
   case DW_CFA_def_cfa:
     fprintf(file,"DW_CFA_def_cfa ");
@@ -86,6 +86,9 @@ typedef struct
   byte* arg3Bytes;
   usint arg3NumBytes;
   word_t arg3;
+  byte* arg4Bytes;
+  usint arg4NumBytes;
+  word_t arg4;
   //both the integer and bytes values for an argument are not valid at any one time
   //which is valid depends on the opcode
 } DwarfInstruction;
@@ -121,10 +124,17 @@ typedef struct
   int type;//one of DW_CFA_
   word_t arg1;//whether used depends on the type
   DwarfExpr expr;//only used for DW_CFA_expression and similar
+  byte* exprBytes;//the encoded expression, only set for instructions
+                  //read from a binary
+  int exprLen;
+  struct DwarfExprProgram* exprProgram;//exprBytes decoded for evaluation
+                                       //by the dwarf vm the first time
+                                       //it is needed, NULL until then
   PoReg arg1Reg;//whether used depends on the type
   word_t arg2;//whether used depends on the type
   PoReg arg2Reg;//whether used depends on the type
-  word_t arg3;//used only for DW_CFA_KATANA_do_fixups
+  word_t arg3;//used only for the DW_CFA_KATANA_fixups instructions
+  word_t arg4;//used only for DW_CFA_KATANA_fixups_array
 } RegInstruction;
 
 
@@ -171,4 +181,11 @@ extern char** dwarfExpressionNames;
 //corresponds to a pointer to a type given by the index of the FDE
 #define DW_CFA_KATANA_fixups_pointer DW_CFA_lo_user+0x6
 
+//fixes up an array. The first three operands are as for
+//DW_CFA_KATANA_fixups, for the first element, with the size of each
+//register being the size of an element. The fourth is a LEB128
+//number of elements. The fixups are applied to each element in turn,
+//stepping both registers along by their sizes
+#define DW_CFA_KATANA_fixups_array DW_CFA_lo_user+0x7
+
 #endif
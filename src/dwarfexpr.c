@@ -0,0 +1,697 @@
+/*
+  File: dwarfexpr.c
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: stack machine for DWARF expressions
+*/
+
+#include "dwarfexpr.h"
+#include "leb.h"
+#include "util/util.h"
+#include "patcher/target.h"
+#include <dwarf.h>
+#include <stdlib.h>
+#include <string.h>
+
+//the stack lives on the C stack while a program runs
+#define DWARF_EXPR_MAX_STACK 256
+//a program with backward branches can loop forever, give up after
+//this many operations
+#define DWARF_EXPR_MAX_STEPS (1<<24)
+
+//the decoded operations. Several DW_OP_* collapse into one of these
+//(every way of pushing a constant becomes DEO_CONST, every
+//DW_OP_breg* becomes DEO_BREG, and so on)
+typedef enum
+{
+  DEO_END=0,//falls off the end of the program
+  DEO_CONST,
+  DEO_DUP,
+  DEO_DROP,
+  DEO_PICK,
+  DEO_SWAP,
+  DEO_ROT,
+  DEO_DEREF,
+  DEO_ABS,
+  DEO_AND,
+  DEO_DIV,
+  DEO_MINUS,
+  DEO_MOD,
+  DEO_MUL,
+  DEO_NEG,
+  DEO_NOT,
+  DEO_OR,
+  DEO_PLUS,
+  DEO_PLUS_CONST,
+  DEO_SHL,
+  DEO_SHR,
+  DEO_SHRA,
+  DEO_XOR,
+  DEO_EQ,
+  DEO_GE,
+  DEO_GT,
+  DEO_LE,
+  DEO_LT,
+  DEO_NE,
+  DEO_SKIP,
+  DEO_BRA,
+  DEO_BREG,
+  DEO_FBREG,
+  DEO_CFA,
+  DEO_OBJECT_ADDRESS,
+  DEO_NOP,
+  DEO_UNSUPPORTED,
+  DEO_NUM_OPS
+} E_DWARF_EXPR_OP;
+
+typedef struct
+{
+  byte op;//E_DWARF_EXPR_OP
+  byte size;//bytes to read for DEO_DEREF
+  byte dwOp;//the original DW_OP_*, for error messages
+  int arg;//instruction index for DEO_SKIP and DEO_BRA, register
+          //for DEO_BREG, stack index for DEO_PICK
+  word_t operand;//constant for DEO_CONST and DEO_PLUS_CONST, offset
+                 //for DEO_BREG and DEO_FBREG
+} DwarfExprOp;
+
+struct DwarfExprProgram
+{
+  DwarfExprOp* ops;//numOps+1 entries, the last is always DEO_END
+  int numOps;
+  bool ownsMemory;//allocated without an arena
+};
+
+static word_t readUnsigned(byte* bytes,int size)
+{
+  switch(size)
+  {
+  case 1:
+    return *bytes;
+  case 2:
+    {
+      uint16_t val;
+      memcpy(&val,bytes,2);
+      return val;
+    }
+  case 4:
+    {
+      uint32_t val;
+      memcpy(&val,bytes,4);
+      return val;
+    }
+  default:
+    {
+      uint64_t val;
+      memcpy(&val,bytes,8);
+      return (word_t)val;
+    }
+  }
+}
+
+static word_t readSigned(byte* bytes,int size)
+{
+  switch(size)
+  {
+  case 1:
+    return (word_t)(sword_t)(int8_t)*bytes;
+  case 2:
+    return (word_t)(sword_t)(int16_t)readUnsigned(bytes,2);
+  case 4:
+    return (word_t)(sword_t)(int32_t)readUnsigned(bytes,4);
+  default:
+    return readUnsigned(bytes,8);
+  }
+}
+
+//LEB operands are bounded by the end of the expression
+static word_t readULEBOperand(byte* bytes,int len,int* pos)
+{
+  word_t value;
+  usint lebLen=decodeULEB128(bytes+*pos,bytes+len,&value);
+  if(!lebLen)
+  {
+    death("DWARF expression operation 0x%x has a malformed operand\n",(int)bytes[0]);
+  }
+  *pos+=lebLen;
+  return value;
+}
+
+static word_t readSLEBOperand(byte* bytes,int len,int* pos)
+{
+  sword_t value;
+  usint lebLen=decodeSLEB128(bytes+*pos,bytes+len,&value);
+  if(!lebLen)
+  {
+    death("DWARF expression operation 0x%x has a malformed operand\n",(int)bytes[0]);
+  }
+  *pos+=lebLen;
+  return (word_t)value;
+}
+
+//decodes the operation at bytes into op and returns its encoded
+//length, or 0 for an operation we don't know. Branch targets are
+//left as byte offsets relative to the end of the operation, they're
+//resolved once everything is decoded
+static int decodeOp(byte* bytes,int len,DwarfExprOp* op)
+{
+  byte dwOp=bytes[0];
+  int pos=1;
+  op->dwOp=dwOp;
+  //operands may not run off the end of the expression
+  #define NEED(n) if(pos+(n)>len){death("DWARF expression operation 0x%x is truncated\n",(int)dwOp);}
+
+  if(dwOp>=DW_OP_lit0 && dwOp<=DW_OP_lit31)
+  {
+    op->op=DEO_CONST;
+    op->operand=dwOp-DW_OP_lit0;
+    return pos;
+  }
+  if(dwOp>=DW_OP_breg0 && dwOp<=DW_OP_breg31)
+  {
+    op->op=DEO_BREG;
+    op->arg=dwOp-DW_OP_breg0;
+    op->operand=readSLEBOperand(bytes,len,&pos);
+    return pos;
+  }
+  if(dwOp>=DW_OP_reg0 && dwOp<=DW_OP_reg31)
+  {
+    //register locations name a register rather than computing a
+    //value, they aren't meaningful where we evaluate expressions
+    op->op=DEO_UNSUPPORTED;
+    return pos;
+  }
+
+  switch(dwOp)
+  {
+  case DW_OP_addr:
+    NEED(sizeof(addr_t));
+    op->op=DEO_CONST;
+    op->operand=readUnsigned(bytes+pos,sizeof(addr_t));
+    return pos+sizeof(addr_t);
+  case DW_OP_const1u:
+  case DW_OP_const2u:
+  case DW_OP_const4u:
+  case DW_OP_const8u:
+  case DW_OP_const1s:
+  case DW_OP_const2s:
+  case DW_OP_const4s:
+  case DW_OP_const8s:
+    {
+      int size=1;
+      bool isSigned=false;
+      switch(dwOp)
+      {
+      case DW_OP_const1s:
+        isSigned=true;
+      case DW_OP_const1u:
+        size=1;
+        break;
+      case DW_OP_const2s:
+        isSigned=true;
+      case DW_OP_const2u:
+        size=2;
+        break;
+      case DW_OP_const4s:
+        isSigned=true;
+      case DW_OP_const4u:
+        size=4;
+        break;
+      case DW_OP_const8s:
+        isSigned=true;
+      default:
+        size=8;
+      }
+      NEED(size);
+      op->op=DEO_CONST;
+      op->operand=isSigned?readSigned(bytes+pos,size):readUnsigned(bytes+pos,size);
+      return pos+size;
+    }
+  case DW_OP_constu:
+    op->op=DEO_CONST;
+    op->operand=readULEBOperand(bytes,len,&pos);
+    return pos;
+  case DW_OP_consts:
+    op->op=DEO_CONST;
+    op->operand=readSLEBOperand(bytes,len,&pos);
+    return pos;
+  case DW_OP_plus_uconst:
+    op->op=DEO_PLUS_CONST;
+    op->operand=readULEBOperand(bytes,len,&pos);
+    return pos;
+  case DW_OP_dup:
+    op->op=DEO_DUP;
+    return pos;
+  case DW_OP_drop:
+    op->op=DEO_DROP;
+    return pos;
+  case DW_OP_over:
+    //over is just pick 1
+    op->op=DEO_PICK;
+    op->arg=1;
+    return pos;
+  case DW_OP_pick:
+    NEED(1);
+    op->op=DEO_PICK;
+    op->arg=bytes[pos];
+    return pos+1;
+  case DW_OP_swap:
+    op->op=DEO_SWAP;
+    return pos;
+  case DW_OP_rot:
+    op->op=DEO_ROT;
+    return pos;
+  case DW_OP_deref:
+    op->op=DEO_DEREF;
+    op->size=sizeof(word_t);
+    return pos;
+  case DW_OP_deref_size:
+    NEED(1);
+    op->op=DEO_DEREF;
+    op->size=bytes[pos];
+    if(!op->size || op->size>sizeof(word_t))
+    {
+      death("DW_OP_deref_size of %i bytes is not valid\n",(int)op->size);
+    }
+    return pos+1;
+  case DW_OP_abs:
+    op->op=DEO_ABS;
+    return pos;
+  case DW_OP_and:
+    op->op=DEO_AND;
+    return pos;
+  case DW_OP_div:
+    op->op=DEO_DIV;
+    return pos;
+  case DW_OP_minus:
+    op->op=DEO_MINUS;
+    return pos;
+  case DW_OP_mod:
+    op->op=DEO_MOD;
+    return pos;
+  case DW_OP_mul:
+    op->op=DEO_MUL;
+    return pos;
+  case DW_OP_neg:
+    op->op=DEO_NEG;
+    return pos;
+  case DW_OP_not:
+    op->op=DEO_NOT;
+    return pos;
+  case DW_OP_or:
+    op->op=DEO_OR;
+    return pos;
+  case DW_OP_plus:
+    op->op=DEO_PLUS;
+    return pos;
+  case DW_OP_shl:
+    op->op=DEO_SHL;
+    return pos;
+  case DW_OP_shr:
+    op->op=DEO_SHR;
+    return pos;
+  case DW_OP_shra:
+    op->op=DEO_SHRA;
+    return pos;
+  case DW_OP_xor:
+    op->op=DEO_XOR;
+    return pos;
+  case DW_OP_eq:
+    op->op=DEO_EQ;
+    return pos;
+  case DW_OP_ge:
+    op->op=DEO_GE;
+    return pos;
+  case DW_OP_gt:
+    op->op=DEO_GT;
+    return pos;
+  case DW_OP_le:
+    op->op=DEO_LE;
+    return pos;
+  case DW_OP_lt:
+    op->op=DEO_LT;
+    return pos;
+  case DW_OP_ne:
+    op->op=DEO_NE;
+    return pos;
+  case DW_OP_skip:
+  case DW_OP_bra:
+    NEED(2);
+    op->op=DW_OP_skip==dwOp?DEO_SKIP:DEO_BRA;
+    op->operand=readSigned(bytes+pos,2);
+    return pos+2;
+  case DW_OP_bregx:
+    op->op=DEO_BREG;
+    op->arg=readULEBOperand(bytes,len,&pos);
+    op->operand=readSLEBOperand(bytes,len,&pos);
+    return pos;
+  case DW_OP_fbreg:
+    op->op=DEO_FBREG;
+    op->operand=readSLEBOperand(bytes,len,&pos);
+    return pos;
+  case DW_OP_call_frame_cfa:
+    op->op=DEO_CFA;
+    return pos;
+  case DW_OP_push_object_address:
+    op->op=DEO_OBJECT_ADDRESS;
+    return pos;
+  case DW_OP_nop:
+  case DW_OP_stack_value:
+    //we always produce the value on top of the stack anyway
+    op->op=DEO_NOP;
+    return pos;
+  case DW_OP_regx:
+  case DW_OP_piece:
+    op->op=DEO_UNSUPPORTED;
+    readULEBOperand(bytes,len,&pos);
+    return pos;
+  case DW_OP_xderef:
+  case DW_OP_xderef_size:
+  case DW_OP_form_tls_address:
+    op->op=DEO_UNSUPPORTED;
+    return pos+(DW_OP_xderef_size==dwOp?1:0);
+  default:
+    //there's no telling how long its operands are, so nothing after
+    //it can be decoded either. Only fatal if it's reached
+    op->op=DEO_UNSUPPORTED;
+    return 0;
+  }
+  #undef NEED
+  return pos;
+}
+
+DwarfExprProgram* compileDwarfExpr(Arena* arena,byte* bytes,int len)
+{
+  //no operation is shorter than a byte, so len+1 is enough room for
+  //everything and the trailing DEO_END
+  DwarfExprOp* ops=zmalloc((len+1)*sizeof(DwarfExprOp));
+  //opStarts[byte offset] is the index of the operation starting
+  //there, -1 for offsets inside an operation. opStarts[len] is the
+  //end of the program, a valid branch target
+  int* opStarts=malloc((len+1)*sizeof(int));
+  MALLOC_CHECK(opStarts);
+  int* opEnds=zmalloc((len+1)*sizeof(int));
+  for(int i=0;i<=len;i++)
+  {
+    opStarts[i]=-1;
+  }
+  int numOps=0;
+  for(int pos=0;pos<len;numOps++)
+  {
+    opStarts[pos]=numOps;
+    int opLen=decodeOp(bytes+pos,len-pos,&ops[numOps]);
+    if(!opLen)
+    {
+      //the rest of the expression is the unknown operation as far as
+      //we can tell, so anything branching into it ends up there
+      for(int i=pos+1;i<len;i++)
+      {
+        opStarts[i]=numOps;
+      }
+      opLen=len-pos;
+    }
+    pos+=opLen;
+    if(pos>len)
+    {
+      death("DWARF expression operation 0x%x is truncated\n",(int)ops[numOps].dwOp);
+    }
+    opEnds[numOps]=pos;
+  }
+  opStarts[len]=numOps;
+  ops[numOps].op=DEO_END;
+
+  for(int i=0;i<numOps;i++)
+  {
+    if(DEO_SKIP!=ops[i].op && DEO_BRA!=ops[i].op)
+    {
+      continue;
+    }
+    sword_t target=opEnds[i]+(sword_t)ops[i].operand;
+    if(target<0 || target>len || -1==opStarts[target])
+    {
+      death("DWARF expression branch at operation %i does not land on an operation\n",i);
+    }
+    ops[i].arg=opStarts[target];
+  }
+  free(opStarts);
+  free(opEnds);
+
+  DwarfExprProgram* prog;
+  if(arena)
+  {
+    prog=arenaAlloc(arena,sizeof(DwarfExprProgram));
+    prog->ops=arenaMemdup(arena,ops,(numOps+1)*sizeof(DwarfExprOp));
+    free(ops);
+  }
+  else
+  {
+    prog=zmalloc(sizeof(DwarfExprProgram));
+    prog->ops=ops;
+    prog->ownsMemory=true;
+  }
+  prog->numOps=numOps;
+  return prog;
+}
+
+void freeDwarfExpr(DwarfExprProgram* prog)
+{
+  if(prog && prog->ownsMemory)
+  {
+    free(prog->ops);
+    free(prog);
+  }
+}
+
+int dwarfExprLength(DwarfExprProgram* prog)
+{
+  return prog->numOps;
+}
+
+static void readTargetMemory(void* data,addr_t addr,byte* out,int numBytes)
+{
+  memcpyFromTarget(out,addr,numBytes);
+}
+
+word_t runDwarfExpr(DwarfExprProgram* prog,DwarfExprContext* ctx,word_t* initialStack,int stackLen)
+{
+  word_t stack[DWARF_EXPR_MAX_STACK];
+  if(stackLen>DWARF_EXPR_MAX_STACK)
+  {
+    death("Too many initial values for a DWARF expression\n");
+  }
+  if(stackLen)
+  {
+    memcpy(stack,initialStack,stackLen*sizeof(word_t));
+  }
+  void (*readMemory)(void*,addr_t,byte*,int)=ctx->readMemory?ctx->readMemory:readTargetMemory;
+  int sp=stackLen;//number of values on the stack
+  int pc=-1;
+  long steps=0;
+  DwarfExprOp* ops=prog->ops;
+  DwarfExprOp* op;
+  word_t a,b;
+
+  #define NEED_STACK(n) if(sp<(n)){death("DWARF expression operation 0x%x needs %i stack values but there are %i\n",(int)op->dwOp,(n),sp);}
+  #define PUSH(v) do{if(sp==DWARF_EXPR_MAX_STACK){death("DWARF expression overflowed the stack\n");}stack[sp++]=(v);}while(0)
+  #define TOP stack[sp-1]
+  #define BINARY(expr) NEED_STACK(2);b=stack[--sp];a=TOP;TOP=(expr);NEXT
+
+  //operations are dispatched with computed gotos where the compiler
+  //has them, a plain switch otherwise. Either way each operation ends
+  //by jumping straight to the next one
+#if defined(__GNUC__) && !defined(DWARF_EXPR_NO_THREADING)
+  static void* dispatch[DEO_NUM_OPS]={
+    [DEO_END]=&&do_END,[DEO_CONST]=&&do_CONST,[DEO_DUP]=&&do_DUP,
+    [DEO_DROP]=&&do_DROP,[DEO_PICK]=&&do_PICK,
+    [DEO_SWAP]=&&do_SWAP,[DEO_ROT]=&&do_ROT,[DEO_DEREF]=&&do_DEREF,
+    [DEO_ABS]=&&do_ABS,[DEO_AND]=&&do_AND,[DEO_DIV]=&&do_DIV,
+    [DEO_MINUS]=&&do_MINUS,[DEO_MOD]=&&do_MOD,[DEO_MUL]=&&do_MUL,
+    [DEO_NEG]=&&do_NEG,[DEO_NOT]=&&do_NOT,[DEO_OR]=&&do_OR,
+    [DEO_PLUS]=&&do_PLUS,[DEO_PLUS_CONST]=&&do_PLUS_CONST,
+    [DEO_SHL]=&&do_SHL,[DEO_SHR]=&&do_SHR,[DEO_SHRA]=&&do_SHRA,
+    [DEO_XOR]=&&do_XOR,[DEO_EQ]=&&do_EQ,[DEO_GE]=&&do_GE,
+    [DEO_GT]=&&do_GT,[DEO_LE]=&&do_LE,[DEO_LT]=&&do_LT,[DEO_NE]=&&do_NE,
+    [DEO_SKIP]=&&do_SKIP,[DEO_BRA]=&&do_BRA,[DEO_BREG]=&&do_BREG,
+    [DEO_FBREG]=&&do_FBREG,[DEO_CFA]=&&do_CFA,
+    [DEO_OBJECT_ADDRESS]=&&do_OBJECT_ADDRESS,[DEO_NOP]=&&do_NOP,
+    [DEO_UNSUPPORTED]=&&do_UNSUPPORTED
+  };
+  #define CASE(name) do_##name
+  #define NEXT op=&ops[++pc];goto *dispatch[op->op]
+  #define JUMP(target) pc=(target)-1;NEXT
+  //the switch below is only there for the portable version, the
+  //threaded one never goes through it
+  NEXT;
+#else
+  #define CASE(name) case DEO_##name
+  #define NEXT continue
+  #define JUMP(target) pc=(target)-1;continue
+#endif
+
+  for(;;)
+  {
+    op=&ops[++pc];
+    switch(op->op)
+    {
+    CASE(END):
+      NEED_STACK(1);
+      return TOP;
+    CASE(CONST):
+      PUSH(op->operand);
+      NEXT;
+    CASE(DUP):
+      NEED_STACK(1);
+      a=TOP;
+      PUSH(a);
+      NEXT;
+    CASE(DROP):
+      NEED_STACK(1);
+      sp--;
+      NEXT;
+    CASE(PICK):
+      NEED_STACK(op->arg+1);
+      a=stack[sp-1-op->arg];
+      PUSH(a);
+      NEXT;
+    CASE(SWAP):
+      NEED_STACK(2);
+      a=TOP;
+      TOP=stack[sp-2];
+      stack[sp-2]=a;
+      NEXT;
+    CASE(ROT):
+      //the top entry moves to third, the second and third move up
+      NEED_STACK(3);
+      a=TOP;
+      TOP=stack[sp-2];
+      stack[sp-2]=stack[sp-3];
+      stack[sp-3]=a;
+      NEXT;
+    CASE(DEREF):
+      NEED_STACK(1);
+      a=0;
+      readMemory(ctx->data,TOP,(byte*)&a,op->size);
+      TOP=a;
+      NEXT;
+    CASE(ABS):
+      NEED_STACK(1);
+      if((sword_t)TOP<0)
+      {
+        TOP=-TOP;
+      }
+      NEXT;
+    CASE(AND):
+      BINARY(a&b);
+    CASE(DIV):
+      NEED_STACK(2);
+      if(!TOP)
+      {
+        death("DWARF expression divided by zero\n");
+      }
+      BINARY((word_t)((sword_t)a/(sword_t)b));
+    CASE(MINUS):
+      BINARY(a-b);
+    CASE(MOD):
+      NEED_STACK(2);
+      if(!TOP)
+      {
+        death("DWARF expression divided by zero\n");
+      }
+      BINARY(a%b);
+    CASE(MUL):
+      BINARY(a*b);
+    CASE(NEG):
+      NEED_STACK(1);
+      TOP=-TOP;
+      NEXT;
+    CASE(NOT):
+      NEED_STACK(1);
+      TOP=~TOP;
+      NEXT;
+    CASE(OR):
+      BINARY(a|b);
+    CASE(PLUS):
+      BINARY(a+b);
+    CASE(PLUS_CONST):
+      NEED_STACK(1);
+      TOP+=op->operand;
+      NEXT;
+    CASE(SHL):
+      BINARY(b>=sizeof(word_t)*8?0:a<<b);
+    CASE(SHR):
+      BINARY(b>=sizeof(word_t)*8?0:a>>b);
+    CASE(SHRA):
+      BINARY((word_t)((sword_t)a>>(b>=sizeof(word_t)*8?sizeof(word_t)*8-1:b)));
+    CASE(XOR):
+      BINARY(a^b);
+    //comparisons are signed
+    CASE(EQ):
+      BINARY((sword_t)a==(sword_t)b);
+    CASE(GE):
+      BINARY((sword_t)a>=(sword_t)b);
+    CASE(GT):
+      BINARY((sword_t)a>(sword_t)b);
+    CASE(LE):
+      BINARY((sword_t)a<=(sword_t)b);
+    CASE(LT):
+      BINARY((sword_t)a<(sword_t)b);
+    CASE(NE):
+      BINARY((sword_t)a!=(sword_t)b);
+    CASE(SKIP):
+      if(op->arg<=pc && ++steps>DWARF_EXPR_MAX_STEPS)
+      {
+        death("DWARF expression does not terminate\n");
+      }
+      JUMP(op->arg);
+    CASE(BRA):
+      NEED_STACK(1);
+      if(!stack[--sp])
+      {
+        NEXT;
+      }
+      if(op->arg<=pc && ++steps>DWARF_EXPR_MAX_STEPS)
+      {
+        death("DWARF expression does not terminate\n");
+      }
+      JUMP(op->arg);
+    CASE(BREG):
+      if(!ctx->readReg || !ctx->readReg(ctx->data,op->arg,&a))
+      {
+        death("DWARF expression needs register %i, which is not available\n",op->arg);
+      }
+      PUSH(a+op->operand);
+      NEXT;
+    CASE(FBREG):
+      PUSH(ctx->frameBase+op->operand);
+      NEXT;
+    CASE(CFA):
+      PUSH(ctx->cfa);
+      NEXT;
+    CASE(OBJECT_ADDRESS):
+      PUSH(ctx->objectAddress);
+      NEXT;
+    CASE(NOP):
+      NEXT;
+    CASE(UNSUPPORTED):
+    default:
+      death("DWARF expression operation 0x%x cannot be evaluated by katana\n",(int)op->dwOp);
+    }
+  }
+  #undef CASE
+  #undef NEXT
+  #undef JUMP
+  #undef BINARY
+  #undef TOP
+  #undef PUSH
+  #undef NEED_STACK
+}
@@ -0,0 +1,65 @@
+/*
+  File: dwarfexpr.h
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: stack machine for DWARF expressions (DW_OP_*).
+               Expressions are decoded once into a DwarfExprProgram,
+               with LEB operands already read and skip/bra targets
+               turned into instruction indices, so evaluating one
+               again (as happens for every object a patch transforms)
+               never touches the encoded bytes
+*/
+
+#ifndef dwarfexpr_h
+#define dwarfexpr_h
+
+#include "types.h"
+#include "util/arena.h"
+
+typedef struct DwarfExprProgram DwarfExprProgram;
+
+//how the machine reads registers and memory. Everything may be left
+//zeroed: a missing readMemory reads the target with
+//memcpyFromTarget, and a missing readReg makes DW_OP_breg* fatal
+typedef struct
+{
+  //reads DWARF register regNum into *value, returns false if the
+  //register is not available
+  bool (*readReg)(void* data,int regNum,word_t* value);
+  //reads numBytes (at most sizeof(word_t)) at addr into out
+  void (*readMemory)(void* data,addr_t addr,byte* out,int numBytes);
+  void* data;//passed to the callbacks
+  addr_t cfa;//for DW_OP_call_frame_cfa
+  addr_t objectAddress;//for DW_OP_push_object_address
+  addr_t frameBase;//for DW_OP_fbreg
+} DwarfExprContext;
+
+//decodes len bytes of DWARF expression. The program is allocated
+//from arena, which may be NULL in which case the program must be
+//freed with freeDwarfExpr. Dies if the expression is malformed
+//(truncated, or branching into the middle of an instruction).
+//Operations that can be decoded but not evaluated (such as
+//DW_OP_piece) and operations that aren't known at all only die if
+//they are actually reached
+DwarfExprProgram* compileDwarfExpr(Arena* arena,byte* bytes,int len);
+void freeDwarfExpr(DwarfExprProgram* prog);
+
+//number of decoded operations
+int dwarfExprLength(DwarfExprProgram* prog);
+
+//runs the program with initialStack (stackLen words, the last one
+//being the top) already pushed and returns the value on top of the
+//stack when it finishes
+word_t runDwarfExpr(DwarfExprProgram* prog,DwarfExprContext* ctx,word_t* initialStack,int stackLen);
+
+#endif
@@ -62,21 +62,83 @@
 #include <dwarf.h>
 #include "elfparse.h"
 #include "util/logging.h"
-#include "util/refcounted.h"
 #include "util/path.h"
+#include "util/intern.h"
 #include "dwarfvm.h"
+#include <time.h>
+
+//index of the compilation units in an ELF file. Compilation units are
+//only read in when something asks for them by name
+typedef struct
+{
+  Dwarf_Off hdrOffset;//offset of the CU header in .debug_info
+  Dwarf_Off endOffset;//offset of the next CU header
+  Dwarf_Off dieOffset;//offset of the CU's own DIE
+  char* name;
+  char* id;
+  CompilationUnit* cu;//NULL until the CU has been read in
+} CUIndexEntry;
+
+struct DwarfIndex
+{
+  Dwarf_Debug dbg;
+  ElfInfo* elf;
+  CUIndexEntry** entries;//sorted by offset
+  int numEntries;
+  Dictionary* entriesByName;
+};
+
+//what we read from libdwarf about every DIE before dispatching on it,
+//so that it only has to be asked once
+typedef struct
+{
+  Dwarf_Off off;
+  Dwarf_Off cuOff;//offset relative to the start of the CU
+  Dwarf_Half tag;
+} DieRecord;
 
-Dictionary* cuIdentifiers=NULL;
 DwarfInfo* di;
+CUIndexEntry* loadingEntry=NULL;//the entry for the CU being read in
+
+unsigned long diesWalked=0;//for reporting throughput
 DList* activeSubprogramsHead=NULL;
 DList* activeSubprogramsTail=NULL;
-char* workingDir=NULL;
 
 TypeInfo* getTypeInfoFromATType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu);
+CUIndexEntry* findCUIndexEntry(struct DwarfIndex* index,Dwarf_Off off);
 char* getTypeNameFromATType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu,Dwarf_Die* dieOfType);
+char* getNameForDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu);
 
 void walkDieTree(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu,bool siblings,ElfInfo* elf);
 
+//everything read in from the DWARF (types, variables, subprograms and
+//the lists and keys that tie them together) lives in the arena of the
+//DwarfInfo being read and is released all at once by freeDwarfInfo
+static void* dwAlloc(size_t size)
+{
+  return arenaAlloc(di->arena,size);
+}
+
+//like getNameForDie but the name is interned (see util/intern.h), so
+//names shared between compilation units and between the old and new
+//versions of a binary are only stored once and can be compared by pointer
+static char* dwNameForDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
+{
+  char* name=NULL;
+  Dwarf_Error err;
+  if(DW_DLV_OK==dwarf_diename(die,&name,&err))
+  {
+    char* result=internString(name);
+    dwarf_dealloc(dbg,name,DW_DLA_STRING);
+    return result;
+  }
+  //anonymous, getNameForDie knows how to make something up
+  name=getNameForDie(dbg,die,cu);
+  char* result=internString(name);
+  free(name);
+  return result;
+}
+
 
 void dwarfErrorHandler(Dwarf_Error err,Dwarf_Ptr arg)
 {
@@ -224,9 +286,12 @@ char* readAttributeAsString(Dwarf_Attribute attr)
 }
 
 //die must be the die for the cu
-void setIdentifierForCU(CompilationUnit* cu,Dwarf_Die die)
+//cuIdentifiers holds the identifiers already given out in this ELF file.
+//The returned string should be freed
+char* makeIdentifierForCU(Dictionary* cuIdentifiers,char* name,Dwarf_Die die)
 {
-  if(dictExists(cuIdentifiers,cu->name))
+  char* id;
+  if(dictExists(cuIdentifiers,name))
   {
     //ok, we have multiple compilation units with the same name, need to use the compilation path as well
       Dwarf_Attribute attr;
@@ -235,8 +300,8 @@ void setIdentifierForCU(CompilationUnit* cu,Dwarf_Die die)
       if(res==DW_DLV_OK)
       {
         char* dir=readAttributeAsString(attr);
-        cu->id=malloc(strlen(cu->name)+strlen(dir)+3);
-        sprintf(cu->id,"%s:%s",cu->name,dir);
+        id=malloc(strlen(name)+strlen(dir)+3);
+        sprintf(id,"%s:%s",name,dir);
         free(dir);
       }
       else
@@ -246,11 +311,12 @@ void setIdentifierForCU(CompilationUnit* cu,Dwarf_Die die)
   }
   else
   {
-    cu->id=strdup(cu->name);
+    id=strdup(name);
   }
   //don't actually care what value we insert, just making
   //a record that there's something
-  dictInsert(cuIdentifiers,cu->id,cu->id);
+  dictInsert(cuIdentifiers,id,NULL);
+  return id;
 }
 
 //ranges are not just a low and high. An array can be multiple levels deep.
@@ -540,6 +606,16 @@ TypeInfo* getTypeInfoFromATType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* c
     Dwarf_Off off;
     dwarf_dieoffset(dieOfType,&off,&err);
     data=mapGet(cu->tv->parsedDies,&off);
+    if(!data && di->index)
+    {
+      //the type may live in another compilation unit (DW_FORM_ref_addr),
+      //in which case we can use it from there if that unit has been read in
+      CUIndexEntry* entry=findCUIndexEntry(di->index,off);
+      if(entry && entry->cu && entry->cu!=cu)
+      {
+        data=mapGet(entry->cu->tv->parsedDies,&off);
+      }
+    }
     if(!data)
     {
       //we haven't read in this die yet
@@ -556,6 +632,7 @@ TypeInfo* getTypeInfoFromATType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* c
   {
     char* name=getNameForDie(dbg,dieOfType,cu);
     logprintf(ELL_WARN,ELS_DWARFTYPES,"Type for die of name %s does not seem to exist\n",name);
+    free(name);
   }
   return data;
 }
@@ -577,56 +654,66 @@ void setParsedDie(Dwarf_Die die,void* data,CompilationUnit* cu)
   Dwarf_Error err;
   Dwarf_Off off;
   dwarf_dieoffset(die,&off,&err);
-  size_t* key=zmalloc(sizeof(size_t));
+  size_t* key=dwAlloc(sizeof(size_t));
   *key=off;
   //set it properly in parsed dies so it can be referred to
-  mapSet(cu->tv->parsedDies,key,data,NULL,free);
+  mapSet(cu->tv->parsedDies,key,data,NULL,NULL);
 }
 
 
 
+//makes room for one more field (type->numFields has already been
+//incremented). The arrays are reallocated together in the arena,
+//fields are rarely numerous enough for the copying to matter
+static void growFields(TypeInfo* type,bool offsets)
+{
+  int n=type->numFields;
+  type->fields=arenaRealloc(di->arena,type->fields,(n-1)*sizeof(char*),n*sizeof(char*));
+  if(offsets)
+  {
+    type->fieldOffsets=arenaRealloc(di->arena,type->fieldOffsets,(n-1)*sizeof(int),n*sizeof(int));
+  }
+  type->fieldTypes=arenaRealloc(di->arena,type->fieldTypes,(n-1)*sizeof(TypeInfo*),n*sizeof(TypeInfo*));
+}
+
 void* addBaseTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 {
-  TypeInfo* type=zmalloc(sizeof(TypeInfo));
+  TypeInfo* type=dwAlloc(sizeof(TypeInfo));
   type->type=TT_BASE;
   type->cu=cu;//base types should be the same across all cu's in the given langauge, but we don't know that all cu's are the same language
   Dwarf_Error err=0;
 
-  type->name=getNameForDie(dbg,die,cu);
+  type->name=dwNameForDie(dbg,die,cu);
   Dwarf_Unsigned byteSize;
   int res=dwarf_bytesize(die,&byteSize,&err);
   if(DW_DLV_NO_ENTRY==res)
   {
     logprintf(ELL_WARN,ELS_DWARFTYPES,"base type %s has no byte length, we can't read it\n",type->name);
-    freeTypeInfo(type);
     return NULL;
   }
   type->length=byteSize;
   dictInsert(cu->tv->types,type->name,type);
-  grabRefCounted((RC*)type);
   logprintf(ELL_INFO_V4,ELS_MISC,"added base type of name %s\n",type->name);
   return type;
 }
 
 void* addEnumFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 {
-  TypeInfo* type=zmalloc(sizeof(TypeInfo));
+  TypeInfo* type=dwAlloc(sizeof(TypeInfo));
   type->type=TT_ENUM;
   type->cu=cu;
   Dwarf_Error err=0;
 
-  type->name=getNameForDie(dbg,die,cu);
+  type->name=dwNameForDie(dbg,die,cu);
   Dwarf_Unsigned byteSize;
   int res=dwarf_bytesize(die,&byteSize,&err);
   if(DW_DLV_NO_ENTRY==res)
   {
     logprintf(ELL_WARN,ELS_DWARFTYPES,"enumeration %s has no byte length, we can't read it\n",type->name);
-    freeTypeInfo(type);
     return NULL;
   }
   type->length=byteSize;
   dictInsert(cu->tv->types,type->name,type);
-  grabRefCounted((RC*)type);
   //check for fde info for transformation
   Dwarf_Attribute attr;
   res=dwarf_attr(die,DW_AT_MIPS_fde,&attr,&err);
@@ -644,7 +731,7 @@ void* addStructureFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   logprintf(ELL_INFO_V4,ELS_MISC,"reading structure ");
   Dwarf_Error err=0;
 
-  char* name=getNameForDie(dbg,die,cu);
+  char* name=dwNameForDie(dbg,die,cu);
   logprintf(ELL_INFO_V4,ELS_MISC,"of name %s\n",name);
 
   TypeInfo* type=dictGet(cu->tv->types,name);
@@ -657,7 +744,7 @@ void* addStructureFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   }
   else
   {
-    type=zmalloc(sizeof(TypeInfo));
+    type=dwAlloc(sizeof(TypeInfo));
   }
   type->type=TT_STRUCT;
   type->cu=cu;
@@ -674,7 +761,6 @@ void* addStructureFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   //insert the type into global types now with a note that
   //it's incomplete in case has members that reference it
   dictSet(cu->tv->types,type->name,type,NULL);
-  grabRefCounted((RC*)type);
   
   setParsedDie(die,type,cu);
 
@@ -692,7 +778,6 @@ void* addStructureFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   if(DW_DLV_NO_ENTRY==res)
   {
     logprintf(ELL_WARN,ELS_DWARFTYPES,"structure %s has no byte length, we can't read it\n",type->name);
-    freeTypeInfo(type);
     return NULL;
   }
   type->length=byteSize;
@@ -714,14 +799,8 @@ void* addStructureFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
         continue;
       }
       type->numFields++;
-      type->fields=realloc(type->fields,type->numFields*sizeof(char*));
-      MALLOC_CHECK(type->fields);
-      type->fieldOffsets=realloc(type->fieldOffsets,type->numFields*sizeof(int));
-      MALLOC_CHECK(type->fieldOffsets);
-      type->fieldTypes=realloc(type->fieldTypes,type->numFields*sizeof(char*));
-      MALLOC_CHECK(type->fieldTypes);
-
-      type->fields[idx]=getNameForDie(dbg,child,cu);
+      growFields(type,true);
+      type->fields[idx]=dwNameForDie(dbg,child,cu);
       logprintf(ELL_INFO_V4,ELS_MISC,"found field %s\n",type->fields[idx]);
 
       TypeInfo* typeOfField=getTypeInfoFromATType(dbg,child,cu);
@@ -744,7 +823,6 @@ void* addStructureFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
       }
       offsetGuessSoFar+=typeOfField->length;
       type->fieldTypes[idx]=typeOfField;
-      grabRefCounted((RC*)typeOfField);
       idx++;
     }while(DW_DLV_OK==dwarf_siblingof(dbg,child,&child,&err));
   }
@@ -765,14 +843,14 @@ void* addStructureFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 
 void* addPointerTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 {
-  char* name=getNameForDie(dbg,die,cu);
+  char* name=dwNameForDie(dbg,die,cu);
   if(dictExists(cu->tv->types,name))
   {
     //this is an ok condition, because of typedefs a pointer
     //type could get added more than once
     return dictGet(cu->tv->types,name);
   }
-  TypeInfo* type=zmalloc(sizeof(TypeInfo));
+  TypeInfo* type=dwAlloc(sizeof(TypeInfo));
   type->type=TT_POINTER;
   type->cu=cu;
   Dwarf_Error err=0;
@@ -781,21 +859,14 @@ void* addPointerTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   logprintf(ELL_INFO_V4,ELS_MISC,"got name for pointer\n");
   type->incomplete=true;//set incomplete and add in case the structure we get refers to it
   dictInsert(cu->tv->types,type->name,type);
-  grabRefCounted((RC*)type);
 
-  Dwarf_Off off;
-  dwarf_dieoffset(die,&off,&err);
-  size_t* key=zmalloc(sizeof(size_t));
-  *key=off;
-  //set it properly in parsed dies so it can be referred to
-  mapSet(cu->tv->parsedDies,key,type,NULL,free);
+  setParsedDie(die,type,cu);
   
   Dwarf_Unsigned byteSize;
   int res=dwarf_bytesize(die,&byteSize,&err);
   if(DW_DLV_NO_ENTRY==res)
   {
     logprintf(ELL_WARN,ELS_DWARFTYPES,"pointer type %s has no byte length, we can't read it\n",type->name);
-    freeTypeInfo(type);
     return NULL;
   }
   type->length=byteSize;
@@ -823,20 +894,19 @@ void* addPointerTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 
 void* addConstTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 {
-  char* name=getNameForDie(dbg,die,cu);
+  char* name=dwNameForDie(dbg,die,cu);
   if(dictExists(cu->tv->types,name))
   {
     //this is an ok condition, because of typedefs a const
     //type could get added more than once
     return dictGet(cu->tv->types,name);
   }
-  TypeInfo* type=zmalloc(sizeof(TypeInfo));
+  TypeInfo* type=dwAlloc(sizeof(TypeInfo));
   type->type=TT_CONST;
   type->cu=cu;
   type->name=name;
   type->incomplete=true;//set incomplete and add in case the structure we get refers to it
   dictInsert(cu->tv->types,type->name,type);
-  grabRefCounted((RC*)type);
 
   setParsedDie(die,type,cu);
   
@@ -860,9 +930,9 @@ void* addConstTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 
 void* addArrayTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 {
-  TypeInfo* type=zmalloc(sizeof(TypeInfo));
+  TypeInfo* type=dwAlloc(sizeof(TypeInfo));
   type->type=TT_ARRAY;
-  type->name=getNameForDie(dbg,die,cu);
+  type->name=dwNameForDie(dbg,die,cu);
   logprintf(ELL_INFO_V4,ELS_MISC,"reading array type %s\n",type->name);
   type->cu=cu;
   Dwarf_Error err=0;
@@ -875,7 +945,16 @@ void* addArrayTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
     death("ERROR: cannot add array with no type\n");
   }
   type->pointedType=pointedType;
-  type->depth=getRangeFromDie(dbg,die,&type->lowerBounds,&type->upperBounds);
+  int* lowerBounds;
+  int* upperBounds;
+  type->depth=getRangeFromDie(dbg,die,&lowerBounds,&upperBounds);
+  if(type->depth)
+  {
+    type->lowerBounds=arenaMemdup(di->arena,lowerBounds,type->depth*sizeof(int));
+    type->upperBounds=arenaMemdup(di->arena,upperBounds,type->depth*sizeof(int));
+    free(lowerBounds);
+    free(upperBounds);
+  }
 
   type->length=0;
   for(int i=0;i<type->depth;i++)
@@ -891,7 +970,6 @@ void* addArrayTypeFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
     type->fde=readAttributeAsInt(attr);
   }
   dictInsert(cu->tv->types,type->name,type);
-  grabRefCounted((RC*)type);
   logprintf(ELL_INFO_V4,ELS_MISC,"added array type of name %s\n",type->name);
   return type;
 }
@@ -905,7 +983,6 @@ void* addTypedefFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
     if(!dictExists(cu->tv->types,name))
     {
       dictInsert(cu->tv->types,name,type);
-      grabRefCounted((RC*)type);
       logprintf(ELL_INFO_V4,ELS_MISC,"added typedef for name %s\n",name);
     }
   }
@@ -922,19 +999,18 @@ void* addTypedefFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 void* addUnionFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 {
   logprintf(ELL_INFO_V4,ELS_MISC,"reading union ");
-  TypeInfo* type=zmalloc(sizeof(TypeInfo));
+  TypeInfo* type=dwAlloc(sizeof(TypeInfo));
   type->type=TT_UNION;
   type->cu=cu;
   Dwarf_Error err=0;
 
-  type->name=getNameForDie(dbg,die,cu);
+  type->name=dwNameForDie(dbg,die,cu);
   logprintf(ELL_INFO_V4,ELS_MISC,"of name %s\n",type->name);
   Dwarf_Unsigned byteSize;
   int res=dwarf_bytesize(die,&byteSize,&err);
   if(DW_DLV_NO_ENTRY==res)
   {
     logprintf(ELL_ERR,ELS_DWARFTYPES,"union %s has no byte length, we can't read it\n",type->name);
-    freeTypeInfo(type);
     return NULL;
   }
   type->length=byteSize;
@@ -942,7 +1018,6 @@ void* addUnionFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   //it's incomplete in case has members that reference it
   type->incomplete=true;
   dictInsert(cu->tv->types,type->name,type);
-  grabRefCounted((RC*)type);
   setParsedDie(die,type,cu);
   Dwarf_Die child;
   res=dwarf_child(die,&child,&err);
@@ -961,14 +1036,8 @@ void* addUnionFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
         continue;
       }
       type->numFields++;
-      type->fields=realloc(type->fields,type->numFields*sizeof(char*));
-      MALLOC_CHECK(type->fields);
-      type->fieldOffsets=realloc(type->fieldOffsets,type->numFields*sizeof(int));
-      MALLOC_CHECK(type->fieldOffsets);
-      type->fieldTypes=realloc(type->fieldTypes,type->numFields*sizeof(char*));
-      MALLOC_CHECK(type->fieldTypes);
-
-      type->fields[idx]=getNameForDie(dbg,child,cu);
+      growFields(type,true);
+      type->fields[idx]=dwNameForDie(dbg,child,cu);
       logprintf(ELL_INFO_V4,ELS_MISC,"found field %s\n",type->fields[idx]);
 
       TypeInfo* typeOfField=getTypeInfoFromATType(dbg,child,cu);
@@ -990,7 +1059,6 @@ void* addUnionFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
       }
       offsetGuessSoFar+=typeOfField->length;
       type->fieldTypes[idx]=typeOfField;
-      grabRefCounted((RC*)typeOfField);
       idx++;
     }while(DW_DLV_OK==dwarf_siblingof(dbg,child,&child,&err));
   }
@@ -1034,7 +1102,7 @@ void parseFormalParameter(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   {
     SubprogramInfo* sub=li->value;
     assert(sub);
-    List* li=zmalloc(sizeof(List));
+    List* li=dwAlloc(sizeof(List));
     li->value=type;
     listAppend(&sub->typesHead,&sub->typesTail,li);
   }
@@ -1058,8 +1126,8 @@ void parseUnspecifiedParameters(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* c
 
 void* addVarFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 {
-  VarInfo* var=zmalloc(sizeof(VarInfo));
-  var->name=getNameForDie(dbg,die,cu);
+  VarInfo* var=dwAlloc(sizeof(VarInfo));
+  var->name=dwNameForDie(dbg,die,cu);
   Dwarf_Attribute attr;
   Dwarf_Error err;
   int res=dwarf_attr(die,DW_AT_declaration,&attr,&err);
@@ -1076,7 +1144,6 @@ void* addVarFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   if(!var->type)
   {
     fprintf(stderr,"Cannot create var %s when its type cannot be determined\n",var->name);
-    free(var->name);
     return NULL;
   }
 
@@ -1088,7 +1155,7 @@ void* addVarFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
     {
       if(prev->declaration)
       {
-        dictSet(cu->tv->globalVars,var->name,var,&freeVarInfoVoid);
+        dictSet(cu->tv->globalVars,var->name,var,NULL);
       }
       else
       {
@@ -1115,7 +1182,7 @@ void* addVarFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   {
     SubprogramInfo* sub=li->value;
     assert(sub);
-    List* li=zmalloc(sizeof(List));
+    List* li=dwAlloc(sizeof(List));
     li->value=var->type;
     listAppend(&sub->typesHead,&sub->typesTail,li);
   }
@@ -1124,10 +1191,10 @@ void* addVarFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 
 void* parseCompileUnit(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit** cu,ElfInfo* elf)
 {
-  *cu=zmalloc(sizeof(CompilationUnit));
+  *cu=dwAlloc(sizeof(CompilationUnit));
   (*cu)->elf=elf;
   (*cu)->subprograms=dictCreate(100);//todo: get rid of magic # 100 and base it on something
-  List* cuLi=zmalloc(sizeof(List));
+  List* cuLi=dwAlloc(sizeof(List));
   cuLi->value=*cu;
   if(di->compilationUnits)
   {
@@ -1139,7 +1206,7 @@ void* parseCompileUnit(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit** cu,ElfInf
   }
   di->lastCompilationUnit=cuLi;
           
-  TypeAndVarInfo* tv=zmalloc(sizeof(TypeAndVarInfo));
+  TypeAndVarInfo* tv=dwAlloc(sizeof(TypeAndVarInfo));
   (*cu)->tv=tv;
   tv->types=dictCreate(100);//todo: get rid of magic number 100 and base it on smth
   Dictionary* globalVars=dictCreate(100);//todo: get rid of magic number 100 and base it on smth
@@ -1147,34 +1214,24 @@ void* parseCompileUnit(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit** cu,ElfInf
   tv->globalVars=globalVars;
   tv->parsedDies=size_tMapCreate(100);//todo: get rid of magic number 100 and base it on smth
   //create the void type
-  TypeInfo* voidType=zmalloc(sizeof(TypeInfo));
+  TypeInfo* voidType=dwAlloc(sizeof(TypeInfo));
   voidType->type=TT_VOID;
-  voidType->name=strdup("void");
+  voidType->name=internString("void");
   dictInsert(tv->types,voidType->name,voidType);
-  grabRefCounted((RC*)voidType);
-  char* name=getNameForDie(dbg,die,*cu);
-  if(!elf->isPO)
-  {
-    char* dir=getDirectoryOfPath(elf->fname);
-    char* relDir=makePathRelativeTo(dir,workingDir);
-    free(dir);
-    (*cu)->name=joinPaths(relDir,name);
-    free(name);
-  }
-  else
-  {
-    (*cu)->name=name;
-  }
-  setIdentifierForCU(*cu,die);
+  //the name and identifier were worked out when the CU was indexed
+  assert(loadingEntry);
+  (*cu)->name=loadingEntry->name;
+  (*cu)->id=loadingEntry->id;
+  loadingEntry->cu=*cu;
   logprintf(ELL_INFO_V4,ELS_MISC,"compilation unit has name %s\n",(*cu)->name);
   return *cu;
 }
 
 SubprogramInfo* addSubprogramFromDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 {
-  SubprogramInfo* prog=zmalloc(sizeof(SubprogramInfo));
+  SubprogramInfo* prog=dwAlloc(sizeof(SubprogramInfo));
   prog->cu=cu;
-  prog->name=getNameForDie(dbg,die,cu);
+  prog->name=dwNameForDie(dbg,die,cu);
   Dwarf_Attribute attr;
   Dwarf_Error err;
   int res=dwarf_attr(die,DW_AT_low_pc,&attr,&err);
@@ -1207,11 +1264,11 @@ void* addSubroutineType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
     death("non-prototype subroutine found, James doesn't yet know what to do with these\n");
   }
 
-  TypeInfo* type=zmalloc(sizeof(TypeInfo));
+  TypeInfo* type=dwAlloc(sizeof(TypeInfo));
   type->type=TT_SUBROUTINE_TYPE;
   type->cu=cu;
   type->declaration=isPrototype;
-  type->name=getNameForDie(dbg,die,cu);
+  type->name=dwNameForDie(dbg,die,cu);
   logprintf(ELL_INFO_V4,ELS_DWARFTYPES,"reading subroutine type of name %s\n",type->name);
   type->length=0;//subroutine type in a way isn't a real type. It certainly has no length
   
@@ -1219,7 +1276,6 @@ void* addSubroutineType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
   //it's incomplete in case has members that reference it
   type->incomplete=true;
   dictInsert(cu->tv->types,type->name,type);
-  grabRefCounted((RC*)type);
   setParsedDie(die,type,cu);
   Dwarf_Die child;
   res=dwarf_child(die,&child,&err);
@@ -1242,11 +1298,8 @@ void* addSubroutineType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
         continue;
       }
       type->numFields++;
-      type->fields=realloc(type->fields,type->numFields*sizeof(char*));
-      MALLOC_CHECK(type->fields);
-      type->fieldTypes=realloc(type->fieldTypes,type->numFields*sizeof(char*));
-      MALLOC_CHECK(type->fieldTypes);
-      type->fields[idx]=getNameForDie(dbg,child,cu);
+      growFields(type,false);
+      type->fields[idx]=dwNameForDie(dbg,child,cu);
 
       TypeInfo* typeOfField=getTypeInfoFromATType(dbg,child,cu);
       if(!typeOfField)
@@ -1257,8 +1310,6 @@ void* addSubroutineType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
       
       //todo: perhaps use DW_AT_location instead of this?
       type->fieldTypes[idx]=typeOfField;
-      grabRefCounted((RC*)typeOfField);
-      grabRefCounted((RC*)typeOfField);
       idx++;
     }while(DW_DLV_OK==dwarf_siblingof(dbg,child,&child,&err));
   }
@@ -1272,30 +1323,25 @@ void* addSubroutineType(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu)
 //the current compile unit will change
 //returns a void* datum which will be passed to endDieChildren when all children
 //of the die have been parsed
-void* parseDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit** cu,bool* parseChildren,ElfInfo* elf)
+void* parseDie(Dwarf_Debug dbg,Dwarf_Die die,const DieRecord* rec,CompilationUnit** cu,bool* parseChildren,ElfInfo* elf)
 {
   void* result=NULL;
-  Dwarf_Off off,cuOff;
-  Dwarf_Error err;
-  dwarf_dieoffset(die,&off,&err);
-  dwarf_die_CU_offset(die,&cuOff,&err);
-  logprintf(ELL_INFO_V4,ELS_MISC,"processing die at offset %i (%i)\n",(int)off,(int)cuOff);
-  if(*cu && mapExists((*cu)->tv->parsedDies,&off))
+  logprintf(ELL_INFO_V4,ELS_MISC,"processing die at offset %i (%i)\n",(int)rec->off,(int)rec->cuOff);
+  if(*cu && mapExists((*cu)->tv->parsedDies,(void*)&rec->off))
   {
     //we've already parsed this die
     *parseChildren=false;//already will have parsed children too
     return result;
   }
 
-  Dwarf_Half tag = 0;
-  dwarf_tag(die,&tag,&err);
+  Dwarf_Half tag=rec->tag;
   if(!(*cu) && tag!=DW_TAG_compile_unit)
   {
     death("tag before compile unit\n");
   }
 
-  size_t* key=zmalloc(sizeof(size_t));
-  *key=off;
+  size_t* key=dwAlloc(sizeof(size_t));
+  *key=rec->off;
   if(*cu)
   {
     *parseChildren=true;
@@ -1384,12 +1430,9 @@ void* parseDie(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit** cu,bool* parseChi
   return result;
 }
 
-void endDieChildren(Dwarf_Die die,void* data)
+void endDieChildren(const DieRecord* rec,void* data)
 {
-  Dwarf_Half tag = 0;
-  Dwarf_Error err;
-  dwarf_tag(die,&tag,&err);
-  switch(tag)
+  switch(rec->tag)
   {
   case DW_TAG_subprogram:
     //assume that subprograms are properly nested, makes no sense
@@ -1400,97 +1443,191 @@ void endDieChildren(Dwarf_Die die,void* data)
   }
 }
 
+//one DIE on the explicit stack used by walkDieTree
+typedef struct
+{
+  Dwarf_Die die;
+  DieRecord rec;
+  void* data;//returned by parseDie, handed to endDieChildren
+  CompilationUnit* cu;
+  bool parsed;
+  bool ownsDie;//false only for the die walkDieTree was given
+} DieWalkFrame;
+
+static void readDieRecord(Dwarf_Die die,DieRecord* rec)
+{
+  Dwarf_Error err;
+  dwarf_dieoffset(die,&rec->off,&err);
+  dwarf_die_CU_offset(die,&rec->cuOff,&err);
+  rec->tag=0;
+  dwarf_tag(die,&rec->tag,&err);
+}
+
+//walks the tree rooted at die (and the root's siblings if siblings is
+//true) depth first, calling parseDie on the way down and
+//endDieChildren on the way back up. Uses an explicit stack rather than
+//recursion, as a CU may have tens of thousands of top-level DIEs.
+//The root die belongs to the caller, everything else is deallocated here
 void walkDieTree(Dwarf_Debug dbg,Dwarf_Die die,CompilationUnit* cu,bool siblings,ElfInfo* elf)
 {
   //code inspired by David Anderson's simplereader.c
   //distributed with libdwarf
-  char* name=NULL;
   Dwarf_Error err=0;
-  dwarf_diename(die,&name,&err);
-  if(name)
-  {
-    //printf("found die with name %s\n",name);
-  }
-  else
-  {
-    //printf("found die with no name\n");
-  }
-  dwarf_dealloc(dbg,name,DW_DLA_STRING);
-  bool parseChildren=true;
-  void* data=parseDie(dbg,die,&cu,&parseChildren,elf);
-  Dwarf_Die childOrSibling;
-  if(parseChildren)
-  {
-    
-    int res=dwarf_child(die,&childOrSibling,&err);
-    if(res==DW_DLV_OK)
+  int stackAllocated=32;
+  DieWalkFrame* stack=zmalloc(stackAllocated*sizeof(DieWalkFrame));
+  int depth=1;
+  stack[0].die=die;
+  stack[0].cu=cu;
+  while(depth)
+  {
+    DieWalkFrame* frame=&stack[depth-1];
+    if(!frame->parsed)
     {
+      frame->parsed=true;
+      readDieRecord(frame->die,&frame->rec);
+      diesWalked++;
+      bool parseChildren=true;
+      frame->data=parseDie(dbg,frame->die,&frame->rec,&frame->cu,&parseChildren,elf);
+      Dwarf_Die child;
       //if result was error our callback will have been called
       //if however there simply is no child it won't be an error
       //but the return value won't be ok
-      //printf("walking child\n");
-      walkDieTree(dbg,childOrSibling,cu,true,elf);
-      dwarf_dealloc(dbg,childOrSibling,DW_DLA_DIE);
+      if(parseChildren && DW_DLV_OK==dwarf_child(frame->die,&child,&err))
+      {
+        if(depth==stackAllocated)
+        {
+          stackAllocated*=2;
+          stack=realloc(stack,stackAllocated*sizeof(DieWalkFrame));
+          MALLOC_CHECK(stack);
+          frame=&stack[depth-1];
+        }
+        DieWalkFrame* childFrame=&stack[depth++];
+        memset(childFrame,0,sizeof(DieWalkFrame));
+        childFrame->die=child;
+        childFrame->ownsDie=true;
+        //a compile unit die changes the cu for everything beneath it
+        childFrame->cu=frame->cu;
+        continue;
+      }
+    }
+    //all children of this die have been dealt with
+    endDieChildren(&frame->rec,frame->data);
+    Dwarf_Die sibling=NULL;
+    int res=DW_DLV_NO_ENTRY;
+    if(depth>1 || siblings)
+    {
+      res=dwarf_siblingof(dbg,frame->die,&sibling,&err);
+      if(res==DW_DLV_ERROR)
+      {
+        dwarfErrorHandler(err,NULL);
+      }
+    }
+    if(frame->ownsDie)
+    {
+      dwarf_dealloc(dbg,frame->die,DW_DLA_DIE);
+    }
+    if(res==DW_DLV_OK)
+    {
+      //the sibling takes this die's place on the stack and
+      //inherits its cu
+      frame->die=sibling;
+      frame->data=NULL;
+      frame->parsed=false;
+      frame->ownsDie=true;
+    }
+    else
+    {
+      depth--;
     }
   }
-  endDieChildren(die,data);
-  if(!siblings)
-  {
-    return;
-  }
-  int res=dwarf_siblingof(dbg,die,&childOrSibling,&err);
-  if(res==DW_DLV_ERROR)
+  free(stack);
+}
+
+//returns the entry for the CU containing the given .debug_info offset
+//or NULL if there isn't one
+CUIndexEntry* findCUIndexEntry(struct DwarfIndex* index,Dwarf_Off off)
+{
+  int low=0;
+  int high=index->numEntries-1;
+  while(low<=high)
   {
-    dwarfErrorHandler(err,NULL);
+    int mid=(low+high)/2;
+    CUIndexEntry* entry=index->entries[mid];
+    if(off<entry->hdrOffset)
+    {
+      high=mid-1;
+    }
+    else if(off>=entry->endOffset)
+    {
+      low=mid+1;
+    }
+    else
+    {
+      return entry;
+    }
   }
-  if(res==DW_DLV_NO_ENTRY)
+  return NULL;
+}
+
+//die must be the die for the cu
+//the returned string should be freed
+char* makeNameForCU(Dwarf_Debug dbg,Dwarf_Die die,ElfInfo* elf,char* workingDir)
+{
+  char* name=getNameForDie(dbg,die,NULL);
+  if(elf->isPO)
   {
-    //no sibling
-    //printf("no sibling\n");
-    return;
+    return name;
   }
-  //printf("walking sibling\n");
-  walkDieTree(dbg,childOrSibling,cu,true,elf);
-  dwarf_dealloc(dbg,childOrSibling,DW_DLA_DIE);
-
+  char* dir=getDirectoryOfPath(elf->fname);
+  char* relDir=makePathRelativeTo(dir,workingDir);
+  free(dir);
+  char* result=joinPaths(relDir,name);
+  free(name);
+  return result;
 }
 
-//the returned structure should be freed
-//when the caller is finished with it
+//builds the index of compilation units for elf without reading any of
+//them in. Only the CU headers and the CU DIEs themselves are read.
+//Compilation units are then read in on demand with the
+//loadCompilationUnit* functions. The resulting DwarfInfo is stored in
+//elf->dwarfInfo and keeps the DWARF consumer open until the ELF file
+//is closed (see closeDWARFIndex)
 //workingDir is used for path names
 //it is the directory that names should be relative to
-DwarfInfo* readDWARFTypes(ElfInfo* elf,char* workingDir_)
+DwarfInfo* indexDWARFTypes(ElfInfo* elf,char* workingDir)
 {
-  workingDir=workingDir_;
   if(!elf->sectionIndices[ERS_DEBUG_INFO])
   {
     logprintf(ELL_WARN,ELS_DWARFTYPES,"ELF file %s does not seem to have any dwarf DIE information\n",elf->fname);
     return NULL;
   }
-  
-  di=zmalloc(sizeof(DwarfInfo));
+  DwarfInfo* info=zmalloc(sizeof(DwarfInfo));
+  info->arena=arenaCreate(0);
+  retainInternPool();//released by freeDwarfInfo
+  struct DwarfIndex* index=zmalloc(sizeof(struct DwarfIndex));
+  info->index=index;
+  index->elf=elf;
   Dwarf_Error err;
-  Dwarf_Debug dbg;
-  if(DW_DLV_OK!=dwarf_elf_init(elf->e,DW_DLC_READ,&dwarfErrorHandler,NULL,&dbg,&err))
+  if(DW_DLV_OK!=dwarf_elf_init(elf->e,DW_DLC_READ,&dwarfErrorHandler,NULL,&index->dbg,&err))
   {
     dwarfErrorHandler(err,NULL);
   }
+  Dwarf_Debug dbg=index->dbg;
+  index->entriesByName=dictCreate(100);//todo: get rid of magic number 100 and base it on smth
+  Dictionary* cuIdentifiers=dictCreate(100);//todo: get rid of magic number 100 and base it on smth
+  int entriesAllocated=0;
   //code inspired by David Anderson's simplereader.c
   //distributed with libdwarf
-  Dwarf_Unsigned nextCUHeader=0;//todo: does this need to be initialized outside
-                                //the loop, doees dwarf_next_cu_header read it,
-                                //or does it keep its own state and only set it?
+  Dwarf_Unsigned hdrOffset=0;
+  Dwarf_Unsigned nextCUHeader=0;
   Dwarf_Unsigned cuHeaderLength=0;
   Dwarf_Half version=0;
   Dwarf_Unsigned abbrevOffset=0;
   Dwarf_Half addressSize=0;
-  cuIdentifiers=dictCreate(100);//todo: get rid of magic number 100 and base it on smth
   while(1)
   {
-    logprintf(ELL_INFO_V4,ELS_MISC,"iterating compilation units\n");
-    int res;
-    res = dwarf_next_cu_header(dbg,&cuHeaderLength,&version, &abbrevOffset,
-                               &addressSize,&nextCUHeader, &err);
+    int res=dwarf_next_cu_header(dbg,&cuHeaderLength,&version,&abbrevOffset,
+                                 &addressSize,&nextCUHeader,&err);
     if(res == DW_DLV_ERROR)
     {
       dwarfErrorHandler(err,NULL);
@@ -1500,30 +1637,179 @@ DwarfInfo* readDWARFTypes(ElfInfo* elf,char* workingDir_)
       //finished reading all compilation units
       break;
     }
-    CompilationUnit* cu=NULL;
-    
-    Dwarf_Die cu_die = 0;
-    // The CU will have a single sibling, a cu_die.
+    Dwarf_Die cuDie=0;
     //passing NULL gets the first die in the CU
-    if(DW_DLV_ERROR==dwarf_siblingof(dbg,NULL,&cu_die,&err))
+    res=dwarf_siblingof(dbg,NULL,&cuDie,&err);
+    if(DW_DLV_ERROR==res)
     {
       dwarfErrorHandler(err,NULL);
     }
-    if(res == DW_DLV_NO_ENTRY)
+    if(DW_DLV_NO_ENTRY==res)
     {
       death("no entry! in dwarf_siblingof on CU die. This should never happen. Something is terribly wrong \n");
     }
-    //walk the die tree without siblings because
-    //we must initialize each compilation unit separately
-    walkDieTree(dbg,cu_die,cu,true,elf);
-    dwarf_dealloc(dbg,cu_die,DW_DLA_DIE);
+    if(index->numEntries==entriesAllocated)
+    {
+      entriesAllocated=max(16,entriesAllocated*2);
+      index->entries=realloc(index->entries,entriesAllocated*sizeof(CUIndexEntry*));
+      MALLOC_CHECK(index->entries);
+    }
+    CUIndexEntry* entry=zmalloc(sizeof(CUIndexEntry));
+    index->entries[index->numEntries++]=entry;
+    entry->hdrOffset=hdrOffset;
+    entry->endOffset=nextCUHeader;
+    hdrOffset=nextCUHeader;
+    dwarf_dieoffset(cuDie,&entry->dieOffset,&err);
+    char* name=makeNameForCU(dbg,cuDie,elf,workingDir);
+    char* id=makeIdentifierForCU(cuIdentifiers,name,cuDie);
+    entry->name=internString(name);
+    entry->id=internString(id);
+    free(name);
+    free(id);
+    if(!dictExists(index->entriesByName,entry->name))
+    {
+      dictInsert(index->entriesByName,entry->name,entry);
+    }
+    dwarf_dealloc(dbg,cuDie,DW_DLA_DIE);
   }
-  
-  if(DW_DLV_OK!=dwarf_finish(dbg,&err))
+  dictDelete(cuIdentifiers,NULL);
+  logprintf(ELL_INFO_V2,ELS_DWARFTYPES,"indexed %i compilation units in %s\n",index->numEntries,elf->fname);
+  elf->dwarfInfo=info;
+  return info;
+}
+
+//reads in the whole of the compilation unit for the given entry
+//if it has not been read in already
+static CompilationUnit* loadCompilationUnit(DwarfInfo* info,CUIndexEntry* entry)
+{
+  if(entry->cu)
+  {
+    return entry->cu;
+  }
+  struct DwarfIndex* index=info->index;
+  Dwarf_Error err;
+  Dwarf_Die cuDie;
+  int res=dwarf_offdie(index->dbg,entry->dieOffset,&cuDie,&err);
+  if(DW_DLV_OK!=res)
+  {
+    death("Could not find the DIE for compilation unit %s\n",entry->name);
+  }
+  di=info;
+  loadingEntry=entry;
+  walkDieTree(index->dbg,cuDie,NULL,false,index->elf);
+  loadingEntry=NULL;
+  dwarf_dealloc(index->dbg,cuDie,DW_DLA_DIE);
+  logprintf(ELL_INFO_V2,ELS_DWARFTYPES,"read in compilation unit %s\n",entry->name);
+  return entry->cu;
+}
+
+//reads in the compilation unit with the given name (as it appears in
+//CompilationUnit.name) if it has not already been read in.
+//Returns NULL if there is no such compilation unit
+CompilationUnit* loadCompilationUnitNamed(DwarfInfo* info,char* cuName)
+{
+  if(!info->index)
+  {
+    //everything was read in up front
+    for(List* li=info->compilationUnits;li;li=li->next)
+    {
+      CompilationUnit* cu=li->value;
+      if(cu->name && !strcmp(cu->name,cuName))
+      {
+        return cu;
+      }
+    }
+    return NULL;
+  }
+  CUIndexEntry* entry=dictGet(info->index->entriesByName,cuName);
+  return entry?loadCompilationUnit(info,entry):NULL;
+}
+
+int getNumCompilationUnits(DwarfInfo* info)
+{
+  return info->index?info->index->numEntries:0;
+}
+
+char* getCompilationUnitName(DwarfInfo* info,int i)
+{
+  return info->index->entries[i]->name;
+}
+
+CompilationUnit* loadCompilationUnitAt(DwarfInfo* info,int i)
+{
+  return loadCompilationUnit(info,info->index->entries[i]);
+}
+
+bool getCompilationUnitExtent(DwarfInfo* info,char* cuName,addr_t* start,addr_t* end)
+{
+  CUIndexEntry* entry=info->index?dictGet(info->index->entriesByName,cuName):NULL;
+  if(!entry)
+  {
+    return false;
+  }
+  *start=entry->hdrOffset;
+  *end=entry->endOffset;
+  return true;
+}
+
+void loadAllCompilationUnits(DwarfInfo* info)
+{
+  if(!info->index)
+  {
+    return;
+  }
+  struct timespec start,end;
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  unsigned long diesBefore=diesWalked;
+  for(int i=0;i<info->index->numEntries;i++)
+  {
+    loadCompilationUnit(info,info->index->entries[i]);
+  }
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double seconds=(end.tv_sec-start.tv_sec)+(end.tv_nsec-start.tv_nsec)/1e9;
+  unsigned long dies=diesWalked-diesBefore;
+  logprintf(ELL_INFO_V2,ELS_DWARFTYPES,"read %lu DIEs from %s in %.3fs (%.0f DIEs/sec)\n",
+            dies,info->index->elf->fname,seconds,seconds>0?dies/seconds:0.0);
+}
+
+//closes the DWARF consumer kept open by indexDWARFTypes. No more
+//compilation units can be read in afterwards
+void closeDWARFIndex(DwarfInfo* info)
+{
+  struct DwarfIndex* index=info->index;
+  if(!index)
+  {
+    return;
+  }
+  Dwarf_Error err;
+  if(DW_DLV_OK!=dwarf_finish(index->dbg,&err))
   {
     dwarfErrorHandler(err,NULL);
   }
-  dictDelete(cuIdentifiers,NULL);
-  elf->dwarfInfo=di;
-  return di;
+  for(int i=0;i<index->numEntries;i++)
+  {
+    free(index->entries[i]);
+  }
+  free(index->entries);
+  dictDelete(index->entriesByName,NULL);
+  free(index);
+  info->index=NULL;
+}
+
+//reads in every compilation unit at once. Use indexDWARFTypes instead
+//if only some of them will be needed
+//the returned structure should be freed
+//when the caller is finished with it
+//workingDir is used for path names
+//it is the directory that names should be relative to
+DwarfInfo* readDWARFTypes(ElfInfo* elf,char* workingDir)
+{
+  DwarfInfo* info=indexDWARFTypes(elf,workingDir);
+  if(!info)
+  {
+    return NULL;
+  }
+  loadAllCompilationUnits(info);
+  closeDWARFIndex(info);
+  return info;
 }
@@ -58,11 +58,33 @@
 #define dwarftypes_h
 #include "elfparse.h"
 #include "libdwarf_inc.h"
+//reads in every compilation unit
 //caller should free info when no longer needs it
 //workingDir is used for path names
 //it is the directory that names should be relative to
 DwarfInfo* readDWARFTypes(ElfInfo* elf,char* workingDir);
 
+//indexes the compilation units without reading any of them in,
+//they are then read in on demand with the functions below.
+//Sets elf->dwarfInfo. The index stays open until closeDWARFIndex
+//(called by endELF)
+DwarfInfo* indexDWARFTypes(ElfInfo* elf,char* workingDir);
+//returns NULL if there is no compilation unit of that name
+CompilationUnit* loadCompilationUnitNamed(DwarfInfo* di,char* cuName);
+void loadAllCompilationUnits(DwarfInfo* di);
+//how many DIEs have been read in so far, for reporting throughput
+extern unsigned long diesWalked;
+//the compilation units in the index can also be gone through one at a
+//time, by their position in .debug_info, deciding from the name
+//whether to read each in. 0 units once the index is closed
+int getNumCompilationUnits(DwarfInfo* di);
+char* getCompilationUnitName(DwarfInfo* di,int i);
+CompilationUnit* loadCompilationUnitAt(DwarfInfo* di,int i);
+//the offsets in .debug_info of the start of the named unit's header
+//and of the end of the unit. False if there is no such unit
+bool getCompilationUnitExtent(DwarfInfo* di,char* cuName,addr_t* start,addr_t* end);
+void closeDWARFIndex(DwarfInfo* di);
+
 
 void dwarfErrorHandler(Dwarf_Error err,Dwarf_Ptr arg);
 
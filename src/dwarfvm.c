@@ -66,12 +66,87 @@
 #include "patcher/hotpatch.h"
 #include "util/stack.h"
 #include "elfutil.h"
+#include "util/vector.h"
+#include "dwarfexpr.h"
 
-//returns a list of PatchData objects
-List* generatePatchesFromFDEAndState(FDE* fde,SpecialRegsState* state,ElfInfo* patch,ElfInfo* patchedBin);
+//data objects (variables and heap objects reached through pointers)
+//that have been moved while applying the current patch. Open
+//addressed, an oldAddr of 0 marks an empty slot, which is fine
+//because NULL pointers are never followed
+typedef struct
+{
+  addr_t oldAddr;
+  addr_t newAddr;
+} MovedObject;
+
+#define MOVED_OBJECTS_MIN_SLOTS 1024
+
+static struct
+{
+  MovedObject* slots;
+  int numSlots;//always a power of 2
+  int count;
+} dataMoved;
 
-//keys are old addresses of data objects (variables). Values are the new addresses
-Map* dataMoved=NULL;
+static inline int movedObjectSlot(addr_t addr)
+{
+  uint64_t hash=(uint64_t)addr*0x9E3779B97F4A7C15ULL;
+  return (int)((hash^(hash>>32))&(dataMoved.numSlots-1));
+}
+
+//returns the new address for an object or NULL if it hasn't been moved
+static addr_t* findMovedObject(addr_t oldAddr)
+{
+  if(!dataMoved.count)
+  {
+    return NULL;
+  }
+  int mask=dataMoved.numSlots-1;
+  for(int slot=movedObjectSlot(oldAddr);dataMoved.slots[slot].oldAddr;slot=(slot+1)&mask)
+  {
+    if(dataMoved.slots[slot].oldAddr==oldAddr)
+    {
+      return &dataMoved.slots[slot].newAddr;
+    }
+  }
+  return NULL;
+}
+
+static void insertMovedObjectSlot(addr_t oldAddr,addr_t newAddr)
+{
+  int mask=dataMoved.numSlots-1;
+  int slot=movedObjectSlot(oldAddr);
+  while(dataMoved.slots[slot].oldAddr)
+  {
+    slot=(slot+1)&mask;
+  }
+  dataMoved.slots[slot].oldAddr=oldAddr;
+  dataMoved.slots[slot].newAddr=newAddr;
+}
+
+//oldAddr must not already be in the table
+static void insertMovedObject(addr_t oldAddr,addr_t newAddr)
+{
+  assert(oldAddr);
+  //keep the load factor under 3/4
+  if((dataMoved.count+1)*4>dataMoved.numSlots*3)
+  {
+    MovedObject* oldSlots=dataMoved.slots;
+    int oldNumSlots=dataMoved.numSlots;
+    dataMoved.numSlots=oldNumSlots?oldNumSlots*2:MOVED_OBJECTS_MIN_SLOTS;
+    dataMoved.slots=zmalloc(dataMoved.numSlots*sizeof(MovedObject));
+    for(int i=0;i<oldNumSlots;i++)
+    {
+      if(oldSlots[i].oldAddr)
+      {
+        insertMovedObjectSlot(oldSlots[i].oldAddr,oldSlots[i].newAddr);
+      }
+    }
+    free(oldSlots);
+  }
+  insertMovedObjectSlot(oldAddr,newAddr);
+  dataMoved.count++;
+}
 
 //this is the stack of saved register states used by the
 //DW_CFA_remember_state and DW_CFA_restore_state instructions
@@ -79,6 +154,17 @@ static Stack* stateStack;
 //unfortunately because the way we currently evaluate
 //static Map* rememberedStatesByLocation;
 
+//expressions read from a binary are only decoded the first time
+//something evaluates them, most never are
+static DwarfExprProgram* getExprProgram(CIE* cie,RegInstruction* inst)
+{
+  if(inst->exprBytes && !inst->exprProgram)
+  {
+    inst->exprProgram=compileDwarfExpr(cie->arena,inst->exprBytes,inst->exprLen);
+  }
+  return inst->exprProgram;
+}
+
 //evaluates the given instructions and stores them in the output rules
 //dictionary.The initial condition of regarray IS taken into account.
 //Execution continues until the end of the instructions or until the
@@ -147,12 +233,12 @@ int evaluateInstructionsToRules(CIE* cie,RegInstruction* instrs,int numInstrs,Di
         {
           death("Attempt to use DW_CFA_restore_state without using DW_CFA_remember_state\n");
         }
-        char** keys=dictKeys(savedRules);
-        for(int i=0;keys[i];i++)
+        DictIterator iter=DICT_ITERATOR_INIT;
+        char* key;
+        PoRegRule* savedRule;
+        while(dictIterNext(savedRules,&iter,&key,(void**)&savedRule))
         {
-          char* key=keys[i];
           PoRegRule* currentRule=dictGet(rules,key);
-          PoRegRule* savedRule=dictGet(savedRules,key);
           assert(savedRule);
           if(currentRule)
           {
@@ -175,7 +261,8 @@ int evaluateInstructionsToRules(CIE* cie,RegInstruction* instrs,int numInstrs,Di
     char* str=NULL;
     if(DW_CFA_def_cfa==inst.type ||
        DW_CFA_def_cfa_register==inst.type ||
-       DW_CFA_def_cfa_offset==inst.type)
+       DW_CFA_def_cfa_offset==inst.type ||
+       DW_CFA_def_cfa_expression==inst.type)
     {
       memset(&reg,0,sizeof(reg));
       reg.type=ERT_CFA;
@@ -229,14 +316,28 @@ int evaluateInstructionsToRules(CIE* cie,RegInstruction* instrs,int numInstrs,Di
       rule->type=ERRT_CFA;
       rule->regRH=inst.arg1Reg;
       rule->offset=inst.arg2;
+      rule->expr=NULL;
       break;
     case DW_CFA_def_cfa_register:
       rule->type=ERRT_CFA;
       rule->regRH=inst.arg1Reg;
+      rule->expr=NULL;
       break;
     case DW_CFA_def_cfa_offset:
       rule->type=ERRT_CFA;
       rule->offset=inst.arg1;
+      rule->expr=NULL;
+      break;
+    case DW_CFA_def_cfa_expression:
+      inst.exprProgram=getExprProgram(cie,&instrs[i]);
+      if(!inst.exprProgram)
+      {
+        death("DW_CFA_def_cfa_expression can only be evaluated for instructions read from a binary\n");
+      }
+      rule->type=ERRT_CFA;
+      memset(&rule->regRH,0,sizeof(PoReg));
+      rule->offset=0;
+      rule->expr=inst.exprProgram;
       break;
     case DW_CFA_restore:
       {
@@ -262,10 +363,24 @@ int evaluateInstructionsToRules(CIE* cie,RegInstruction* instrs,int numInstrs,Di
       rule->regRH=inst.arg2Reg;
       rule->index=inst.arg3;
       break;
+    case DW_CFA_KATANA_fixups_array:
+      rule->type=ERRT_RECURSE_FIXUP_ARRAY;
+      rule->regRH=inst.arg2Reg;
+      rule->index=inst.arg3;
+      rule->count=inst.arg4;
+      break;
     case DW_CFA_expression:
     case DW_CFA_val_expression:
-      //todo: support this
-      logprintf(ELL_WARN,ELS_VM,"DW_CFA_expression/DW_CFA_val_expression is not supported in the DWARF VM yet. Ignoring this instruction. This means that the register rules will not be accurate.\n");
+      inst.exprProgram=getExprProgram(cie,&instrs[i]);
+      if(!inst.exprProgram)
+      {
+        //built by hand (e.g. from dwarfscript) rather than read from a
+        //binary, so never decoded
+        logprintf(ELL_WARN,ELS_VM,"DW_CFA_expression/DW_CFA_val_expression without a decoded expression. Ignoring this instruction. This means that the register rules will not be accurate.\n");
+        break;
+      }
+      rule->type=DW_CFA_expression==inst.type?ERRT_EXPR:ERRT_VAL_EXPR;
+      rule->expr=inst.exprProgram;
       break;
     case DW_CFA_nop:
       //do nothing, nothing changed
@@ -289,28 +404,117 @@ typedef struct
   byte* data;//data to be poked into the target
   uint len;//how much data
   addr_t addr;//address to copy the data to
+  bool inArena;//data belongs to an arena rather than this PatchData
 } PatchData;
 
-void freePatchData(PatchData* pd)
+VECTOR_DEFINE(PatchDataVec,PatchData)
+
+void freePatchDataVec(PatchDataVec* patches)
 {
-  if(pd->data)
+  for(int i=0;i<patches->len;i++)
   {
-    free(pd->data);
+    if(!patches->data[i].inArena)
+    {
+      free(patches->data[i].data);
+    }
   }
-  free(pd);
+  PatchDataVecFree(patches);
 }
 
-//returns a list of PatchData objects
-//this list generally only has one item unless a recurse rule
-//was encountered
-List* makePatchData(PoRegRule* rule,SpecialRegsState* state,ElfInfo* patch,ElfInfo* patchedBin)
+//appends PatchData objects to patches
+void generatePatchesFromFDEAndState(FDE* fde,SpecialRegsState* state,ElfInfo* patch,ElfInfo* patchedBin,PatchDataVec* patches);
+
+//work out where the object that an old pointer points to should live
+//in the new version of the target and record the move in
+//dataMoved. fde is the transformer for the pointed-to object. Returns
+//true if the object was already moved earlier, in which case it must
+//not be transformed again
+static bool relocatePointedObject(addr_t oldAddr,FDE* fde,SpecialRegsState* state,
+                                  ElfInfo* patch,ElfInfo* patchedBin,addr_t* newAddr)
 {
-  if(!dataMoved)
+  addr_t* existingDataMove=NULL;
+  if((existingDataMove=findMovedObject(oldAddr)))
+  {
+    logprintf(ELL_INFO_V4,ELS_DWARF_FRAME,"Found existing data move for addr 0x%x at 0x%x\n",oldAddr,*existingDataMove);
+    //we've already fixed up the location,
+    //just have to set the pointer to point where we want it to
+    *newAddr=*existingDataMove;
+    return true;
+  }
+
+  addr_t pointedObjectNewLocation=0;
+
+  //now we have to see if the location corresponds to a symbol
+  //that may be being relocated to a .data.new section or something
+  //or the symbol itself may not even move
+  idx_t symIdxOld=findSymbolContainingAddress(state->oldBinaryElf,oldAddr,STT_OBJECT,SHN_UNDEF);
+  if(symIdxOld!=STN_UNDEF)
   {
-    dataMoved=size_tMapCreate(100);//todo: get rid of arbitrary constant 100
+    //ok, so it was in a symbol in the executing binary, Now we have to find
+    //out where it might have been moved to. This will be the new location of
+    //the .data.new section plus the value of the symbol in the patch
+    idx_t symIdxPatch=reindexSymbol(state->oldBinaryElf,patch,symIdxOld,ESFF_FUZZY_MATCHING_OK|ESFF_BSS_MATCH_DATA_OK);
+    if(STN_UNDEF==symIdxPatch)
+    {
+      death("need to fix up a pointer that is supposedly part of a variable (rather than arbitrary stuff on the heap) but the patch doesn't seem to contain this variable\n");
+    }
+
+    GElf_Sym sym;
+    getSymbol(patch,symIdxPatch,&sym);
+    assert(sym.st_shndx==elf_ndxscn(getSectionByERS(patch,ERS_DATA)));
+    Elf_Scn* scn=getLastSectionByName(patchedBin,".data.new");
+    assert(scn);
+    GElf_Shdr shdr;
+    if(!gelf_getshdr(scn,&shdr))
+    {death("gelf_getshdr failed\n");}
+    pointedObjectNewLocation=shdr.sh_addr+sym.st_value;
+    logprintf(ELL_INFO_V2,ELS_DWARF_FRAME,"Found a symbol in target corresponding to this symbol(%s), so we're making our new location be 0x%zx as specified by the patch\n",getString(patch,sym.st_name),pointedObjectNewLocation);
   }
-  List* head=NULL;
+  else
+  {
+        
+    //no variable associated with this, it's just some random data
+    //on the heap. So we just allocate some random space for it
+    //the problem now is, we have to know how much space to allocate
+    //for this purpose we can use the address_range field
+    //of the fde we're targeting
+
+    //todo: deal with freeing the original memory
+    //      and issues if the original var is
+    //      part of a larger block, not on its own
+    //      (this is very hard to get right because we're
+    //      lacking important information)
+        
+    //pointedObjectNewLocation=getFreeSpaceInTarget(fde->memSize);
+    pointedObjectNewLocation=mallocTarget(fde->memSize);
+    logprintf(ELL_INFO_V2,ELS_DWARF_FRAME,"No symbol associated with object at address 0x%zx we have to relocate that we have a pointer to. Mallocced new memory at 0x%zx\n",oldAddr,pointedObjectNewLocation);
+  }
+
+  insertMovedObject(oldAddr,pointedObjectNewLocation);
+  *newAddr=pointedObjectNewLocation;
+  return false;
+}
+
+//runs a rule's expression. The object being transformed is the
+//object address, and is pushed first for DW_CFA_expression and
+//DW_CFA_val_expression as the standard pushes the CFA there
+static addr_t evaluateRuleExpr(PoRegRule* rule,SpecialRegsState* state,bool pushObject)
+{
+  DwarfExprContext ctx;
+  memset(&ctx,0,sizeof(DwarfExprContext));
+  ctx.cfa=state->cfaValue;
+  ctx.objectAddress=state->currAddrOld;
+  word_t initial=state->currAddrOld;
+  return runDwarfExpr(rule->expr,&ctx,&initial,pushObject?1:0);
+}
+
+//appends PatchData objects to patches
+//this generally only adds one item unless a recurse rule
+//was encountered
+void makePatchData(PoRegRule* rule,SpecialRegsState* state,ElfInfo* patch,ElfInfo* patchedBin,PatchDataVec* patches)
+{
   PatchData* result=NULL;
+  int resultIdx=-1;
   byte* addrBytes;
   int numAddrBytes=resolveRegisterValue(&rule->regLH,state,&addrBytes,ERRF_ASSIGN);
   addr_t resultAddr;
@@ -322,21 +526,20 @@ List* makePatchData(PoRegRule* rule,SpecialRegsState* state,ElfInfo* patch,ElfIn
   free(addrBytes);
 
   if(ERRT_OFFSET==rule->type || ERRT_REGISTER==rule->type || ERRT_EXPR==rule->type ||
-     ERRT_RECURSE_FIXUP_POINTER==rule->type)
+     ERRT_VAL_EXPR==rule->type || ERRT_RECURSE_FIXUP_POINTER==rule->type)
   {
-    head=zmalloc(sizeof(List));
-    result=zmalloc(sizeof(PatchData));
-    head->value=result;
+    //recursion below may grow the vector, so remember where
+    //our element is rather than holding on to the pointer
+    resultIdx=patches->len;
+    result=PatchDataVecPush(patches);
     result->addr=resultAddr;
   }
   
   switch(rule->type)
   {
   case ERRT_UNDEF:
-    free(result);
-    free(head);
     fprintf(stderr,"WARNING: undefined register, not doing anything. This is odd\n");
-    return NULL;
+    return;
     break;
   case ERRT_OFFSET:
     {
@@ -353,7 +556,20 @@ List* makePatchData(PoRegRule* rule,SpecialRegsState* state,ElfInfo* patch,ElfIn
     death("cfa should have been handled earlier\n");
     break;
   case ERRT_EXPR:
-    death("expressions not handled yet. todo: implement them\n");
+    {
+      addr_t addr=evaluateRuleExpr(rule,state,true);
+      result->len=rule->regLH.size?rule->regLH.size:sizeof(word_t);
+      result->data=zmalloc(result->len);
+      memcpyFromTarget(result->data,addr,result->len);
+    }
+    break;
+  case ERRT_VAL_EXPR:
+    {
+      word_t value=evaluateRuleExpr(rule,state,true);
+      result->len=rule->regLH.size?rule->regLH.size:sizeof(word_t);
+      result->data=zmalloc(result->len);
+      memcpy(result->data,&value,(min(result->len,sizeof(word_t))));
+    }
     break;
   case ERRT_RECURSE_FIXUP:
     {
@@ -365,7 +581,25 @@ List* makePatchData(PoRegRule* rule,SpecialRegsState* state,ElfInfo* patch,ElfIn
       memcpy(&tmpState.currAddrOld,rhAddrBytes,sizeof(addr_t));
       free(rhAddrBytes);
       //fde indices seem to be 1-based and we store them zero-based
-      head=generatePatchesFromFDEAndState(&patch->callFrameInfo.fdes[rule->index-1],&tmpState,patch,patchedBin);
+      generatePatchesFromFDEAndState(&patch->callFrameInfo.fdes[rule->index-1],&tmpState,patch,patchedBin,patches);
+    }
+    break;
+  case ERRT_RECURSE_FIXUP_ARRAY:
+    {
+      byte* rhAddrBytes=NULL;
+      int size=resolveRegisterValue(&rule->regRH,state,&rhAddrBytes,ERRF_NONE);
+      assert(size==sizeof(addr_t));
+      addr_t oldAddr;
+      memcpy(&oldAddr,rhAddrBytes,sizeof(addr_t));
+      free(rhAddrBytes);
+      FDE* elemFDE=&patch->callFrameInfo.fdes[rule->index-1];
+      for(int i=0;i<rule->count;i++)
+      {
+        SpecialRegsState tmpState=*state;
+        tmpState.currAddrNew=resultAddr+i*rule->regLH.size;
+        tmpState.currAddrOld=oldAddr+i*rule->regRH.size;
+        generatePatchesFromFDEAndState(elemFDE,&tmpState,patch,patchedBin,patches);
+      }
     }
     break;
   case ERRT_RECURSE_FIXUP_POINTER:
@@ -400,87 +634,27 @@ List* makePatchData(PoRegRule* rule,SpecialRegsState* state,ElfInfo* patch,ElfIn
         //we've already created the patch data as zero though, so we're all set
         break;
       }
-      
 
-      addr_t* existingDataMove=NULL;
-      if((existingDataMove=mapGet(dataMoved,&tmpState.currAddrOld)))
+      //fde indices seem to be 1-based and we store them zero-based
+      FDE* pointedFDE=&patch->callFrameInfo.fdes[rule->index-1];
+      addr_t pointedObjectNewLocation;
+      bool alreadyMoved=relocatePointedObject(tmpState.currAddrOld,pointedFDE,state,patch,patchedBin,&pointedObjectNewLocation);
+      memcpy(result->data,&pointedObjectNewLocation,sizeof(addr_t));
+      if(alreadyMoved)
       {
-        logprintf(ELL_INFO_V2,ELS_DWARF_FRAME,"Found existing data move for addr 0x%x at 0x%x\n",tmpState.currAddrOld,existingDataMove);
-        //we've already fixed up the location,
-        //just have to set the pointer to point where we want it to
-        memcpy(result->data,existingDataMove,sizeof(addr_t));
-        result->len=sizeof(addr_t);
         break;
       }
-
-      addr_t pointedObjectNewLocation=0;
-      
-      //now we have to see if the location corresponds to a symbol
-      //that may be being relocated to a .data.new section or something
-      //or the symbol itself may not even move
-      idx_t symIdxOld=findSymbolContainingAddress(state->oldBinaryElf,tmpState.currAddrOld,STT_OBJECT,SHN_UNDEF);
-      if(symIdxOld!=STN_UNDEF)
-      {
-        //ok, so it was in a symbol in the executing binary, Now we have to find
-        //out where it might have been moved to. This will be the new location of
-        //the .data.new section plus the value of the symbol in the patch
-        idx_t symIdxPatch=reindexSymbol(state->oldBinaryElf,patch,symIdxOld,ESFF_FUZZY_MATCHING_OK|ESFF_BSS_MATCH_DATA_OK);
-        if(STN_UNDEF==symIdxPatch)
-        {
-          death("need to fix up a pointer that is supposedly part of a variable (rather than arbitrary stuff on the heap) but the patch doesn't seem to contain this variable\n");
-        }
-
-        GElf_Sym sym;
-        getSymbol(patch,symIdxPatch,&sym);
-        assert(sym.st_shndx==elf_ndxscn(getSectionByERS(patch,ERS_DATA)));
-        Elf_Scn* scn=getSectionByName(patchedBin,".data.new");
-        assert(scn);
-        GElf_Shdr shdr;
-        if(!gelf_getshdr(scn,&shdr))
-        {death("gelf_getshdr failed\n");}
-        pointedObjectNewLocation=shdr.sh_addr+sym.st_value;
-        logprintf(ELL_INFO_V2,ELS_DWARF_FRAME,"Found a symbol in target corresponding to this symbol(%s), so we're making our new location be 0x%zx as specified by the patch\n",getString(patch,sym.st_name),pointedObjectNewLocation);
-      }
-      else
-      {
-        
-        //no variable associated with this, it's just some random data
-        //on the heap. So we just allocate some random space for it
-        //the problem now is, we have to know how much space to allocate
-        //for this purpose we can use the address_range field
-        //of the fde we're targeting
-
-        //todo: deal with freeing the original memory
-        //      and issues if the original var is
-        //      part of a larger block, not on its own
-        //      (this is very hard to get right because we're
-        //      lacking important information)
-        
-        //pointedObjectNewLocation=getFreeSpaceInTarget(patch->fdes[rule->index-1].memSize);
-        pointedObjectNewLocation=mallocTarget(patch->callFrameInfo.fdes[rule->index-1].memSize);
-        logprintf(ELL_INFO_V2,ELS_DWARF_FRAME,"No symbol associated with object at address 0x%zx we have to relocate that we have a pointer to. Mallocced new memory at 0x%zx\n",tmpState.currAddrOld,pointedObjectNewLocation);
-      }
-
-      addr_t* value=zmalloc(sizeof(addr_t));
-      *value=pointedObjectNewLocation;
-      size_t* key=zmalloc(sizeof(size_t));
-      memcpy(key,&tmpState.currAddrOld,sizeof(size_t));
-      mapInsert(dataMoved,key,value);
-      
-      
       tmpState.currAddrNew=pointedObjectNewLocation;
-      memcpy(result->data,&pointedObjectNewLocation,sizeof(addr_t));
-      
-      //fde indices seem to be 1-based and we store them zero-based
-      head->next=generatePatchesFromFDEAndState(&patch->callFrameInfo.fdes[rule->index-1],&tmpState,patch,patchedBin);
+      generatePatchesFromFDEAndState(pointedFDE,&tmpState,patch,patchedBin,patches);
     }
     break;
   default:
     death("unknown register rule type\n");
   }
   #ifdef DEBUG
-  if(result)
+  if(resultIdx>=0)
   {
+    result=&patches->data[resultIdx];
     logprintf(ELL_INFO_V2,ELS_HOTPATCH,"patching 0x%x with the following bytes:\n{",(uint)result->addr);
     for(int i=0;i<result->len;i++)
     {
@@ -489,17 +663,59 @@ List* makePatchData(PoRegRule* rule,SpecialRegsState* state,ElfInfo* patch,ElfIn
     logprintf(ELL_INFO_V2,ELS_HOTPATCH,"}\n");
   }
   #endif
-  return head;
 }
 
-//returns a list of PatchData objects
-List* generatePatchesFromFDEAndState(FDE* fde,SpecialRegsState* state,ElfInfo* patch,ElfInfo* patchedBin)
+//sets state->cfaValue from the CFA rule, if there is one
+static void computeCFAValue(PoRegRule* cfaRule,SpecialRegsState* state)
+{
+  if(cfaRule && cfaRule->expr)
+  {
+    //DW_CFA_def_cfa_expression starts with an empty stack
+    state->cfaValue=evaluateRuleExpr(cfaRule,state,false);
+  }
+  else if(cfaRule)
+  {
+    addr_t addr;
+    byte* cfaBytes;
+    int nbytes=resolveRegisterValue(&cfaRule->regRH,state,&cfaBytes,ERRF_NONE);
+    assert(sizeof(addr_t)==nbytes);
+    memcpy(&addr,cfaBytes,sizeof(addr_t));
+    free(cfaBytes);
+    state->cfaValue=addr+cfaRule->offset;
+  }
+  else
+  {
+    state->cfaValue=0;
+  }
+}
+
+//evaluates the FDE's instructions to rules. Returns a NULL-terminated
+//array of the rules in the order they were first assigned, which must
+//be freed, as must rulesDict with dictDelete(rulesDict,free)
+static PoRegRule** rulesForFDE(FDE* fde,Dictionary** rulesDictOut,PoRegRule** cfaRuleOut)
 {
   //we build up rules for each register from the DW_CFA instructions
   Dictionary* rulesDict=dictCreate(100);//todo: get rid of arbitrary constant 100
   //todo: versioning?
-  evaluateInstructionsToRules(fde->cie,fde->instructions,fde->numInstructions,rulesDict,fde->lowpc,fde->highpc,NULL);
-  PoRegRule** rules=(PoRegRule**)dictValues(rulesDict);
+  int numInstructions;
+  RegInstruction* instructions=getFDEInstructions(fde,&numInstructions);
+  evaluateInstructionsToRules(fde->cie,instructions,numInstructions,rulesDict,fde->lowpc,fde->highpc,NULL);
+  PoReg cfaReg;
+  memset(&cfaReg,0,sizeof(PoReg));
+  cfaReg.type=ERT_CFA;
+  char* str=strForReg(cfaReg,0);
+  *cfaRuleOut=dictGet(rulesDict,str);
+  free(str);
+  *rulesDictOut=rulesDict;
+  return (PoRegRule**)dictValues(rulesDict);
+}
+
+//appends PatchData objects to patches
+void generatePatchesFromFDEAndState(FDE* fde,SpecialRegsState* state,ElfInfo* patch,ElfInfo* patchedBin,PatchDataVec* patches)
+{
+  Dictionary* rulesDict;
+  PoRegRule* cfaRule;
+  PoRegRule** rules=rulesForFDE(fde,&rulesDict,&cfaRule);
   //we gather all of the the patch data together first before actually poking the target
   //because everything is supposed to be applied in parallel, as a table, and
   //it is possible that some writes would affect some reads, so we must
@@ -507,118 +723,481 @@ List* generatePatchesFromFDEAndState(FDE* fde,SpecialRegsState* state,ElfInfo* p
 
   //we read the CFA rule first, if it exists, however because the CFA may be needed
   //to determine the value of other registers
-  PoReg cfaReg;
-  memset(&cfaReg,0,sizeof(PoReg));
-  cfaReg.type=ERT_CFA;
-  char* str=strForReg(cfaReg,0);
-  PoRegRule* cfaRule=dictGet(rulesDict,str);
-  free(str);
-  if(cfaRule)
+  computeCFAValue(cfaRule,state);
+  for(int i=0;rules[i];i++)
   {
-    addr_t addr;
-    byte* cfaBytes;
-    int nbytes=resolveRegisterValue(&cfaRule->regRH,state,&cfaBytes,ERRF_NONE);
-    assert(sizeof(addr_t)==nbytes);
-    memcpy(&addr,cfaBytes,sizeof(addr_t));
-    state->cfaValue=addr+cfaRule->offset;
+    makePatchData(rules[i],state,patch,patchedBin,patches);
   }
-  else
+  free(rules);
+  dictDelete(rulesDict,free);
+}
+
+/*
+  Compiled transformers.
+
+  Interpreting an FDE means rebuilding its rule dictionary (with a
+  malloc'd string key per register) every time it is applied, and a
+  transformer FDE is applied once for every object it reaches through
+  a pointer or an embedded struct. Instead each FDE is compiled the
+  first time it is used into a TransformProgram, a flat array of ops
+  on the two registers that matter, CURR_TARG_OLD and CURR_TARG_NEW,
+  which refer to fixed offsets from the current old and new object.
+  Rules that don't fit one of the fast ops are kept as
+  ETO_GENERIC and handed to makePatchData, so compiled programs
+  always produce exactly what interpreting the FDE would.
+
+  Running a program doesn't touch the target field by field. The
+  whole source object (including any embedded structs and arrays the
+  program recurses into) is snapshotted with one read, the new object
+  is built up in a local image, and the parts of the image that were
+  actually written become one PatchData per contiguous run. Objects
+  reached through pointers are put on a worklist rather than recursed
+  into, so arbitrarily long linked structures can be transformed.
+*/
+
+typedef enum
+{
+  ETO_COPY,//copy size bytes from old+srcOffset to new+dstOffset
+  ETO_RECURSE,//transform the object at old+srcOffset into new+dstOffset with sub
+  ETO_RECURSE_POINTER,//the pointer at old+srcOffset points to an object to be
+                      //transformed with sub, new+dstOffset gets the new pointer
+  ETO_REPEAT,//run sub count times, advancing old and new by
+             //srcStride and dstStride each time. Made from
+             //ERRT_RECURSE_FIXUP_ARRAY, or from runs of ETO_RECURSE
+  ETO_GENERIC//anything else, rule is interpreted by makePatchData
+} E_TRANSFORM_OP;
+
+struct TransformProgram;
+
+typedef struct
+{
+  E_TRANSFORM_OP op;
+  int dstOffset;
+  int srcOffset;
+  int size;//for ETO_COPY
+  int count;//for ETO_REPEAT
+  int dstStride;//for ETO_REPEAT
+  int srcStride;//for ETO_REPEAT
+  struct TransformProgram* sub;//for ETO_RECURSE, ETO_RECURSE_POINTER and ETO_REPEAT
+  FDE* subFDE;//the FDE sub was compiled from
+  PoRegRule* rule;//for ETO_GENERIC
+} TransformOp;
+
+VECTOR_DEFINE(TransformOpVec,TransformOp)
+
+typedef struct TransformProgram
+{
+  TransformOp* ops;
+  int numOps;
+  PoRegRule* cfaRule;//NULL if the FDE doesn't define the CFA
+  int srcExtent;//bytes of the old object the ops read
+  int dstExtent;//bytes of the new object the ops write
+  bool compiled;//false while the program is still being compiled
+} TransformProgram;
+
+static TransformProgram* getTransformProgram(FDE* fde,ElfInfo* patch);
+
+//fold a run of recursions on the same transformer at evenly spaced
+//offsets (an array of structs) into a single ETO_REPEAT,
+//and neighbouring copies into a single larger copy. Only the last op
+//is ever merged with, so the order of the ops is unchanged
+static void appendTransformOp(TransformOpVec* ops,TransformOp* op)
+{
+  TransformOp* last=ops->len?&ops->data[ops->len-1]:NULL;
+  if(last && ETO_COPY==op->op && ETO_COPY==last->op &&
+     last->srcOffset+last->size==op->srcOffset &&
+     last->dstOffset+last->size==op->dstOffset)
   {
-    state->cfaValue=0;
+    last->size+=op->size;
+    return;
+  }
+  if(last && ETO_RECURSE==op->op && last->sub==op->sub)
+  {
+    if(ETO_RECURSE==last->op && op->srcOffset>=last->srcOffset && op->dstOffset>=last->dstOffset)
+    {
+      //any two recursions on the same transformer are a repeat of 2
+      last->op=ETO_REPEAT;
+      last->count=2;
+      last->srcStride=op->srcOffset-last->srcOffset;
+      last->dstStride=op->dstOffset-last->dstOffset;
+      return;
+    }
+    if(ETO_REPEAT==last->op && last->srcStride>=0 && last->dstStride>=0 &&
+       last->srcOffset+last->count*last->srcStride==op->srcOffset &&
+       last->dstOffset+last->count*last->dstStride==op->dstOffset)
+    {
+      last->count++;
+      return;
+    }
   }
-  List* liStart=NULL;
-  List* liEnd=NULL;
+  *TransformOpVecPush(ops)=*op;
+}
+
+static TransformProgram* compileTransformProgram(FDE* fde,ElfInfo* patch)
+{
+  TransformProgram* program=arenaAlloc(patch->arena,sizeof(TransformProgram));
+  //set before compiling any sub-programs so that
+  //self-referential types (linked lists etc) find it
+  fde->transformProgram=program;
+
+  Dictionary* rulesDict;
+  PoRegRule* cfaRule;
+  PoRegRule** rules=rulesForFDE(fde,&rulesDict,&cfaRule);
+  if(cfaRule)
+  {
+    program->cfaRule=arenaMemdup(patch->arena,cfaRule,sizeof(PoRegRule));
+  }
+  TransformOpVec ops={0};
   for(int i=0;rules[i];i++)
   {
-    List* patchList=makePatchData(rules[i],state,patch,patchedBin);
-    liStart=concatLists(liStart,liEnd,patchList,NULL,&liEnd);
+    PoRegRule* rule=rules[i];
+    if(rule==cfaRule)
+    {
+      continue;
+    }
+    TransformOp op;
+    memset(&op,0,sizeof(TransformOp));
+    op.op=ETO_GENERIC;
+    op.dstOffset=rule->regLH.u.offset;
+    op.srcOffset=rule->regRH.u.offset;
+    if(ERT_CURR_TARG_NEW==rule->regLH.type && ERT_CURR_TARG_OLD==rule->regRH.type &&
+       op.dstOffset>=0 && op.srcOffset>=0)
+    {
+      switch(rule->type)
+      {
+      case ERRT_REGISTER:
+        op.op=ETO_COPY;
+        op.size=rule->regRH.size;
+        break;
+      case ERRT_RECURSE_FIXUP:
+      case ERRT_RECURSE_FIXUP_POINTER:
+        if(ERRT_RECURSE_FIXUP_POINTER==rule->type && rule->regRH.size!=sizeof(addr_t))
+        {
+          break;
+        }
+        //fde indices seem to be 1-based and we store them zero-based
+        op.subFDE=&patch->callFrameInfo.fdes[rule->index-1];
+        op.sub=getTransformProgram(op.subFDE,patch);
+        //an object can't contain itself, only a pointer to
+        //itself, but don't trust that blindly
+        if(ERRT_RECURSE_FIXUP==rule->type && !op.sub->compiled)
+        {
+          op.sub=NULL;
+          op.subFDE=NULL;
+          break;
+        }
+        op.op=ERRT_RECURSE_FIXUP==rule->type?ETO_RECURSE:ETO_RECURSE_POINTER;
+        break;
+      case ERRT_RECURSE_FIXUP_ARRAY:
+        if(rule->count<=0 || rule->regRH.size<=0 || rule->regLH.size<=0)
+        {
+          break;
+        }
+        op.subFDE=&patch->callFrameInfo.fdes[rule->index-1];
+        op.sub=getTransformProgram(op.subFDE,patch);
+        if(!op.sub->compiled)
+        {
+          op.sub=NULL;
+          op.subFDE=NULL;
+          break;
+        }
+        op.op=ETO_REPEAT;
+        op.count=rule->count;
+        op.srcStride=rule->regRH.size;
+        op.dstStride=rule->regLH.size;
+        break;
+      default:
+        break;
+      }
+    }
+    if(ETO_GENERIC==op.op)
+    {
+      op.rule=arenaMemdup(patch->arena,rule,sizeof(PoRegRule));
+    }
+    appendTransformOp(&ops,&op);
+  }
+  program->numOps=ops.len;
+  program->ops=arenaMemdup(patch->arena,ops.data,ops.len*sizeof(TransformOp));
+  for(int i=0;i<program->numOps;i++)
+  {
+    TransformOp* op=&program->ops[i];
+    int srcEnd=0;
+    int dstEnd=0;
+    switch(op->op)
+    {
+    case ETO_COPY:
+      srcEnd=op->srcOffset+op->size;
+      dstEnd=op->dstOffset+op->size;
+      break;
+    case ETO_RECURSE:
+      srcEnd=op->srcOffset+op->sub->srcExtent;
+      dstEnd=op->dstOffset+op->sub->dstExtent;
+      break;
+    case ETO_REPEAT:
+      //strides come from offsets which are never negative, so
+      //the last element is the furthest out
+      srcEnd=op->srcOffset+(op->count-1)*op->srcStride+op->sub->srcExtent;
+      dstEnd=op->dstOffset+(op->count-1)*op->dstStride+op->sub->dstExtent;
+      break;
+    case ETO_RECURSE_POINTER:
+      srcEnd=op->srcOffset+sizeof(addr_t);
+      dstEnd=op->dstOffset+sizeof(addr_t);
+      break;
+    case ETO_GENERIC:
+      break;
+    }
+    program->srcExtent=max(program->srcExtent,srcEnd);
+    program->dstExtent=max(program->dstExtent,dstEnd);
   }
+  program->compiled=true;
+  TransformOpVecFree(&ops);
   free(rules);
   dictDelete(rulesDict,free);
-  return liStart;
+  logprintf(ELL_INFO_V3,ELS_DWARF_FRAME,"compiled transformer fde %i into %i ops\n",fde->idx,program->numOps);
+  return program;
 }
 
-//patchBin is the elf object we're mirroring all the changes
-//we made to memory in so that it's possible to do successive patching
-void patchDataWithFDE(VarInfo* var,FDE* fde,ElfInfo* oldBinaryElf,ElfInfo* patch,ElfInfo* patchedBin)
+static TransformProgram* getTransformProgram(FDE* fde,ElfInfo* patch)
 {
-
-  SpecialRegsState state;
-  memset(&state,0,sizeof(state));
-  state.currAddrOld=var->oldLocation;
-  state.currAddrNew=var->newLocation;
-  state.oldBinaryElf=oldBinaryElf;
-
-  List* patchesList=generatePatchesFromFDEAndState(fde,&state,patch,patchedBin);
-  //now that we've made all the patch data, apply it
-  List* li=patchesList;
-  for(;li;li=li->next)
+  if(fde->transformProgram)
   {
-    PatchData* pd=li->value;
-    memcpyToTarget(pd->addr,pd->data,pd->len);
+    return fde->transformProgram;
   }
-  deleteList(patchesList,(FreeFunc)freePatchData);
+  return compileTransformProgram(fde,patch);
 }
 
-//helper function for evaluationDwarfExpression
-word_t popDWVMStack(word_t* stack,int* stackLen)
+//an object reached through a pointer, waiting to be transformed
+typedef struct
+{
+  TransformProgram* program;
+  SpecialRegsState state;
+} PendingObject;
+
+VECTOR_DEFINE(PendingObjectVec,PendingObject)
+
+//how often to report progress when transforming a lot of objects
+#define TRANSFORM_PROGRESS_INTERVAL 100000
+
+//everything needed while transforming one variable and all the
+//objects it reaches. Objects found through pointers go on the
+//worklist rather than being recursed into, so the depth of the heap
+//graph doesn't matter
+typedef struct
+{
+  ElfInfo* patch;
+  ElfInfo* patchedBin;
+  PatchDataVec patches;
+  PendingObjectVec worklist;
+  Arena* arena;//holds the data for patches made from object images
+  //scratch buffers reused for each object
+  byte* old;
+  byte* image;
+  bool* written;
+  int scratchSize;
+  size_t objectsTransformed;
+  size_t bytesRead;
+  size_t bytesToWrite;
+} TransformRun;
+
+//the interpreter for compiled transformers. old is the snapshot of
+//the old object at state->currAddrOld, image and written are the new
+//object being built at state->currAddrNew and which of its bytes have
+//been set. Sub-objects are worked on in place in the same
+//buffers. Objects reached through pointers go on the worklist
+static void runTransformProgram(TransformRun* run,TransformProgram* program,SpecialRegsState* state,
+                                byte* old,byte* image,bool* written)
 {
-  if(0==*stackLen)
+  computeCFAValue(program->cfaRule,state);
+  for(int i=0;i<program->numOps;i++)
   {
-    death("Attempt to pop empty Dwarf stack\n");
+    TransformOp* op=&program->ops[i];
+    switch(op->op)
+    {
+    case ETO_COPY:
+      memcpy(image+op->dstOffset,old+op->srcOffset,op->size);
+      memset(written+op->dstOffset,true,op->size*sizeof(bool));
+      break;
+    case ETO_RECURSE:
+    case ETO_REPEAT:
+      {
+        int count=ETO_REPEAT==op->op?op->count:1;
+        for(int j=0;j<count;j++)
+        {
+          SpecialRegsState tmpState=*state;
+          int srcOffset=op->srcOffset+j*op->srcStride;
+          int dstOffset=op->dstOffset+j*op->dstStride;
+          tmpState.currAddrOld=state->currAddrOld+srcOffset;
+          tmpState.currAddrNew=state->currAddrNew+dstOffset;
+          runTransformProgram(run,op->sub,&tmpState,old+srcOffset,image+dstOffset,written+dstOffset);
+        }
+      }
+      break;
+    case ETO_RECURSE_POINTER:
+      {
+        addr_t pointer;
+        memcpy(&pointer,old+op->srcOffset,sizeof(addr_t));
+        addr_t newPointer=0;
+        bool alreadyMoved=true;
+        if(pointer)
+        {
+          alreadyMoved=relocatePointedObject(pointer,op->subFDE,state,run->patch,run->patchedBin,&newPointer);
+        }
+        memcpy(image+op->dstOffset,&newPointer,sizeof(addr_t));
+        memset(written+op->dstOffset,true,sizeof(addr_t)*sizeof(bool));
+        if(!alreadyMoved)
+        {
+          PendingObject* pending=PendingObjectVecPush(&run->worklist);
+          pending->program=op->sub;
+          pending->state=*state;
+          pending->state.currAddrOld=pointer;
+          pending->state.currAddrNew=newPointer;
+        }
+      }
+      break;
+    case ETO_GENERIC:
+      makePatchData(op->rule,state,run->patch,run->patchedBin,&run->patches);
+      break;
+    }
   }
-  (*stackLen)--;
-  return stack[*stackLen];
 }
 
-//helper function for evaluationDwarfExpression
-void pushDWVMStack(word_t** stack,int* stackLen,int* stackAlloced,word_t value)
+//transform a whole object (as opposed to one embedded in another
+//object), reading it from the target in one go and producing one
+//PatchData for each contiguous run of bytes written
+static void transformObject(TransformRun* run,TransformProgram* program,SpecialRegsState* state)
 {
-  if(*stackLen+1==*stackAlloced)
+  int scratchNeeded=max(program->srcExtent,program->dstExtent);
+  if(scratchNeeded>run->scratchSize)
+  {
+    run->scratchSize=max(scratchNeeded,2*run->scratchSize);
+    free(run->old);
+    free(run->image);
+    free(run->written);
+    run->old=zmalloc(run->scratchSize);
+    run->image=zmalloc(run->scratchSize);
+    run->written=zmalloc(run->scratchSize*sizeof(bool));
+  }
+  if(program->srcExtent)
   {
-    *stackAlloced=max(2*(*stackAlloced),2);
-    *stack=realloc(stack,*stackAlloced);
-    MALLOC_CHECK(*stack);
+    memcpyFromTarget(run->old,state->currAddrOld,program->srcExtent);
+    run->bytesRead+=program->srcExtent;
   }
-  (*stack)[*stackLen]=value;
-  (*stackLen)++;
+  memset(run->written,0,program->dstExtent*sizeof(bool));
+  runTransformProgram(run,program,state,run->old,run->image,run->written);
+  for(int start=0;start<program->dstExtent;)
+  {
+    if(!run->written[start])
+    {
+      start++;
+      continue;
+    }
+    int end=start;
+    while(end<program->dstExtent && run->written[end])
+    {
+      end++;
+    }
+    PatchData* pd=PatchDataVecPush(&run->patches);
+    pd->addr=state->currAddrNew+start;
+    pd->len=end-start;
+    pd->data=arenaMemdup(run->arena,run->image+start,pd->len);
+    pd->inArena=true;
+    run->bytesToWrite+=pd->len;
+    start=end;
+  }
+  run->objectsTransformed++;
 }
 
-//stack length given in words
-word_t evaluateDwarfExpression(byte* bytes,int len,word_t* startingStack,int stackLen)
+static void logTransformProgress(TransformRun* run,VarInfo* var,bool done)
 {
-  int stackAlloced=stackLen+10;
-  word_t* stack=zmalloc(stackAlloced*sizeof(word_t));//alloc more as needed
-  if(stackLen)
+  size_t memUsed=run->arena->bytesAllocated+
+    run->patches.cap*sizeof(PatchData)+
+    run->worklist.cap*sizeof(PendingObject)+
+    dataMoved.numSlots*sizeof(MovedObject)+
+    3*run->scratchSize;
+  logprintf(ELL_INFO_V1,ELS_DWARF_FRAME,"%s %s: %zu objects (%i waiting), read %zu bytes, %zu bytes to write, %zuK memory in use\n",
+            done?"transformed":"transforming",var->name,run->objectsTransformed,run->worklist.len,run->bytesRead,run->bytesToWrite,memUsed/1024);
+}
+
+//patchBin is the elf object we're mirroring all the changes
+//we made to memory in so that it's possible to do successive patching
+void patchDataWithFDE(VarInfo* var,FDE* fde,ElfInfo* oldBinaryElf,ElfInfo* patch,ElfInfo* patchedBin)
+{
+  TransformRun run;
+  memset(&run,0,sizeof(run));
+  run.patch=patch;
+  run.patchedBin=patchedBin;
+  run.arena=arenaCreate(0);
+
+  PendingObject* first=PendingObjectVecPush(&run.worklist);
+  first->program=getTransformProgram(fde,patch);
+  first->state.currAddrOld=var->oldLocation;
+  first->state.currAddrNew=var->newLocation;
+  first->state.oldBinaryElf=oldBinaryElf;
+  first->state.newBinaryElf=patchedBin;
+  while(run.worklist.len)
   {
-    memcpy(stack,startingStack,stackLen);
+    PendingObject pending=run.worklist.data[--run.worklist.len];
+    transformObject(&run,pending.program,&pending.state);
+    if(0==run.objectsTransformed%TRANSFORM_PROGRESS_INTERVAL)
+    {
+      logTransformProgress(&run,var,false);
+    }
   }
-  
-  for(int cnt=0;cnt<len;)
+  logTransformProgress(&run,var,true);
+  free(run.old);
+  free(run.image);
+  free(run.written);
+  PendingObjectVecFree(&run.worklist);
+
+  //now that we've made all the patch data, apply it. Patches that
+  //follow on from each other in memory go out in a single write
+  PatchDataVec patches=run.patches;
+  for(int i=0;i<patches.len;)
   {
-    byte op=bytes[cnt++];
-    switch(op)
+    PatchData* pd=&patches.data[i];
+    int end=i+1;
+    uint len=pd->len;
+    while(end<patches.len && patches.data[end].addr==pd->addr+len)
+    {
+      len+=patches.data[end].len;
+      end++;
+    }
+    if(end==i+1)
     {
-    case DW_OP_plus_uconst:
+      memcpyToTarget(pd->addr,pd->data,pd->len);
+    }
+    else
+    {
+      byte* buf=zmalloc(len);
+      uint off=0;
+      for(int j=i;j<end;j++)
       {
-        word_t top=popDWVMStack(stack,&stackLen);
-        usint bytesRead;
-        word_t uconst=leb128ToUWord(bytes+cnt,&bytesRead);
-        cnt+=bytesRead;
-        pushDWVMStack(&stack,&stackLen,&stackAlloced,top+uconst);
+        memcpy(buf+off,patches.data[j].data,patches.data[j].len);
+        off+=patches.data[j].len;
       }
-      break;
-    default:
-      death("Dwarf expression operand %i not supported yet\n",(int)op);
+      memcpyToTarget(pd->addr,buf,len);
+      free(buf);
     }
+    i=end;
   }
-  return popDWVMStack(stack,&stackLen);
+  freePatchDataVec(&patches);
+  arenaDelete(run.arena);
+}
+
+//stack length given in words
+word_t evaluateDwarfExpression(byte* bytes,int len,word_t* startingStack,int stackLen)
+{
+  DwarfExprProgram* prog=compileDwarfExpr(NULL,bytes,len);
+  DwarfExprContext ctx;
+  memset(&ctx,0,sizeof(DwarfExprContext));
+  word_t result=runDwarfExpr(prog,&ctx,startingStack,stackLen);
+  freeDwarfExpr(prog);
+  return result;
 }
 
+//forget everything remembered while applying a patch
 void cleanupDwarfVM()
 {
-  if(dataMoved)
-  {
-    mapDelete(dataMoved,free,free);
-  }
+  free(dataMoved.slots);
+  memset(&dataMoved,0,sizeof(dataMoved));
 }
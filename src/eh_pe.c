@@ -232,25 +232,25 @@ addr_t decodeEHPointer(byte* data,int len,addr_t dataStartAddress,byte encoding,
     assert(len>=8);
     assert(sizeof(addr_t)>=8);
     memcpy(&result,data,8);
-    byteSize=4;
+    byteSize=8;
     break;
   case DW_EH_PE_uleb128:
+    byteSize=decodeULEB128(data,data+len,&result);
+    if(!byteSize)
     {
-      usint numBytes;
-      byte* decodedLEB=decodeLEB128(data,false,&numBytes,&byteSize);
-      assert(numBytes<=sizeof(result));
-      memcpy(&result,decodedLEB,numBytes);
-      free(decodedLEB);
+      death("malformed ULEB eh_frame pointer\n");
     }
     break;
   case DW_EH_PE_sleb128:
     {
       resultSigned=true;
-      usint numBytes;
-      byte* decodedLEB=decodeLEB128(data,false,&numBytes,&byteSize);
-      assert(numBytes<=sizeof(result));
-      memcpy(&result,decodedLEB,numBytes);
-      free(decodedLEB);
+      sword_t value;
+      byteSize=decodeSLEB128(data,data+len,&value);
+      if(!byteSize)
+      {
+        death("malformed SLEB eh_frame pointer\n");
+      }
+      result=(addr_t)value;
     }
     break;
   default:
@@ -262,6 +262,13 @@ addr_t decodeEHPointer(byte* data,int len,addr_t dataStartAddress,byte encoding,
   {
     *bytesRead=byteSize;
   }
+  if(resultSigned && byteSize<sizeof(addr_t) && format!=DW_EH_PE_sleb128)
+  {
+    //sign extend so that negative pc-relative offsets still work
+    //when addresses are wider than the encoding
+    addr_t signBit=(addr_t)1<<(byteSize*8-1);
+    result=(result^signBit)-signBit;
+  }
 
   //DW_EH_PE_indirect can be ORd with one of the others.  we don't
   //care about it right now, all we have to do is to make sure that if
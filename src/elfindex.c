@@ -0,0 +1,451 @@
+/*
+  File: elfindex.c
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: building, saving and loading sidecar symbol indexes
+*/
+
+#include "elfindex.h"
+#include "elfutil.h"
+#include "util/logging.h"
+#include "util/hash.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+//an index file is an ElfIndexHeader, the build id padded to a
+//multiple of 8 bytes, numBuckets uint32 and numAddrEntries
+//ElfIndexAddrEntry, all in host form. Each bucket holds 1+the index
+//of the first symbol with a name hashing there, or 0 if empty
+//(collisions go to the next bucket). Which bucket a name is in
+//depends on hashBytes, so the header records what hashBytes makes of
+//a fixed string: an index made with a different hash (a changed
+//hashBytes, or a katana of the other width) is rebuilt, not misread
+typedef struct
+{
+  char magic[8];
+  uint32 version;
+  uint32 buildIdLen;
+  uint32 numSymbols;//of the symbol table indexed
+  uint32 strtabSize;//of its string table
+  uint32 numBuckets;//always a power of 2
+  uint32 numAddrEntries;
+  uint64_t maxSymbolSize;//largest st_size in the address table
+  uint64_t nameHashCheck;//see getNameHashCheck
+} ElfIndexHeader;
+
+//sorted by value
+typedef struct
+{
+  uint64_t value;
+  uint64_t size;
+  uint32 symIdx;
+  uint32 shndx;
+  uint32 type;
+  uint32 pad;
+} ElfIndexAddrEntry;
+
+struct ElfIndex
+{
+  byte* data;//the whole index
+  size_t size;
+  bool mapped;//data is mapped from the index file rather than malloced
+  uint32* buckets;
+  uint32 numBuckets;
+  ElfIndexAddrEntry* addrEntries;
+  uint32 numAddrEntries;
+  uint64_t maxSymbolSize;
+  Elf_Data* symTabData;//the symbol table the index describes
+  int numSymbols;
+};
+
+#define INDEX_ALIGN(x) (((x)+7)&~7)
+
+static uint32 nameBucket(char* name,uint32 numBuckets)
+{
+  return hashBytes(name,strlen(name))&(numBuckets-1);
+}
+
+static uint64_t getNameHashCheck()
+{
+  static char probe[]="katana symbol index";
+  return hashBytes(probe,sizeof(probe)-1);
+}
+
+static int cmpAddrEntries(const void* a,const void* b)
+{
+  const ElfIndexAddrEntry* x=a;
+  const ElfIndexAddrEntry* y=b;
+  if(x->value!=y->value)
+  {
+    return x->value<y->value?-1:1;
+  }
+  return x->symIdx<y->symIdx?-1:(x->symIdx>y->symIdx?1:0);
+}
+
+static uint32 getStrtabSize(ElfInfo* e)
+{
+  GElf_Shdr shdr;
+  if(!gelf_getshdr(elf_getscn(e->e,e->strTblIdx),&shdr))
+  {
+    return 0;
+  }
+  return shdr.sh_size;
+}
+
+//points index's tables into index->data, returns false if the data
+//isn't a usable index for e
+static bool setUpIndex(ElfIndex* index,ElfInfo* e,byte* buildId,uint32 buildIdLen)
+{
+  ElfIndexHeader header;
+  if(index->size<sizeof(header))
+  {
+    return false;
+  }
+  memcpy(&header,index->data,sizeof(header));
+  size_t offset=sizeof(header)+INDEX_ALIGN((size_t)header.buildIdLen);
+  size_t size=INDEX_ALIGN(offset+sizeof(uint32)*(size_t)header.numBuckets)+
+    sizeof(ElfIndexAddrEntry)*(size_t)header.numAddrEntries;
+  if(memcmp(header.magic,ELF_INDEX_MAGIC,sizeof(header.magic)) ||
+     ELF_INDEX_VERSION!=header.version || getNameHashCheck()!=header.nameHashCheck ||
+     index->size<size ||
+     header.buildIdLen!=buildIdLen ||
+     (buildIdLen && memcmp(index->data+sizeof(header),buildId,buildIdLen)) ||
+     header.numSymbols!=e->symTabCount || header.strtabSize!=getStrtabSize(e) ||
+     !header.numBuckets || (header.numBuckets&(header.numBuckets-1)) ||
+     header.numAddrEntries>header.numSymbols)
+  {
+    return false;
+  }
+  index->buckets=(uint32*)(index->data+offset);
+  index->numBuckets=header.numBuckets;
+  offset+=sizeof(uint32)*header.numBuckets;
+  offset=INDEX_ALIGN(offset);
+  index->addrEntries=(ElfIndexAddrEntry*)(index->data+offset);
+  index->numAddrEntries=header.numAddrEntries;
+  index->maxSymbolSize=header.maxSymbolSize;
+  index->symTabData=getDataByERS(e,ERS_SYMTAB);
+  index->numSymbols=header.numSymbols;
+  return true;
+}
+
+static void buildIndex(ElfIndex* index,ElfInfo* e,byte* buildId,uint32 buildIdLen)
+{
+  ElfIndexHeader header;
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,ELF_INDEX_MAGIC,sizeof(header.magic));
+  header.version=ELF_INDEX_VERSION;
+  header.nameHashCheck=getNameHashCheck();
+  header.buildIdLen=buildIdLen;
+  header.numSymbols=e->symTabCount;
+  header.strtabSize=getStrtabSize(e);
+  header.numBuckets=1;
+  while(header.numBuckets<2*header.numSymbols)
+  {
+    header.numBuckets*=2;
+  }
+  header.numAddrEntries=header.numSymbols-1;
+
+  size_t bucketsOffset=sizeof(header)+INDEX_ALIGN((size_t)buildIdLen);
+  size_t addrOffset=INDEX_ALIGN(bucketsOffset+sizeof(uint32)*header.numBuckets);
+  index->size=addrOffset+sizeof(ElfIndexAddrEntry)*header.numAddrEntries;
+  index->data=zmalloc(index->size);
+  if(buildIdLen)
+  {
+    memcpy(index->data+sizeof(header),buildId,buildIdLen);
+  }
+  uint32* buckets=(uint32*)(index->data+bucketsOffset);
+  ElfIndexAddrEntry* addrEntries=(ElfIndexAddrEntry*)(index->data+addrOffset);
+
+  Elf_Data* symTabData=getDataByERS(e,ERS_SYMTAB);
+  ElfXX_Sym* syms=getNativeSymbols(e,symTabData);
+  uint32 mask=header.numBuckets-1;
+  for(int i=1;i<e->symTabCount;i++)
+  {
+    ElfXX_Sym buf;
+    ElfXX_Sym* sym=getSymbolInTable(syms,symTabData,i,&buf);
+    ElfIndexAddrEntry* entry=&addrEntries[i-1];
+    entry->value=sym->st_value;
+    entry->size=sym->st_size;
+    entry->symIdx=i;
+    entry->shndx=sym->st_shndx;
+    entry->type=ELFXX_ST_TYPE(sym->st_info);
+    header.maxSymbolSize=max(header.maxSymbolSize,(uint64_t)sym->st_size);
+
+    char* name=getString(e,sym->st_name);
+    if(!name || !name[0])
+    {
+      continue;
+    }
+    //only the first symbol with each name goes in
+    uint32 bucket=nameBucket(name,header.numBuckets);
+    for(;buckets[bucket];bucket=(bucket+1)&mask)
+    {
+      ElfXX_Sym otherBuf;
+      ElfXX_Sym* other=getSymbolInTable(syms,symTabData,buckets[bucket]-1,&otherBuf);
+      if(!strcmp(getString(e,other->st_name),name))
+      {
+        break;
+      }
+    }
+    if(!buckets[bucket])
+    {
+      buckets[bucket]=i+1;
+    }
+  }
+  qsort(addrEntries,header.numAddrEntries,sizeof(ElfIndexAddrEntry),cmpAddrEntries);
+  memcpy(index->data,&header,sizeof(header));
+  setUpIndex(index,e,buildId,buildIdLen);
+}
+
+//saves the index so it can be replaced atomically and never seen
+//half written
+static void saveIndex(ElfIndex* index,char* fname)
+{
+  char tmpFname[320];
+  snprintf(tmpFname,320,"%s.%i",fname,(int)getpid());
+  int fd=open(tmpFname,O_WRONLY|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR);
+  if(fd<0)
+  {
+    logprintf(ELL_INFO_V1,ELS_MISC,"Cannot save symbol index %s\n",fname);
+    return;
+  }
+  byte* p=index->data;
+  size_t left=index->size;
+  while(left)
+  {
+    ssize_t written=write(fd,p,left);
+    if(written<0 && EINTR==errno)
+    {
+      continue;
+    }
+    if(written<=0)
+    {
+      break;
+    }
+    p+=written;
+    left-=written;
+  }
+  close(fd);
+  if(left || rename(tmpFname,fname))
+  {
+    logprintf(ELL_INFO_V1,ELS_MISC,"Cannot save symbol index %s\n",fname);
+    unlink(tmpFname);
+  }
+}
+
+//an index read from a file is only used as far as it can be checked:
+//every symbol it refers to has to be in the symbol table, there has to
+//be an empty bucket for a name lookup to stop at, and the address
+//table has to be in order and within maxSymbolSize for the search
+//through it
+static bool isIndexConsistent(ElfIndex* index)
+{
+  bool haveEmptyBucket=false;
+  for(uint32 i=0;i<index->numBuckets;i++)
+  {
+    if(index->buckets[i]>index->numSymbols)
+    {
+      return false;
+    }
+    haveEmptyBucket=haveEmptyBucket || !index->buckets[i];
+  }
+  if(!haveEmptyBucket)
+  {
+    return false;
+  }
+  for(uint32 i=0;i<index->numAddrEntries;i++)
+  {
+    ElfIndexAddrEntry* entry=&index->addrEntries[i];
+    if(entry->symIdx>=index->numSymbols || entry->size>index->maxSymbolSize ||
+       (i && cmpAddrEntries(entry-1,entry)>0))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool loadIndex(ElfIndex* index,ElfInfo* e,char* fname,byte* buildId,uint32 buildIdLen)
+{
+  int fd=open(fname,O_RDONLY);
+  if(fd<0)
+  {
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd,&st) || !st.st_size)
+  {
+    close(fd);
+    return false;
+  }
+  void* map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if(MAP_FAILED==map)
+  {
+    return false;
+  }
+  index->data=map;
+  index->size=st.st_size;
+  index->mapped=true;
+  if(!setUpIndex(index,e,buildId,buildIdLen) || !isIndexConsistent(index))
+  {
+    logprintf(ELL_INFO_V1,ELS_MISC,"Symbol index %s is out of date or damaged, not using it\n",fname);
+    munmap(map,st.st_size);
+    memset(index,0,sizeof(ElfIndex));
+    return false;
+  }
+  return true;
+}
+
+//whether e's symbol table is still as it was read. Anything that
+//changes it, adding symbols or updating them in place, flags it dirty
+static bool isSymTabUnchanged(ElfInfo* e)
+{
+  Elf_Scn* scn=getSectionByERS(e,ERS_SYMTAB);
+  Elf_Data* data=getDataByERS(e,ERS_SYMTAB);
+  return !((elf_flagscn(scn,ELF_C_SET,0) | elf_flagdata(data,ELF_C_SET,0)) & ELF_F_DIRTY);
+}
+
+ElfIndex* getELFIndex(ElfInfo* e)
+{
+  if(e->indexChecked)
+  {
+    //once the symbol table has been changed the index no longer
+    //describes it
+    if(e->index && (e->index->numSymbols!=e->symTabCount ||
+                    e->index->symTabData!=getDataByERS(e,ERS_SYMTAB) ||
+                    !isSymTabUnchanged(e)))
+    {
+      return NULL;
+    }
+    return e->index;
+  }
+  e->indexChecked=true;
+  if(!hasERS(e,ERS_SYMTAB) || e->symTabCount<ELF_INDEX_MIN_SYMBOLS ||
+     !isSymTabUnchanged(e))
+  {
+    return NULL;
+  }
+  //only files we read whole from disk can share their index with
+  //later runs, they're known by their build id
+  uint32 buildIdLen=0;
+  byte* buildId=NULL;
+  if(e->map && !e->overlayBase)
+  {
+    buildId=getBuildId(e,&buildIdLen);
+  }
+
+  char fname[256];
+  if(buildId)
+  {
+    snprintf(fname,256,"/tmp/katana-%s",getenv("USER"));
+    mkdir(fname,S_IRWXU);
+    snprintf(fname,256,"/tmp/katana-%s/index",getenv("USER"));
+    mkdir(fname,S_IRWXU);
+    int len=strlen(fname);
+    len+=snprintf(fname+len,256-len,"/");
+    for(int i=0;i<buildIdLen && len<250;i++)
+    {
+      len+=snprintf(fname+len,256-len,"%02x",buildId[i]);
+    }
+  }
+
+  ElfIndex* index=zmalloc(sizeof(ElfIndex));
+  if(!buildId || !loadIndex(index,e,fname,buildId,buildIdLen))
+  {
+    logprintf(ELL_INFO_V1,ELS_MISC,"Building symbol index for %s\n",e->fname);
+    buildIndex(index,e,buildId,buildIdLen);
+    if(buildId)
+    {
+      saveIndex(index,fname);
+    }
+  }
+  e->index=index;
+  return index;
+}
+
+void closeELFIndex(ElfIndex* index)
+{
+  if(!index)
+  {
+    return;
+  }
+  if(index->mapped)
+  {
+    munmap(index->data,index->size);
+  }
+  else
+  {
+    free(index->data);
+  }
+  free(index);
+}
+
+idx_t findSymbolByNameInIndex(ElfIndex* index,ElfInfo* e,char* name)
+{
+  Elf_Data* symTabData=getDataByERS(e,ERS_SYMTAB);
+  ElfXX_Sym* syms=getNativeSymbols(e,symTabData);
+  uint32 mask=index->numBuckets-1;
+  for(uint32 bucket=nameBucket(name,index->numBuckets);index->buckets[bucket];bucket=(bucket+1)&mask)
+  {
+    ElfXX_Sym buf;
+    ElfXX_Sym* sym=getSymbolInTable(syms,symTabData,index->buckets[bucket]-1,&buf);
+    if(!strcmp(getString(e,sym->st_name),name))
+    {
+      return index->buckets[bucket]-1;
+    }
+  }
+  return STN_UNDEF;
+}
+
+idx_t findSymbolByAddressInIndex(ElfIndex* index,addr_t addr,byte type,idx_t scnIdx)
+{
+  //first entry starting after addr
+  int low=0;
+  int high=index->numAddrEntries;
+  while(low<high)
+  {
+    int middle=low+(high-low)/2;
+    if(index->addrEntries[middle].value<=addr)
+    {
+      low=middle+1;
+    }
+    else
+    {
+      high=middle;
+    }
+  }
+  //anything containing addr starts before it, and no further before
+  //it than the largest symbol is long. Several may contain it, and
+  //the first in the symbol table wins as it would in a scan
+  idx_t result=STN_UNDEF;
+  for(int i=low-1;i>=0;i--)
+  {
+    ElfIndexAddrEntry* entry=&index->addrEntries[i];
+    if(addr-entry->value>index->maxSymbolSize)
+    {
+      break;
+    }
+    if(entry->type==type &&
+       (entry->shndx==scnIdx || SHN_UNDEF==scnIdx) &&
+       (entry->value==addr || entry->value+entry->size>addr) &&
+       (STN_UNDEF==result || entry->symIdx<result))
+    {
+      result=entry->symIdx;
+    }
+  }
+  return result;
+}
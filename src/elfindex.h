@@ -0,0 +1,53 @@
+/*
+  File: elfindex.h
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: sidecar symbol indexes for executables and shared
+               libraries. Looking symbols up by name or by address in
+               a big binary otherwise means scanning its whole symbol
+               table, and every katana run against the same binary
+               would do that again. An index is a name hash table and
+               a sorted address table, built the first time they're
+               needed for any sizeable symbol table. For a file with a
+               build id it is saved under /tmp/katana-$USER/index,
+               keyed by build id, and later runs map the saved index
+               and use it directly. The index is only consulted while
+               the ElfInfo's symbol table is unchanged from when it was
+               read
+*/
+
+#ifndef elfindex_h
+#define elfindex_h
+
+#include "elfparse.h"
+
+#define ELF_INDEX_MAGIC "KTNINDX"
+#define ELF_INDEX_VERSION 2
+//symbol tables smaller than this are quick enough to scan
+#define ELF_INDEX_MIN_SYMBOLS 512
+
+typedef struct ElfIndex ElfIndex;
+
+//returns e's index, loading or building it the first time it's asked
+//for. NULL if e doesn't get one
+ElfIndex* getELFIndex(ElfInfo* e);
+void closeELFIndex(ElfIndex* index);
+
+//the index of the first symbol in e's symbol table named name, or
+//STN_UNDEF if there is none
+idx_t findSymbolByNameInIndex(ElfIndex* index,ElfInfo* e,char* name);
+
+//the same result as findSymbolContainingAddress
+idx_t findSymbolByAddressInIndex(ElfIndex* index,addr_t addr,byte type,idx_t scnIdx);
+
+#endif
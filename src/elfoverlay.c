@@ -0,0 +1,365 @@
+/*
+  File: elfoverlay.c
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: saving and loading an ELF object as the changes made to
+               another ELF object
+*/
+
+#include "elfoverlay.h"
+#include "elfutil.h"
+#include "elfwriter.h"
+#include "util/logging.h"
+#include "util/file.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+typedef struct
+{
+  char magic[8];
+  uint32 version;
+  uint32 numSections;//not counting the null section
+  uint32 numPhdrs;
+  uint32 buildIdLen;//0 if the base has no build id
+  uint32 basePathLen;//including the terminating nul
+  uint32 pad;
+  uint64_t baseSize;
+  int64_t baseMtime;
+  //followed by a GElf_Ehdr, numPhdrs GElf_Phdr, the build id, the
+  //base path and numSections OverlaySection
+} OverlayHeader;
+
+typedef struct
+{
+  GElf_Shdr shdr;
+  uint32 fromBase;//data is that of the base's section with the same index
+  uint32 dataType;//Elf_Type of the data
+  uint64_t dataLen;//bytes of data following, 0 if fromBase
+} OverlaySection;
+
+//the overlay refers to its base through a file "base" next to
+//itself, so that the base lives as long as it does. The binary a
+//process is running may well have been deleted or replaced on disk
+//since it started, so we go by the file e->overlayBase was actually
+//read from (its descriptor, which /proc/PID/exe still leads to) rather
+//than its name. It's hard linked if it can be, otherwise
+//copied. Returns the name of the pinned base in pinName
+static bool pinOverlayBase(ElfInfo* e,char* pinName)
+{
+  ElfInfo* base=e->overlayBase;
+  char* slash=strrchr(e->fname,'/');
+  int dirLen=slash?slash-e->fname+1:0;
+  char tmpName[PATH_MAX];
+  char fdPath[64];
+  snprintf(pinName,PATH_MAX,"%.*sbase",dirLen,e->fname);
+  snprintf(tmpName,PATH_MAX,"%s.%i",pinName,(int)getpid());
+  snprintf(fdPath,64,"/proc/self/fd/%i",base->fd);
+  unlink(tmpName);
+  //linking fails if the file has been deleted or is on another
+  //file system
+  bool ok=!linkat(AT_FDCWD,fdPath,AT_FDCWD,tmpName,AT_SYMLINK_FOLLOW) ||
+    copyFileFromFd(base->fd,tmpName);
+  if(!ok || rename(tmpName,pinName))
+  {
+    logprintf(ELL_WARN,ELS_ELFWRITE,"Cannot keep a copy of %s as %s: %s\n",base->fname,pinName,strerror(errno));
+    unlink(tmpName);
+    return false;
+  }
+  return true;
+}
+
+bool writeELFOverlay(ElfInfo* e)
+{
+  ElfInfo* base=e->overlayBase;
+  assert(base);
+  OverlayHeader hdr;
+  memset(&hdr,0,sizeof(hdr));
+  memcpy(hdr.magic,ELF_OVERLAY_MAGIC,sizeof(ELF_OVERLAY_MAGIC));
+  hdr.version=ELF_OVERLAY_VERSION;
+
+  //base->fname may well be /proc/PID/exe, which won't be around as
+  //long as the overlay
+  char basePath[PATH_MAX];
+  char pinnedBase[PATH_MAX];
+  if(!pinOverlayBase(e,pinnedBase))
+  {
+    return false;
+  }
+  if(!realpath(pinnedBase,basePath))
+  {
+    logprintf(ELL_WARN,ELS_ELFWRITE,"Cannot resolve the path of %s to write an overlay on it\n",pinnedBase);
+    return false;
+  }
+  hdr.basePathLen=strlen(basePath)+1;
+  struct stat st;
+  if(stat(basePath,&st))
+  {
+    return false;
+  }
+  hdr.baseSize=st.st_size;
+  hdr.baseMtime=st.st_mtime;
+  //an overlay base has the build id of its own base whatever it
+  //changed, so is only known by its size and modification time
+  byte* buildId=base->overlayBase?NULL:getBuildId(base,&hdr.buildIdLen);
+
+  GElf_Ehdr ehdr;
+  if(!gelf_getehdr(e->e,&ehdr))
+  {
+    logprintf(ELL_WARN,ELS_ELFWRITE,"Failed to get ehdr for overlay: %s\n",elf_errmsg(-1));
+    return false;
+  }
+  size_t numScns;
+  elf_getshdrnum(e->e,&numScns);
+  hdr.numSections=numScns?numScns-1:0;
+  hdr.numPhdrs=ehdr.e_phnum;
+
+  if(ftruncate(e->fd,0) || lseek(e->fd,0,SEEK_SET))
+  {
+    logprintf(ELL_WARN,ELS_ELFWRITE,"Cannot truncate overlay file %s\n",e->fname);
+    return false;
+  }
+  bool ok=writeAll(e->fd,&hdr,sizeof(hdr)) && writeAll(e->fd,&ehdr,sizeof(ehdr));
+  for(int i=0;ok && i<ehdr.e_phnum;i++)
+  {
+    GElf_Phdr phdr;
+    gelf_getphdr(e->e,i,&phdr);
+    ok=writeAll(e->fd,&phdr,sizeof(phdr));
+  }
+  ok=ok && writeAll(e->fd,buildId,hdr.buildIdLen) && writeAll(e->fd,basePath,hdr.basePathLen);
+
+  int sharedSections=0;
+  word_t bytesWritten=0;
+  for(Elf_Scn* scn=elf_nextscn(e->e,NULL);ok && scn;scn=elf_nextscn(e->e,scn))
+  {
+    OverlaySection rec;
+    memset(&rec,0,sizeof(rec));
+    gelf_getshdr(scn,&rec.shdr);
+    rec.fromBase=elf_getscn(base->e,elf_ndxscn(scn)) && isScnDataShared(e,scn);
+    Elf_Data* firstData=elf_getdata(scn,NULL);
+    rec.dataType=firstData?firstData->d_type:ELF_T_BYTE;
+    if(!rec.fromBase && SHT_NOBITS!=rec.shdr.sh_type)
+    {
+      for(Elf_Data* data=elf_getdata(scn,NULL);data;data=elf_getdata(scn,data))
+      {
+        rec.dataLen+=data->d_size;
+      }
+    }
+    ok=writeAll(e->fd,&rec,sizeof(rec));
+    if(rec.dataLen)
+    {
+      for(Elf_Data* data=elf_getdata(scn,NULL);ok && data;data=elf_getdata(scn,data))
+      {
+        ok=writeAll(e->fd,data->d_buf,data->d_size);
+      }
+    }
+    sharedSections+=rec.fromBase;
+    bytesWritten+=rec.dataLen;
+  }
+  if(!ok)
+  {
+    logprintf(ELL_WARN,ELS_ELFWRITE,"Failed writing overlay %s: %s\n",e->fname,strerror(errno));
+    return false;
+  }
+  logprintf(ELL_INFO_V1,ELS_ELFWRITE,"wrote overlay %s on %s: %i of %i sections shared, 0x%zx bytes of section data\n",
+            e->fname,basePath,sharedSections,hdr.numSections,(size_t)bytesWritten);
+  return true;
+}
+
+bool isELFOverlay(char* fname)
+{
+  char magic[sizeof(ELF_OVERLAY_MAGIC)];
+  FILE* f=fopen(fname,"r");
+  if(!f)
+  {
+    return false;
+  }
+  bool result=1==fread(magic,sizeof(magic),1,f) && !memcmp(magic,ELF_OVERLAY_MAGIC,sizeof(magic));
+  fclose(f);
+  return result;
+}
+
+//the parts of an overlay file before its sections
+typedef struct
+{
+  OverlayHeader hdr;
+  GElf_Ehdr ehdr;
+  byte* phdrs;
+  byte* buildId;
+  char* basePath;
+  byte* sections;
+} OverlayParts;
+
+static bool splitOverlay(byte* contents,int len,OverlayParts* parts)
+{
+  byte* p=contents;
+  byte* end=contents+len;
+  if(len<sizeof(OverlayHeader))
+  {
+    return false;
+  }
+  OverlayHeader* hdr=&parts->hdr;
+  memcpy(hdr,p,sizeof(OverlayHeader));
+  p+=sizeof(OverlayHeader);
+  if(memcmp(hdr->magic,ELF_OVERLAY_MAGIC,sizeof(ELF_OVERLAY_MAGIC)) || ELF_OVERLAY_VERSION!=hdr->version ||
+     (word_t)(end-p)<sizeof(GElf_Ehdr)+hdr->numPhdrs*sizeof(GElf_Phdr)+hdr->buildIdLen+hdr->basePathLen)
+  {
+    return false;
+  }
+  memcpy(&parts->ehdr,p,sizeof(GElf_Ehdr));
+  p+=sizeof(GElf_Ehdr);
+  parts->phdrs=p;
+  p+=hdr->numPhdrs*sizeof(GElf_Phdr);
+  parts->buildId=p;
+  p+=hdr->buildIdLen;
+  parts->basePath=(char*)p;
+  p+=hdr->basePathLen;
+  parts->sections=p;
+  return hdr->basePathLen && !parts->basePath[hdr->basePathLen-1];
+}
+
+ElfInfo* openELFOverlay(char* fname)
+{
+  int len;
+  byte* contents=(byte*)getFileContents(fname,&len);
+  if(!contents)
+  {
+    return NULL;
+  }
+  OverlayParts parts;
+  if(!splitOverlay(contents,len,&parts))
+  {
+    logprintf(ELL_WARN,ELS_MISC,"%s is not a katana overlay file\n",fname);
+    free(contents);
+    return NULL;
+  }
+  OverlayHeader hdr=parts.hdr;
+  char* basePath=parts.basePath;
+  byte* p=parts.sections;
+  byte* end=contents+len;
+
+  ElfInfo* base=isELFOverlay(basePath)?openELFOverlay(basePath):openELFFile(basePath);
+  if(!base)
+  {
+    logprintf(ELL_WARN,ELS_MISC,"Cannot open %s, which overlay %s is based on\n",basePath,fname);
+    free(contents);
+    return NULL;
+  }
+  uint32 baseBuildIdLen=0;
+  byte* baseBuildId=base->overlayBase?NULL:getBuildId(base,&baseBuildIdLen);
+  struct stat st;
+  bool sameBase=baseBuildIdLen==hdr.buildIdLen;
+  if(sameBase && hdr.buildIdLen)
+  {
+    sameBase=!memcmp(baseBuildId,parts.buildId,hdr.buildIdLen);
+  }
+  else if(sameBase)
+  {
+    sameBase=!stat(basePath,&st) && st.st_size==hdr.baseSize && st.st_mtime==hdr.baseMtime;
+  }
+  if(!sameBase)
+  {
+    logprintf(ELL_WARN,ELS_MISC,"%s has changed since overlay %s was written on it\n",basePath,fname);
+    endELF(base);
+    free(contents);
+    return NULL;
+  }
+
+  //libelf wants a file descriptor even though we never write with it
+  int fd=open(fname,O_RDONLY);
+  Elf* outelf=elf_begin(fd,ELF_C_WRITE,NULL);
+  if(!outelf)
+  {
+    logprintf(ELL_WARN,ELS_MISC,"Cannot create ELF for overlay %s: %s\n",fname,elf_errmsg(-1));
+    close(fd);
+    endELF(base);
+    free(contents);
+    return NULL;
+  }
+  ElfInfo* e=zmalloc(sizeof(ElfInfo));
+  e->arena=arenaCreate(0);
+  e->dataAllocatedByKatana=true;
+  e->fd=fd;
+  e->fname=strdup(fname);
+  e->e=outelf;
+  e->overlayBase=base;
+  e->ownsOverlayBase=true;
+
+  gelf_newehdr(outelf,gelf_getclass(base->e));
+  gelf_update_ehdr(outelf,&parts.ehdr);
+  if(hdr.numPhdrs)
+  {
+    gelf_newphdr(outelf,hdr.numPhdrs);
+    for(int i=0;i<hdr.numPhdrs;i++)
+    {
+      GElf_Phdr phdr;
+      memcpy(&phdr,parts.phdrs+i*sizeof(GElf_Phdr),sizeof(phdr));
+      gelf_update_phdr(outelf,i,&phdr);
+    }
+  }
+  for(int i=0;i<hdr.numSections;i++)
+  {
+    OverlaySection rec;
+    if((word_t)(end-p)<sizeof(rec))
+    {
+      death("Overlay %s is truncated\n",fname);
+    }
+    memcpy(&rec,p,sizeof(rec));
+    p+=sizeof(rec);
+    Elf_Scn* scn=elf_newscn(outelf);
+    gelf_update_shdr(scn,&rec.shdr);
+    if(rec.fromBase)
+    {
+      Elf_Scn* baseScn=elf_getscn(base->e,elf_ndxscn(scn));
+      Elf_Data* baseData=baseScn?elf_getdata(baseScn,NULL):NULL;
+      if(!baseData)
+      {
+        death("Overlay %s refers to section %i of %s which it does not have\n",fname,(int)elf_ndxscn(scn),basePath);
+      }
+      //same as overlayElf does
+      shareScnData(e,scn,baseData);
+      continue;
+    }
+    if((word_t)(end-p)<rec.dataLen)
+    {
+      death("Overlay %s is truncated\n",fname);
+    }
+    Elf_Data* data=elf_newdata(scn);
+    data->d_off=0;
+    data->d_align=rec.shdr.sh_addralign?rec.shdr.sh_addralign:1;
+    data->d_version=EV_CURRENT;
+    data->d_type=rec.dataType;
+    if(SHT_NOBITS==rec.shdr.sh_type)
+    {
+      data->d_size=rec.shdr.sh_size;
+    }
+    else
+    {
+      data->d_size=rec.dataLen;
+      data->d_buf=zmalloc(rec.dataLen);
+      memcpy(data->d_buf,p,rec.dataLen);
+      ownScnData(data,rec.dataLen);
+      p+=rec.dataLen;
+    }
+    //as it was read, like the data of a file libelf reads (see
+    //getELFIndex)
+    elf_flagdata(data,ELF_C_CLR,ELF_F_DIRTY);
+    elf_flagscn(scn,ELF_C_CLR,ELF_F_DIRTY);
+  }
+  free(contents);
+  elf_flagelf(outelf,ELF_C_SET,ELF_F_LAYOUT);
+  findELFSections(e);
+  return e;
+}
@@ -0,0 +1,52 @@
+/*
+  File: elfoverlay.h
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: saving and loading an ELF object as the changes made to
+               another (base) ELF object. An overlay file holds the
+               ELF and program headers, every section header, and the
+               contents of only those sections that are new or whose
+               data is not shared with the base (see overlayElf). The
+               base is kept beside the overlay, hard linked or copied
+               from the file it was read from, since the binary a
+               process runs may be deleted or replaced while it
+               runs. It is identified by its build id, or its size and
+               modification time if it has none (or is itself an
+               overlay).
+               Overlay files are only meant to be read on the machine
+               that wrote them, the headers are stored in host form
+*/
+
+#ifndef elfoverlay_h
+#define elfoverlay_h
+
+#include "elfparse.h"
+
+#define ELF_OVERLAY_MAGIC "KTNOVLY"
+#define ELF_OVERLAY_VERSION 1
+
+//writes e, which must have been made with overlayElf, to its own file
+//(e->fd) as an overlay on e->overlayBase. Returns false on error
+bool writeELFOverlay(ElfInfo* e);
+
+//opens the overlay file fname and the base it refers to, and returns
+//an ElfInfo presenting the two as one object. Ending it also ends the
+//base. Returns NULL if either can't be read or the base has changed
+//since the overlay was written
+ElfInfo* openELFOverlay(char* fname);
+
+//whether fname is an overlay file rather than an ELF object. An
+//overlay's base may itself be an overlay
+bool isELFOverlay(char* fname);
+
+#endif
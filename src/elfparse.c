@@ -60,16 +60,53 @@
 #include <assert.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "util/logging.h"
 #include "fderead.h"
 #include "symbol.h"
+#include "dwarftypes.h"
+#include "elfindex.h"
+#include "elfstream.h"
+#include "util/intern.h"
+#include "elfwriter.h"
 #include "../config.h"
+#include "katana_config.h"
+
+//maps the whole file private and writable, so that anything which
+//writes to section data we hand out only changes our copy. libelf
+//then points section data straight into the mapping rather than
+//copying it (as long as the file has our byte order)
+static Elf* beginMappedELF(ElfInfo* e)
+{
+  struct stat st;
+  if(fstat(e->fd,&st) || st.st_size<=0)
+  {
+    return NULL;
+  }
+  void* map=mmap(NULL,st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,e->fd,0);
+  if(MAP_FAILED==map)
+  {
+    logprintf(ELL_INFO_V1,ELS_MISC,"Could not map %s, reading it instead\n",e->fname);
+    return NULL;
+  }
+  Elf* elf=elf_memory(map,st.st_size);
+  if(!elf)
+  {
+    munmap(map,st.st_size);
+    return NULL;
+  }
+  e->map=map;
+  e->mapSize=st.st_size;
+  return elf;
+}
 
 //the ELF file is always opened read-only. If you want to write a copy
 //to disk, call writeOutElf. 
 ElfInfo* openELFFile(char* fname)
 {
   ElfInfo* e=zmalloc(sizeof(ElfInfo));
+  e->arena=arenaCreate(0);
   e->fname=strdup(fname);
   e->fd=open(fname,O_RDONLY);
   if(e->fd < 0)
@@ -78,10 +115,20 @@ ElfInfo* openELFFile(char* fname)
     return NULL;
 
   }
-  e->e=elf_begin(e->fd,ELF_C_READ,NULL);
+  if(!isFlag(EKCF_NO_MMAP))
+  {
+    e->e=beginMappedELF(e);
+  }
+  if(!e->e)
+  {
+    e->e=elf_begin(e->fd,ELF_C_READ,NULL);
+  }
   if(!e->e)
   {
     logprintf(ELL_WARN,ELS_MISC,"Failed to open file %s as an ELF file %s\n",fname,elf_errmsg(-1));
+    close(e->fd);
+    arenaDelete(e->arena);
+    free(e->fname);
     free(e);
     return NULL;
   }
@@ -106,9 +153,52 @@ ElfInfo* openELFFile(char* fname)
   return e;
 }
 
+void adviseELFSection(ElfInfo* e,Elf_Scn* scn,int advice)
+{
+  if(!e->map)
+  {
+    return;
+  }
+  GElf_Shdr shdr;
+  if(!gelf_getshdr(scn,&shdr) || SHT_NOBITS==shdr.sh_type ||
+     shdr.sh_offset+shdr.sh_size>e->mapSize)
+  {
+    return;
+  }
+  //madvise wants a page aligned start
+  size_t pageSize=sysconf(_SC_PAGE_SIZE);
+  size_t start=shdr.sh_offset & ~(pageSize-1);
+  size_t len=shdr.sh_offset+shdr.sh_size-start;
+  if(len && madvise((char*)e->map+start,len,advice))
+  {
+    logprintf(ELL_INFO_V2,ELS_MISC,"madvise failed for section of %s\n",e->fname);
+  }
+}
+
+static bool isDataAdopted(ElfInfo* e,Elf_Data* data)
+{
+  for(List* li=e->adoptedData;li;li=li->next)
+  {
+    if(li->value==data)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
 void endELF(ElfInfo* e)
 {
   logprintf(ELL_INFO_V2,ELS_CLEANUP,"ending elf %s\n",e->fname);
+  //buffers we've grown or replaced, whoever the object was read or
+  //built by
+  for(Elf_Scn* scn=elf_nextscn(e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
+  {
+    for(Elf_Data* data=elf_getdata(scn,NULL);data;data=elf_getdata(scn,data))
+    {
+      releaseScnData(data);
+    }
+  }
   if(e->dataAllocatedByKatana)
   {
     //since we wrote this elf file we malloc'd all the
@@ -116,34 +206,129 @@ void endELF(ElfInfo* e)
     //so we have to do it ourselves
     for(Elf_Scn* scn=elf_nextscn (e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
     {
-      Elf_Data* data=elf_getdata(scn,NULL);
-      if(data && data->d_buf)
+      for(Elf_Data* data=elf_getdata(scn,NULL);data;data=elf_getdata(scn,data))
       {
-        free(data->d_buf);
+        if(data->d_buf && !isDataAdopted(e,data))
+        {
+          free(data->d_buf);
+        }
       }
     }
   }
+  deleteList(e->adoptedData,NULL);
+  deleteList(e->sharedData,NULL);
+  for(List* li=e->strtabIndices;li;li=li->next)
+  {
+    StrtabIndex* index=li->value;
+    dictDelete(index->offsets,free);
+  }
+  deleteList(e->strtabIndices,free);
+  if(e->dwarfProducer)
+  {
+    Dwarf_Error err;
+    if(DW_DLV_ERROR==dwarf_producer_finish(e->dwarfProducer,&err))
+    {
+      logprintf(ELL_WARN,ELS_CLEANUP,"dwarf_producer_finish failed for %s\n",e->fname);
+    }
+  }
   if(e->dwarfInfo)
   {
+    closeDWARFIndex(e->dwarfInfo);
     freeDwarfInfo(e->dwarfInfo);
   }
-  //todo: this is not correct and leaks, need to a proper destroy function
-  for(int i=0;i<e->callFrameInfo.numFDEs;i++)
+  //the CIEs and FDEs themselves are in the arena, only the rules
+  //evaluated from each CIE's initial instructions are not
+  for(int i=0;i<e->callFrameInfo.numCIEs;i++)
   {
-    free(e->callFrameInfo.fdes[i].instructions);
+    dictDelete(e->callFrameInfo.cies[i].initialRules,free);
   }
-  free(e->callFrameInfo.fdes);
+  if(e->symbolNameIndex)
+  {
+    mapDelete(e->symbolNameIndex,NULL,NULL);
+    releaseInternPool();
+  }
+  closeELFIndex(e->index);
+  arenaDelete(e->arena);
   elf_end(e->e);
+  if(e->map)
+  {
+    //only safe now that libelf is done with it
+    munmap(e->map,e->mapSize);
+  }
   //I think elf_end must call close on the file descriptor
   //close(e->fd);
+  if(e->ownsOverlayBase)
+  {
+    //only now that nothing points at its data any more
+    endELF(e->overlayBase);
+  }
+  free(e->mapFname);
   free(e->fname);
   free(e);
 }
 
 
-//have to pass the name that the elf file will originally get written
-//out to, because of the way elf_begin is set up
-ElfInfo* duplicateElf(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout)
+void shareScnData(ElfInfo* e,Elf_Scn* scn,Elf_Data* data)
+{
+  Elf_Data* newdata=elf_newdata(scn);
+  newdata->d_buf=data->d_buf;
+  newdata->d_off=data->d_off;
+  newdata->d_size=data->d_size;
+  newdata->d_align=data->d_align;
+  newdata->d_version=data->d_version;
+  newdata->d_type=data->d_type;
+  //the ELF as a whole is dirty, so this is still written out if
+  //it is ever written with libelf
+  elf_flagdata(newdata,ELF_C_CLR,ELF_F_DIRTY);
+  elf_flagscn(scn,ELF_C_CLR,ELF_F_DIRTY);
+  List* li=zmalloc(sizeof(List));
+  li->value=newdata;
+  li->next=e->adoptedData;
+  e->adoptedData=li;
+  li=zmalloc(sizeof(List));
+  li->value=newdata;
+  li->next=e->sharedData;
+  e->sharedData=li;
+}
+
+bool isScnDataShared(ElfInfo* e,Elf_Scn* scn)
+{
+  Elf_Data* data=elf_getdata(scn,NULL);
+  if(!data || elf_getdata(scn,data))
+  {
+    //a section that has been added to isn't the base's any more
+    return false;
+  }
+  if((elf_flagscn(scn,ELF_C_SET,0) | elf_flagdata(data,ELF_C_SET,0)) & ELF_F_DIRTY)
+  {
+    return false;
+  }
+  for(List* li=e->sharedData;li;li=li->next)
+  {
+    if(li->value==data)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool isNameIn(char* name,char** names)
+{
+  for(int i=0;names && names[i];i++)
+  {
+    if(!strcmp(name,names[i]))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//if shareAllBut is non-NULL, sections not named in it share e's data
+//instead of copying it
+static ElfInfo* duplicateElfSharing(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout,
+                                    char** shareAllBut)
 {
   int outfd = open(outfname, O_WRONLY|O_CREAT,S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH);
   if (outfd < 0)
@@ -152,6 +337,7 @@ ElfInfo* duplicateElf(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout
     perror("Error code is: ");
     return NULL;
   }
+  ElfInfo* newE=zmalloc(sizeof(ElfInfo));
   //code inspired by ecp in elfutils tests
   Elf *outelf = elf_begin(outfd, ELF_C_WRITE, NULL);
 
@@ -184,9 +370,14 @@ ElfInfo* duplicateElf(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout
     Elf_Scn *newscn = elf_newscn (outelf);
     GElf_Shdr shdr;
     gelf_update_shdr(newscn,gelf_getshdr(scn,&shdr));
-    Elf_Data* newdata=elf_newdata(newscn);
     Elf_Data* data=elf_getdata (scn,NULL);
     assert(data);
+    if(shareAllBut && !isNameIn(elf_strptr(e->e,e->sectionHdrStrTblIdx,shdr.sh_name),shareAllBut))
+    {
+      shareScnData(newE,newscn,data);
+      continue;
+    }
+    Elf_Data* newdata=elf_newdata(newscn);
     newdata->d_off=data->d_off;
     newdata->d_size=data->d_size;
     newdata->d_align=data->d_align;
@@ -196,6 +387,7 @@ ElfInfo* duplicateElf(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout
     {
       newdata->d_buf=zmalloc(newdata->d_size);
       memcpy(newdata->d_buf,data->d_buf,data->d_size);
+      ownScnData(newdata,newdata->d_size);
     }
   }
 
@@ -209,9 +401,12 @@ ElfInfo* duplicateElf(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout
   if (elf_update(outelf, flushToDisk?ELF_C_WRITE:ELF_C_NULL) <0)
   {
     fprintf(stdout,"Failed to write out elf file: %s\n",elf_errmsg (-1));
+    deleteList(newE->adoptedData,NULL);
+    deleteList(newE->sharedData,NULL);
+    free(newE);
     return NULL;
   }
-  ElfInfo* newE=zmalloc(sizeof(ElfInfo));
+  newE->arena=arenaCreate(0);
   newE->dataAllocatedByKatana=true;
   newE->fd=outfd;
   newE->fname=strdup(outfname);
@@ -220,12 +415,48 @@ ElfInfo* duplicateElf(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout
   return newE;
 }
 
+//have to pass the name that the elf file will originally get written
+//out to, because of the way elf_begin is set up
+ElfInfo* duplicateElf(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout)
+{
+  return duplicateElfSharing(e,outfname,flushToDisk,keepLayout,NULL);
+}
+
+ElfInfo* overlayElf(ElfInfo* base,char* outfname,char** ownSections)
+{
+  static char* noSections[]={NULL};
+  ElfInfo* e=duplicateElfSharing(base,outfname,false,true,ownSections?ownSections:noSections);
+  if(e)
+  {
+    e->overlayBase=base;
+  }
+  return e;
+}
+
 //return true on success
 bool writeOutElf(ElfInfo* e,char* outfname,bool keepLayout)
+{
+  //with the layout kept only what has changed needs writing
+  if(keepLayout && streamOutElf(e,outfname))
+  {
+    return true;
+  }
+  return writeOutElfWithLibelf(e,outfname,keepLayout);
+}
+
+bool writeOutElfWithLibelf(ElfInfo* e,char* outfname,bool keepLayout)
 {
   ElfInfo* newE=duplicateElf(e,outfname,true,keepLayout);
   if(newE)
   {
+    //the copies duplicateElf made of the section data
+    for(Elf_Scn* scn=elf_nextscn(newE->e,NULL);scn;scn=elf_nextscn(newE->e,scn))
+    {
+      for(Elf_Data* data=elf_getdata(scn,NULL);data;data=elf_getdata(scn,data))
+      {
+        releaseScnData(data);
+      }
+    }
     elf_end(newE->e);
     //elf_end seems to close the file descriptor
     //close(newE->fd);
@@ -252,12 +483,15 @@ void findELFSections(ElfInfo* e)
     }
     else if(!strcmp(".symtab",name))
     {
+      //symbol lookups jump all over the symbol table
+      adviseELFSection(e,scn,MADV_WILLNEED);
       e->sectionIndices[ERS_SYMTAB]=elf_ndxscn(scn);
       e->symTabCount = shdr.sh_size / shdr.sh_entsize;
       e->strTblIdx=shdr.sh_link;
     }
     else if(!strcmp(".strtab",name))
     {
+      adviseELFSection(e,scn,MADV_WILLNEED);
       e->sectionIndices[ERS_STRTAB]=elf_ndxscn(scn);
       //todo: use this or get sh_link value from .symtab section
       // strTblIdx=elf_ndxscn(scn);
@@ -368,6 +602,10 @@ void findELFSections(ElfInfo* e)
     {
       e->sectionIndices[ERS_EH_FRAME]=elf_ndxscn(scn);
     }
+    else if(!strcmp(".gnu.hash",name))
+    {
+      e->sectionIndices[ERS_GNU_HASH]=elf_ndxscn(scn);
+    }
   }
   //todo: support x86_64 sections ltext, ldata,lrdodata, etc
 }
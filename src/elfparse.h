@@ -64,6 +64,17 @@
 
 #include "callFrameInfo.h"
 
+//index of the strings in one of the string tables of an ELF object
+//we're adding to, so that each distinct string only gets written
+//once (see addStringToStrtab)
+typedef struct
+{
+  size_t scnIdx;//section index of the string table
+  Dictionary* offsets;//maps strings to word_t* offsets in the section
+  bool mergeSuffixes;//a patch object's table: the strings it already
+                     //had are indexed too, and so is every suffix
+} StrtabIndex;
+
 typedef struct ElfInfo
 {
   int symTabCount;
@@ -76,11 +87,40 @@ typedef struct ElfInfo
   int dataStart[2];//in memory and on disk
   int textStart[2];//in memory and on disk
   int fd;//file descriptor for elf file
+  void* map;//the whole file, if openELFFile mapped it. Section data
+            //read through libelf points into it
+  size_t mapSize;
   char* fname;//file name associated with descriptor. Not always set
   DwarfInfo* dwarfInfo;
   CallFrameInfo callFrameInfo;
   bool dataAllocatedByKatana;//used for memory management
+  List* adoptedData;//Elf_Data whose buffers we point at but do not own
+                    //(see adoptScnData), so must not be freed by endELF
+  List* sharedData;//those of adoptedData that point at overlayBase's
+                   //data (see shareScnData)
+  List* strtabIndices;//StrtabIndex for each string table we've added to
+  Dwarf_P_Debug dwarfProducer;//if set, owns the buffers of some of the
+                              //adoptedData and is finished by endELF
   bool isPO;//is this elf object a patch object?
+  struct ElfInfo* overlayBase;//if this is an overlay (see overlayElf)
+                              //the object whose section data it
+                              //shares for sections it hasn't changed
+  bool ownsOverlayBase;//end overlayBase when this is ended
+  struct PatchPlan* plan;//for a patch object being applied, its plan
+                         //for the target if it has one that fits (see
+                         //patchplan.h). Allocated from arena
+  char* mapFname;//for a patch object being applied, a copy of it that
+                 //nothing will change for the target to map its
+                 //sections from (see getPatchCopy). NULL if there is
+                 //none
+  Arena* arena;//for things read out of the file that live as long as
+               //it does (call frame information). Released by endELF
+  Map* symbolNameIndex;//interned symbol name to 1+index of the first
+                       //symbol with that name, see getSymtabIdx
+  Elf_Data* symbolNameIndexData;//symbol table data the index was built from
+  int symbolNameIndexCount;//how many symbols have been indexed
+  struct ElfIndex* index;//sidecar symbol index, see elfindex.h
+  bool indexChecked;//whether we've tried to get index yet
   #ifdef KATANA_X86_64_ARCH
   //set true if text sections use a small code
   //model, requiring any relocations of text, data, rodata, etc
@@ -90,7 +130,14 @@ typedef struct ElfInfo
 } ElfInfo;
 
 
+//opens fname read-only. Unless EKCF_NO_MMAP is set the file is
+//mapped rather than read, so section data costs nothing until it is
+//touched
 ElfInfo* openELFFile(char* fname);
+//tells the kernel how a section of a mapped ELF file is about to be
+//read. advice is one of the MADV_ values. Does nothing if the file
+//wasn't mapped
+void adviseELFSection(ElfInfo* e,Elf_Scn* scn,int advice);
 //called when we are finished using the given ELF file
 //this function does nothing more than cleanup and deallocate resources.
 void endELF(ElfInfo* _e);
@@ -101,12 +148,31 @@ void endELF(ElfInfo* _e);
 //actually write to disk right now
 ElfInfo* duplicateElf(ElfInfo* e,char* outfname,bool flushToDisk,bool keepLayout);
 
+//like duplicateElf with flushToDisk false, but only the sections named
+//in ownSections (NULL terminated) get their own copy of their
+//data. Every other section points at base's data, so must not be
+//written to, and base must outlive the result. Sections added to
+//the result later are its own. See elfoverlay.h for saving only
+//what differs from base
+ElfInfo* overlayElf(ElfInfo* base,char* outfname,char** ownSections);
+
+//makes data, of the section of e->overlayBase with the same index,
+//the data of scn without copying it. The data is left clean, so
+//once anything writes to it (and flags it dirty, as it must) it is
+//no longer considered shared. See isScnDataShared
+void shareScnData(ElfInfo* e,Elf_Scn* scn,Elf_Data* data);
+//whether scn's data is still just what shareScnData gave it
+bool isScnDataShared(ElfInfo* e,Elf_Scn* scn);
+
 //write out a copy of this ELF object to the given location on disk.
 //if keepLayout is true, don't allow libelf to rearrange the
 //layout. ELF files seem to get screwed up sometimes when libelf is
 //allowed a free reign. I don't quite understand why.
 //return true on success
 bool writeOutElf(ElfInfo* e,char* outfname,bool keepLayout);
+//like writeOutElf, but libelf always writes the whole file, never
+//just what has changed (see streamOutElf)
+bool writeOutElfWithLibelf(ElfInfo* e,char* outfname,bool keepLayout);
 void findELFSections(ElfInfo* e);
 
 
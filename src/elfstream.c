@@ -0,0 +1,391 @@
+/*
+  File: elfstream.c
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: writing ELF objects out by copying the unchanged parts
+               of the file they were read from
+*/
+
+#include "elfstream.h"
+#include "elfutil.h"
+#include "util/logging.h"
+#include "util/vector.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+
+//a range of the output file
+typedef struct
+{
+  word_t offset;
+  word_t size;
+  byte* buf;//what to write there, in file form. NULL for zeros
+  bool fromInput;//the range is left as it is in the input file. Only
+                 //used to check that nothing written overlaps it
+} WriteExtent;
+
+VECTOR_DEFINE(WriteExtentVec,WriteExtent)
+
+static int cmpExtents(const void* a,const void* b)
+{
+  const WriteExtent* x=a;
+  const WriteExtent* y=b;
+  if(x->offset!=y->offset)
+  {
+    return x->offset<y->offset?-1:1;
+  }
+  return 0;
+}
+
+static void addExtent(WriteExtentVec* extents,word_t offset,word_t size,byte* buf,bool fromInput)
+{
+  if(!size)
+  {
+    free(buf);
+    return;
+  }
+  WriteExtent* x=WriteExtentVecPush(extents);
+  x->offset=offset;
+  x->size=size;
+  x->buf=buf;
+  x->fromInput=fromInput;
+}
+
+//returns a malloced copy of buf translated from memory form to file
+//form, NULL on failure
+static byte* toFileForm(Elf* elf,void* buf,size_t size,Elf_Type type,unsigned int encoding)
+{
+  Elf_Data src;
+  memset(&src,0,sizeof(src));
+  src.d_buf=buf;
+  src.d_size=size;
+  src.d_type=type;
+  src.d_version=EV_CURRENT;
+  Elf_Data dst=src;
+  dst.d_buf=zmalloc(size);
+  if(!gelf_xlatetof(elf,&dst,&src,encoding))
+  {
+    logprintf(ELL_WARN,ELS_ELFWRITE,"Failed to translate data to file form: %s\n",elf_errmsg(-1));
+    free(dst.d_buf);
+    return NULL;
+  }
+  return dst.d_buf;
+}
+
+//works out what has to be written where. Returns false if e can't be
+//streamed out over orig, the file it was read from
+static bool planExtents(ElfInfo* e,Elf* orig,WriteExtentVec* extents)
+{
+  ElfXX_Ehdr* ehdr=elfxx_getehdr(e->e);
+  ElfXX_Ehdr* origEhdr=elfxx_getehdr(orig);
+  size_t numScns;
+  size_t origNumScns;
+  if(!ehdr || !origEhdr || elf_getshdrnum(e->e,&numScns) ||
+     elf_getshdrnum(orig,&origNumScns) || numScns!=origNumScns ||
+     ehdr->e_shoff!=origEhdr->e_shoff || ehdr->e_phoff!=origEhdr->e_phoff ||
+     ehdr->e_phnum!=origEhdr->e_phnum)
+  {
+    logprintf(ELL_INFO_V2,ELS_ELFWRITE,"Headers of %s have moved, cannot stream it out\n",e->fname);
+    return false;
+  }
+  unsigned int encoding=ehdr->e_ident[EI_DATA];
+
+  //copied so sizes can be brought up to date with the data without
+  //touching e
+  ElfXX_Shdr* shdrs=zmalloc(sizeof(ElfXX_Shdr)*(numScns+1));
+  bool ok=true;
+  for(int i=0;ok && i<numScns;i++)
+  {
+    Elf_Scn* scn=elf_getscn(e->e,i);
+    ElfXX_Shdr* shdr=scn?elfxx_getshdr(scn):NULL;
+    Elf_Scn* origScn=elf_getscn(orig,i);
+    ElfXX_Shdr* origShdr=origScn?elfxx_getshdr(origScn):NULL;
+    if(!shdr || !origShdr || shdr->sh_type!=origShdr->sh_type ||
+       shdr->sh_offset!=origShdr->sh_offset)
+    {
+      logprintf(ELL_INFO_V2,ELS_ELFWRITE,"Section %i of %s has changed type or moved, cannot stream it out\n",i,e->fname);
+      ok=false;
+      break;
+    }
+    shdrs[i]=*shdr;
+    if(!i || SHT_NOBITS==shdr->sh_type)
+    {
+      continue;
+    }
+    Elf_Data* data=elf_getdata(scn,NULL);
+    bool dirty=data && ((elf_flagscn(scn,ELF_C_SET,0) | elf_flagdata(data,ELF_C_SET,0)) & ELF_F_DIRTY);
+    if(data && elf_getdata(scn,data))
+    {
+      //only libelf knows how it would lay out several pieces of data
+      logprintf(ELL_INFO_V2,ELS_ELFWRITE,"Section %i of %s has several data, cannot stream it out\n",i,e->fname);
+      ok=false;
+      break;
+    }
+    if(!dirty)
+    {
+      if(shdr->sh_size!=origShdr->sh_size)
+      {
+        ok=false;
+        break;
+      }
+      addExtent(extents,origShdr->sh_offset,origShdr->sh_size,NULL,true);
+      continue;
+    }
+    shdrs[i].sh_size=data->d_size;
+    if(data->d_size)
+    {
+      byte* buf=toFileForm(e->e,data->d_buf,data->d_size,data->d_type,encoding);
+      if(!buf)
+      {
+        ok=false;
+        break;
+      }
+      addExtent(extents,shdr->sh_offset,data->d_size,buf,false);
+    }
+    //libelf would fill whatever the section no longer covers
+    if(data->d_size<origShdr->sh_size)
+    {
+      addExtent(extents,shdr->sh_offset+data->d_size,origShdr->sh_size-data->d_size,NULL,false);
+    }
+  }
+
+  //the headers are small, always write them
+  if(ok)
+  {
+    byte* buf=toFileForm(e->e,ehdr,sizeof(ElfXX_Ehdr),ELF_T_EHDR,encoding);
+    ok=NULL!=buf;
+    addExtent(extents,0,sizeof(ElfXX_Ehdr),buf,false);
+  }
+  if(ok && ehdr->e_phnum)
+  {
+    ElfXX_Phdr* phdrs=elfxx_getphdr(e->e);
+    byte* buf=phdrs?toFileForm(e->e,phdrs,sizeof(ElfXX_Phdr)*ehdr->e_phnum,ELF_T_PHDR,encoding):NULL;
+    ok=NULL!=buf;
+    addExtent(extents,ehdr->e_phoff,sizeof(ElfXX_Phdr)*ehdr->e_phnum,buf,false);
+  }
+  if(ok && numScns)
+  {
+    byte* buf=toFileForm(e->e,shdrs,sizeof(ElfXX_Shdr)*numScns,ELF_T_SHDR,encoding);
+    ok=NULL!=buf;
+    addExtent(extents,ehdr->e_shoff,sizeof(ElfXX_Shdr)*numScns,buf,false);
+  }
+  free(shdrs);
+  if(!ok)
+  {
+    return false;
+  }
+
+  //nothing we write may overlap anything else. Sections left alone
+  //may overlap each other if they did in the input
+  WriteExtentVecSort(extents,cmpExtents);
+  word_t end=0;
+  word_t writtenEnd=0;
+  for(int i=0;i<extents->len;i++)
+  {
+    WriteExtent* x=&extents->data[i];
+    if(x->offset<writtenEnd || (!x->fromInput && x->offset<end))
+    {
+      logprintf(ELL_INFO_V2,ELS_ELFWRITE,"Changed data in %s no longer fits where it was, cannot stream it out\n",e->fname);
+      return false;
+    }
+    if(x->offset+x->size>end)
+    {
+      end=x->offset+x->size;
+    }
+    if(!x->fromInput)
+    {
+      writtenEnd=x->offset+x->size;
+    }
+  }
+  return true;
+}
+
+static bool pwriteAll(int fd,byte* buf,size_t len,word_t offset)
+{
+  while(len)
+  {
+    ssize_t written=pwrite(fd,buf,len,offset);
+    if(written<0)
+    {
+      if(EINTR==errno)
+      {
+        continue;
+      }
+      return false;
+    }
+    buf+=written;
+    len-=written;
+    offset+=written;
+  }
+  return true;
+}
+
+static bool writeZeros(int fd,word_t offset,word_t len)
+{
+  static byte zeros[4096];
+  while(len)
+  {
+    size_t chunk=len<sizeof(zeros)?len:sizeof(zeros);
+    if(!pwriteAll(fd,zeros,chunk,offset))
+    {
+      return false;
+    }
+    offset+=chunk;
+    len-=chunk;
+  }
+  return true;
+}
+
+//copies len bytes at offset in infd to the same offset in outfd,
+//within the kernel if it will let us
+static bool copyRange(int infd,int outfd,word_t offset,word_t len)
+{
+  #ifdef SYS_copy_file_range
+  int64_t inOffset=offset;
+  int64_t outOffset=offset;
+  while(len)
+  {
+    ssize_t copied=syscall(SYS_copy_file_range,infd,&inOffset,outfd,&outOffset,len,0);
+    if(copied<0 && EINTR==errno)
+    {
+      continue;
+    }
+    if(copied<=0)
+    {
+      //not supported between these files, copy the rest ourselves
+      break;
+    }
+    len-=copied;
+  }
+  offset=inOffset;
+  #endif
+  byte buf[65536];
+  while(len)
+  {
+    ssize_t got=pread(infd,buf,len<sizeof(buf)?len:sizeof(buf),offset);
+    if(got<0 && EINTR==errno)
+    {
+      continue;
+    }
+    if(got<=0 || !pwriteAll(outfd,buf,got,offset))
+    {
+      return false;
+    }
+    offset+=got;
+    len-=got;
+  }
+  return true;
+}
+
+static bool writeExtents(ElfInfo* e,int outfd,word_t inSize,WriteExtentVec* extents)
+{
+  //a reflink shares all the input's blocks, and the writes below
+  //only unshare the ones they touch
+  #ifdef FICLONE
+  bool cloned=!ioctl(outfd,FICLONE,e->fd);
+  #else
+  bool cloned=false;
+  #endif
+  word_t pos=0;
+  word_t written=0;
+  for(int i=0;i<extents->len;i++)
+  {
+    WriteExtent* x=&extents->data[i];
+    if(x->fromInput)
+    {
+      continue;
+    }
+    if(!cloned && pos<x->offset && pos<inSize)
+    {
+      word_t copyEnd=x->offset<inSize?x->offset:inSize;
+      if(!copyRange(e->fd,outfd,pos,copyEnd-pos))
+      {
+        return false;
+      }
+    }
+    if(!(x->buf?pwriteAll(outfd,x->buf,x->size,x->offset):writeZeros(outfd,x->offset,x->size)))
+    {
+      return false;
+    }
+    written+=x->size;
+    pos=x->offset+x->size;
+  }
+  if(!cloned && pos<inSize && !copyRange(e->fd,outfd,pos,inSize-pos))
+  {
+    return false;
+  }
+  logprintf(ELL_INFO_V1,ELS_ELFWRITE,"Wrote %lu bytes of %s, %s the rest\n",(unsigned long)written,
+            e->fname,cloned?"shared":"copied");
+  return true;
+}
+
+bool streamOutElf(ElfInfo* e,char* outfname)
+{
+  if(!e->map || e->overlayBase || ELFCLASSXX!=gelf_getclass(e->e))
+  {
+    return false;
+  }
+  struct stat inSt;
+  struct stat outSt;
+  if(fstat(e->fd,&inSt))
+  {
+    return false;
+  }
+  //the output is truncated before anything is copied from the input
+  if(!stat(outfname,&outSt) && outSt.st_dev==inSt.st_dev && outSt.st_ino==inSt.st_ino)
+  {
+    return false;
+  }
+  //e's headers and data may have been changed in place, so the
+  //original layout has to come from the file itself
+  Elf* orig=elf_begin(e->fd,ELF_C_READ_MMAP,NULL);
+  if(!orig)
+  {
+    return false;
+  }
+  WriteExtentVec extents={0};
+  bool ok=planExtents(e,orig,&extents);
+  elf_end(orig);
+  if(ok)
+  {
+    int outfd=open(outfname,O_WRONLY|O_CREAT|O_TRUNC,S_IRWXU|S_IRWXG|S_IROTH|S_IXOTH);
+    if(outfd<0)
+    {
+      logprintf(ELL_WARN,ELS_ELFWRITE,"cannot open output file '%s' for writing\n",outfname);
+      ok=false;
+    }
+    else
+    {
+      ok=writeExtents(e,outfd,inSt.st_size,&extents);
+      if(!ok)
+      {
+        logprintf(ELL_WARN,ELS_ELFWRITE,"Failed writing %s, will write it the slow way\n",outfname);
+        if(ftruncate(outfd,0))
+        {
+          logprintf(ELL_WARN,ELS_ELFWRITE,"Cannot truncate %s\n",outfname);
+        }
+      }
+      close(outfd);
+    }
+  }
+  for(int i=0;i<extents.len;i++)
+  {
+    free(extents.data[i].buf);
+  }
+  WriteExtentVecFree(&extents);
+  return ok;
+}
@@ -0,0 +1,37 @@
+/*
+  File: elfstream.h
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: writing an ELF object back out with the layout of the
+               file it was read from. Rather than having libelf
+               rebuild the whole file, the output is a copy of the
+               input (a reflink, or copy_file_range, so the kernel
+               does the copying) with only the headers and the
+               sections that have changed written over it. Rewriting
+               .eh_frame in a huge binary then costs I/O proportional
+               to .eh_frame rather than to the binary
+*/
+
+#ifndef elfstream_h
+#define elfstream_h
+
+#include "elfparse.h"
+
+//writes e to outfname as described above. Returns false without
+//writing anything if e can't be written this way: it wasn't mapped
+//from a file, sections have been added or removed or moved, a
+//section grew into whatever followed it, or it is of the other width
+//from katana. writeOutElf then falls back on libelf
+bool streamOutElf(ElfInfo* e,char* outfname);
+
+#endif
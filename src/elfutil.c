@@ -191,17 +191,28 @@ void getShdrByERS(ElfInfo* e,E_RECOGNIZED_SECTION ers,GElf_Shdr* shdr)
   }
 }
 
+//sh_name of scn, read in place when we can
+static int getScnNameIdx(ElfInfo* e,Elf_Scn* scn)
+{
+  ElfXX_Shdr* nativeShdr=getNativeShdr(e,scn);
+  if(nativeShdr)
+  {
+    return nativeShdr->sh_name;
+  }
+  GElf_Shdr shdr;
+  if(!gelf_getshdr(scn,&shdr))
+  {
+    death("cannot get shdr\n");
+  }
+  return shdr.sh_name;
+}
+
 Elf_Scn* getSectionByName(ElfInfo* e,char* name)
 {
   assert(e->sectionHdrStrTblIdx);
   for(Elf_Scn* scn=elf_nextscn (e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
   {
-    GElf_Shdr shdr;
-    if(!gelf_getshdr(scn,&shdr))
-    {
-      death("cannot get shdr\n");
-    }
-    char* scnName=getScnHdrString(e,shdr.sh_name);
+    char* scnName=getScnHdrString(e,getScnNameIdx(e,scn));
     if(!strcmp(name,scnName))
     {
       return scn;
@@ -210,6 +221,22 @@ Elf_Scn* getSectionByName(ElfInfo* e,char* name)
   return NULL;
 }
 
+//a patched binary gets one .text.new (etc.) for each patch applied
+//in a series, and the last one belongs to the patch being applied
+Elf_Scn* getLastSectionByName(ElfInfo* e,char* name)
+{
+  assert(e->sectionHdrStrTblIdx);
+  Elf_Scn* result=NULL;
+  for(Elf_Scn* scn=elf_nextscn (e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
+  {
+    if(!strcmp(name,getScnHdrString(e,getScnNameIdx(e,scn))))
+    {
+      result=scn;
+    }
+  }
+  return result;
+}
+
 char* getSectionNameFromIdx(ElfInfo* e,int idx)
 {
   Elf_Scn* scn=elf_getscn(e->e,idx);
@@ -350,3 +377,114 @@ SectionHeaderData gshdrToSectionHeaderData(ElfInfo* e,GElf_Shdr shdr)
   shd.sh_entsize=shdr.sh_entsize; 
   return shd;
 }
+
+byte* getBuildId(ElfInfo* e,uint32* len)
+{
+  for(Elf_Scn* scn=elf_nextscn(e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
+  {
+    GElf_Shdr shdr;
+    if(!gelf_getshdr(scn,&shdr) || SHT_NOTE!=shdr.sh_type)
+    {
+      continue;
+    }
+    Elf_Data* data=elf_getdata(scn,NULL);
+    size_t offset=0;
+    GElf_Nhdr nhdr;
+    size_t nameOffset,descOffset;
+    while(data && (offset=gelf_getnote(data,offset,&nhdr,&nameOffset,&descOffset))>0)
+    {
+      if(NT_GNU_BUILD_ID==nhdr.n_type && 4==nhdr.n_namesz &&
+         !memcmp((byte*)data->d_buf+nameOffset,"GNU",4))
+      {
+        *len=nhdr.n_descsz;
+        return (byte*)data->d_buf+descOffset;
+      }
+    }
+  }
+  *len=0;
+  return NULL;
+}
+
+ElfXX_Sym* getNativeSymbols(ElfInfo* e,Elf_Data* symTabData)
+{
+  if(ELFCLASSXX!=gelf_getclass(e->e) || ELF_T_SYM!=symTabData->d_type)
+  {
+    return NULL;
+  }
+  return symTabData->d_buf;
+}
+
+ElfXX_Rela* getNativeRelas(ElfInfo* e,Elf_Data* data)
+{
+  if(ELFCLASSXX!=gelf_getclass(e->e) || ELF_T_RELA!=data->d_type)
+  {
+    return NULL;
+  }
+  return data->d_buf;
+}
+
+ElfXX_Rel* getNativeRels(ElfInfo* e,Elf_Data* data)
+{
+  if(ELFCLASSXX!=gelf_getclass(e->e) || ELF_T_REL!=data->d_type)
+  {
+    return NULL;
+  }
+  return data->d_buf;
+}
+
+ElfXX_Shdr* getNativeShdr(ElfInfo* e,Elf_Scn* scn)
+{
+  if(ELFCLASSXX!=gelf_getclass(e->e))
+  {
+    return NULL;
+  }
+  return elfxx_getshdr(scn);
+}
+
+ElfXX_Sym* getSymbolInTable(ElfXX_Sym* syms,Elf_Data* data,int i,ElfXX_Sym* buf)
+{
+  if(syms)
+  {
+    return &syms[i];
+  }
+  GElf_Sym sym;
+  if(!gelf_getsym(data,i,&sym))
+  {
+    death("gelf_getsym failed\n");
+  }
+  *buf=gelfSymToNativeSym(sym);
+  return buf;
+}
+
+ElfXX_Rela* getRelaInTable(ElfXX_Rela* relas,Elf_Data* data,int i,ElfXX_Rela* buf)
+{
+  if(relas)
+  {
+    return &relas[i];
+  }
+  GElf_Rela rela;
+  if(!gelf_getrela(data,i,&rela))
+  {
+    death("gelf_getrela failed\n");
+  }
+  buf->r_offset=rela.r_offset;
+  buf->r_info=ELFXX_R_INFO(ELF64_R_SYM(rela.r_info),ELF64_R_TYPE(rela.r_info));
+  buf->r_addend=rela.r_addend;
+  return buf;
+}
+
+ElfXX_Rel* getRelInTable(ElfXX_Rel* rels,Elf_Data* data,int i,ElfXX_Rel* buf)
+{
+  if(rels)
+  {
+    return &rels[i];
+  }
+  GElf_Rel rel;
+  if(!gelf_getrel(data,i,&rel))
+  {
+    death("gelf_getrel failed\n");
+  }
+  buf->r_offset=rel.r_offset;
+  buf->r_info=ELFXX_R_INFO(ELF64_R_SYM(rel.r_info),ELF64_R_TYPE(rel.r_info));
+  return buf;
+}
@@ -59,6 +59,7 @@
 #include <libelf.h>
 #include <gelf.h>
 #include "types.h"
+#include "arch.h"
 
 struct ElfInfo;
 typedef struct ElfInfo ElfInfo;
@@ -89,6 +90,7 @@ typedef enum
   ERS_UNSAFE_FUNCTIONS,
   ERS_DEBUG_INFO,
   ERS_EH_FRAME,
+  ERS_GNU_HASH,
   ERS_CNT,
   ERS_INVALID
 } E_RECOGNIZED_SECTION;
@@ -128,6 +130,8 @@ word_t getTextAtRelOffset(ElfInfo* e,int offset);
 //methods for getting whole sections or data blocks
 //returns NULL if the section does not exist
 Elf_Scn* getSectionByName(ElfInfo* e,char* name);
+//like getSectionByName but finds the last section with the name
+Elf_Scn* getLastSectionByName(ElfInfo* e,char* name);
 Elf_Scn* getSectionByERS(ElfInfo* e,E_RECOGNIZED_SECTION ers);
 Elf_Data* getDataByIdx(ElfInfo* e,idx_t idx);
 Elf_Data* getDataByERS(ElfInfo* e,E_RECOGNIZED_SECTION scn);
@@ -152,6 +156,28 @@ bool hasERS(ElfInfo* e,E_RECOGNIZED_SECTION ers);
 //the returned string should be freed
 char* getFunctionNameAtPC(ElfInfo* elf,addr_t pc);
 void printSymTab(ElfInfo* e);
+//the contents of the GNU build id note, NULL if there is none. The
+//length is written to len
+byte* getBuildId(ElfInfo* e,uint32* len);
+
+//////////////////////////////////////////
+//native table access
+//When a file is of the width katana was built for, libelf gives us
+//symbol and relocation tables already laid out as arrays of ElfXX
+//structures. These return those arrays so hot loops can read entries
+//in place instead of converting each one to GElf. They return NULL
+//for files of the other width
+ElfXX_Sym* getNativeSymbols(ElfInfo* e,Elf_Data* symTabData);
+ElfXX_Rela* getNativeRelas(ElfInfo* e,Elf_Data* data);
+ElfXX_Rel* getNativeRels(ElfInfo* e,Elf_Data* data);
+//the section header itself, NULL for files of the other width
+ElfXX_Shdr* getNativeShdr(ElfInfo* e,Elf_Scn* scn);
+//entry i of a table. Points into syms/relas if it is a table returned
+//by the functions above, otherwise entry i of data is converted
+//through gelf into buf
+ElfXX_Sym* getSymbolInTable(ElfXX_Sym* syms,Elf_Data* data,int i,ElfXX_Sym* buf);
+ElfXX_Rela* getRelaInTable(ElfXX_Rela* relas,Elf_Data* data,int i,ElfXX_Rela* buf);
+ElfXX_Rel* getRelInTable(ElfXX_Rel* rels,Elf_Data* data,int i,ElfXX_Rel* buf);
 
 
 #endif
@@ -59,6 +59,7 @@
 #include <util/logging.h>
 #include "constants.h"
 #include "elfutil.h"
+#include "util/hash.h"
 
 
 //global because libdwarf gives us no way of passing data into
@@ -79,23 +80,154 @@ static ScnInProgress scnInfo[ERS_CNT];
 
 
 
+//smallest buffer we bother allocating for a section we're appending
+//to. Keeps the many tiny appends to a fresh section from reallocing
+//on every call
+#define MIN_SCN_ALLOCATION 256
+
+//section buffers that we malloc'd ourselves, mapping the Elf_Data to
+//an OwnedScnBuffer. Only these may be realloc'd: the buffer of
+//data read by libelf belongs to libelf or points into the mapped
+//file, and shared or adopted data belongs to somebody else
+typedef struct
+{
+  void* buf;
+  size_t allocated;
+} OwnedScnBuffer;
+static Map* ownedScnBuffers=NULL;
+
+static unsigned long ptrHash(void* ptr)
+{
+  return hashSizeT((size_t)ptr);
+}
+
+static int ptrCmp(void* a,void* b)
+{
+  return a==b?0:((size_t)a<(size_t)b?-1:1);
+}
+
+//the record of our buffer for dataDest, NULL if d_buf isn't one of ours
+static OwnedScnBuffer* getOwnedScnBuffer(Elf_Data* dataDest)
+{
+  OwnedScnBuffer* owned=ownedScnBuffers?mapGet(ownedScnBuffers,dataDest):NULL;
+  if(owned && owned->buf!=dataDest->d_buf)
+  {
+    //somebody else has swapped out d_buf, whatever it is now isn't ours
+    mapRemove(ownedScnBuffers,dataDest,free,NULL);
+    owned=NULL;
+  }
+  return owned;
+}
+
+void ownScnData(Elf_Data* data,size_t allocated)
+{
+  if(!ownedScnBuffers)
+  {
+    ownedScnBuffers=mapCreate(256,ptrHash,ptrCmp);
+  }
+  OwnedScnBuffer* owned=zmalloc(sizeof(OwnedScnBuffer));
+  owned->buf=data->d_buf;
+  owned->allocated=allocated;
+  mapSet(ownedScnBuffers,data,owned,free,NULL);
+}
+
+bool releaseScnData(Elf_Data* data)
+{
+  OwnedScnBuffer* owned=getOwnedScnBuffer(data);
+  if(!owned)
+  {
+    return false;
+  }
+  free(data->d_buf);
+  data->d_buf=NULL;
+  mapRemove(ownedScnBuffers,data,free,NULL);
+  return true;
+}
+
+//make sure dataDest->d_buf has room for at least size bytes. The
+//buffer is grown geometrically so that a series of appends is
+//amortized O(1) rather than reallocing to the exact new size every
+//time (which made building .text.new, .strtab, .symtab etc
+//quadratic). A buffer that isn't one of ours is copied into one that
+//is the first time it has to grow, rather than realloc'd
+static void reserveScnData(Elf_Data* dataDest,size_t size)
+{
+  OwnedScnBuffer* owned=getOwnedScnBuffer(dataDest);
+  size_t allocated=owned?owned->allocated:0;
+  if(owned && size<=allocated)
+  {
+    return;
+  }
+  size_t newAllocated=max(allocated*2,MIN_SCN_ALLOCATION);
+  while(newAllocated<size)
+  {
+    newAllocated*=2;
+  }
+  if(owned)
+  {
+    dataDest->d_buf=realloc(dataDest->d_buf,newAllocated);
+    MALLOC_CHECK(dataDest->d_buf);
+    owned->buf=dataDest->d_buf;
+    owned->allocated=newAllocated;
+    return;
+  }
+  void* buf=malloc(newAllocated);
+  MALLOC_CHECK(buf);
+  if(dataDest->d_buf && dataDest->d_size)
+  {
+    memcpy(buf,dataDest->d_buf,dataDest->d_size);
+  }
+  dataDest->d_buf=buf;
+  ownScnData(dataDest,newAllocated);
+}
+
 //returns the offset into the section that the data was added at
 addr_t addDataToScn(Elf_Data* dataDest, const void* data,int size)
 {
-  dataDest->d_buf=realloc(dataDest->d_buf,dataDest->d_size+size);
-  MALLOC_CHECK(dataDest->d_buf);
+  reserveScnData(dataDest,dataDest->d_size+size);
   memcpy((byte*)dataDest->d_buf+dataDest->d_size,data,size);
   dataDest->d_size=dataDest->d_size+size;
   elf_flagdata(dataDest,ELF_C_SET,ELF_F_DIRTY);
   return dataDest->d_size-size;
 }
 
+//appends buf to the end of scn as a new Elf_Data in the section's
+//data chain, without copying it. e does not take ownership of buf,
+//whoever does own it must keep it alive until e has been ended (see
+//ElfInfo.dwarfProducer). Returns the offset into the section that
+//the data was added at
+addr_t adoptScnData(ElfInfo* e,Elf_Scn* scn,void* buf,size_t size)
+{
+  addr_t offset=0;
+  for(Elf_Data* data=elf_getdata(scn,NULL);data;data=elf_getdata(scn,data))
+  {
+    offset+=data->d_size;
+  }
+  Elf_Data* data=elf_newdata(scn);
+  data->d_buf=buf;
+  data->d_size=size;
+  data->d_off=offset;
+  data->d_align=1;
+  data->d_type=ELF_T_BYTE;
+  data->d_version=EV_CURRENT;
+  elf_flagdata(data,ELF_C_SET,ELF_F_DIRTY);
+  List* li=zmalloc(sizeof(List));
+  li->value=data;
+  li->next=e->adoptedData;
+  e->adoptedData=li;
+  return offset;
+}
+
 //wipes out the existing information in dataDest and replaces it with data
 void replaceScnData(Elf_Data* dataDest,void* data,int size)
 {
-  dataDest->d_buf=malloc(size);
-  MALLOC_CHECK(dataDest->d_buf);
-  memcpy((byte*)dataDest->d_buf,data,size);
+  void* buf=malloc(size);
+  MALLOC_CHECK(buf);
+  memcpy(buf,data,size);
+  //data may well have come from the old buffer
+  releaseScnData(dataDest);
+  dataDest->d_buf=buf;
+  ownScnData(dataDest,size);
   dataDest->d_size=size;
   elf_flagdata(dataDest,ELF_C_SET,ELF_F_DIRTY);
 }
@@ -107,8 +239,7 @@ void modifyScnData(Elf_Data* dataDest,word_t offset,void* data,int size)
 {
   if(offset+size > dataDest->d_size)
   {
-    dataDest->d_buf=realloc(dataDest->d_buf,offset+size);
-    MALLOC_CHECK(dataDest->d_buf);
+    reserveScnData(dataDest,offset+size);
     //zero out the data we just added that we won't fill
     if(offset > dataDest->d_size)
     {
@@ -120,26 +251,95 @@ void modifyScnData(Elf_Data* dataDest,word_t offset,void* data,int size)
   elf_flagdata(dataDest,ELF_C_SET,ELF_F_DIRTY);
 }
 
+//number of buckets in a string table index. Patches have a few
+//hundred names, and we add fewer than that to a binary
+#define STRTAB_INDEX_BUCKETS 256
+
+static void indexStrtabString(StrtabIndex* index,const char* str,word_t offset)
+{
+  int len=strlen(str);
+  //with suffix merging every tail of str can be referred to as well,
+  //as linkers do for SHF_MERGE|SHF_STRINGS sections
+  int lastSuffix=index->mergeSuffixes?len:0;
+  for(int i=0;i<=lastSuffix;i++)
+  {
+    if(dictExists(index->offsets,(char*)str+i))
+    {
+      //the first copy of a string wins
+      continue;
+    }
+    word_t* offsetCopy=zmalloc(sizeof(word_t));
+    *offsetCopy=offset+i;
+    dictInsert(index->offsets,(char*)str+i,offsetCopy);
+  }
+}
+
+//patch objects are small and their string tables almost all katana's
+//own, so what is already in them is indexed as well, suffixes
+//included. The string tables of the binaries we patch can be large,
+//and indexing them would mean copying every name in them into the
+//dictionary, so there only the strings we add are deduplicated
+static StrtabIndex* getStrtabIndex(ElfInfo* e,size_t scnIdx,Elf_Data* data)
+{
+  for(List* li=e->strtabIndices;li;li=li->next)
+  {
+    if(((StrtabIndex*)li->value)->scnIdx==scnIdx)
+    {
+      return li->value;
+    }
+  }
+  StrtabIndex* index=zmalloc(sizeof(StrtabIndex));
+  index->scnIdx=scnIdx;
+  index->offsets=dictCreate(STRTAB_INDEX_BUCKETS);
+  index->mergeSuffixes=e->isPO;
+  for(word_t off=0;index->mergeSuffixes && off<data->d_size;)
+  {
+    char* scnStr=(char*)data->d_buf+off;
+    int len=strnlen(scnStr,data->d_size-off);
+    if(off+len==data->d_size)
+    {
+      //unterminated string at the end of the table, can't index it
+      break;
+    }
+    indexStrtabString(index,scnStr,off);
+    off+=len+1;
+  }
+  List* li=zmalloc(sizeof(List));
+  li->value=index;
+  li->next=e->strtabIndices;
+  e->strtabIndices=li;
+  return index;
+}
+
+//returns the offset of str in the string table in section scnIdx,
+//only adding it to the table if it isn't already there
+int addStringToStrtab(ElfInfo* e,size_t scnIdx,const char* str)
+{
+  Elf_Scn* scn=elf_getscn(e->e,scnIdx);
+  assert(scn);
+  Elf_Data* data=elf_getdata(scn,NULL);
+  StrtabIndex* index=getStrtabIndex(e,scnIdx,data);
+  word_t* offset=dictGet(index->offsets,(char*)str);
+  if(offset)
+  {
+    return *offset;
+  }
+  int len=strlen(str)+1;
+  addr_t newOffset=addDataToScn(data,str,len);
+  indexStrtabString(index,str,newOffset);
+  return newOffset;
+}
+
 //adds an entry to the string table, return its offset
 int addStrtabEntry(ElfInfo* e, const char* str)
 {
-  Elf_Data* strtab_data=getDataByERS(e,ERS_STRTAB);
-  int len=strlen(str)+1;
-  addDataToScn(strtab_data,str,len);
-  elf_flagdata(strtab_data,ELF_C_SET,ELF_F_DIRTY);
-  return strtab_data->d_size-len;
+  return addStringToStrtab(e,e->sectionIndices[ERS_STRTAB],str);
 }
 
 //adds an entry to the section header string table, return its offset
 int addShdrStrtabEntry(ElfInfo* e,char* str)
 {
-  Elf_Scn* scn=elf_getscn(e->e,e->sectionHdrStrTblIdx);
-  assert(scn);
-  Elf_Data* data=elf_getdata(scn,NULL);
-  int len=strlen(str)+1;
-  addDataToScn(data,str,len);
-  elf_flagdata(data,ELF_C_SET,ELF_F_DIRTY);
-  return data->d_size-len;
+  return addStringToStrtab(e,e->sectionHdrStrTblIdx,str);
 }
 
 //return index of entry in symbol table
@@ -253,7 +453,7 @@ void createSections(ElfInfo* e)
   //text section for new functions
   Elf_Scn* text_scn=elf_newscn(outelf);
   Elf_Data* text_data=elf_newdata(text_scn);
-  text_data->d_align=1;
+  text_data->d_align=PATCH_MAPPED_SECTION_ALIGN;
   text_data->d_buf=NULL;
                                        //will be allocced as needed
   text_data->d_off=0;
@@ -264,7 +464,9 @@ void createSections(ElfInfo* e)
   shdr->sh_type=SHT_PROGBITS;
   shdr->sh_link=0;
   shdr->sh_info=0;
-  shdr->sh_addralign=1;//normally text is aligned, but we never actually execute from this section
+  //page aligned in the file so the target can map it straight from
+  //the patch (see mmapFileInTarget)
+  shdr->sh_addralign=PATCH_MAPPED_SECTION_ALIGN;
   shdr->sh_name=addStrtabEntry(e,".text.new");
   shdr->sh_addr=0;//going to have to relocate anyway so no point in trying to keep the same address
   shdr->sh_flags=SHF_EXECINSTR;
@@ -277,7 +479,7 @@ void createSections(ElfInfo* e)
   //be difficult to determine what is needed and what is not
   Elf_Scn* rodata_scn=elf_newscn(outelf);
   Elf_Data* rodata_data=elf_newdata(rodata_scn);
-  rodata_data->d_align=1;
+  rodata_data->d_align=PATCH_MAPPED_SECTION_ALIGN;
   rodata_data->d_buf=NULL;
   rodata_data->d_off=0;
   rodata_data->d_size=0;
@@ -289,7 +491,7 @@ void createSections(ElfInfo* e)
   shdr->sh_type=SHT_PROGBITS;
   shdr->sh_link=0;
   shdr->sh_info=0;
-  shdr->sh_addralign=1;//normally text is aligned, but we never actually execute from this section
+  shdr->sh_addralign=PATCH_MAPPED_SECTION_ALIGN;//mapped like .text.new
   shdr->sh_flags=0;
   shdr->sh_name=addStrtabEntry(e,".rodata.new");
 
@@ -341,6 +543,7 @@ ElfInfo* startPatchElf(FILE* file,char* filename)
     file=fopen(filename,"w");
   }
   patch=zmalloc(sizeof(ElfInfo));
+  patch->arena=arenaCreate(0);
   patch->isPO=true;
   patch->fname=strdup(filename);
   int outfd = fileno(file);
@@ -382,15 +585,21 @@ ElfInfo* startPatchElf(FILE* file,char* filename)
   return patch;
 }
 
-void finalizeDataSize(ElfInfo* e,Elf_Scn* scn,Elf_Data* data)
+void finalizeDataSize(ElfInfo* e,Elf_Scn* scn)
 {
   ElfXX_Shdr* shdr=elfxx_getshdr(scn);
-  shdr->sh_size=data->d_size;
-  elf_flagshdr(scn,ELF_C_SET,ELF_F_DIRTY);
-  if(shdr->sh_type!=SHT_NOBITS)
+  //a section may be made up of a chain of several Elf_Data (see adoptScnData)
+  word_t size=0;
+  for(Elf_Data* data=elf_getdata(scn,NULL);data;data=elf_getdata(scn,data))
   {
-    elf_flagdata(data,ELF_C_SET,ELF_F_DIRTY);
+    size+=data->d_size;
+    if(shdr->sh_type!=SHT_NOBITS)
+    {
+      elf_flagdata(data,ELF_C_SET,ELF_F_DIRTY);
+    }
   }
+  shdr->sh_size=size;
+  elf_flagshdr(scn,ELF_C_SET,ELF_F_DIRTY);
   logprintf(ELL_INFO_V3,ELS_ELFWRITE,"finalizing data size to 0x%x for section with name %s(%i)\n",shdr->sh_size,getScnHdrString(e,shdr->sh_name),shdr->sh_name);
 }
 
@@ -401,8 +610,7 @@ void finalizeDataSizes(ElfInfo* e)
 
   for(Elf_Scn* scn=elf_nextscn(e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
   {
-    Elf_Data* data=elf_getdata(scn,NULL);
-    finalizeDataSize(e,scn,data);
+    finalizeDataSize(e,scn);
   }
   //todo: do a second pass and make all the layouts come out right.
   ElfXX_Shdr* lastShdr=NULL;
@@ -427,9 +635,141 @@ void finalizeDataSizes(ElfInfo* e)
   }  
 }
 
+uint32 gnuHash(const char* name)
+{
+  uint32 h=5381;
+  for(const byte* p=(const byte*)name;*p;p++)
+  {
+    h=(h<<5)+h+*p;
+  }
+  return h;
+}
+
+//.gnu.hash is laid out as nbuckets, symoffset, bloom_size and
+//bloom_shift, bloom_size Bloom filter words of the file's width,
+//nbuckets buckets each holding the first symbol in that bucket, and a
+//chain entry for each hashed symbol holding its hash with the low bit
+//set on the last symbol in its bucket
+byte* buildGnuHashTable(ElfInfo* e,uint32 numBuckets,uint32 symOffset,
+                        uint32 bloomSize,uint32 bloomShift,size_t* len)
+{
+  assert(numBuckets && bloomSize && !(bloomSize&(bloomSize-1)));
+  Elf_Data* dynsymData=getDataByERS(e,ERS_DYNSYM);
+  uint32 numSyms=dynsymData->d_size/sizeof(ElfXX_Sym);
+  if(symOffset>numSyms)
+  {
+    return NULL;
+  }
+  uint32 numHashed=numSyms-symOffset;
+  *len=4*sizeof(uint32)+bloomSize*sizeof(word_t)+(numBuckets+numHashed)*sizeof(uint32);
+  byte* table=zmalloc(*len);
+  uint32* header=(uint32*)table;
+  header[0]=numBuckets;
+  header[1]=symOffset;
+  header[2]=bloomSize;
+  header[3]=bloomShift;
+  word_t* bloom=(word_t*)(table+4*sizeof(uint32));
+  uint32* buckets=(uint32*)(bloom+bloomSize);
+  uint32* chain=buckets+numBuckets;
+
+  const int wordBits=sizeof(word_t)*8;
+  ElfXX_Sym* syms=getNativeSymbols(e,dynsymData);
+  uint32 lastBucket=0;
+  for(uint32 i=symOffset;i<numSyms;i++)
+  {
+    ElfXX_Sym buf;
+    ElfXX_Sym* sym=getSymbolInTable(syms,dynsymData,i,&buf);
+    uint32 h=gnuHash(getDynString(e,sym->st_name));
+    uint32 bucket=h%numBuckets;
+    if(bucket<lastBucket)
+    {
+      logprintf(ELL_WARN,ELS_ELFWRITE,"Dynamic symbols of %s are not in .gnu.hash bucket order\n",e->fname);
+      free(table);
+      return NULL;
+    }
+    bloom[(h/wordBits)&(bloomSize-1)]|=((word_t)1<<(h%wordBits)) |
+      ((word_t)1<<((h>>bloomShift)%wordBits));
+    if(!buckets[bucket])
+    {
+      buckets[bucket]=i;
+      //close off the previous bucket's chain
+      if(i>symOffset)
+      {
+        chain[i-symOffset-1]|=1;
+      }
+    }
+    chain[i-symOffset]=h&~1;
+    lastBucket=bucket;
+  }
+  if(numHashed)
+  {
+    chain[numHashed-1]|=1;
+  }
+  return table;
+}
+
+bool updateGnuHashTable(ElfInfo* e)
+{
+  if(!hasERS(e,ERS_GNU_HASH) || !hasERS(e,ERS_DYNSYM) ||
+     ELFCLASSXX!=gelf_getclass(e->e))
+  {
+    return false;
+  }
+  Elf_Data* data=getDataByERS(e,ERS_GNU_HASH);
+  if(data->d_size<4*sizeof(uint32))
+  {
+    return false;
+  }
+  uint32 header[4];
+  memcpy(header,data->d_buf,sizeof(header));
+  if(!header[0] || !header[2] || (header[2]&(header[2]-1)))
+  {
+    logprintf(ELL_WARN,ELS_ELFWRITE,".gnu.hash of %s is malformed\n",e->fname);
+    return false;
+  }
+  size_t len;
+  byte* table=buildGnuHashTable(e,header[0],header[1],header[2],header[3],&len);
+  if(!table)
+  {
+    return false;
+  }
+  if(len!=data->d_size)
+  {
+    logprintf(ELL_WARN,ELS_ELFWRITE,"Dynamic symbols of %s have been added or removed, cannot update .gnu.hash in place\n",e->fname);
+    free(table);
+    return false;
+  }
+  if(memcmp(table,data->d_buf,len))
+  {
+    replaceScnData(data,table,len);
+  }
+  free(table);
+  return true;
+}
+
+static bool isERSDirty(ElfInfo* e,E_RECOGNIZED_SECTION ers)
+{
+  if(!hasERS(e,ers))
+  {
+    return false;
+  }
+  int flags=elf_flagscn(getSectionByERS(e,ers),ELF_C_SET,0);
+  Elf_Data* data=getDataByERS(e,ers);
+  if(data)
+  {
+    flags|=elf_flagdata(data,ELF_C_SET,0);
+  }
+  return flags & ELF_F_DIRTY;
+}
+
 //prepare a modified elf object for writing
 void finalizeModifiedElf(ElfInfo* e)
 {
+  //dynamic symbol names may have changed under .gnu.hash
+  if(hasERS(e,ERS_GNU_HASH) && (isERSDirty(e,ERS_DYNSYM) || isERSDirty(e,ERS_DYNSTR)))
+  {
+    updateGnuHashTable(e);
+  }
   finalizeDataSizes(e);
 }
 
@@ -70,6 +70,22 @@ ElfInfo* startPatchElf(FILE* file,char* filename);
 //data in the section
 addr_t addDataToScn(Elf_Data* dataDest, const void* data,int size);
 
+//appends buf to the end of scn as a new Elf_Data in the section's
+//data chain, without copying it. e does not take ownership of buf,
+//whoever does own it must keep it alive until e has been ended.
+//Returns the offset into the section that the data was added at
+addr_t adoptScnData(ElfInfo* e,Elf_Scn* scn,void* buf,size_t size);
+
+//records that data->d_buf was malloc'd by us with room for allocated
+//bytes, so it may be grown in place and is freed by endELF.
+//addDataToScn and the other functions here do this themselves, it's
+//only needed for buffers allocated elsewhere
+void ownScnData(Elf_Data* data,size_t allocated);
+
+//frees data->d_buf and sets it to NULL if it is one of ours (see
+//ownScnData). Returns whether it was
+bool releaseScnData(Elf_Data* data);
+
 //wipes out the existing information in dataDest and replaces it with data
 void replaceScnData(Elf_Data* dataDest,void* data,int size);
 
@@ -78,10 +94,17 @@ void replaceScnData(Elf_Data* dataDest,void* data,int size);
 //of the data, extends it as necessary
 void modifyScnData(Elf_Data* dataDest,word_t offset,void* data,int size);
 
-//adds an entry to the string table, return its offset
+//returns the offset of str in the string table in section scnIdx,
+//only adding it to the table if it isn't already there. Identical
+//strings (and, for patch objects, suffixes of strings already
+//present) share a single entry
+int addStringToStrtab(ElfInfo* e,size_t scnIdx,const char* str);
+
+//adds an entry to the string table (if not already present), return its offset
 int addStrtabEntry(ElfInfo* e, const char* str);
 
-//adds an entry to the section header string table, return its offset
+//adds an entry to the section header string table (if not already
+//present), return its offset
 int addShdrStrtabEntry(ElfInfo* e,char* str);
 
 //return index of entry in symbol table
@@ -94,6 +117,25 @@ int dwarfWriteSectionCallback(const char* name,int size,Dwarf_Unsigned type,
                               Dwarf_Unsigned info,Dwarf_Unsigned* sectNameIdx,
                               void* user_data, int* error);
 
+//the hash of name used by .gnu.hash
+uint32 gnuHash(const char* name);
+
+//builds a .gnu.hash table (in memory form) for e's dynamic symbols
+//with the given number of buckets and Bloom filter words (which must
+//be a power of 2). Symbols from symOffset on are hashed and must
+//already be ordered by bucket, as the linker orders them. Returns a
+//malloced table and writes its size to len, or returns NULL if the
+//symbols are out of order
+byte* buildGnuHashTable(ElfInfo* e,uint32 numBuckets,uint32 symOffset,
+                        uint32 bloomSize,uint32 bloomShift,size_t* len);
+
+//rebuilds e's .gnu.hash from its current .dynsym, keeping the
+//parameters of the existing table so it stays the same size and
+//matches the symbol order the linker chose. Returns false if e has no
+//.gnu.hash or it can't be rebuilt (the dynamic symbols can't be
+//reordered without renumbering everything that refers to them)
+bool updateGnuHashTable(ElfInfo* e);
+
 //prepare a modified elf object for writing
 void finalizeModifiedElf(ElfInfo* e);
 #endif
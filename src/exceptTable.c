@@ -571,10 +571,11 @@ ExceptTable parseExceptFrame(Elf_Scn* scn,addr_t* lsdaPointers,int numLSDAPointe
     addr_t ttBase=0;
     if(lsda->ttEncoding!=DW_EH_PE_omit)
     {
-      byte* ttBaseBytes=decodeLEB128(bytes,false,&numBytesOut,&numSeptets);
-      assert(sizeof(ttBase) >= numBytesOut);
-      memcpy(&ttBase,ttBaseBytes,numBytesOut);
-      free(ttBaseBytes);
+      numSeptets=decodeULEB128(bytes,(byte*)data->d_buf+data->d_size,&ttBase);
+      if(!numSeptets)
+      {
+        death("malformed type table offset in LSDA\n");
+      }
       //remember ttBase is a self-relative offset to the end of the type
       //table. For our purposes it's helpful if it is instead relative
       //to the beginning of this section (instead of self-relative)
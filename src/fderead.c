@@ -64,9 +64,14 @@
 #include "util/logging.h"
 #include "dwarfvm.h"
 #include "elfutil.h"
+#include "util/vector.h"
+#include "eh_pe.h"
+#include "constants.h"
+#include <sys/mman.h>
 
 //create a DwarfExpression object from the raw bytes
-DwarfExpr parseDwarfExpression(byte* data,uint len)
+//the instructions are allocated in arena
+DwarfExpr parseDwarfExpression(Arena* arena,byte* data,uint len)
 {
   DwarfExpr result;
   result.numInstructions=0;
@@ -250,14 +255,15 @@ DwarfExpr parseDwarfExpression(byte* data,uint len)
     case DW_OP_constu:
     case DW_OP_plus_uconst:
       {
-        usint numBytes;
-        usint numSeptetsRead;
-        byte* number=decodeLEB128(data+1,false,&numBytes,&numSeptetsRead);
-        assert(numBytes<=sizeof(instr->arg1));
-        memcpy(&instr->arg1,number,numBytes);
-        data+=numSeptetsRead;
-        len-=numSeptetsRead;
-        free(number);
+        word_t number;
+        usint numBytesRead=decodeULEB128(data+1,data+len,&number);
+        if(!numBytesRead)
+        {
+          death("malformed LEB operand for DW_OP 0x%x\n",instr->type);
+        }
+        instr->arg1=(word_t)number;
+        data+=numBytesRead;
+        len-=numBytesRead;
       }
       break;
     //handle all the opcodes which take a signed LEB argument
@@ -296,14 +302,15 @@ DwarfExpr parseDwarfExpression(byte* data,uint len)
     case DW_OP_breg30:
     case DW_OP_breg31:
       {
-        usint numBytes;
-        usint numSeptetsRead;
-        byte* number=decodeLEB128(data+1,true,&numBytes,&numSeptetsRead);
-        assert(numBytes<=sizeof(instr->arg1));
-        memcpy(&instr->arg1,number,numBytes);
-        data+=numSeptetsRead;
-        len-=numSeptetsRead;
-        free(number);
+        sword_t number;
+        usint numBytesRead=decodeSLEB128(data+1,data+len,&number);
+        if(!numBytesRead)
+        {
+          death("malformed LEB operand for DW_OP 0x%x\n",instr->type);
+        }
+        instr->arg1=(word_t)number;
+        data+=numBytesRead;
+        len-=numBytesRead;
       }
       break;
     default:
@@ -311,17 +318,19 @@ DwarfExpr parseDwarfExpression(byte* data,uint len)
     }
   }
 
-  result.instructions=realloc(result.instructions,sizeof(DwarfExprInstr)*result.numInstructions);
+  DwarfExprInstr* instrs=arenaMemdup(arena,result.instructions,sizeof(DwarfExprInstr)*result.numInstructions);
+  free(result.instructions);
+  result.instructions=instrs;
   return result;
 }
 
-//the returned memory should be freed
-RegInstruction* parseFDEInstructions(Dwarf_Debug dbg,unsigned char* bytes,
+//the returned memory is allocated in arena
+RegInstruction* parseFDEInstructions(Arena* arena,unsigned char* bytes,
                                      int len,int* numInstrs)
 {
   *numInstrs=0;
-  //allocate more mem than we'll actually need
-  //we can free some later
+  //allocate more mem than we'll actually need,
+  //only what we use is copied into the arena
   RegInstruction* result=zmalloc(sizeof(RegInstruction)*len);
   for(;len>0;len--,bytes++,(*numInstrs)++)
   {
@@ -444,6 +453,29 @@ RegInstruction* parseFDEInstructions(Dwarf_Debug dbg,unsigned char* bytes,
         bytes+=uleblen;
         len-=uleblen;
         break;
+      case DW_CFA_KATANA_fixups_array:
+        logprintf(ELL_INFO_V3,ELS_DWARF_FRAME,"Reading DW_CFA_KATANA_fixups_array\n");
+        if(!isPoRegType(bytes[1]))
+        {
+          death("register of unexpected format for po\n");
+        }
+        result[*numInstrs].arg1Reg=readRegFromLEB128(bytes + 1,&uleblen);
+        bytes+=uleblen;
+        len-=uleblen;
+        if(!isPoRegType(bytes[1]))
+        {
+          death("register of unexpected format for po\n");
+        }
+        result[*numInstrs].arg2Reg=readRegFromLEB128(bytes + 1,&uleblen);
+        bytes+=uleblen;
+        len-=uleblen;
+        result[*numInstrs].arg3=leb128ToUInt(bytes+1,&uleblen);
+        bytes+=uleblen;
+        len-=uleblen;
+        result[*numInstrs].arg4=leb128ToUInt(bytes+1,&uleblen);
+        bytes+=uleblen;
+        len-=uleblen;
+        break;
       case DW_CFA_def_cfa:
         result[*numInstrs].arg1Reg=readRegFromLEB128(bytes + 1,&uleblen);
         bytes+=uleblen;
@@ -480,7 +512,9 @@ RegInstruction* parseFDEInstructions(Dwarf_Debug dbg,unsigned char* bytes,
         exprBytesLen=leb128ToUInt(bytes + 1, &uleblen);
         bytes+=uleblen;
         len-=uleblen;
-        result[*numInstrs].expr=parseDwarfExpression(bytes+1,exprBytesLen);
+        result[*numInstrs].expr=parseDwarfExpression(arena,bytes+1,exprBytesLen);
+        result[*numInstrs].exprBytes=bytes+1;
+        result[*numInstrs].exprLen=exprBytesLen;
         bytes+=exprBytesLen;
         len-=exprBytesLen;
         break;
@@ -488,7 +522,9 @@ RegInstruction* parseFDEInstructions(Dwarf_Debug dbg,unsigned char* bytes,
         exprBytesLen=leb128ToUInt(bytes + 1, &uleblen);
         bytes+=uleblen;
         len-=uleblen;
-        result[*numInstrs].expr=parseDwarfExpression(bytes+1,exprBytesLen);
+        result[*numInstrs].expr=parseDwarfExpression(arena,bytes+1,exprBytesLen);
+        result[*numInstrs].exprBytes=bytes+1;
+        result[*numInstrs].exprLen=exprBytesLen;
         bytes+=exprBytesLen;
         len-=exprBytesLen;
         break;
@@ -500,9 +536,9 @@ RegInstruction* parseFDEInstructions(Dwarf_Debug dbg,unsigned char* bytes,
       }
     }
   }
-  //realloc to free mem we didn't actually use
-  result=realloc(result,sizeof(RegInstruction)*(*numInstrs));
-  return result;
+  RegInstruction* instrs=arenaMemdup(arena,result,sizeof(RegInstruction)*(*numInstrs));
+  free(result);
+  return instrs;
 }
 
 //helper function for readDebugFrame,
@@ -514,266 +550,501 @@ int fdeCmp(const void* a,const void* b)
   return fdeA->lowpc-fdeB->lowpc;
 }
 
-//returns a Map between the numerical offset of an FDE (accessible via
-//the DW_AT_MIPS_fde attribute of the relevant type) and the FDE
-//structure.  if ehInsteadOfDebug is true, then read information from
-//.eh_frame instead of .debug_frame.
-//return NULL on error
-Map* readDebugFrame(ElfInfo* elf,bool ehInsteadOfDebug)
+//a CIE or FDE found in the linear pass over the section, before
+//anything but its header has been looked at
+typedef struct
 {
-  Dwarf_Fde *fdeData = NULL;
-  Dwarf_Signed fdeElementCount = 0;
-  Dwarf_Cie *cieData = NULL;
-  Dwarf_Signed cieElementCount = 0;
-  
-  Map* result=integerMapCreate(100);//todo: remove arbitrary constant 100
-  Dwarf_Error err;
-  Dwarf_Debug dbg;
-  addr_t* lsdaPointers=NULL;
-  int numLSDAPointers=0;
-  if(DW_DLV_OK!=dwarf_elf_init(elf->e,DW_DLC_READ,&dwarfErrorHandler,NULL,&dbg,&err))
+  int offset;//of the entry's length field in the section
+  int cieOffset;//for FDEs, the offset of the CIE it uses
+  byte* body;//just past the CIE id/pointer
+  byte* end;
+} FrameEntry;
+
+VECTOR_DEFINE(FrameEntryVec,FrameEntry)
+
+//the .eh_frame or .debug_frame being read
+typedef struct
+{
+  byte* data;
+  byte* end;
+  addr_t address;
+  bool isEH;
+} FrameSection;
+
+static int cmpFrameEntryOffset(const void* a,const void* b)
+{
+  return ((const FrameEntry*)a)->offset-((const FrameEntry*)b)->offset;
+}
+
+static int cmpFDEPtrOffset(const void* a,const void* b)
+{
+  return (*(FDE* const*)a)->offset-(*(FDE* const*)b)->offset;
+}
+
+static word_t readFrameULEB(byte** p,byte* end)
+{
+  word_t value;
+  usint len=decodeULEB128(*p,end,&value);
+  if(!len)
   {
-    dwarfErrorHandler(err,NULL);
+    death("Malformed LEB in call frame information\n");
   }
+  *p+=len;
+  return value;
+}
 
-  Elf_Scn* scn=NULL;
-  if(!ehInsteadOfDebug)
+static sword_t readFrameSLEB(byte** p,byte* end)
+{
+  sword_t value;
+  usint len=decodeSLEB128(*p,end,&value);
+  if(!len)
+  {
+    death("Malformed LEB in call frame information\n");
+  }
+  *p+=len;
+  return value;
+}
+
+//splits the section into its CIEs and FDEs
+static void scanFrameSection(FrameSection* sec,FrameEntryVec* cies,FrameEntryVec* fdes)
+{
+  byte* p=sec->data;
+  while(sec->end-p>=4)
   {
-    if(DW_DLV_OK!=dwarf_get_fde_list(dbg, &cieData, &cieElementCount,
-                                     &fdeData, &fdeElementCount, &err))
+    int offset=p-sec->data;
+    uint32_t length32;
+    memcpy(&length32,p,4);
+    p+=4;
+    word_t length=length32;
+    int idSize=4;
+    if(0xffffffff==length32)
+    {
+      //64-bit DWARF format
+      uint64_t length64;
+      if(sec->end-p<8)
+      {
+        death("Truncated call frame entry at offset 0x%x\n",offset);
+      }
+      memcpy(&length64,p,8);
+      p+=8;
+      length=length64;
+      idSize=8;
+    }
+    if(0==length)
     {
-      dwarfErrorHandler(err,NULL);
+      //a terminator. GCC puts one at the end of .eh_frame
+      continue;
     }
-    scn=getSectionByName(elf,".debug_frame");
+    if(length>(word_t)(sec->end-p) || length<(word_t)idSize)
+    {
+      death("Call frame entry at offset 0x%x runs off the end of the section\n",offset);
+    }
+    FrameEntry entry;
+    entry.offset=offset;
+    entry.end=p+length;
+    word_t id=0;
+    memcpy(&id,p,idSize);
+    entry.body=p+idSize;
+    bool isCIE=sec->isEH?(EH_CIE_ID==id):(4==idSize?DEBUG_CIE_ID==id:(word_t)-1==id);
+    if(isCIE)
+    {
+      entry.cieOffset=offset;
+      *FrameEntryVecPush(cies)=entry;
+    }
+    else
+    {
+      //in .eh_frame the CIE pointer is relative to where it is stored
+      entry.cieOffset=sec->isEH?(int)(p-sec->data-id):(int)id;
+      *FrameEntryVecPush(fdes)=entry;
+    }
+    p=entry.end;
+  }
+}
+
+static void parseCIE(ElfInfo* elf,FrameSection* sec,FrameEntry* entry,CIE* cie)
+{
+  byte* p=entry->body;
+  byte* end=entry->end;
+  cie->arena=elf->arena;
+  cie->version=*p++;
+  char* augmenter=(char*)p;
+  byte* nul=memchr(p,0,end-p);
+  if(!nul)
+  {
+    death("CIE at offset 0x%x has an unterminated augmentation string\n",entry->offset);
+  }
+  p=nul+1;
+  if(cie->version>=4)
+  {
+    cie->addressSize=*p++;
+    cie->segmentSize=*p++;
+  }
+  else
+  {
+    //same guess dwarfscript makes
+    cie->addressSize=sec->isEH?4:sizeof(addr_t);
+  }
+  cie->codeAlign=readFrameULEB(&p,end);
+  cie->dataAlign=readFrameSLEB(&p,end);
+  if(1==cie->version)
+  {
+    cie->returnAddrRuleNum=*p++;
+  }
+  else
+  {
+    cie->returnAddrRuleNum=readFrameULEB(&p,end);
+  }
+  if('z'==augmenter[0])
+  {
+    word_t augdataLen=readFrameULEB(&p,end);
+    if(augdataLen>(word_t)(end-p))
+    {
+      death("CIE at offset 0x%x has more augmentation data than room for it\n",entry->offset);
+    }
+    addr_t augdataAddress=sec->address+(p-sec->data);
+    parseAugmentationStringAndData(cie,augmenter,p,augdataLen,augdataAddress);
+    p+=augdataLen;
+  }
+  else if(augmenter[0])
+  {
+    death("CIE at offset 0x%x has unsupported augmentation \"%s\"\n",entry->offset,augmenter);
+  }
+
+  //don't care about initial instructions, for patching,
+  //but do if we're reading a debug frame for stack unwinding purposes
+  //so that we can find activation frames
+  cie->initialInstructions=parseFDEInstructions(elf->arena,p,end-p,&cie->numInitialInstructions);
+  cie->initialRules=dictCreate(100);//todo: get rid of
+  //arbitrary constant 100
+  evaluateInstructionsToRules(cie,cie->initialInstructions,cie->numInitialInstructions,
+                              cie->initialRules,0,-1,NULL);
+}
+
+//reads the FDE's header. Its instructions are only decoded when
+//someone asks for them with getFDEInstructions
+static void parseFDE(ElfInfo* elf,FrameSection* sec,FrameEntry* entry,FDE* fde,
+                     addr_t** lsdaPointers,int* numLSDAPointers)
+{
+  byte* p=entry->body;
+  byte* end=entry->end;
+  CIE* cie=fde->cie;
+  addr_t lowPC=0;
+  addr_t addrRange=0;
+  if(sec->isEH)
+  {
+    byte encoding=(cie->augmentationFlags & CAF_FDE_ENC)?cie->fdePointerEncoding:DW_EH_PE_absptr;
+    usint numBytes;
+    lowPC=decodeEHPointer(p,end-p,sec->address+(p-sec->data),encoding,&numBytes);
+    p+=numBytes;
+    //the range is never relative to anything
+    addrRange=decodeEHPointer(p,end-p,0,encoding&0x0F,&numBytes);
+    p+=numBytes;
   }
   else
   {
-    elf->callFrameInfo.isEHFrame=true;
-    if(DW_DLV_OK!=dwarf_get_fde_list_eh(dbg, &cieData, &cieElementCount,
-                                     &fdeData, &fdeElementCount, &err))
+    int addressSize=cie->addressSize?cie->addressSize:sizeof(addr_t);
+    if(end-p<2*addressSize || addressSize>sizeof(addr_t))
     {
-      dwarfErrorHandler(err,NULL);
+      death("FDE at offset 0x%x is too short\n",entry->offset);
     }
+    memcpy(&lowPC,p,addressSize);
+    p+=addressSize;
+    memcpy(&addrRange,p,addressSize);
+    p+=addressSize;
+  }
+  if(elf->isPO)
+  {
+    fde->lowpc=lowPC;
+    fde->highpc=0;//has no meaning if the fde was read from a patch object
+    fde->memSize=addrRange;
+  }
+  else
+  {
+    fde->lowpc=lowPC;
+    fde->highpc=lowPC+addrRange;
+    fde->memSize=0;//has no meaning if the fde wasn't read from a patch object
+  }
+  fde->offset=entry->offset;
+
+  if(cie->augmentationFlags & CAF_DATA_PRESENT)
+  {
+    word_t augdataLen=readFrameULEB(&p,end);
+    if(augdataLen>(word_t)(end-p))
+    {
+      death("FDE at offset 0x%x has more augmentation data than room for it\n",entry->offset);
+    }
+    if(sec->isEH && augdataLen)
+    {
+      addr_t augDataAddr=sec->address+(p-sec->data);
+      parseFDEAugmentationData(fde,augDataAddr,p,augdataLen,lsdaPointers,numLSDAPointers);
+    }
+    p+=augdataLen;
+  }
+  fde->rawInstructions=p;
+  fde->rawInstructionsLen=end-p;
+}
+
+RegInstruction* getFDEInstructions(FDE* fde,int* numInstructions)
+{
+  if(fde->rawInstructions)
+  {
+    logprintf(ELL_INFO_V2,ELS_DWARF_FRAME,"Reading instructions in FDE #%i\n",fde->idx);
+    fde->instructions=parseFDEInstructions(fde->cie->arena,fde->rawInstructions,
+                                           fde->rawInstructionsLen,&fde->numInstructions);
+    fde->rawInstructions=NULL;
+  }
+  if(numInstructions)
+  {
+    *numInstructions=fde->numInstructions;
+  }
+  return fde->instructions;
+}
+
+//remembers the binary search table in .eh_frame_hdr if it's in the
+//only form GCC produces
+static void readEhFrameHdr(ElfInfo* elf,Elf_Scn* hdrScn)
+{
+  CallFrameInfo* cfi=&elf->callFrameInfo;
+  GElf_Shdr shdr;
+  getShdr(hdrScn,&shdr);
+  cfi->ehHdrAddress=shdr.sh_addr;
+  Elf_Data* hdrData=elf_getdata(hdrScn,NULL);
+  byte* hdr=hdrData->d_buf;
+  int len=hdrData->d_size;
+  cfi->hdrTable=NULL;
+  cfi->hdrTableCount=0;
+  if(len<4)
+  {
+    cfi->hdrTableEncoding=DW_EH_PE_omit;
+    return;
+  }
+  //get the encoding value
+  cfi->hdrTableEncoding=hdr[3];
+  byte ehFramePtrEncoding=hdr[1];
+  byte countEncoding=hdr[2];
+  if(1!=hdr[0] || DW_EH_PE_omit==countEncoding ||
+     (DW_EH_PE_datarel|DW_EH_PE_sdata4)!=cfi->hdrTableEncoding)
+  {
+    return;
+  }
+  //we already know where .eh_frame is, just skip its pointer
+  int offset=4+getPointerSizeFromEHPointerEncoding(ehFramePtrEncoding);
+  if(offset>len)
+  {
+    return;
+  }
+  usint numBytes;
+  word_t count=decodeEHPointer(hdr+offset,len-offset,0,countEncoding&0x0F,&numBytes);
+  offset+=numBytes;
+  if(count*sizeof(EhFrameHdrTableEntry)>(word_t)(len-offset))
+  {
+    logprintf(ELL_WARN,ELS_DWARF_FRAME,".eh_frame_hdr table is truncated, not using it\n");
+    return;
+  }
+  cfi->hdrTable=(EhFrameHdrTableEntry*)(hdr+offset);
+  cfi->hdrTableCount=count;
+}
+
+//reads .eh_frame or .debug_frame straight from the section data in
+//one pass. CIEs are decoded fully, FDEs only as far as their headers.
+//if ehInsteadOfDebug is true, then read information from .eh_frame
+//instead of .debug_frame.
+//return false on error
+bool readDebugFrame(ElfInfo* elf,bool ehInsteadOfDebug)
+{
+  CallFrameInfo* cfi=&elf->callFrameInfo;
+  addr_t* lsdaPointers=NULL;
+  int numLSDAPointers=0;
+
+  Elf_Scn* scn=NULL;
+  if(!ehInsteadOfDebug)
+  {
+    scn=getSectionByName(elf,".debug_frame");
+  }
+  else
+  {
+    cfi->isEHFrame=true;
     scn=getSectionByName(elf,".eh_frame");
     Elf_Scn* hdrScn=getSectionByName(elf,".eh_frame_hdr");
     if(hdrScn)
     {
-      GElf_Shdr shdr;
-      getShdr(hdrScn,&shdr);
-      elf->callFrameInfo.ehHdrAddress=shdr.sh_addr;
-
-      //get the encoding value
-      Elf_Data* hdrData=elf_getdata(hdrScn,NULL);
-      elf->callFrameInfo.hdrTableEncoding=((byte*)hdrData->d_buf)[3];
+      readEhFrameHdr(elf,hdrScn);
     }
     else
     {
       logprintf(ELL_WARN, ELS_DWARF_FRAME,"ELF has no .eh_frame_hdr section\n");
-      elf->callFrameInfo.ehHdrAddress=0;
-      elf->callFrameInfo.hdrTableEncoding=0;
-      
+      cfi->ehHdrAddress=0;
+      cfi->hdrTableEncoding=0;
+      cfi->hdrTable=NULL;
+      cfi->hdrTableCount=0;
     }
   }
+  if(!scn)
+  {
+    logprintf(ELL_WARN,ELS_DWARF_FRAME,"ELF has no %s section\n",ehInsteadOfDebug?".eh_frame":".debug_frame");
+    return false;
+  }
+  //read front to back in one pass
+  adviseELFSection(elf,scn,MADV_SEQUENTIAL);
   GElf_Shdr shdr;
   getShdr(scn,&shdr);
-  elf->callFrameInfo.ehAddress=shdr.sh_addr;
-    
+  cfi->ehAddress=shdr.sh_addr;
+  Elf_Data* data=elf_getdata(scn,NULL);
+  FrameSection sec;
+  sec.data=data->d_buf;
+  sec.end=sec.data+data->d_size;
+  sec.address=shdr.sh_addr;
+  sec.isEH=ehInsteadOfDebug;
+
+  FrameEntryVec cieEntries={0};
+  FrameEntryVec fdeEntries={0};
+  scanFrameSection(&sec,&cieEntries,&fdeEntries);
+
+  //the CIEs, FDEs and their instructions live as long as elf does and
+  //are released with its arena
+  cfi->cies=arenaAlloc(elf->arena,sizeof(CIE)*cieEntries.len);
+  cfi->numCIEs=cieEntries.len;
+  for(int i=0;i<cieEntries.len;i++)
+  {
+    cfi->cies[i].idx=i;
+    parseCIE(elf,&sec,&cieEntries.data[i],&cfi->cies[i]);
+  }
 
-  //read the CIE
-  Dwarf_Unsigned cieLength = 0;
-  Dwarf_Ptr initInstr = 0;
-  Dwarf_Unsigned initInstrLen = 0;
-
-  elf->callFrameInfo.cies=zmalloc(sizeof(CIE)*cieElementCount);
-  elf->callFrameInfo.numCIEs=cieElementCount;
-
-  for(int i=0;i<cieElementCount;i++)
-  {
-    char* augmenter = "";
-    elf->callFrameInfo.cies[i].idx=i;
-    CIE* cie=&elf->callFrameInfo.cies[i];
-    //todo: all the casting here is hackish
-    //should respect types more
-    if(DW_DLV_OK!=dwarf_get_cie_info(cieData[i],
-                                     &cieLength,
-                                     &cie->version,
-                                     &augmenter,
-                                     &cie->codeAlign,
-                                     &cie->dataAlign,
-                                     &cie->returnAddrRuleNum,
-                                     &initInstr,
-                                     &initInstrLen, &err))
+  //entries were found in section order, so the CIEs are already
+  //sorted by offset
+  FrameEntryVecSpan cieSpan=FrameEntryVecAsSpan(&cieEntries);
+  cfi->fdes=arenaAlloc(elf->arena,fdeEntries.len*sizeof(FDE));
+  cfi->numFDEs=fdeEntries.len;
+  for(int i=0;i<fdeEntries.len;i++)
+  {
+    FrameEntry* entry=&fdeEntries.data[i];
+    FDE* fde=&cfi->fdes[i];
+    fde->idx=i;
+    FrameEntry key;
+    key.offset=entry->cieOffset;
+    FrameEntry* cieEntry=FrameEntryVecBSearch(cieSpan,&key,cmpFrameEntryOffset);
+    if(!cieEntry)
     {
-      dwarfErrorHandler(err,NULL);
+      death("FDE at offset 0x%x refers to a CIE at 0x%x which does not exist\n",entry->offset,entry->cieOffset);
     }
-    //get the augmentation data
-    Dwarf_Small* augdata;
-    Dwarf_Unsigned augdataLen;
-    dwarf_get_cie_augmentation_data(cieData[i],
-                                    &augdata,
-                                    &augdataLen,
-                                    &err);
-    //computing the precise address of the augmentation data (for
-    //doing pc-relative pointer encodings) is a bit of a pain.
-    Dwarf_Off cieOff;
-    dwarf_cie_section_offset(dbg,cieData[i],&cieOff,&err);
-    addr_t cieAddress=elf->callFrameInfo.ehAddress+cieOff;
-    //ok, now we have the address of the cie. We want the offset to
-    //the augmentation todo: the below sizes are all for 32-bit DWARF
-    //format, not 64-bit.  (32-bit DWARF format is still most
-    //prevalent on 64-bit systems and is not directly correlated to
-    //the ELF class)
-    addr_t augdataAddress=cieAddress + 4 //the length fields
-      + 4 //CIE_id
-      + 1 //version byte
-      + strlen(augmenter)+1
-      + 1 //byte for code align, assuming less than 64
-      + 1 //byte for data align, assuming less than 64
-      + 1; //byte for returnAddrRegLen assuming the return address
-           //register is less than 128
-    assert(cie->codeAlign < 64);
-    assert(cie->dataAlign < 64);
-    assert(cie->returnAddrRuleNum < 64);
+    fde->cie=&cfi->cies[cieEntry-cieEntries.data];
+    parseFDE(elf,&sec,entry,fde,&lsdaPointers,&numLSDAPointers);
+  }
+  FrameEntryVecFree(&cieEntries);
+  FrameEntryVecFree(&fdeEntries);
 
-    
-    parseAugmentationStringAndData(cie,augmenter,augdata,augdataLen,augdataAddress);
-    
-    //don't care about initial instructions, for patching,
-    //but do if we're reading a debug frame for stack unwinding purposes
-    //so that we can find activation frames
-    elf->callFrameInfo.cies[i].initialInstructions=
-      parseFDEInstructions(dbg,initInstr,initInstrLen,
-                           &elf->callFrameInfo.cies[i].numInitialInstructions);
-    elf->callFrameInfo.cies[i].initialRules=dictCreate(100);//todo: get rid of
-    //arbitrary constant 100
-    evaluateInstructionsToRules(&elf->callFrameInfo.cies[i],
-                                elf->callFrameInfo.cies[i].initialInstructions,
-                                elf->callFrameInfo.cies[i].numInitialInstructions,
-                                elf->callFrameInfo.cies[i].initialRules,0,-1,NULL);
-  
-    //todo: bizarre bug, it keeps coming out as -1, which is wrong
-    elf->callFrameInfo.cies[i].codeAlign=1;
-  }
-  
-  elf->callFrameInfo.fdes=zmalloc(fdeElementCount*sizeof(FDE));
-  elf->callFrameInfo.numFDEs=fdeElementCount;
-  for (int i = 0; i < fdeElementCount; i++)
-  {
-    elf->callFrameInfo.fdes[i].idx=i;
-    Dwarf_Fde dfde=fdeData[i];
-    Dwarf_Ptr instrs;
-    Dwarf_Unsigned ilen;
-    if(DW_DLV_OK!=dwarf_get_fde_instr_bytes(dfde, &instrs, &ilen, &err))
+  if(ehInsteadOfDebug)
+  {
+    Elf_Scn* exceptTableSection=getSectionByName(elf,".gcc_except_table");
+    if(exceptTableSection)
     {
-      dwarfErrorHandler(err,NULL);
+      getShdr(exceptTableSection,&shdr);
+      cfi->exceptTableAddress=shdr.sh_addr;
+      ExceptTable et=parseExceptFrame(exceptTableSection,lsdaPointers,numLSDAPointers);
+      cfi->exceptTable=zmalloc(sizeof(ExceptTable));
+      memcpy(cfi->exceptTable,&et,sizeof(et));
     }
+  }
+  free(lsdaPointers);
 
-    Dwarf_Cie dcie;
-    dwarf_get_cie_of_fde(dfde,&dcie,&err);
-    Dwarf_Signed cieIndex;
-    dwarf_get_cie_index(dcie,&cieIndex,&err);
-    elf->callFrameInfo.fdes[i].cie=&elf->callFrameInfo.cies[cieIndex];
-    logprintf(ELL_INFO_V2,ELS_DWARF_FRAME,"Reading instructions in FDE #%i\n",i);
-    elf->callFrameInfo.fdes[i].instructions=parseFDEInstructions(dbg,instrs,ilen,&elf->callFrameInfo.fdes[i].numInstructions);
-    Dwarf_Addr lowPC = 0;
-    Dwarf_Unsigned addrRange = 0;
-    Dwarf_Ptr fdeBytes = NULL;
-    Dwarf_Unsigned fdeBytesLength = 0;
-    Dwarf_Off cieOffset = 0;
-    Dwarf_Signed cie_index = 0;
-    Dwarf_Off fdeOffset = 0;
-    dwarf_get_fde_range(dfde,
-                        &lowPC, &addrRange,
-                        &fdeBytes,
-                        &fdeBytesLength,
-                        &cieOffset, &cie_index,
-                        &fdeOffset, &err);
-    if(elf->isPO)
+  //sort fdes by lowpc unless this is a patch object. This
+  //makes determining backtraces easier
+  qsort(cfi->fdes,cfi->numFDEs,sizeof(FDE),fdeCmp);
+
+  //and keep them findable by the offset types refer to them with
+  cfi->fdesByOffset=arenaAlloc(elf->arena,cfi->numFDEs*sizeof(FDE*));
+  for(int i=0;i<cfi->numFDEs;i++)
+  {
+    cfi->fdesByOffset[i]=&cfi->fdes[i];
+  }
+  qsort(cfi->fdesByOffset,cfi->numFDEs,sizeof(FDE*),cmpFDEPtrOffset);
+  return true;
+}
+
+FDE* getFDEAtOffset(ElfInfo* elf,int offset)
+{
+  CallFrameInfo* cfi=&elf->callFrameInfo;
+  if(!cfi->fdesByOffset)
+  {
+    return NULL;
+  }
+  int low=0;
+  int high=cfi->numFDEs;
+  while(low<high)
+  {
+    int middle=low+(high-low)/2;
+    if(cfi->fdesByOffset[middle]->offset<offset)
     {
-      elf->callFrameInfo.fdes[i].lowpc=lowPC;
-      elf->callFrameInfo.fdes[i].highpc=0;//has no meaning if the fde was read from a patch object
-      elf->callFrameInfo.fdes[i].memSize=addrRange;
+      low=middle+1;
     }
     else
     {
-      elf->callFrameInfo.fdes[i].lowpc=lowPC;
-      elf->callFrameInfo.fdes[i].highpc=lowPC+addrRange;
-      elf->callFrameInfo.fdes[i].memSize=0;//has no meaning if the fde wasn't read from a patch object
+      high=middle;
     }
-    elf->callFrameInfo.fdes[i].offset=fdeOffset;
-
-    Dwarf_Small* augdata;
-    Dwarf_Unsigned augdataLen;
-    dwarf_get_fde_augmentation_data(dfde,
-                                    &augdata,
-                                    &augdataLen,
-                                    &err);
+  }
+  if(low<cfi->numFDEs && cfi->fdesByOffset[low]->offset==offset)
+  {
+    return cfi->fdesByOffset[low];
+  }
+  return NULL;
+}
 
-    if(elf->callFrameInfo.isEHFrame && augdataLen)
+FDE* getFDEForPC(ElfInfo* elf,addr_t pc)
+{
+  CallFrameInfo* cfi=&elf->callFrameInfo;
+  FDE* fde=NULL;
+  if(cfi->hdrTable)
+  {
+    //entries are sorted by initial location, both fields are
+    //relative to .eh_frame_hdr
+    sword_t target=(sword_t)(pc-cfi->ehHdrAddress);
+    int low=0;
+    int high=cfi->hdrTableCount;
+    while(low<high)
     {
-      //find the address of the augmentation data, because we'll need it
-      addr_t augDataOffset=0;
-      int iterationOffset=0;
-      while(true)
+      int middle=low+(high-low)/2;
+      if(cfi->hdrTable[middle].initialLocation<=target)
       {
-        byte* ptr=memchr(fdeBytes+iterationOffset,augdata[0],fdeBytesLength);
-        if(!ptr)
-        {
-          death("Augmentation data seemingly does not exist when scanning raw data!\n");
-        }
-        bool isMatch=true;
-        for(int j=1;j<augdataLen;j++)
-        {
-          if(augdata[j]!=ptr[j])
-          {
-            isMatch=false;
-            break;
-          }
-        }
-        if(isMatch)
-        {
-          augDataOffset=fdeOffset+ptr-(byte*)fdeBytes;
-          break;
-        }
-        else
-        {
-          iterationOffset=ptr-(byte*)fdeBytes+1;
-          continue;
-        }
+        low=middle+1;
+      }
+      else
+      {
+        high=middle;
       }
-      //turn the offset into an address
-      addr_t augDataAddr=elf->callFrameInfo.ehAddress+augDataOffset;
-      parseFDEAugmentationData(elf->callFrameInfo.fdes+i,augDataAddr,
-                               augdata,augdataLen,&lsdaPointers,&numLSDAPointers);
     }
-    
-    int* key=zmalloc(sizeof(int));
-    *key=elf->callFrameInfo.fdes[i].offset;
-    mapInsert(result,key,elf->callFrameInfo.fdes+i);
-    dwarf_dealloc(dbg,dfde,DW_DLA_FDE);
+    if(0==low)
+    {
+      return NULL;
+    }
+    addr_t fdeAddr=cfi->ehHdrAddress+(sword_t)cfi->hdrTable[low-1].fdeAddress;
+    fde=getFDEAtOffset(elf,fdeAddr-cfi->ehAddress);
   }
-
-  if(ehInsteadOfDebug)
+  else
   {
-    Elf_Scn* exceptTableSection=getSectionByName(elf,".gcc_except_table");
-    if(exceptTableSection)
+    //elf->callFrameInfo.fdes are sorted by lowpc, so we can do a binary search
+    int low=0;
+    int high=cfi->numFDEs;
+    while(low<high)
     {
-      getShdr(exceptTableSection,&shdr);
-      elf->callFrameInfo.exceptTableAddress=shdr.sh_addr;
-      ExceptTable et=parseExceptFrame(exceptTableSection,lsdaPointers,numLSDAPointers);
-      elf->callFrameInfo.exceptTable=zmalloc(sizeof(ExceptTable));
-      memcpy(elf->callFrameInfo.exceptTable,&et,sizeof(et));
+      int middle=low+(high-low)/2;
+      if((addr_t)cfi->fdes[middle].lowpc<=pc)
+      {
+        low=middle+1;
+      }
+      else
+      {
+        high=middle;
+      }
+    }
+    if(low)
+    {
+      fde=&cfi->fdes[low-1];
     }
   }
-
-  //sort fdes by lowpc unless this is a patch object. This
-  //makes determining backtraces easier
-  qsort(elf->callFrameInfo.fdes,elf->callFrameInfo.numFDEs,sizeof(FDE),fdeCmp);
-  
-  dwarf_dealloc(dbg,cieData[0],DW_DLA_CIE);
-  dwarf_dealloc(dbg,fdeData,DW_DLA_LIST);
-  dwarf_dealloc(dbg,cieData,DW_DLA_LIST);
-  dwarf_finish(dbg,&err);
-  return result;
+  if(fde && (addr_t)fde->lowpc<=pc && pc<(addr_t)fde->highpc)
+  {
+    return fde;
+  }
+  return NULL;
 }
 
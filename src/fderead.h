@@ -59,15 +59,23 @@
 #include "util/map.h"
 #include "dwarf_instr.h"
 
-//returns a Map between the numerical offset of an FDE
-//(accessible via the DW_AT_MIPS_fde attribute of the relevant type)
-//and the FDE structure
-Map* readDebugFrame(ElfInfo* elf,bool ehInsteadOfDebug);
+//fills in elf->callFrameInfo from .debug_frame or, if
+//ehInsteadOfDebug, from .eh_frame. Returns false if the section
+//isn't there
+bool readDebugFrame(ElfInfo* elf,bool ehInsteadOfDebug);
 
-//the returned memory should be freed
-RegInstruction* parseFDEInstructions(Dwarf_Debug dbg,unsigned char* bytes,int len,
+//the returned memory is allocated in arena
+RegInstruction* parseFDEInstructions(Arena* arena,unsigned char* bytes,int len,
                                      int* numInstrs);
 
+//looks up an FDE by its offset in the section it was read from
+//(which is what the DW_AT_MIPS_fde attribute of a type refers to)
+FDE* getFDEAtOffset(ElfInfo* elf,int offset);
+
+//the FDE whose range covers pc, or NULL. Uses the .eh_frame_hdr
+//table when there is one
+FDE* getFDEForPC(ElfInfo* elf,addr_t pc);
+
 
 
 #endif
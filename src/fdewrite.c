@@ -37,9 +37,10 @@ void writeCIEToDwarf(Dwarf_P_Debug dbg,CIE* cie)
 //transform an FDE into its binary form for writing to disk
 void writeFDEToDwarf(Dwarf_P_Debug dbg,FDE* fde)
 {
+  int numInstructions;
+  RegInstruction* instructions=getFDEInstructions(fde,&numInstructions);
   DwarfInstructions rawInstructions=
-    serializeDwarfRegInstructions(fde->instructions,
-                                  fde->numInstructions);
+    serializeDwarfRegInstructions(instructions,numInstructions);
   Dwarf_P_Fde dwFde=dwarf_new_fde(dbg,&err);
   int fdeIdx=dwarf_add_frame_fde(dbg,dwFde,NULL,fde->cie->idx,fde->lowpc,fde->highpc-fde->lowpc,0,&err);
   dwarf_insert_fde_inst_bytes(dbg,fdeIdx,instrs.numBytes,instrs.instrs,&err);
@@ -58,7 +58,7 @@
 #include <limits.h>
 #include "fderead.h"
 
-void printPatchDwarfInfo(ElfInfo* patch,Map* fdeMap)
+void printPatchDwarfInfo(ElfInfo* patch)
 {
   if(!patch->dwarfInfo)
   {
@@ -105,7 +105,7 @@ void printPatchDwarfInfo(ElfInfo* patch,Map* fdeMap)
       }
       printf("    %s %s\n",vars[i]->type->name,vars[i]->name);
       //todo: should display an index
-      FDE* transformerFDE=mapGet(fdeMap,&vars[i]->type->fde);
+      FDE* transformerFDE=getFDEAtOffset(patch,vars[i]->type->fde);
       if(transformerFDE)
       {
         printf("      transformed by FDE#%i\n",transformerFDE->idx);
@@ -55,5 +55,5 @@
 
 #ifndef dwinfo_dump_h
 #define dwinfo_dump_h
-void printPatchDwarfInfo(ElfInfo* patch,Map* fdeMap);
+void printPatchDwarfInfo(ElfInfo* patch);
 #endif
@@ -138,11 +138,13 @@ void printFDEInfo(FILE* file,FDE* fde,int num,ElfInfo* elf)
     assert(fde->hasLSDAPointer);
     fprintf(file,"\tLSDA index: 0x%zx\n",fde->lsdaIdx);
   }
+  int numInstructions;
+  RegInstruction* instructions=getFDEInstructions(fde,&numInstructions);
   fprintf(file,"  Instructions:\n");
-  for(int i=0;i<fde->numInstructions;i++)
+  for(int i=0;i<numInstructions;i++)
   {
     fprintf(file,"    ");
-    printInstruction(file,fde->instructions[i],0);
+    printInstruction(file,instructions[i],0);
   }
   fprintf(file,"    The table would be as follows\n");
   Dictionary* rulesDict=dictDuplicate(cie->initialRules,(DictDataCopy)duplicatePoRegRule);
@@ -156,7 +158,7 @@ void printFDEInfo(FILE* file,FDE* fde,int num,ElfInfo* elf)
   for(int i=fde->lowpc;i<fde->highpc || 0==i;i++)
   {
     int instrsRead=0;
-    int stopLocation=evaluateInstructionsToRules(fde->cie,fde->instructions+numInstrsReadSoFar,fde->numInstructions,rulesDict,fde->lowpc,i,&instrsRead);
+    int stopLocation=evaluateInstructionsToRules(fde->cie,instructions+numInstrsReadSoFar,numInstructions,rulesDict,fde->lowpc,i,&instrsRead);
     numInstrsReadSoFar+=instrsRead;
     if(stopLocation != i) 
     { 
@@ -64,6 +64,7 @@
 #include <assert.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include "dwarftypes.h"
 #include "types.h"
 #include "elfparse.h"
@@ -153,22 +154,29 @@ int main(int argc,char** argv)
   {
     oldBinElfInfo=getElfRepresentingProc(config.pid);
     findELFSections(oldBinElfInfo);
-    ElfInfo* patch=openELFFile(config.objectName);
-    findELFSections(patch);
-    patch->isPO=true;
-    readAndApplyPatch(config.pid,oldBinElfInfo,patch);
-    endELF(patch);
+    ElfInfo** patches=zmalloc(sizeof(ElfInfo*)*config.numPatches);
+    for(int i=0;i<config.numPatches;i++)
+    {
+      patches[i]=openELFFile(config.patchNames[i]);
+      findELFSections(patches[i]);
+      patches[i]->isPO=true;
+    }
+    readAndApplyPatches(config.pid,oldBinElfInfo,patches,config.numPatches);
+    for(int i=0;i<config.numPatches;i++)
+    {
+      endELF(patches[i]);
+    }
+    free(patches);
   }
   else if(EKM_INFO==config.mode)
   {
     ElfInfo* patch=openELFFile(config.objectName);
-    Map* fdeMap=readDebugFrame(patch,isFlag(EKCF_EH_FRAME));
-    if(!fdeMap)
+    if(!readDebugFrame(patch,isFlag(EKCF_EH_FRAME)))
     {
       death("Unable to read frame info, can't print info\n");
     }
     printf("*********Type and Function Info****************\n");
-    printPatchDwarfInfo(patch,fdeMap);
+    printPatchDwarfInfo(patch);
 
     //while katana is primarily for dealing with patches, it also has
     //some functionality for displaying general-purpose information
@@ -197,6 +205,12 @@ int main(int argc,char** argv)
   {
     death("unhandled katana mode");
   }
+  //for comparing memory use with and without -M
+  struct rusage usage;
+  if(!getrusage(RUSAGE_SELF,&usage))
+  {
+    logprintf(ELL_INFO_V1,ELS_MISC,"peak resident set size was %ld KB\n",usage.ru_maxrss);
+  }
   return 0;
 }
 
@@ -67,6 +67,8 @@ typedef enum
                       //the patch. This is only used for debugging
   EKCF_EH_FRAME,   //instead of listing call frame info from
                    //.debug_frame, list it from .eh_frame
+  EKCF_NO_MMAP,    //have libelf read ELF files into memory rather
+                   //than mapping them (see openELFFile)
   EKCF_COUNT
 } E_KATANA_CONFIG_FLAGS;
 extern const char* flagNames[];
@@ -98,6 +100,9 @@ typedef struct Config
                    //is for each version relative to the source
                    //tree. for patch application, the patch file to load
   int pid;         //for patch application, the process to attach to
+  char** patchNames;//for patch application, the series of patches to
+                    //apply in a single stop, oldest first
+  int numPatches;
   
 } Config;
 
@@ -58,6 +58,8 @@
 #include "types.h"
 #include "leb.h"
 #include <math.h>
+#include <limits.h>
+#include <stdint.h>
 #include "util/logging.h"
 
 //encode bytes (presumably representing a number)
@@ -214,18 +216,21 @@ byte* encodeAsLEB128NoOptimization(byte* bytes,int numBytes,bool signed_,usint*
   return result;
 }
 
-//the returned memory should be freed
-byte* decodeLEB128(byte* bytes,bool signed_,usint* numBytesOut,usint* numSeptetsRead)
+usint decodeLEB128ToBuffer(byte* bytes,bool signed_,byte* out,usint outLen,usint* numBytesOut)
 {
   //do a first pass to determine the number of septets
   int numSeptets=0;
   while(bytes[numSeptets++]&(1<<7))
   {}
   
-  //calculate the most possible number of bytes in the result so that
-  //we can allocate memory
-  int numBytesMax=(int)ceil(((float)numSeptets)*7.0/8.0);
-  byte* result=zmalloc(numBytesMax);
+  //the most possible number of bytes in the result
+  int numBytesMax=(numSeptets*7+7)/8;
+  if((usint)numBytesMax>outLen)
+  {
+    death("LEB of %i bytes is too long to decode into %u bytes\n",numSeptets,outLen);
+  }
+  byte* result=out;
+  memset(result,0,numBytesMax);
 
   //track the index of the byte in the result array we're currently
   //filling
@@ -287,117 +292,193 @@ byte* decodeLEB128(byte* bytes,bool signed_,usint* numBytesOut,usint* numSeptets
   }
   //now calculate the actual number of bytes
   int numBytes = bitsLeftInByte==8 ? byteIdx : byteIdx+1;
-  if(numBytes < numBytesMax)
-  {
-    result=realloc(result,numBytes);
-    MALLOC_CHECK(result);
-  }
-  if(numSeptetsRead)
-  {
-    *numSeptetsRead=numSeptets;
-  }
   if(numBytesOut)
   {
     *numBytesOut=numBytes;
   }
-  return result;
+  return numSeptets;
 }
 
-byte* uintToLEB128(uint value,usint* numBytesOut)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__ && defined(__GNUC__)
+#define LEB_WORD_AT_A_TIME
+#endif
+
+//decodes an unsigned LEB into *value, returns the number of bytes
+//it occupied or 0 if it's malformed
+usint decodeULEB128Slow(byte* bytes,byte* end,word_t* value)
 {
-  int bytesNeeded=1;
-  if(value & 0xFF000000)
+#ifdef LEB_WORD_AT_A_TIME
+  if(end && end-bytes>=8)
   {
-    //we need all four bytes
-    bytesNeeded=4;
+    //find the terminating byte among the next eight (the first one
+    //without its high bit set) and squeeze out the high bits of
+    //everything before it, halving the number of gaps each step
+    uint64_t w;
+    memcpy(&w,bytes,8);
+    uint64_t stops=~w&0x8080808080808080ULL;
+    if(stops)
+    {
+      int len=__builtin_ctzll(stops)/8+1;
+      uint64_t x=w&0x7f7f7f7f7f7f7f7fULL;
+      if(len<8)
+      {
+        x&=(1ULL<<(8*len))-1;
+      }
+      x=((x&0x7f007f007f007f00ULL)>>1)|(x&0x007f007f007f007fULL);
+      x=((x&0x3fff00003fff0000ULL)>>2)|(x&0x00003fff00003fffULL);
+      x=((x&0x0fffffff00000000ULL)>>4)|(x&0x000000000fffffffULL);
+      *value=(word_t)x;
+      return len;
+    }
   }
-  else if(value & 0xFFFF0000)
+#endif
+  word_t result=0;
+  int shift=0;
+  usint i=0;
+  byte b;
+  do
   {
-    bytesNeeded=3;
+    if(i==LEB128_MAX_WORD_BYTES || (end && bytes+i>=end))
+    {
+      return 0;
+    }
+    b=bytes[i++];
+    if(shift<sizeof(word_t)*8)
+    {
+      result|=(word_t)(b&0x7f)<<shift;
+    }
+    shift+=7;
+  } while(b&0x80);
+  *value=result;
+  return i;
+}
+
+usint decodeSLEB128Slow(byte* bytes,byte* end,sword_t* value)
+{
+  word_t result;
+  usint len=decodeULEB128Slow(bytes,end,&result);
+  if(len && len*7<sizeof(word_t)*8 && (result>>(len*7-1))&1)
+  {
+    //negative, sign extend
+    result|=~(word_t)0<<(len*7);
   }
-  else if(value & 0xFFFFFF00)
+  *value=(sword_t)result;
+  return len;
+}
+
+usint encodeULEB128(word_t value,byte* out)
+{
+  usint len=0;
+  do
+  {
+    byte b=value&0x7f;
+    value>>=7;
+    if(value)
+    {
+      b|=0x80;//more bytes to come
+    }
+    out[len++]=b;
+  } while(value);
+  return len;
+}
+
+usint encodeSLEB128(sword_t value,byte* out)
+{
+  usint len=0;
+  bool more=true;
+  while(more)
   {
-    bytesNeeded=2;
+    byte b=value&0x7f;
+    value>>=7;//relies on an arithmetic shift
+    //done once what is left is all sign bits and the sign bit of
+    //this septet agrees with it
+    if((0==value && !(b&0x40)) || (-1==value && (b&0x40)))
+    {
+      more=false;
+    }
+    else
+    {
+      b|=0x80;
+    }
+    out[len++]=b;
   }
-  return encodeAsLEB128((byte*)&value,bytesNeeded,false,numBytesOut);
+  return len;
 }
 
-byte* intToLEB128(int value,usint* numBytesOut)
+
+
+//return value should be freed when caller is finished with it
+byte* uintToLEB128(uint value,usint* numBytesOut)
 {
-  if(value >= 0)
+  byte buf[LEB128_MAX_WORD_BYTES];
+  usint numBytes=encodeULEB128(value,buf);
+  if(numBytesOut)
   {
-    return uintToLEB128(value,numBytesOut);
+    *numBytesOut=numBytes;
   }
-  
-  usint numBytes;
-  byte* result=encodeAsLEB128((byte*)&value,sizeof(int),true,&numBytes);
+  byte* result=zmalloc(numBytes);
+  memcpy(result,buf,numBytes);
+  return result;
+}
+
+//return value should be freed when caller is finished with it
+byte* intToLEB128(int value,usint* numBytesOut)
+{
+  byte buf[LEB128_MAX_WORD_BYTES];
+  usint numBytes=encodeSLEB128(value,buf);
   if(numBytesOut)
   {
     *numBytesOut=numBytes;
   }
+  byte* result=zmalloc(numBytes);
+  memcpy(result,buf,numBytes);
   return result;
 }
 
 uint leb128ToUInt(byte* bytes,usint* outLEBBytesRead)
 {
-  usint resultBytes;
-  //valgrind gives this as a mem leak, but I can't figure out why,
-  //as I free the result below. . .
-  byte* result=decodeLEB128(bytes,false,&resultBytes,outLEBBytesRead);
-  //printf("result bytes is %i\n",resultBytes);
-  assert(resultBytes <= sizeof(uint));
-  uint val=0;
-  memcpy(&val,result,resultBytes);
-  free(result);
-  return val;
+  word_t val;
+  usint len=decodeULEB128(bytes,NULL,&val);
+  assert(len && val<=UINT_MAX);
+  if(outLEBBytesRead)
+  {
+    *outLEBBytesRead=len;
+  }
+  return (uint)val;
 }
 
 int leb128ToInt(byte* bytes,usint* outLEBBytesRead)
 {
-  usint resultBytes;
-  //valgrind gives this as a mem leak, but I can't figure out why,
-  //as I free the result below. . .
-  byte* result=decodeLEB128(bytes,true,&resultBytes,outLEBBytesRead);
-  //printf("result bytes is %i\n",resultBytes);
-  assert(resultBytes <= sizeof(int));
-  int val=0;
-  memcpy(&val,result,resultBytes);
-  if(resultBytes < sizeof(val))
+  sword_t val;
+  usint len=decodeSLEB128(bytes,NULL,&val);
+  assert(len && val>=INT_MIN && val<=INT_MAX);
+  if(outLEBBytesRead)
   {
-    val=sextend(val,resultBytes);
+    *outLEBBytesRead=len;
   }
-  free(result);
-  return val;
+  return (int)val;
 }
 
 word_t leb128ToUWord(byte* bytes,usint* outLEBBytesRead)
 {
-
-  usint resultBytes;
-  //valgrind gives this as a mem leak, but I can't figure out why,
-  //as I free the result below. . .
-  byte* result=decodeLEB128(bytes,false,&resultBytes,outLEBBytesRead);
-  //printf("result bytes is %i\n",resultBytes);
-  assert(resultBytes <= sizeof(word_t));
-  word_t val=0;
-  memcpy(&val,result,resultBytes);
-  free(result);
+  word_t val;
+  usint len=decodeULEB128(bytes,NULL,&val);
+  assert(len);
+  if(outLEBBytesRead)
+  {
+    *outLEBBytesRead=len;
+  }
   return val;
 }
 
 sword_t leb128ToSWord(byte* bytes,usint* outLEBBytesRead)
 {
-  usint resultBytes;
-  //valgrind gives this as a mem leak, but I can't figure out why,
-  //as I free the result below. . .
-  byte* result=decodeLEB128(bytes,true,&resultBytes,outLEBBytesRead);
-  assert(resultBytes <= sizeof(word_t));
-  sword_t val=0;
-  memcpy(&val,result,resultBytes);
-  if(resultBytes < sizeof(val))
+  sword_t val;
+  usint len=decodeSLEB128(bytes,NULL,&val);
+  assert(len);
+  if(outLEBBytesRead)
   {
-    val=sextend(val,resultBytes);
+    *outLEBBytesRead=len;
   }
-  free(result);
   return val;
 }
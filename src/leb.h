@@ -16,8 +16,69 @@ byte* encodeAsLEB128(byte* bytes,int numBytes,bool signed_,usint* numBytesOut);
 //like encodeAsLEB128 except doesn't attempt to do any optimization
 byte* encodeAsLEB128NoOptimization(byte* bytes,int numBytes,bool signed_,usint* numBytesOut);
 
-//return value should be freed when you're finished with it
-byte* decodeLEB128(byte* bytes,bool signed_,usint* numBytesOut,usint* numSeptetsRead);
+//decodes a LEB128 number of any width into out, which must have room
+//for outLen bytes. The number of bytes written to out goes in
+//numBytesOut. Returns the number of bytes the LEB occupied. Only
+//needed for numbers wider than a word (such as encoded PoRegs), use
+//decodeULEB128/decodeSLEB128 for everything else
+usint decodeLEB128ToBuffer(byte* bytes,bool signed_,byte* out,usint outLen,usint* numBytesOut);
+
+//the most bytes a LEB128 encoded word can occupy
+#define LEB128_MAX_WORD_BYTES ((sizeof(word_t)*8+6)/7)
+
+//decoding straight to an integer with no allocation. end is one past
+//the last byte that may be read, or NULL if the LEB is trusted to be
+//terminated. Knowing end lets longer numbers be decoded a word at a
+//time. Returns the number of bytes the LEB occupied, or 0 if it runs
+//past end or is too long for a word
+usint decodeULEB128Slow(byte* bytes,byte* end,word_t* value);
+usint decodeSLEB128Slow(byte* bytes,byte* end,sword_t* value);
+
+//almost every LEB in DWARF (register numbers, alignment factors,
+//small offsets) is one or two bytes, so those are decoded inline
+static inline usint decodeULEB128(byte* bytes,byte* end,word_t* value)
+{
+  if(!end || end>bytes)
+  {
+    if(!(bytes[0]&0x80))
+    {
+      *value=bytes[0];
+      return 1;
+    }
+    if((!end || end-bytes>=2) && !(bytes[1]&0x80))
+    {
+      *value=(bytes[0]&0x7f)|((word_t)bytes[1]<<7);
+      return 2;
+    }
+  }
+  return decodeULEB128Slow(bytes,end,value);
+}
+
+static inline usint decodeSLEB128(byte* bytes,byte* end,sword_t* value)
+{
+  if(!end || end>bytes)
+  {
+    if(!(bytes[0]&0x80))
+    {
+      //sign extend from 7 bits
+      *value=(sword_t)(bytes[0]^0x40)-0x40;
+      return 1;
+    }
+    if((!end || end-bytes>=2) && !(bytes[1]&0x80))
+    {
+      //sign extend from 14 bits
+      *value=(sword_t)(((bytes[0]&0x7f)|((word_t)bytes[1]<<7))^0x2000)-0x2000;
+      return 2;
+    }
+  }
+  return decodeSLEB128Slow(bytes,end,value);
+}
+
+//encoding into a caller-supplied buffer of at least
+//LEB128_MAX_WORD_BYTES bytes. Returns the number of bytes written.
+//The encoding is always the shortest possible
+usint encodeULEB128(word_t value,byte* out);
+usint encodeSLEB128(sword_t value,byte* out);
 
 
 uint leb128ToUInt(byte* bytes,usint* outLEBBytesRead);
@@ -101,6 +101,21 @@ addr_t reserveFreeSpaceInTarget(uint howMuch,addr_t where)
 }
 
 
+//claims whole pages of the free space, starting on a page boundary
+addr_t getPageAlignedFreeSpaceInTarget(uint howMuch)
+{
+  uint pageSize=sysconf(_SC_PAGE_SIZE);
+  uint misalignment=addrFreeSpace%pageSize;
+  if(misalignment && pageSize-misalignment<=freeSpaceLeft)
+  {
+    //skip to the next page. If there isn't enough left to do that
+    //we'll be given new pages anyway
+    getFreeSpaceInTarget(pageSize-misalignment);
+  }
+  uint numPages=(howMuch+pageSize-1)/pageSize;
+  return getFreeSpaceInTarget(numPages*pageSize);
+}
+
 addr_t getFreeSpaceInTarget(uint howMuch)
 {
   addr_t retval;
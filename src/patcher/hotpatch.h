@@ -60,6 +60,9 @@
 addr_t getFreeSpaceForTransformation(TransformationInfo* trans,uint howMuch);
 #endif
 addr_t getFreeSpaceInTarget(uint howMuch);
+//like getFreeSpaceInTarget but the space starts on a page boundary and
+//is rounded up to whole pages, so something can be mapped over it
+addr_t getPageAlignedFreeSpaceInTarget(uint howMuch);
 
 //mmap some contiguous space in the target, but don't
 //assume it's being used right now. It will be claimed
@@ -54,6 +54,7 @@
 */
 
 #include "elfutil.h"
+#include "elfwriter.h"
 #include "dwarftypes.h"
 #include "hotpatch.h"
 #include "target.h"
@@ -76,9 +77,15 @@
 #include "pmap.h"
 #include "patchapply.h"
 #include "katana_config.h"
+#include "elfoverlay.h"
+#include "patchplan.h"
 
 ElfInfo* patchedBin=NULL;
 ElfInfo* targetBin=NULL;
+//the binary the patch being applied was generated against. This is
+//targetBin for the first patch of a series and patchedBin, as the
+//earlier patches left it, for the rest
+ElfInfo* oldBin=NULL;
 addr_t patchTextAddr=0;
 addr_t patchRodataAddr=0;
 addr_t patchRelTextAddr=0;
@@ -100,16 +107,16 @@ void allocateMemoryForVarRelocation(VarInfo* var)
 }
 
 
-void transformVarData(VarInfo* var,Map* fdeMap,ElfInfo* patch)
+void transformVarData(VarInfo* var,ElfInfo* patch)
 {
   logprintf(ELL_INFO_V2,ELS_PATCHAPPLY,"transforming var %s\n",var->name);
-  FDE* transformerFDE=mapGet(fdeMap,&var->type->fde);
+  FDE* transformerFDE=getFDEAtOffset(patch,var->type->fde);
   if(!transformerFDE)
   {
     //todo: roll back atomically
     death("could not find transformer for variable %s referencing fde%i\n",var->name,var->type->fde);
   }
-  patchDataWithFDE(var,transformerFDE,targetBin,patch,patchedBin);
+  patchDataWithFDE(var,transformerFDE,oldBin,patch,patchedBin);
 }
 
 void relocateVar(VarInfo* var,ElfInfo* targetBin)
@@ -118,7 +125,7 @@ void relocateVar(VarInfo* var,ElfInfo* targetBin)
 
   //do this first so that addend computation will be done
   //before we change the symtab entry
-  List* relocItems=getRelocationItemsFor(patchedBin,symIdx);
+  RelocInfoVec relocItems=getRelocationItemsFor(patchedBin,symIdx);
 
   //record in the patched binary that we're putting the variable here
   GElf_Sym sym;
@@ -132,7 +139,8 @@ void relocateVar(VarInfo* var,ElfInfo* targetBin)
 
   //we do need to do this because may contain some relocations
   //not in new code
-  applyRelocations(relocItems,IN_MEM);
+  applyRelocations(RelocInfoVecAsSpan(&relocItems),IN_MEM);
+  RelocInfoVecFree(&relocItems);
 }
 
 void insertTrampolineJump(addr_t insertAt,addr_t jumpTo)
@@ -174,9 +182,9 @@ void insertTrampolineJump(addr_t insertAt,addr_t jumpTo)
   free(verify);
 }
 
-void applyVariablePatch(VarInfo* var,Map* fdeMap,ElfInfo* patch)
+void applyVariablePatch(VarInfo* var,ElfInfo* patch)
 {
-  int idx=getSymtabIdx(targetBin,var->name,0);
+  int idx=getSymtabIdx(oldBin,var->name,0);
   int symIdxInPatch=getSymtabIdx(patch,var->name,0);
   GElf_Sym symInPatch;
   if(STN_UNDEF!=symIdxInPatch)
@@ -189,7 +197,7 @@ void applyVariablePatch(VarInfo* var,Map* fdeMap,ElfInfo* patch)
     logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"Fixing up existing variable %s\n",var->name);
     GElf_Sym sym;
     //todo: should make space for the variable in .data.new or something
-    getSymbol(targetBin,idx,&sym);
+    getSymbol(oldBin,idx,&sym);
     var->oldLocation=sym.st_value;
     //now always relocating because the contents of .data.new may matter. todo: is this correct
     //bool relocate=sym.st_size < var->type->length;
@@ -200,13 +208,13 @@ void applyVariablePatch(VarInfo* var,Map* fdeMap,ElfInfo* patch)
     }
     if(var->type->fde)//might not have an fde if just a constant with a changed initializer
     {
-      transformVarData(var,fdeMap,patch);
+      transformVarData(var,patch);
     }
     if(var->newLocation!=var->oldLocation)
     {
       //do need to do this because may contain some relocations
       //not in .rela.text.new
-      relocateVar(var,targetBin);
+      relocateVar(var,oldBin);
     }
   }
   else
@@ -224,13 +232,13 @@ void applyVariablePatch(VarInfo* var,Map* fdeMap,ElfInfo* patch)
     //todo: might not always be the case that it's global
     sym.st_info=ELFXX_ST_INFO(STB_GLOBAL,STT_OBJECT);
     sym.st_name=addStrtabEntryToExisting(patchedBin,var->name,false);
-    sym.st_shndx=elf_ndxscn(getSectionByName(patchedBin,".data.new"));
+    sym.st_shndx=elf_ndxscn(getLastSectionByName(patchedBin,".data.new"));
     sym.st_value=var->newLocation;
     addSymtabEntryToExisting(patchedBin,&sym);
   }
 }
 
-void applyFunctionPatch(SubprogramInfo* func,int pid,ElfInfo* targetBin,ElfInfo* patch)
+void applyFunctionPatch(SubprogramInfo* func,int pid,ElfInfo* oldBin,ElfInfo* patch)
 {
   logprintf(ELL_INFO_V2,ELS_PATCHAPPLY,"patching function %s\n",func->name);
   //int len=func->highpc-func->lowpc;
@@ -246,12 +254,12 @@ void applyFunctionPatch(SubprogramInfo* func,int pid,ElfInfo* targetBin,ElfInfo*
   
   //now look up the symbol in the old binary to discover where to insert
   //the trampoline jump
-  int idx=getSymtabIdx(targetBin,func->name,0);
+  int idx=getSymtabIdx(oldBin,func->name,0);
   if(idx!=STN_UNDEF)
   {
-    addr_t oldAddr=getSymAddress(targetBin,idx);
+    addr_t oldAddr=getSymAddress(oldBin,idx);
     GElf_Sym sym;
-    getSymbol(targetBin,idx,&sym);
+    getSymbol(oldBin,idx,&sym);
     sym.st_value=addr;
     //now we write the symbol to the new binary to keep
     //track of where it is for future patches
@@ -259,6 +267,14 @@ void applyFunctionPatch(SubprogramInfo* func,int pid,ElfInfo* targetBin,ElfInfo*
     gelf_update_sym(symTabData,idx,&sym);
     insertTrampolineJump(oldAddr,addr);
 
+    //if an earlier patch in the series already moved the function,
+    //the original jumps straight to the newest body rather than
+    //through the intermediate one
+    int origIdx=getSymtabIdx(targetBin,func->name,0);
+    if(origIdx!=STN_UNDEF && getSymAddress(targetBin,origIdx)!=oldAddr)
+    {
+      insertTrampolineJump(getSymAddress(targetBin,origIdx),addr);
+    }
   }
   else
   {
@@ -270,7 +286,7 @@ void applyFunctionPatch(SubprogramInfo* func,int pid,ElfInfo* targetBin,ElfInfo*
     //todo: might not always be the case that it's global
     sym.st_info=ELFXX_ST_INFO(STB_GLOBAL,STT_FUNC);
     sym.st_name=addStrtabEntryToExisting(patchedBin,func->name,false);
-    sym.st_shndx=elf_ndxscn(getSectionByName(patchedBin,".text.new"));
+    sym.st_shndx=elf_ndxscn(getLastSectionByName(patchedBin,".text.new"));
     sym.st_value=addr;
     addSymtabEntryToExisting(patchedBin,&sym);
   }
@@ -279,23 +295,13 @@ void applyFunctionPatch(SubprogramInfo* func,int pid,ElfInfo* targetBin,ElfInfo*
 
 int addStrtabEntryToExisting(ElfInfo* e,char* str,bool header)
 {
-  
-  Elf_Scn* scn;
-  if(header)
-  {
-    scn=elf_getscn(e->e,e->sectionHdrStrTblIdx);
-  }
-  else
-  {
-    scn=elf_getscn(e->e,e->strTblIdx);
-  }
+  size_t scnIdx=header?e->sectionHdrStrTblIdx:e->strTblIdx;
+  //names we add (for variables, functions, and .katana sections) are
+  //frequently already present in the string table, so this will often
+  //not actually grow it
+  int retval=addStringToStrtab(e,scnIdx,str);
+  Elf_Scn* scn=elf_getscn(e->e,scnIdx);
   Elf_Data* data=elf_getdata(scn,NULL);
-  int newSize=data->d_size+strlen(str)+1;
-  data->d_buf=realloc(data->d_buf,newSize);
-  memcpy((char*)data->d_buf+data->d_size,str,strlen(str)+1);
-  int retval=data->d_size;
-  data->d_size=newSize;
-  elf_flagdata(data,ELF_C_SET,ELF_F_DIRTY);
   GElf_Shdr shdr;
   gelf_getshdr(scn,&shdr);
   shdr.sh_size=data->d_size;
@@ -307,17 +313,48 @@ int addSymtabEntryToExisting(ElfInfo* e,ElfXX_Sym* sym)
 {
   Elf_Data* data=getDataByERS(e,ERS_SYMTAB);
   int len=sizeof(ElfXX_Sym);
-  int newSize=data->d_size+len;
-  data->d_buf=realloc(data->d_buf,newSize);
-  memcpy((char*)data->d_buf+data->d_size,sym,len);
-  data->d_size=newSize;
-  e->symTabCount=newSize/len;
+  addDataToScn(data,sym,len);
+  e->symTabCount=data->d_size/len;
   //printf("symtab count is now %i\n",e->symTabCount);
-  elf_flagdata(data,ELF_C_SET,ELF_F_DIRTY);
   return e->symTabCount-1;
 }
 
 
+//records in patchedBin that the section scn has been put in the
+//target at addr under the name newName
+static void addSectionToPatchedBin(Elf_Scn* scn,Elf_Data* data,char* newName,addr_t addr)
+{
+  Elf_Scn* newscn = elf_newscn (patchedBin->e);
+  GElf_Shdr shdr,shdrNew;
+  gelf_getshdr(scn,&shdr);
+  gelf_getshdr(scn,&shdrNew);
+  shdrNew.sh_addr=addr;
+  shdrNew.sh_name=addStrtabEntryToExisting(patchedBin,newName,true);
+  shdrNew.sh_type=shdr.sh_type;
+  shdrNew.sh_flags=shdr.sh_flags | SHF_ALLOC;
+  shdrNew.sh_size=shdr.sh_size;
+  shdrNew.sh_link=0;//todo: should this be set?
+  shdrNew.sh_info=0;//todo: should this be set?
+  shdrNew.sh_addralign=shdr.sh_addralign;
+  shdrNew.sh_entsize=shdr.sh_entsize;
+  gelf_update_shdr(newscn,&shdrNew);
+  Elf_Data* newdata=elf_newdata(newscn);
+  *newdata=*data;
+  newdata->d_buf=zmalloc(newdata->d_size);
+  memcpy(newdata->d_buf,data->d_buf,data->d_size);
+  ownScnData(newdata,newdata->d_size);
+
+  //add a symbol
+  ElfXX_Sym sym;
+  memset(&sym,0,sizeof(ElfXX_Sym));
+  sym.st_info=ELFXX_ST_INFO(STB_LOCAL,STT_SECTION);
+  sym.st_name=0;//traditionally section symbols have no name (I dunno why) and
+  //keeping this consistency helps in reindexing symbols
+  sym.st_shndx=elf_ndxscn(newscn);
+  sym.st_value=addr;
+  addSymtabEntryToExisting(patchedBin,&sym);
+}
+
 //copies the section with name from patch into patchedBin with name newName
 //if newName is NULL, it will be taken to be the same as name
 addr_t copyInEntireSection(ElfInfo* patch,char* name,char* newName)
@@ -328,7 +365,6 @@ addr_t copyInEntireSection(ElfInfo* patch,char* name,char* newName)
   {
     newName=name;
   }
-  //todo: perhaps might make more sense to mmap that part of the file?
   Elf_Scn* scn=getSectionByName(patch,name);
   if(!scn)
   {
@@ -349,36 +385,50 @@ addr_t copyInEntireSection(ElfInfo* patch,char* name,char* newName)
   {
     logprintf(ELL_WARN,ELS_PATCHAPPLY,"Section %s does not contain any data, so cannot map it in\n",name);
   }
+  addSectionToPatchedBin(scn,data,newName,addr);
+  return addr;
+}
 
-  //and create a section for it
-  Elf_Scn* newscn = elf_newscn (patchedBin->e);
-  GElf_Shdr shdr,shdrNew;
-  gelf_getshdr(scn,&shdr);
-  gelf_getshdr(scn,&shdrNew);
-  shdrNew.sh_addr=addr;
-  shdrNew.sh_name=addStrtabEntryToExisting(patchedBin,newName,true);
-  shdrNew.sh_type=shdr.sh_type;
-  shdrNew.sh_flags=shdr.sh_flags | SHF_ALLOC;
-  shdrNew.sh_size=shdr.sh_size;
-  shdrNew.sh_link=0;//todo: should this be set?
-  shdrNew.sh_info=0;//todo: should this be set?
-  shdrNew.sh_addralign=shdr.sh_addralign;
-  shdrNew.sh_entsize=shdr.sh_entsize;
-  gelf_update_shdr(newscn,&shdrNew);
-  Elf_Data* newdata=elf_newdata(newscn);
-  *newdata=*data;
-  newdata->d_buf=zmalloc(newdata->d_size);
-  memcpy(newdata->d_buf,data->d_buf,data->d_size);
-
-  //add a symbol
-  ElfXX_Sym sym;
-  memset(&sym,0,sizeof(ElfXX_Sym));
-  sym.st_info=ELFXX_ST_INFO(STB_LOCAL,STT_SECTION);
-  sym.st_name=0;//traditionally section symbols have no name (I dunno why) and
-  //keeping this consistency helps in reindexing symbols
-  sym.st_shndx=elf_ndxscn(newscn);
-  sym.st_value=addr;
-  addSymtabEntryToExisting(patchedBin,&sym);
+//like copyInEntireSection for a section of the patch that is never
+//written to but by relocation (.text.new, .rodata.new). If the patch
+//was written with the section page aligned in the file, the target
+//maps it straight from a copy of the patch (patch->mapFname, as the
+//patch file itself may be rewritten while it's mapped) instead of us
+//copying it through ptrace word by word. Relocation then only copies
+//the pages it touches, and untouched pages are shared with every
+//other process that has the patch applied
+addr_t mapInEntireSection(ElfInfo* patch,char* name,int prot)
+{
+  Elf_Scn* scn=getSectionByName(patch,name);
+  if(!scn)
+  {
+    death("Failed to find section %s in patch\n",name);
+  }
+  GElf_Shdr shdr;
+  getShdr(scn,&shdr);
+  char path[PATH_MAX];
+  if(!shdr.sh_size || SHT_NOBITS==shdr.sh_type ||
+     shdr.sh_offset%sysconf(_SC_PAGE_SIZE) || !patch->mapFname ||
+     !realpath(patch->mapFname,path))
+  {
+    return copyInEntireSection(patch,name,NULL);
+  }
+  Elf_Data* data=elf_getdata(scn,NULL);
+  if(!data)
+  {
+    death("Failed to find data for section %s in patch\n",name);
+  }
+  addr_t addr=getPageAlignedFreeSpaceInTarget(shdr.sh_size);
+  if(mmapFileInTarget(path,shdr.sh_offset,shdr.sh_size,prot,addr))
+  {
+    logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"target mapped %s (%li bytes) from the patch at 0x%lx\n",name,(long)shdr.sh_size,(unsigned long)addr);
+  }
+  else
+  {
+    logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"mapping in the entirety of %s Copying %li bytes to 0x%lx\n",name,(long)data->d_size,(unsigned long)addr);
+    memcpyToTarget(addr,data->d_buf,data->d_size);
+  }
+  addSectionToPatchedBin(scn,data,name,addr);
   return addr;
 }
 
@@ -554,7 +604,17 @@ void fixupPatchRelocations(ElfInfo* patch)
     {
       flags|=ESFF_VERSIONED_SECTIONS_OK;
     }
-    int reindex=reindexSymbol(patch,patchedBin,symIdx,flags);
+    //the plan's target indices are good for patchedBin too, as it
+    //starts out with the target's symbol table
+    int reindex=STN_UNDEF;
+    if(patch->plan)
+    {
+      reindex=patch->plan->symbolMap[symIdx];
+    }
+    if(STN_UNDEF==reindex)
+    {
+      reindex=reindexSymbol(patch,patchedBin,symIdx,flags);
+    }
     logprintf(ELL_INFO_V2,ELS_SYMBOL,"reindexed to %i at 0x%x\n",reindex,(uint)getSymAddress(patchedBin,reindex));
     if(STN_UNDEF==reindex)
     {
@@ -765,10 +825,94 @@ void katanaPLT()
     memcpyToTarget(shdr.sh_addr+entryOffset+2,(byte*)&newAddr,4);//todo: support large code model
     memcpy(pltData->d_buf+entryOffset+2,&newAddr,4);
   }
+  elf_flagdata(pltData,ELF_C_SET,ELF_F_DIRTY);
+}
+
+//maps in the sections of one patch of a series and applies it. The
+//target must already be in a safe state
+static void applyPatchInSeries(int pid,ElfInfo* patch,DwarfInfo* diPatch,bool first)
+{
+  //map in the entirety of .text.new
+  patchTextAddr=mapInEntireSection(patch,".text.new",PROT_READ|PROT_EXEC);
+
+  //map in entirety of .rodata.new
+  patchRodataAddr=mapInEntireSection(patch,".rodata.new",PROT_READ);
+
+  patchDataAddr=copyInEntireSection(patch,".data.new",NULL);
+
+  //todo: now that we're trying to copy everything into the lower 32-bits even if
+  //on x86_64, this isn't really necessary, is it?
+  if(first)
+  {
+    katanaPLT();
+  }
+  
+  writeOutPatchedBin(false);
 
+  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"======Applying patches=======\n");
+  for(List* cuLi=diPatch->compilationUnits;cuLi;cuLi=cuLi->next)
+  {
+    CompilationUnit* cu=cuLi->value;
+    printf("reading patch compilation unit %s\n",cu->name);
+        
+    //first patch variables
+    VarInfo** vars=(VarInfo**) dictValues(cu->tv->globalVars);
+    for(int i=0;vars[i];i++)
+    {
+      applyVariablePatch(vars[i],patch);
+    }
+    free(vars);
+
+    //then patch functions
+    SubprogramInfo** subprograms=(SubprogramInfo**)dictValues(cu->subprograms);
+    for(int i=0;subprograms[i];i++)
+    {
+      applyFunctionPatch(subprograms[i],pid,oldBin,patch);
+    }
+    free(subprograms);
+  }
+
+
+  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"======Fixup Patch Relocations=======\n");
+  fixupPatchRelocations(patch);
+  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"====================================\n");
+  patchRelTextAddr=copyInEntireSection(patch,".rela.text.new",NULL);
+
+  writeOutPatchedBin(false);
+
+  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"======Performing Patch Relocations=======\n");
+    
+  //now perform relocations to our functions to give them a chance
+  //of working
+  Elf_Scn* relTextScn=getLastSectionByName(patchedBin,".rela.text.new");
+  Elf_Data* data=elf_getdata(relTextScn,NULL);
+  
+  RelocInfo reloc;
+  memset(&reloc,0,sizeof(reloc));
+  reloc.e=patchedBin;
+  reloc.scnIdx=elf_ndxscn(getLastSectionByName(patchedBin,".text.new"));
+  ElfXX_Rela* relas=getNativeRelas(patchedBin,data);
+  int numRelocs=data->d_size/sizeof(ElfXX_Rela);
+  for(int i=0;i<numRelocs;i++)
+  {
+    ElfXX_Rela buf;
+    ElfXX_Rela* rela=getRelaInTable(relas,data,i,&buf);
+    reloc.r_offset=rela->r_offset;
+    reloc.r_addend=rela->r_addend;
+    reloc.relocType=ELFXX_R_TYPE(rela->r_info);
+    reloc.symIdx=ELFXX_R_SYM(rela->r_info);
+    applyRelocation(&reloc,IN_MEM);//todo: on disk as well
+  }
+
+  writeOutPatchedBin(false);
 }
 
 void readAndApplyPatch(int pid,ElfInfo* targetBin_,ElfInfo* patch)
+{
+  readAndApplyPatches(pid,targetBin_,&patch,1);
+}
+
+void readAndApplyPatches(int pid,ElfInfo* targetBin_,ElfInfo** patches,int numPatches)
 {
   startPtrace(pid);
   targetBin=targetBin_;
@@ -779,13 +923,30 @@ void readAndApplyPatch(int pid,ElfInfo* targetBin_,ElfInfo* patch)
   //structures. It does, however, allow us to write an accurate symbol table,
   //relocation info, etc. This allows applying a patch to
   //an executable that's already had a patch applied to it.
-  int version=calculateVersionAfterPatch(pid,patch);
+  //It is kept as an overlay on the target binary: the sections we
+  //write to get their own copies, everything else stays shared with
+  //targetBin and only what differs is saved
+  //targets patched identically share one copy in the store
+  collectStalePatchState();
+  int version=calculateVersionAfterPatch(pid,patches[numPatches-1]);
   char* dir=createKatanaDirs(pid,version);
-  char patchedBinFname[256];
-  snprintf(patchedBinFname,256,"%s/exe",dir);
-  free(dir);
+  char* storeEntry=getPatchStoreEntry(targetBin,patches,numPatches);
+  char patchedBinFname[320];
+  if(storeEntry)
+  {
+    snprintf(patchedBinFname,320,"%s/overlay.%i",storeEntry,(int)getpid());
+  }
+  else
+  {
+    snprintf(patchedBinFname,320,"%s/overlay",dir);
+  }
   elf_flagelf(targetBin->e,ELF_C_SET,ELF_F_LAYOUT);
-  patchedBin=duplicateElf(targetBin,patchedBinFname,false,true);
+  static char* modifiedSections[]={".symtab",".strtab",".shstrtab",NULL};
+  patchedBin=overlayElf(targetBin,patchedBinFname,modifiedSections);
+  if(!patchedBin)
+  {
+    death("Could not create the patched binary %s\n",patchedBinFname);
+  }
   
   elf_flagelf(patchedBin->e,ELF_C_SET,ELF_F_LAYOUT);//we assume all responsibility
   //for layout. For some reason libelf seems to have issues with some of the program
@@ -804,13 +965,21 @@ void readAndApplyPatch(int pid,ElfInfo* targetBin_,ElfInfo* patch)
   //todo: we're assuming for now that symbols in the binary the patch was generated
   //with and in the target binary are going to have the same values
   //this isn't necessarily going to be the case
+  //everything is read up front so the target isn't kept waiting on it
   char cwd[PATH_MAX];
   getcwd(cwd,PATH_MAX);
-  DwarfInfo* diPatch=readDWARFTypes(patch,cwd);
-  Map* fdeMap=readDebugFrame(patch,false);//get mapping between fde offsets and fde structures
-  if(!fdeMap)
+  DwarfInfo** diPatches=zmalloc(sizeof(DwarfInfo*)*numPatches);
+  for(int i=0;i<numPatches;i++)
   {
-    death("Unable to read frame info, can't apply patch\n");
+    diPatches[i]=readDWARFTypes(patches[i],cwd);
+    if(!readDebugFrame(patches[i],false))
+    {
+      death("Unable to read frame info, can't apply patch %s\n",patches[i]->fname);
+    }
+    //later patches in a series apply to what the earlier ones
+    //produced, which no plan was made for
+    patches[i]->plan=i?NULL:readPatchPlan(patches[i],targetBin);
+    patches[i]->mapFname=getPatchCopy(patches[i],dir);
   }
   
 
@@ -829,16 +998,24 @@ void readAndApplyPatch(int pid,ElfInfo* targetBin_,ElfInfo* patch)
   setTargetTextStart(targetBin->textStart[IN_MEM]);
 
   
-  bringTargetToSafeState(targetBin,patch,pid);
+  bringTargetToSafeState(targetBin,patches,numPatches,pid);
 
   //reserve memory in a big block so that we'll have as much as we need
   uint amount=0;
   GElf_Shdr shdr;
   char* sectionsToMapIn[]={".text.new",".rodata.new",".data.new",".rela.text.new",NULL};
-  for(int i=0;sectionsToMapIn[i];i++)
+  for(int p=0;p<numPatches;p++)
   {
-    getShdr(getSectionByName(patch,sectionsToMapIn[i]),&shdr);
-    amount+=shdr.sh_size;
+    if(patches[p]->plan)
+    {
+      amount+=patches[p]->plan->mappedSize;
+      continue;
+    }
+    for(int i=0;sectionsToMapIn[i];i++)
+    {
+      getShdr(getSectionByName(patches[p],sectionsToMapIn[i]),&shdr);
+      amount+=shdr.sh_size;
+    }
   }
   //include their sizes so we can use ALTPLT/EXTPLT technique from ERESI/Elfsh
   getShdrByERS(targetBin,ERS_GOT,&shdr);
@@ -847,6 +1024,9 @@ void readAndApplyPatch(int pid,ElfInfo* targetBin_,ElfInfo* patch)
   amount+=shdr.sh_size;
   getShdrByERS(targetBin,ERS_GOTPLT,&shdr);
   amount+=shdr.sh_size;
+  //.text.new and .rodata.new may be mapped over whole pages of the
+  //reserved space (see mapInEntireSection)
+  amount+=numPatches*4*sysconf(_SC_PAGE_SIZE);
 
   #ifdef KATANA_X86_64_ARCH
   addr_t desiredAddress=0;
@@ -875,82 +1055,31 @@ void readAndApplyPatch(int pid,ElfInfo* targetBin_,ElfInfo* patch)
   #endif
     
 
-  //map in the entirety of .text.new
-  patchTextAddr=copyInEntireSection(patch,".text.new",NULL);
-
-  //map in entirety of .rodata.new
-  patchRodataAddr=copyInEntireSection(patch,".rodata.new",NULL);
-
-  patchDataAddr=copyInEntireSection(patch,".data.new",NULL);
-
-  //todo: now that we're trying to copy everything into the lower 32-bits even if
-  //on x86_64, this isn't really necessary, is it?
-  katanaPLT();
-  
-  writeOutPatchedBin(false);
-
-  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"======Applying patches=======\n");
-  for(List* cuLi=diPatch->compilationUnits;cuLi;cuLi=cuLi->next)
+  //each patch was generated against the binary the previous one
+  //produced, so applying them in order composes them: the newest
+  //version of a function wins and each patch's transformers see the
+  //data as the previous patch left it
+  for(int i=0;i<numPatches;i++)
   {
-    CompilationUnit* cu=cuLi->value;
-    printf("reading patch compilation unit %s\n",cu->name);
-        
-    //first patch variables
-    VarInfo** vars=(VarInfo**) dictValues(cu->tv->globalVars);
-    for(int i=0;vars[i];i++)
-    {
-      applyVariablePatch(vars[i],fdeMap,patch);
-    }
-    free(vars);
-
-    //then patch functions
-    SubprogramInfo** subprograms=(SubprogramInfo**)dictValues(cu->subprograms);
-    for(int i=0;subprograms[i];i++)
-    {
-      applyFunctionPatch(subprograms[i],pid,targetBin,patch);
-    }
-    free(subprograms);
+    logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"======Patch %i of %i: %s=======\n",i+1,numPatches,patches[i]->fname);
+    oldBin=i?patchedBin:targetBin;
+    applyPatchInSeries(pid,patches[i],diPatches[i],0==i);
+    //objects the transformers moved are only remembered within a patch,
+    //the next one sees them at their new addresses
+    cleanupDwarfVM();
   }
+  free(diPatches);
 
-
-  mapDelete(fdeMap,NULL,free);
-  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"======Fixup Patch Relocations=======\n");
-  fixupPatchRelocations(patch);
-  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"====================================\n");
-  patchRelTextAddr=copyInEntireSection(patch,".rela.text.new",NULL);
-
-  writeOutPatchedBin(false);
-
-  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"======Performing Patch Relocations=======\n");
-    
-  //now perform relocations to our functions to give them a chance
-  //of working
-  Elf_Scn* relTextScn=getSectionByName(patchedBin,".rela.text.new");
-  Elf_Data* data=elf_getdata(relTextScn,NULL);
-  
-  RelocInfo reloc;
-  memset(&reloc,0,sizeof(reloc));
-  reloc.e=patchedBin;
-  reloc.scnIdx=elf_ndxscn(getSectionByName(patchedBin,".text.new"));
-  GElf_Rela rela;
-  int numRelocs=data->d_size/sizeof(ElfXX_Rela);
-  for(int i=0;i<numRelocs;i++)
+  bool saved=storeEntry?storePatchedBin(patchedBin,storeEntry,dir):writeELFOverlay(patchedBin);
+  free(storeEntry);
+  free(dir);
+  if(!saved)
   {
-    if(!gelf_getrela(data,i,&rela))
-    {
-      death("Failed to get relocation\n");
-    }
-    reloc.r_offset=rela.r_offset;
-    reloc.r_addend=rela.r_addend;
-    reloc.relocType=ELF64_R_TYPE(rela.r_info);//elf64 because it's GElf
-    reloc.symIdx=ELF64_R_SYM(rela.r_info);//elf64 because it's GElf
-    applyRelocation(&reloc,IN_MEM);//todo: on disk as well
+    logprintf(ELL_WARN,ELS_PATCHAPPLY,"Could not save the patched binary, later patches to this process will not see this one\n");
   }
-
-  writeOutPatchedBin(true);
-  endELF(targetBin);
+  //patchedBin shares targetBin's data
   endELF(patchedBin);
-  cleanupDwarfVM();
+  endELF(targetBin);
   endPtrace(isFlag(EKCF_P_STOP_TARGET));
   printf("hooray! completed application of patch successfully\n");
 }
@@ -57,5 +57,8 @@
 #define patchapply_h
 
 void readAndApplyPatch(int pid,ElfInfo* targetBin,ElfInfo* patch);
+//applies a series of patches, each generated against the version the
+//one before it produces, while the target is stopped once
+void readAndApplyPatches(int pid,ElfInfo* targetBin,ElfInfo** patches,int numPatches);
 
 #endif
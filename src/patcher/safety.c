@@ -68,40 +68,11 @@
 #include "safety.h"
 #include "katana_config.h"
 #include "elfutil.h"
+#include "util/vector.h"
+#include "patchplan.h"
 
 static const int MAX_WAIT_SECONDS_BEFORE_TRY_CURRENT_FRAME = 2;
 
-FDE* getFDEForPC(ElfInfo* elf,addr_t pc)
-{
-  assert(elf->callFrameInfo.fdes);
-  //elf->callFrameInfo.fdes are sorted by lowpc, so we can do a binary search
-  size_t low=0;
-  size_t high=elf->callFrameInfo.numFDEs;
-  while(high-low>0)
-  {
-    size_t middle=low+(size_t)floor((float)(high-low)/2.0f);
-    if(elf->callFrameInfo.fdes[middle].lowpc > pc)
-    {
-      high=middle-1;
-    }
-    else if(elf->callFrameInfo.fdes[middle].highpc < pc)
-    {
-      low=middle+1;
-    }
-    else
-    {
-      //we've found it!
-      return &elf->callFrameInfo.fdes[middle];
-    }
-  }
-  if(elf->callFrameInfo.fdes[low].lowpc <= pc && elf->callFrameInfo.fdes[low].highpc >= pc)
-  {
-    return &elf->callFrameInfo.fdes[low];
-  }
-  return NULL;
-}
-
-
 //this function and the one below it are coded badly. This can be done
 //more efficiently
 
@@ -370,15 +341,24 @@ typedef struct
   idx_t symIdx;
 } ActivationFrame;
 
-//returns list with data type ActivationFrame. This list will be a list
-//of stack frames relevant to the target it will be ordered oldest
+VECTOR_DEFINE(ActivationFrameVec,ActivationFrame)
+VECTOR_DEFINE(IdxVec,idx_t)
+
+static int cmpIdx(const void* a,const void* b)
+{
+  idx_t idxA=*(const idx_t*)a;
+  idx_t idxB=*(const idx_t*)b;
+  return idxA<idxB?-1:(idxA>idxB?1:0);
+}
+
+//returns the stack frames relevant to the target. They will be ordered oldest
 //(further up the stack) to newest (further down the stack). This
 //ordering may be counter-intuitive, but makes sense because if we
 //find a safety conflict in something up the stack, it invalidates
 //everything further down the stack too
-DList* findActivationFrames(ElfInfo* elf,int pid)
+ActivationFrameVec findActivationFrames(ElfInfo* elf,int pid)
 {
-  DList* activationFramesHead=NULL;
+  ActivationFrameVec frames={0};
   startLibUnwind(pid);
   unw_word_t ip;
   GElf_Shdr shdr;
@@ -403,97 +383,108 @@ DList* findActivationFrames(ElfInfo* elf,int pid)
       if(STN_UNDEF!=symIdx)
       {
         logprintf(ELL_INFO_V1,ELS_SAFETY,"Found activation frame at 0x%x\n",ip);
-        DList* li=zmalloc(sizeof(DList));
-        li->value=zmalloc(sizeof(ActivationFrame));
-        ((ActivationFrame*)li->value)->pc=ip;
-        ((ActivationFrame*)li->value)->symIdx=symIdx;
-        //push the frame (which will be further up the stack) onto the front
-        //of the list. This gives us a list ordered from old to new
-        //this is because rejecting an older frame will reject all newer ones
-        dlistPush(&activationFramesHead,NULL,li);
+        ActivationFrame* frame=ActivationFrameVecPush(&frames);
+        frame->pc=ip;
+        frame->symIdx=symIdx;
       }
       //of if is STB_UNDEF, might be _start or something we don't care about
     }
   }
   endLibUnwind();
-  return activationFramesHead;
+  //we unwound from new to old, reverse to get the order from old to new
+  //this is because rejecting an older frame will reject all newer ones
+  for(int i=0;i<frames.len/2;i++)
+  {
+    ActivationFrame tmp=frames.data[i];
+    frames.data[i]=frames.data[frames.len-1-i];
+    frames.data[frames.len-1-i]=tmp;
+  }
+  return frames;
 }
 
 //find a location in the target where nothing that's being patched is being used.
-addr_t findSafeBreakpointForPatch(ElfInfo* targetBin,ElfInfo* patch,int pid,
-                                  bool avoidCurrentFrame)
+//when a series of patches is applied in one stop, that is nothing any
+//of them patches
+addr_t findSafeBreakpointForPatch(ElfInfo* targetBin,ElfInfo** patches,int numPatches,
+                                  int pid,bool avoidCurrentFrame)
 {
-  DList* activationFrames=findActivationFrames(targetBin,pid);
-  Elf_Data* unsafeFunctionsData=getDataByERS(patch,ERS_UNSAFE_FUNCTIONS);
-  if(!unsafeFunctionsData)
-  {
-    death("Patch object does not contain any unsafe functions data. This should not be\n");
-  }
-  size_t numUnsafeFunctions=unsafeFunctionsData->d_size/sizeof(idx_t);
-  //have to go through and reindex them all
-  idx_t* unsafeFunctions=zmalloc(numUnsafeFunctions*sizeof(idx_t));
-  for(int i=0;i<numUnsafeFunctions;i++)
+  ActivationFrameVec activationFrames=findActivationFrames(targetBin,pid);
+  IdxVec unsafeFunctions={0};
+  for(int p=0;p<numPatches;p++)
   {
-    idx_t symIdxPatch=((idx_t*)unsafeFunctionsData->d_buf)[i];
-    idx_t symIdxTarget=reindexSymbol(patch,targetBin,symIdxPatch,ESFF_VERSIONED_SECTIONS_OK);
-    if(STN_UNDEF==symIdxTarget)
+    ElfInfo* patch=patches[p];
+    Elf_Data* unsafeFunctionsData=getDataByERS(patch,ERS_UNSAFE_FUNCTIONS);
+    if(!unsafeFunctionsData)
     {
-      death("Failed to reindex symbol for unsafe function\n");
+      death("Patch object does not contain any unsafe functions data. This should not be\n");
     }
-    unsafeFunctions[i]=symIdxTarget;
-  }
-  DList* deepestGoodFrameLi=NULL;
-  DList* li=activationFrames;
-  for(;li;li=li->next)
-  {
-    ActivationFrame* frame=li->value;
-    idx_t symIdx=frame->symIdx;
-    bool unsafe=false;
+    size_t numUnsafeFunctions=unsafeFunctionsData->d_size/sizeof(idx_t);
+    if(patch->plan)
+    {
+      //already reindexed when the patch was generated
+      IdxVecSpan planned={patch->plan->unsafeFunctions,patch->plan->numUnsafeFunctions};
+      IdxVecAppend(&unsafeFunctions,planned);
+      continue;
+    }
+    //have to go through and reindex them all
+    IdxVecReserve(&unsafeFunctions,unsafeFunctions.len+numUnsafeFunctions);
     for(int i=0;i<numUnsafeFunctions;i++)
     {
-      if(symIdx==unsafeFunctions[i])
+      idx_t symIdxPatch=((idx_t*)unsafeFunctionsData->d_buf)[i];
+      idx_t symIdxTarget=reindexSymbol(patch,targetBin,symIdxPatch,ESFF_VERSIONED_SECTIONS_OK);
+      if(STN_UNDEF==symIdxTarget)
       {
-        unsafe=true;
-        break;
+        if(0==p)
+        {
+          death("Failed to reindex symbol for unsafe function\n");
+        }
+        //added by an earlier patch in the series, so the target
+        //can't be running it yet
+        continue;
       }
+      *IdxVecPush(&unsafeFunctions)=symIdxTarget;
     }
-    if(unsafe)
+  }
+  //sorted so each frame is a binary search rather than a scan
+  IdxVecSort(&unsafeFunctions,cmpIdx);
+  IdxVecSpan unsafeSpan=IdxVecAsSpan(&unsafeFunctions);
+  int deepestGoodFrame=-1;
+  for(int i=0;i<activationFrames.len;i++)
+  {
+    ActivationFrame* frame=&activationFrames.data[i];
+    if(IdxVecBSearch(unsafeSpan,&frame->symIdx,cmpIdx))
     {
       logprintf(ELL_INFO_V1,ELS_SAFETY,"Activation frame at 0x%x (%s) failed safety check\n",frame->pc,getFunctionNameAtPC(targetBin,frame->pc));
-      if(li->prev)
-      {
-        li->prev->next=NULL;
-      }
-      deleteDList(li,free);
-      li=NULL;
       break;
     }
     else
     {
-      deepestGoodFrameLi=li;
-      logprintf(ELL_INFO_V1,ELS_SAFETY,"Activation frame at 0x%x (%s) passed safety check\n",((ActivationFrame*)deepestGoodFrameLi->value)->pc,getFunctionNameAtPC(targetBin,frame->pc));
+      deepestGoodFrame=i;
+      logprintf(ELL_INFO_V1,ELS_SAFETY,"Activation frame at 0x%x (%s) passed safety check\n",frame->pc,getFunctionNameAtPC(targetBin,frame->pc));
     }
   }
-  if(!deepestGoodFrameLi)
+  IdxVecFree(&unsafeFunctions);
+  if(deepestGoodFrame<0)
   {
     printBacktrace(targetBin,pid);
     death("All functions with activation frames on the stack require patching. The application will never be in a patchable state!");
   }
 
-  if(deepestGoodFrameLi->prev && avoidCurrentFrame)
+  if(deepestGoodFrame>0 && avoidCurrentFrame)
   {
     //never break in the current function if possible
-    deepestGoodFrameLi = deepestGoodFrameLi->prev;
+    deepestGoodFrame--;
   }
-  
-  return ((ActivationFrame*)deepestGoodFrameLi->value)->pc;
-}
 
+  addr_t pc=activationFrames.data[deepestGoodFrame].pc;
+  ActivationFrameVecFree(&activationFrames);
+  return pc;
+}
 
-void bringTargetToSafeState(ElfInfo* targetBin,ElfInfo* patch,int pid)
+void bringTargetToSafeState(ElfInfo* targetBin,ElfInfo** patches,int numPatches,int pid)
 {
   bool avoidCurrentFrame = true;
-  addr_t safeBreakpointSpot=findSafeBreakpointForPatch(targetBin,patch,pid, avoidCurrentFrame);
+  addr_t safeBreakpointSpot=findSafeBreakpointForPatch(targetBin,patches,numPatches,pid, avoidCurrentFrame);
   logprintf(ELL_INFO_V2,ELS_PATCHAPPLY,"Setting breakpoint to apply patch at 0x%x\n",
             safeBreakpointSpot);
   setBreakpoint(safeBreakpointSpot);
@@ -512,7 +503,7 @@ void bringTargetToSafeState(ElfInfo* targetBin,ElfInfo* patch,int pid)
       waitpid(pid, NULL, WUNTRACED);
       removeBreakpoint(safeBreakpointSpot);
       avoidCurrentFrame = false;
-      safeBreakpointSpot = findSafeBreakpointForPatch(targetBin, patch, pid, avoidCurrentFrame);
+      safeBreakpointSpot = findSafeBreakpointForPatch(targetBin, patches, numPatches, pid, avoidCurrentFrame);
       setBreakpoint(safeBreakpointSpot);
       continuePtrace();
     }
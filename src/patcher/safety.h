@@ -58,8 +58,9 @@
 
 void printBacktrace(ElfInfo* elf,int pid);
 
-//find a location in the target where nothing that's being patched is being used.
-addr_t findSafeBreakpointForPatch(ElfInfo* targetBin,ElfInfo* patch,int pid, bool avoidCurrentFrame);
+//find a location in the target where nothing that's being patched by
+//any of the numPatches patches is being used.
+addr_t findSafeBreakpointForPatch(ElfInfo* targetBin,ElfInfo** patches,int numPatches,int pid, bool avoidCurrentFrame);
 
-void bringTargetToSafeState(ElfInfo* targetBin,ElfInfo* patch,int pid);
+void bringTargetToSafeState(ElfInfo* targetBin,ElfInfo** patches,int numPatches,int pid);
 #endif
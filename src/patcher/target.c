@@ -67,6 +67,7 @@
 #include "katana_config.h"
 #include "util/logging.h"
 #include "util/map.h"
+#include <fcntl.h>
 
 
 int pid;
@@ -504,6 +505,103 @@ addr_t mmapTarget(word_t size,int prot,addr_t desiredAddress)
   return retval;
 }
 
+//system calls return -errno on failure
+#define SYSCALL_FAILED(retval) ((retval)>(word_t)-4096)
+
+//how far below the target's stack pointer we may put things without
+//disturbing it (the x86_64 ABI lets leaf functions use 128 bytes
+//below the stack pointer)
+#define TARGET_STACK_RED_ZONE 128
+
+//has the target make the system call number with the given arguments
+//(at most 6) and returns what the call returned. Works the same way
+//as mmapTarget but passes everything in registers
+static word_t syscallTarget(word_t number,word_t* args,int numArgs)
+{
+  #ifdef KATANA_X86_ARCH
+  byte code[]={0xcd,0x80,0xcc,0x00};
+  #elif defined(KATANA_X86_64_ARCH)
+  byte code[]={0x0f,0x05,0xcc,0x00};
+  #else
+  #error Unknown architecture
+  #endif
+  assert(numArgs<=6);
+  word_t a[6]={0};
+  memcpy(a,args,numArgs*sizeof(word_t));
+
+  struct user_regs_struct oldRegs,newRegs;
+  getTargetRegs(&oldRegs);
+  newRegs=oldRegs;
+  byte oldText[4];
+  memcpyFromTarget(oldText,REG_IP(oldRegs),4);
+  memcpyToTarget(REG_IP(oldRegs),code,4);
+
+  #ifdef KATANA_X86_ARCH
+  REG_BX(newRegs)=a[0];
+  REG_CX(newRegs)=a[1];
+  REG_DX(newRegs)=a[2];
+  REG_SI(newRegs)=a[3];
+  REG_DI(newRegs)=a[4];
+  REG_BP(newRegs)=a[5];
+  #else
+  REG_DI(newRegs)=a[0];
+  REG_SI(newRegs)=a[1];
+  REG_DX(newRegs)=a[2];
+  REG_10(newRegs)=a[3];
+  REG_8(newRegs)=a[4];
+  REG_9(newRegs)=a[5];
+  #endif
+  REG_AX(newRegs)=number;
+  setTargetRegs(&newRegs);
+
+  continuePtrace();
+  wait(NULL);
+  getTargetRegs(&newRegs);
+  word_t retval=REG_AX(newRegs);
+
+  memcpyToTarget(REG_IP(oldRegs),oldText,4);
+  setTargetRegs(&oldRegs);
+  return retval;
+}
+
+addr_t mmapFileInTarget(char* fname,word_t offset,word_t size,int prot,addr_t addr)
+{
+  assert(0==offset%sysconf(_SC_PAGE_SIZE) && 0==addr%sysconf(_SC_PAGE_SIZE));
+  //the name has to be in the target for it to open the file. It
+  //goes on the target's stack, past anything the stack is using
+  struct user_regs_struct regs;
+  getTargetRegs(&regs);
+  int len=strlen(fname)+1;
+  addr_t fnameInTarget=(REG_SP(regs)-TARGET_STACK_RED_ZONE-len)&~(addr_t)0xF;
+  memcpyToTarget(fnameInTarget,(byte*)fname,len);
+
+  word_t openArgs[]={fnameInTarget,O_RDONLY,0};
+  word_t fd=syscallTarget(SYS_open,openArgs,3);
+  if(SYSCALL_FAILED(fd))
+  {
+    logprintf(ELL_INFO_V1,ELS_HOTPATCH,"Target could not open %s (errno %i)\n",fname,(int)-fd);
+    return 0;
+  }
+
+  #ifdef KATANA_X86_ARCH
+  //mmap2 takes the offset in pages
+  word_t mmapArgs[]={addr,size,prot,MAP_PRIVATE|MAP_FIXED,fd,offset/sysconf(_SC_PAGE_SIZE)};
+  word_t result=syscallTarget(SYS_mmap2,mmapArgs,6);
+  #else
+  word_t mmapArgs[]={addr,size,prot,MAP_PRIVATE|MAP_FIXED,fd,offset};
+  word_t result=syscallTarget(SYS_mmap,mmapArgs,6);
+  #endif
+  //the mapping keeps its own reference to the file
+  word_t closeArgs[]={fd};
+  syscallTarget(SYS_close,closeArgs,1);
+  if(SYSCALL_FAILED(result))
+  {
+    logprintf(ELL_INFO_V1,ELS_HOTPATCH,"Target could not map %s (errno %i)\n",fname,(int)-result);
+    return 0;
+  }
+  logprintf(ELL_INFO_V2,ELS_HOTPATCH,"Target mapped 0x%zx bytes of %s at offset 0x%zx to 0x%zx\n",(size_t)size,fname,(size_t)offset,(size_t)result);
+  return result;
+}
 
 //compare a string to a string located
 //at a certain address in the target
@@ -93,6 +93,13 @@ void setTargetRegs(struct user_regs_struct* regs);
 //return the address (in the target) of the region
 //or NULL if the operation failed
 addr_t mmapTarget(word_t size,int prot,addr_t desiredAddress);
+//has the target map size bytes of the file fname, starting at offset,
+//privately at addr, replacing whatever is mapped there. Both offset
+//and addr must be page aligned and addr must be memory katana
+//reserved in the target. Writes made through ptrace afterwards only
+//copy the pages they touch. Returns addr, or 0 if the target
+//couldn't map the file
+addr_t mmapFileInTarget(char* fname,word_t offset,word_t size,int prot,addr_t addr);
 
 //must be called before any calls to mallocTarget
 void setMallocAddress(addr_t addr);
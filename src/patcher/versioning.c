@@ -57,29 +57,96 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include "util/logging.h"
+#include "util/hash.h"
+#include "util/file.h"
+#include "util/growingBuffer.h"
+#include "util/vector.h"
+#include "elfoverlay.h"
+#include "elfutil.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ftw.h>
+#include <sys/file.h>
+
+//held shared from getPatchStoreEntry until storePatchedBin is done
+//with the entry, so collectStalePatchState, which needs it
+//exclusively, never removes an entry that is being filled or linked to
+static int storeLockFd=-1;
+
+//returns whether the lock was taken. operation is as for flock
+static bool lockStore(int operation)
+{
+  char fname[256];
+  snprintf(fname,256,"/tmp/katana-%s/store/.lock",getenv("USER"));
+  int fd=open(fname,O_RDWR|O_CREAT,S_IRUSR|S_IWUSR);
+  if(fd<0)
+  {
+    return false;
+  }
+  if(flock(fd,operation))
+  {
+    close(fd);
+    return false;
+  }
+  storeLockFd=fd;
+  return true;
+}
+
+static void unlockStore()
+{
+  if(storeLockFd>=0)
+  {
+    close(storeLockFd);
+    storeLockFd=-1;
+  }
+}
+
+static bool isProcStillRunning(char* procDir,int pid);
+
+//the highest version pid has been patched to, 0 if it never has
+static int getNewestVersion(int pid)
+{
+  char procDir[256];
+  snprintf(procDir,256,"/tmp/katana-%s/patched/%i",getenv("USER"),pid);
+  DIR* d=opendir(procDir);
+  int newest=0;
+  for(struct dirent* ent=d?readdir(d):NULL;ent;ent=readdir(d))
+  {
+    //alongside the version directories is the start file
+    int version=atoi(ent->d_name);
+    if(version>newest)
+    {
+      newest=version;
+    }
+  }
+  if(d)
+  {
+    closedir(d);
+  }
+  return newest;
+}
 
 ElfInfo* getElfRepresentingProc(int pid)
 {
   ElfInfo* result=NULL;
-  struct stat s;
-  char previousPatchesDir[256];
-  snprintf(previousPatchesDir,256,"/tmp/katana-%s/patched/%i",
-           getenv("USER"),pid);
-  //todo: enable this when actually supporting multiple versions
-  //of patches
-  if(0==stat(previousPatchesDir,&s) && false)
-  {
-    //this directory exists, there are previous patches
-    struct dirent** dirEntries;
-    int numEntries=scandir(previousPatchesDir,&dirEntries,NULL,versionsort);
-    //we only care about the newest version, i.e the highest version number
-    char* vname=strdup(dirEntries[numEntries-1]->d_name);
-    free(dirEntries);
-    char buf[256];
-    snprintf(buf,256,"%s/%s/exe",previousPatchesDir,vname);
-    result=openELFFile(buf);
+  char procDir[256];
+  snprintf(procDir,256,"/tmp/katana-%s/patched/%i",getenv("USER"),pid);
+  int version=getNewestVersion(pid);
+  //the directory may have been left by an earlier process with this pid
+  if(version && isProcStillRunning(procDir,pid))
+  {
+    //there are previous patches, the newest version includes them all
+    char buf[300];
+    snprintf(buf,300,"%s/%i/overlay",procDir,version);
+    result=openELFOverlay(buf);
+    if(!result)
+    {
+      logprintf(ELL_WARN,ELS_VERSION,"Cannot read %s, the process will be treated as never having been patched\n",buf);
+    }
   }
-  else
+  if(!result)
   {
     char execPath[128];
     snprintf(execPath,128,"/proc/%i/exe",pid);
@@ -96,6 +163,27 @@ ElfInfo* getElfRepresentingProc(int pid)
   return result;
 }
 
+//the kernel's start time for the process, which together with the pid
+//identifies it even if the pid is later reused
+static bool getProcStartTime(int pid,unsigned long long* startTime)
+{
+  char path[64];
+  snprintf(path,64,"/proc/%i/stat",pid);
+  FILE* f=fopen(path,"r");
+  if(!f)
+  {
+    return false;
+  }
+  char buf[1024];
+  size_t len=fread(buf,1,sizeof(buf)-1,f);
+  fclose(f);
+  buf[len]='\0';
+  //the command name in parentheses may contain spaces, the fields we
+  //care about come after it. starttime is the 22nd field
+  char* p=strrchr(buf,')');
+  return p && 1==sscanf(p+1," %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu",startTime);
+}
+
 char* createKatanaDirs(int pid,int version)
 {
   //todo: error checking
@@ -108,6 +196,19 @@ char* createKatanaDirs(int pid,int version)
   mkdir(buf2,mode);
   snprintf(buf2,256,"%s/patched/%i",buf1,pid);
   mkdir(buf2,mode);
+  //so that collectStalePatchState can tell when the process is gone
+  unsigned long long startTime;
+  if(getProcStartTime(pid,&startTime))
+  {
+    char startFname[256];
+    snprintf(startFname,256,"%s/start",buf2);
+    FILE* f=fopen(startFname,"w");
+    if(f)
+    {
+      fprintf(f,"%llu\n",startTime);
+      fclose(f);
+    }
+  }
   snprintf(buf2,256,"%s/patched/%i/%i",buf1,pid,version);
   mkdir(buf2,mode);
   return strdup(buf2);
@@ -115,8 +216,7 @@ char* createKatanaDirs(int pid,int version)
 
 int calculateVersionAfterPatch(int pid,ElfInfo* patch)
 {
-  //todo: versioning (hardcoded patching to version 1 here)
-  return 1;
+  return getNewestVersion(pid)+1;
 }
 
 char* getVersionStringOfPatchSections()
@@ -124,3 +224,387 @@ char* getVersionStringOfPatchSections()
   //todo: figure out an actual versioning system
   return "new";
 }
+
+static uint64_t hashFile(char* fname,word_t* size)
+{
+  int fd=open(fname,O_RDONLY);
+  struct stat st;
+  if(fd<0 || fstat(fd,&st))
+  {
+    death("Cannot read %s to identify it\n",fname);
+  }
+  *size=st.st_size;
+  uint64_t hash=hashBytes(NULL,0);
+  if(st.st_size)
+  {
+    void* contents=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if(MAP_FAILED==contents)
+    {
+      death("Cannot map %s to identify it\n",fname);
+    }
+    hash=hashBytes(contents,st.st_size);
+    munmap(contents,st.st_size);
+  }
+  close(fd);
+  return hash;
+}
+
+//names of the files a store entry's identity was taken from
+VECTOR_DEFINE(FnameVec,char*)
+
+static void addLineToIdentity(GrowingBuffer* buf,char* line)
+{
+  addToGrowingBuffer(buf,line,strlen(line));
+}
+
+//describes e well enough that two binaries with the same description
+//are the same. An overlay is described as its base followed by the
+//overlay, so a target patched several times is described by the
+//original binary and each patch in order. The files read are added to
+//inputs
+static void describeTarget(ElfInfo* e,GrowingBuffer* buf,FnameVec* inputs)
+{
+  char line[512];
+  word_t size;
+  uint64_t hash;
+  if(e->overlayBase)
+  {
+    describeTarget(e->overlayBase,buf,inputs);
+    *FnameVecPush(inputs)=e->fname;
+    hash=hashFile(e->fname,&size);
+    snprintf(line,sizeof(line),"overlay %zu %016llx\n",(size_t)size,(unsigned long long)hash);
+    addLineToIdentity(buf,line);
+    return;
+  }
+  uint32 buildIdLen;
+  byte* buildId=getBuildId(e,&buildIdLen);
+  if(buildId)
+  {
+    addLineToIdentity(buf,"build-id ");
+    for(int i=0;i<buildIdLen;i++)
+    {
+      snprintf(line,sizeof(line),"%02x",buildId[i]);
+      addLineToIdentity(buf,line);
+    }
+    addLineToIdentity(buf,"\n");
+    *FnameVecPush(inputs)=e->fname;
+    return;
+  }
+  //no build id, go by the file itself
+  hash=hashFile(e->fname,&size);
+  snprintf(line,sizeof(line),"binary %zu %016llx\n",(size_t)size,(unsigned long long)hash);
+  addLineToIdentity(buf,line);
+}
+
+//makes fname in the store entry dir, as a copy of the open file fd or
+//with the given contents, unless it is already there. It is written
+//under a temporary name first so nobody sees it half written. Returns
+//false if it can't be made, or if it was already there and isn't the
+//same
+static bool addToStoreEntry(char* dir,char* fname,int fd,void* contents,int len)
+{
+  char entryFname[300];
+  char tmpFname[320];
+  snprintf(entryFname,300,"%s/%s",dir,fname);
+  snprintf(tmpFname,320,"%s.%i",entryFname,(int)getpid());
+  unlink(tmpFname);
+  bool ok;
+  if(contents)
+  {
+    int tmpFd=open(tmpFname,O_WRONLY|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR);
+    ok=tmpFd>=0 && writeAll(tmpFd,contents,len);
+    if(tmpFd>=0)
+    {
+      close(tmpFd);
+    }
+  }
+  else
+  {
+    //copied rather than linked, a hard link would follow the input
+    //if it were rewritten in place
+    ok=copyFileFromFd(fd,tmpFname);
+  }
+  if(ok && link(tmpFname,entryFname))
+  {
+    //somebody else made it first
+    ok=EEXIST==errno && haveSameContents(tmpFname,entryFname);
+  }
+  unlink(tmpFname);
+  return ok;
+}
+
+char* getPatchStoreEntry(ElfInfo* targetBin,ElfInfo** patches,int numPatches)
+{
+  GrowingBuffer identity={0};
+  FnameVec inputs={0};
+  describeTarget(targetBin,&identity,&inputs);
+  for(int i=0;i<numPatches;i++)
+  {
+    *FnameVecPush(&inputs)=patches[i]->fname;
+    char line[128];
+    word_t size;
+    uint64_t hash=hashFile(patches[i]->fname,&size);
+    snprintf(line,sizeof(line),"patch %zu %016llx\n",(size_t)size,(unsigned long long)hash);
+    addLineToIdentity(&identity,line);
+  }
+  addToGrowingBuffer(&identity,"",1);
+
+  char dir[256];
+  snprintf(dir,256,"/tmp/katana-%s",getenv("USER"));
+  mkdir(dir,S_IRWXU);
+  snprintf(dir,256,"/tmp/katana-%s/store",getenv("USER"));
+  mkdir(dir,S_IRWXU);
+  if(!lockStore(LOCK_SH))
+  {
+    logprintf(ELL_WARN,ELS_VERSION,"Cannot lock the patch store\n");
+    free(identity.data);
+    FnameVecFree(&inputs);
+    return NULL;
+  }
+  snprintf(dir,256,"/tmp/katana-%s/store/%016llx",getenv("USER"),
+           (unsigned long long)hashBytes(identity.data,identity.len));
+  if(mkdir(dir,S_IRWXU) && EEXIST!=errno)
+  {
+    logprintf(ELL_WARN,ELS_VERSION,"Cannot create store entry %s\n",dir);
+    free(identity.data);
+    FnameVecFree(&inputs);
+    unlockStore();
+    return NULL;
+  }
+
+  //the identity only holds hashes, so the entry keeps a copy of
+  //everything it was taken from as well, and we go by the files
+  //themselves before sharing it. The identity goes in last, an entry
+  //without one may still be being filled
+  bool matches=true;
+  for(int i=0;matches && i<inputs.len;i++)
+  {
+    char inputName[32];
+    snprintf(inputName,32,"input.%i",i);
+    int fd=open(inputs.data[i],O_RDONLY);
+    matches=fd>=0 && addToStoreEntry(dir,inputName,fd,NULL,0);
+    if(fd>=0)
+    {
+      close(fd);
+    }
+  }
+  matches=matches && addToStoreEntry(dir,"identity",-1,identity.data,identity.len-1);
+  free(identity.data);
+  FnameVecFree(&inputs);
+  if(!matches)
+  {
+    logprintf(ELL_WARN,ELS_VERSION,"Store entry %s belongs to a different patched binary, not sharing it\n",dir);
+    unlockStore();
+    return NULL;
+  }
+  return strdup(dir);
+}
+
+bool storePatchedBin(ElfInfo* patchedBin,char* storeEntry,char* procDir)
+{
+  char storeFname[300];
+  snprintf(storeFname,300,"%s/overlay",storeEntry);
+  char procFname[300];
+  snprintf(procFname,300,"%s/overlay",procDir);
+  unlink(procFname);
+  bool result;
+  struct stat st;
+  if(stat(storeFname,&st))
+  {
+    //patchedBin was created in the store entry under a temporary name.
+    //procDir links to it before it's renamed into place, so it is
+    //never in the store without a reference to it. If another katana
+    //got there first that's fine, it wrote the same thing
+    result=writeELFOverlay(patchedBin) && !link(patchedBin->fname,procFname);
+    if(result && rename(patchedBin->fname,storeFname))
+    {
+      logprintf(ELL_WARN,ELS_VERSION,"Cannot add %s to the store, it will not be shared\n",procFname);
+    }
+  }
+  else
+  {
+    logprintf(ELL_INFO_V1,ELS_VERSION,"Patched binary already in the store at %s\n",storeEntry);
+    //a symbolic link wouldn't count as a reference to it
+    result=!link(storeFname,procFname);
+  }
+  if(!result)
+  {
+    logprintf(ELL_WARN,ELS_VERSION,"Cannot save %s in the store as %s\n",procFname,storeFname);
+    unlink(procFname);
+  }
+  unlink(patchedBin->fname);
+  unlockStore();
+  return result;
+}
+
+char* getPatchCopy(ElfInfo* patch,char* procDir)
+{
+  if(!patch->map)
+  {
+    return NULL;
+  }
+  char name[64];
+  snprintf(name,64,"%016llx-%zu.po",(unsigned long long)hashBytes(patch->map,patch->mapSize),patch->mapSize);
+  char storeFname[300];
+  snprintf(storeFname,300,"/tmp/katana-%s/store/patches",getenv("USER"));
+  mkdir(storeFname,S_IRWXU);
+  snprintf(storeFname,300,"/tmp/katana-%s/store/patches/%s",getenv("USER"),name);
+  char procFname[300];
+  snprintf(procFname,300,"%s/%s",procDir,name);
+  unlink(procFname);
+
+  //if there is a copy already we share it. We always go by our own
+  //link to it, which collectStalePatchState can't take away
+  int len;
+  char* existing=getFileContents(storeFname,&len);
+  bool same=existing && len==patch->mapSize && !memcmp(existing,patch->map,len);
+  free(existing);
+  if(same && !link(storeFname,procFname))
+  {
+    return strdup(procFname);
+  }
+
+  //otherwise we write our own and offer it to the store. The patch is
+  //copied as we read it, whatever has happened to the file since
+  int fd=open(procFname,O_WRONLY|O_CREAT|O_EXCL,S_IRUSR);
+  if(fd<0)
+  {
+    return NULL;
+  }
+  bool ok=write(fd,patch->map,patch->mapSize)==patch->mapSize;
+  close(fd);
+  if(!ok)
+  {
+    logprintf(ELL_WARN,ELS_VERSION,"Cannot copy %s to %s\n",patch->fname,procFname);
+    unlink(procFname);
+    return NULL;
+  }
+  if(!same)
+  {
+    //replacing whatever different file had our name
+    char tmpFname[320];
+    snprintf(tmpFname,320,"%s.%i",storeFname,(int)getpid());
+    if(!link(procFname,tmpFname) && rename(tmpFname,storeFname))
+    {
+      unlink(tmpFname);
+    }
+  }
+  return strdup(procFname);
+}
+
+static int removeTreeEntry(const char* path,const struct stat* st,int type,struct FTW* ftw)
+{
+  remove(path);
+  return 0;
+}
+
+static void removeTree(char* path)
+{
+  nftw(path,removeTreeEntry,16,FTW_DEPTH|FTW_PHYS);
+}
+
+static bool isProcStillRunning(char* procDir,int pid)
+{
+  char startFname[300];
+  snprintf(startFname,300,"%s/start",procDir);
+  unsigned long long recorded,current;
+  FILE* f=fopen(startFname,"r");
+  bool haveRecorded=f && 1==fscanf(f,"%llu",&recorded);
+  if(f)
+  {
+    fclose(f);
+  }
+  if(!getProcStartTime(pid,&current))
+  {
+    return false;
+  }
+  //without a recorded start time all we can go on is the pid
+  return !haveRecorded || recorded==current;
+}
+
+void collectStalePatchState()
+{
+  char dir[256];
+  snprintf(dir,256,"/tmp/katana-%s/patched",getenv("USER"));
+  DIR* d=opendir(dir);
+  for(struct dirent* ent=d?readdir(d):NULL;ent;ent=readdir(d))
+  {
+    int pid=atoi(ent->d_name);
+    if(pid<=0)
+    {
+      continue;
+    }
+    char procDir[300];
+    snprintf(procDir,300,"%s/%s",dir,ent->d_name);
+    if(!isProcStillRunning(procDir,pid))
+    {
+      logprintf(ELL_INFO_V1,ELS_VERSION,"process %i has exited, removing %s\n",pid,procDir);
+      removeTree(procDir);
+    }
+  }
+  if(d)
+  {
+    closedir(d);
+  }
+
+  //store entries only the store itself links to are no longer used.
+  //If anybody is filling or linking to an entry we leave them all
+  //until next time
+  if(!lockStore(LOCK_EX|LOCK_NB))
+  {
+    return;
+  }
+  snprintf(dir,256,"/tmp/katana-%s/store",getenv("USER"));
+  d=opendir(dir);
+  for(struct dirent* ent=d?readdir(d):NULL;ent;ent=readdir(d))
+  {
+    if('.'==ent->d_name[0] || !strcmp("patches",ent->d_name))
+    {
+      continue;
+    }
+    char entry[300];
+    char fname[320];
+    snprintf(entry,300,"%s/%s",dir,ent->d_name);
+    snprintf(fname,320,"%s/overlay",entry);
+    struct stat st;
+    bool stale;
+    if(0==stat(fname,&st))
+    {
+      stale=st.st_nlink<=1;
+    }
+    else
+    {
+      //nobody holds the lock, so nobody is going to write one
+      stale=true;
+    }
+    if(stale)
+    {
+      logprintf(ELL_INFO_V1,ELS_VERSION,"removing unused store entry %s\n",entry);
+      removeTree(entry);
+    }
+  }
+  if(d)
+  {
+    closedir(d);
+  }
+  unlockStore();
+
+  //and copies of patches. Whoever maps one has their own link to it
+  //so these can go whenever only the store has one
+  snprintf(dir,256,"/tmp/katana-%s/store/patches",getenv("USER"));
+  d=opendir(dir);
+  for(struct dirent* ent=d?readdir(d):NULL;ent;ent=readdir(d))
+  {
+    char fname[320];
+    snprintf(fname,320,"%s/%s",dir,ent->d_name);
+    struct stat st;
+    if('.'!=ent->d_name[0] && 0==stat(fname,&st) && st.st_nlink<=1)
+    {
+      unlink(fname);
+    }
+  }
+  if(d)
+  {
+    closedir(d);
+  }
+}
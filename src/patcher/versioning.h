@@ -60,4 +60,35 @@ ElfInfo* getElfRepresentingProc(int pid);
 int calculateVersionAfterPatch(int pid,ElfInfo* patch);
 char* getVersionStringOfPatchSections();
 char* createKatanaDirs(int pid,int version);
+
+//patched binaries are kept in a store shared by every process, under
+///tmp/katana-$USER/store/KEY, where KEY is a hash of the target
+//binary's identity (its build id, or contents if it has none) and the
+//patches applied to it in order. Each entry keeps copies of the files
+//its identity was taken from, and is only shared with a patching whose
+//files are byte for byte the same. The directory of each patched
+//process hard links to the entry, so the link count tells us whether
+//anything still uses it. Entries are only removed under an exclusive
+//lock on the store, which getPatchStoreEntry takes shared until
+//storePatchedBin has linked to the entry.
+
+//returns the store entry directory (to be freed) that the result of
+//applying the series of patches to targetBin belongs in, creating it
+//if need be. NULL if the store can't be used
+char* getPatchStoreEntry(ElfInfo* targetBin,ElfInfo** patches,int numPatches);
+//patchedBin must have been created as an overlay in storeEntry under
+//a temporary name. Saves it as the entry's overlay unless an
+//identical one is already there, then links procDir (from
+//createKatanaDirs) to it
+bool storePatchedBin(ElfInfo* patchedBin,char* storeEntry,char* procDir);
+//the target maps patch code from the patch file, so it must never be
+//truncated or rewritten under it. Returns the name (to be freed) of a
+//copy of patch as read (it must have been mapped, see openELFFile)
+//in procDir. Copies of the same patch are shared through the store,
+//so that the target shares its pages with every other process the
+//patch has been applied to. NULL if a copy can't be made
+char* getPatchCopy(ElfInfo* patch,char* procDir);
+//removes the directories of processes that have exited and store
+//entries no process uses any more
+void collectStalePatchState();
 #endif
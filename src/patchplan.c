@@ -0,0 +1,206 @@
+/*
+  File: patchplan.c
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: writing and reading the application plan carried in a
+               patch object's .katana.plan section
+*/
+
+#include "patchplan.h"
+#include "elfutil.h"
+#include "elfwriter.h"
+#include "symbol.h"
+#include "constants.h"
+#include "util/logging.h"
+
+//the section holds a PatchPlanHeader, the target's build id padded to
+//a multiple of 8 bytes, numSymbols idx_t and then numUnsafeFunctions
+//idx_t, all in host form like .unsafe_functions
+typedef struct
+{
+  char magic[8];
+  uint32 version;
+  uint32 buildIdLen;
+  uint32 numSymbols;//entries in the patch's symbol table
+  uint32 numUnsafeFunctions;
+  uint32 numTargetSymbols;//entries in the target's symbol table
+  uint32 pad;
+  uint64_t mappedSize;
+} PatchPlanHeader;
+
+#define PLAN_ALIGN(x) (((x)+7)&~7)
+
+static char* mappedSections[]={".text.new",".rodata.new",".data.new",".rela.text.new",NULL};
+
+static word_t sectionDataSize(ElfInfo* e,char* name)
+{
+  Elf_Scn* scn=getSectionByName(e,name);
+  if(!scn)
+  {
+    death("Patch has no %s section\n",name);
+  }
+  //a section may be made up of a chain of several Elf_Data
+  word_t size=0;
+  for(Elf_Data* data=elf_getdata(scn,NULL);data;data=elf_getdata(scn,data))
+  {
+    size+=data->d_size;
+  }
+  return size;
+}
+
+static int cmpIdx(const void* a,const void* b)
+{
+  idx_t x=*(const idx_t*)a;
+  idx_t y=*(const idx_t*)b;
+  return x<y?-1:(x>y?1:0);
+}
+
+void writePatchPlan(ElfInfo* patch,ElfInfo* targetBin)
+{
+  uint32 buildIdLen;
+  byte* buildId=getBuildId(targetBin,&buildIdLen);
+  if(!buildId)
+  {
+    logprintf(ELL_INFO_V1,ELS_PATCHWRITE,"%s has no build id, not writing an application plan\n",targetBin->fname);
+    return;
+  }
+
+  PatchPlanHeader header;
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,PATCH_PLAN_MAGIC,sizeof(header.magic));
+  header.version=PATCH_PLAN_VERSION;
+  header.buildIdLen=buildIdLen;
+  header.numSymbols=getDataByERS(patch,ERS_SYMTAB)->d_size/sizeof(ElfXX_Sym);
+  header.numTargetSymbols=targetBin->symTabCount;
+  for(int i=0;mappedSections[i];i++)
+  {
+    header.mappedSize+=sectionDataSize(patch,mappedSections[i]);
+  }
+
+  //match symbols the same way fixupPatchRelocations does
+  idx_t* symbolMap=zmalloc(sizeof(idx_t)*header.numSymbols);
+  int numResolved=0;
+  for(int i=1;i<header.numSymbols;i++)
+  {
+    GElf_Sym sym;
+    getSymbol(patch,i,&sym);
+    int flags=ESFF_MANGLED_OK | ESFF_BSS_MATCH_DATA_OK;
+    if(ELF64_ST_TYPE(sym.st_info)!=STT_SECTION)
+    {
+      flags|=ESFF_VERSIONED_SECTIONS_OK;
+    }
+    symbolMap[i]=findSymbol(targetBin,&sym,patch,flags);
+    if(STN_UNDEF!=symbolMap[i])
+    {
+      numResolved++;
+    }
+  }
+
+  //and the unsafe functions the way findSafeBreakpointForPatch does
+  Elf_Data* unsafeData=getDataByERS(patch,ERS_UNSAFE_FUNCTIONS);
+  header.numUnsafeFunctions=unsafeData->d_size/sizeof(idx_t);
+  idx_t* unsafeFunctions=zmalloc(sizeof(idx_t)*(header.numUnsafeFunctions+1));
+  for(int i=0;i<header.numUnsafeFunctions;i++)
+  {
+    GElf_Sym sym;
+    getSymbol(patch,((idx_t*)unsafeData->d_buf)[i],&sym);
+    unsafeFunctions[i]=findSymbol(targetBin,&sym,patch,ESFF_VERSIONED_SECTIONS_OK);
+    if(STN_UNDEF==unsafeFunctions[i])
+    {
+      //the patch can't be applied to this target anyway, leave that
+      //to be reported when it is tried
+      logprintf(ELL_WARN,ELS_PATCHWRITE,"Unsafe function not found in %s, not writing an application plan\n",targetBin->fname);
+      free(symbolMap);
+      free(unsafeFunctions);
+      return;
+    }
+  }
+  qsort(unsafeFunctions,header.numUnsafeFunctions,sizeof(idx_t),cmpIdx);
+
+  Elf_Scn* scn=elf_newscn(patch->e);
+  Elf_Data* data=elf_newdata(scn);
+  data->d_align=sizeof(idx_t);
+  data->d_version=EV_CURRENT;
+  ElfXX_Shdr* shdr=elfxx_getshdr(scn);
+  shdr->sh_type=SHT_KATANA_PLAN;
+  shdr->sh_link=elf_ndxscn(getSectionByERS(patch,ERS_SYMTAB));
+  shdr->sh_info=SHN_UNDEF;
+  shdr->sh_addralign=sizeof(idx_t);
+  shdr->sh_name=addStrtabEntry(patch,".katana.plan");
+
+  static const byte zeros[8]={0};
+  addDataToScn(data,&header,sizeof(header));
+  addDataToScn(data,buildId,buildIdLen);
+  addDataToScn(data,zeros,PLAN_ALIGN(buildIdLen)-buildIdLen);
+  addDataToScn(data,symbolMap,sizeof(idx_t)*header.numSymbols);
+  addDataToScn(data,unsafeFunctions,sizeof(idx_t)*header.numUnsafeFunctions);
+  logprintf(ELL_INFO_V1,ELS_PATCHWRITE,"Wrote application plan for %s, %i of %i symbols resolved\n",targetBin->fname,numResolved,(int)header.numSymbols);
+  free(symbolMap);
+  free(unsafeFunctions);
+}
+
+PatchPlan* readPatchPlan(ElfInfo* patch,ElfInfo* targetBin)
+{
+  Elf_Scn* scn=getSectionByName(patch,".katana.plan");
+  if(!scn)
+  {
+    return NULL;
+  }
+  Elf_Data* data=elf_getdata(scn,NULL);
+  if(!data || data->d_size<sizeof(PatchPlanHeader))
+  {
+    logprintf(ELL_WARN,ELS_PATCHAPPLY,"Application plan in %s is truncated, ignoring it\n",patch->fname);
+    return NULL;
+  }
+  PatchPlanHeader header;
+  memcpy(&header,data->d_buf,sizeof(header));
+  size_t size=sizeof(header)+PLAN_ALIGN((size_t)header.buildIdLen)+
+    sizeof(idx_t)*((size_t)header.numSymbols+header.numUnsafeFunctions);
+  if(memcmp(header.magic,PATCH_PLAN_MAGIC,sizeof(header.magic)) ||
+     PATCH_PLAN_VERSION!=header.version || data->d_size<size)
+  {
+    logprintf(ELL_WARN,ELS_PATCHAPPLY,"Application plan in %s is not one we understand, ignoring it\n",patch->fname);
+    return NULL;
+  }
+
+  byte* buildIdInPlan=(byte*)data->d_buf+sizeof(header);
+  uint32 buildIdLen;
+  byte* buildId=getBuildId(targetBin,&buildIdLen);
+  if(!buildId || buildIdLen!=header.buildIdLen ||
+     memcmp(buildId,buildIdInPlan,buildIdLen))
+  {
+    logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"Application plan in %s was made for a different build of the target\n",patch->fname);
+    return NULL;
+  }
+  //a target that has been patched before has the same build id but
+  //more symbols
+  if(header.numSymbols!=patch->symTabCount ||
+     header.numTargetSymbols!=targetBin->symTabCount)
+  {
+    logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"Application plan in %s doesn't match the symbol tables, not using it\n",patch->fname);
+    return NULL;
+  }
+
+  PatchPlan* plan=arenaAlloc(patch->arena,sizeof(PatchPlan));
+  //copied out so the tables are aligned however the section data is
+  plan->numSymbols=header.numSymbols;
+  plan->symbolMap=arenaMemdup(patch->arena,buildIdInPlan+PLAN_ALIGN(header.buildIdLen),
+                              sizeof(idx_t)*plan->numSymbols);
+  plan->numUnsafeFunctions=header.numUnsafeFunctions;
+  plan->unsafeFunctions=arenaMemdup(patch->arena,buildIdInPlan+PLAN_ALIGN(header.buildIdLen)+
+                                    sizeof(idx_t)*plan->numSymbols,
+                                    sizeof(idx_t)*plan->numUnsafeFunctions);
+  plan->mappedSize=header.mappedSize;
+  logprintf(ELL_INFO_V1,ELS_PATCHAPPLY,"Using the application plan in %s\n",patch->fname);
+  return plan;
+}
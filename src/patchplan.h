@@ -0,0 +1,61 @@
+/*
+  File: patchplan.h
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: the application plan a patch object carries in its
+               .katana.plan section. When the patch is generated we
+               already have the binary it will be applied to, so the
+               symbol matching that patch application would otherwise
+               repeat (reindexing every relocation's symbol and every
+               unsafe function into the target) is done once and
+               stored, along with how much memory the patch needs in
+               the target. The plan is only good for the exact build
+               of the target it was made against (identified by build
+               id), anything else applies the patch the slow way
+*/
+
+#ifndef patchplan_h
+#define patchplan_h
+
+#include "elfparse.h"
+
+#define PATCH_PLAN_MAGIC "KTNPLAN"
+#define PATCH_PLAN_VERSION 1
+
+typedef struct PatchPlan
+{
+  //for each symbol in the patch, the index of the same symbol in the
+  //target. STN_UNDEF if it isn't in the target (such as the patch's
+  //own sections and anything the patch adds), in which case it has to
+  //be looked up when the patch is applied
+  idx_t* symbolMap;
+  int numSymbols;
+  //the target indices of the functions that must not be active while
+  //patching, sorted
+  idx_t* unsafeFunctions;
+  int numUnsafeFunctions;
+  word_t mappedSize;//bytes of .text.new, .rodata.new, .data.new and
+                    //.rela.text.new together
+} PatchPlan;
+
+//computes the plan for applying patch to targetBin and adds it to
+//patch as .katana.plan. Does nothing if targetBin has no build id,
+//since then there would be no way to tell whether a plan fits
+void writePatchPlan(ElfInfo* patch,ElfInfo* targetBin);
+
+//returns the plan carried by patch, allocated from patch's arena, if
+//it was made for exactly targetBin. NULL if there is no plan or it
+//doesn't fit
+PatchPlan* readPatchPlan(ElfInfo* patch,ElfInfo* targetBin);
+
+#endif
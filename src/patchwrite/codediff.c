@@ -61,15 +61,9 @@
 #include "util/logging.h"
 #include <assert.h>
 #include "elfutil.h"
+#include "dwarftypes.h"
+#include "leb.h"
 
-//compares two relocations based on r_offset
-int cmpRelocs(void* a,void* b)
-{
-  RelocInfo* relocA=a;
-  RelocInfo* relocB=b;
-  return relocA->r_offset-relocB->r_offset;
-}
-
 //compare program text modulo relocations which refer to the same
 //symbol, symbol of changed type, or changed offset on symbol
 bool areSubprogramsIdentical(SubprogramInfo* patcheeFunc,SubprogramInfo* patchedFunc,
@@ -94,22 +88,22 @@ bool areSubprogramsIdentical(SubprogramInfo* patcheeFunc,SubprogramInfo* patched
   2. If there is no relocation, return false if the bytes differ
   */
   Elf_Scn* relocScn=getRelocationSection(oldBinary,patcheeFunc->name);
-  List* oldRelocations=getRelocationItemsInRange(oldBinary,relocScn,patcheeFunc->lowpc,patcheeFunc->highpc);
+  RelocInfoVec oldRelocations=getRelocationItemsInRange(oldBinary,relocScn,patcheeFunc->lowpc,patcheeFunc->highpc);
 
   relocScn=getRelocationSection(newBinary,patchedFunc->name);
-  List* newRelocations=getRelocationItemsInRange(newBinary,relocScn,patchedFunc->lowpc,patchedFunc->highpc);
+  RelocInfoVec newRelocations=getRelocationItemsInRange(newBinary,relocScn,patchedFunc->lowpc,patchedFunc->highpc);
 
-  if(listLength(oldRelocations) != listLength(newRelocations))
+  if(oldRelocations.len != newRelocations.len)
   {
-    deleteList(newRelocations,free);
-    deleteList(oldRelocations,free);
+    RelocInfoVecFree(&newRelocations);
+    RelocInfoVecFree(&oldRelocations);
     logprintf(ELL_INFO_V1,ELS_CODEDIFF,"subprogram for %s changed, they contain different numbers of relocations\n",patcheeFunc->name);
     return false;
   }
 
-  //sort both lists
-  sortList(oldRelocations,&cmpRelocs);
-  sortList(newRelocations,&cmpRelocs);
+  //sort both by offset so we can walk them alongside the text
+  RelocInfoVecSort(&oldRelocations,cmpRelocInfoByOffset);
+  RelocInfoVecSort(&newRelocations,cmpRelocInfoByOffset);
   //if -ffunction-sections is used, the function might have its own text section
   Elf_Scn* textScn=NULL;
   char buf[1024];
@@ -130,20 +124,20 @@ bool areSubprogramsIdentical(SubprogramInfo* patcheeFunc,SubprogramInfo* patched
   }
   assert(textScn);
   byte* textNew=getDataAtAbs(textScn,patchedFunc->lowpc,IN_MEM);
-  List* oldLi=oldRelocations;
-  List* newLi=newRelocations;
+  int oldRelocIdx=0;
+  int newRelocIdx=0;
   bool retval=true;
   for(int i=0;i<len1;i++)
   {
     RelocInfo* relocOld=NULL;
-    if(oldLi)
+    if(oldRelocIdx<oldRelocations.len)
     {
-      relocOld=oldLi->value;
+      relocOld=&oldRelocations.data[oldRelocIdx];
     }
     RelocInfo* relocNew=NULL;
-    if(newLi)
+    if(newRelocIdx<newRelocations.len)
     {
-      relocNew=newLi->value;
+      relocNew=&newRelocations.data[newRelocIdx];
     }
     if(relocOld && relocNew &&
        (patcheeFunc->lowpc+i==relocOld->r_offset) &&
@@ -240,8 +234,8 @@ bool areSubprogramsIdentical(SubprogramInfo* patcheeFunc,SubprogramInfo* patched
       //taken care of by checking the addend?
 
       logprintf(ELL_INFO_V4,ELS_CODEDIFF,"Relocations at byte 0x%x determined to be the same\n",i);
-      oldLi=oldLi->next;
-      newLi=newLi->next;
+      oldRelocIdx++;
+      newRelocIdx++;
       i+=sizeof(addr_t)-1;//since we compared on a whole address, not just the one byte
       continue;
     }
@@ -268,11 +262,264 @@ bool areSubprogramsIdentical(SubprogramInfo* patcheeFunc,SubprogramInfo* patched
     }
   }
   
-  deleteList(newRelocations,free);
-  deleteList(oldRelocations,free);
+  RelocInfoVecFree(&newRelocations);
+  RelocInfoVecFree(&oldRelocations);
   if(retval)
   {
     logprintf(ELL_INFO_V2,ELS_CODEDIFF,"subprogram for %s did not change\n",patcheeFunc->name);
   }
   return retval;
 }
+
+//the section in e holding the relocations for section scnIdx, NULL if
+//there is none
+static Elf_Scn* getRelocationsForSection(ElfInfo* e,idx_t scnIdx)
+{
+  for(Elf_Scn* scn=elf_nextscn(e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
+  {
+    GElf_Shdr shdr;
+    getShdr(scn,&shdr);
+    if((SHT_REL==shdr.sh_type || SHT_RELA==shdr.sh_type) && shdr.sh_info==scnIdx)
+    {
+      return scn;
+    }
+  }
+  return NULL;
+}
+
+//what a relocation refers to, by name so it can be compared between
+//the two versions: the symbol's name, or the section's for a section
+//symbol. *scnIdx gets the symbol's section
+static char* getRelocTargetName(ElfInfo* e,idx_t symIdx,idx_t* scnIdx)
+{
+  GElf_Sym sym;
+  getSymbol(e,symIdx,&sym);
+  *scnIdx=sym.st_shndx;
+  if(STT_SECTION==GELF_ST_TYPE(sym.st_info))
+  {
+    return getSectionNameFromIdx(e,sym.st_shndx);
+  }
+  return getString(e,sym.st_name);
+}
+
+//the length of the abbreviation table at off, 0 if it is malformed
+static size_t getAbbrevTableLen(Elf_Data* data,size_t off)
+{
+  byte* bytes=data->d_buf;
+  byte* end=bytes+data->d_size;
+  byte* p=bytes+off;
+  while(1)
+  {
+    word_t code,tag;
+    usint len=decodeULEB128(p,end,&code);
+    if(!len)
+    {
+      return 0;
+    }
+    p+=len;
+    if(!code)
+    {
+      return p-(bytes+off);
+    }
+    len=decodeULEB128(p,end,&tag);
+    //and the children flag
+    if(!len || end-p<len+1)
+    {
+      return 0;
+    }
+    p+=len+1;
+    word_t attr,form;
+    do
+    {
+      usint attrLen=decodeULEB128(p,end,&attr);
+      usint formLen=attrLen?decodeULEB128(p+attrLen,end,&form):0;
+      if(!formLen)
+      {
+        return 0;
+      }
+      p+=attrLen+formLen;
+      if(0x21==form)//DW_FORM_implicit_const carries its value here
+      {
+        sword_t value;
+        len=decodeSLEB128(p,end,&value);
+        if(!len)
+        {
+          return 0;
+        }
+        p+=len;
+      }
+    } while(attr || form);
+  }
+}
+
+//whether what the relocations at off in the two versions of a section
+//refer to is the same. Strings and abbreviation tables are compared
+//themselves, as the same offset into .debug_str says nothing about the
+//string. Anything else is the same if it is the same offset from the
+//same-named symbol or section
+static bool isRelocTargetIdentical(RelocInfo* relocOld,RelocInfo* relocNew)
+{
+  idx_t scnOld,scnNew;
+  char* nameOld=getRelocTargetName(relocOld->e,relocOld->symIdx,&scnOld);
+  char* nameNew=getRelocTargetName(relocNew->e,relocNew->symIdx,&scnNew);
+  if(relocOld->relocType!=relocNew->relocType || strcmp(nameOld,nameNew))
+  {
+    return false;
+  }
+  addr_t addendOld=relocOld->r_addend;
+  addr_t addendNew=relocNew->r_addend;
+  bool isStr=!strcmp(".debug_str",nameOld) || !strcmp(".debug_line_str",nameOld);
+  bool isAbbrev=!strcmp(".debug_abbrev",nameOld);
+  if(!isStr && !isAbbrev)
+  {
+    return addendOld==addendNew;
+  }
+  Elf_Data* dataOld=getDataByIdx(relocOld->e,scnOld);
+  Elf_Data* dataNew=getDataByIdx(relocNew->e,scnNew);
+  if(addendOld>=dataOld->d_size || addendNew>=dataNew->d_size)
+  {
+    return false;
+  }
+  byte* old=(byte*)dataOld->d_buf+addendOld;
+  byte* new=(byte*)dataNew->d_buf+addendNew;
+  if(isStr)
+  {
+    size_t lenOld=strnlen((char*)old,dataOld->d_size-addendOld);
+    size_t lenNew=strnlen((char*)new,dataNew->d_size-addendNew);
+    return lenOld==lenNew && !memcmp(old,new,lenOld);
+  }
+  size_t lenOld=getAbbrevTableLen(dataOld,addendOld);
+  size_t lenNew=getAbbrevTableLen(dataNew,addendNew);
+  return lenOld && lenOld==lenNew && !memcmp(old,new,lenOld);
+}
+
+//whether [startOld,endOld) of section scnOld and [startNew,endNew) of
+//scnNew hold the same bytes and relocations
+static bool areRangesIdentical(ElfInfo* oldObj,idx_t scnOld,addr_t startOld,addr_t endOld,
+                               ElfInfo* newObj,idx_t scnNew,addr_t startNew,addr_t endNew)
+{
+  if(endOld-startOld!=endNew-startNew)
+  {
+    return false;
+  }
+  Elf_Data* dataOld=getDataByIdx(oldObj,scnOld);
+  Elf_Data* dataNew=getDataByIdx(newObj,scnNew);
+  if(!dataOld->d_buf!=!dataNew->d_buf)
+  {
+    return false;
+  }
+  //.bss and the like have no bytes to compare
+  if(dataOld->d_buf &&
+     (endOld>dataOld->d_size || endNew>dataNew->d_size ||
+      memcmp((byte*)dataOld->d_buf+startOld,(byte*)dataNew->d_buf+startNew,endOld-startOld)))
+  {
+    return false;
+  }
+  if(startOld==endOld)
+  {
+    return true;
+  }
+  RelocInfoVec relocsOld=getRelocationItemsInRange(oldObj,getRelocationsForSection(oldObj,scnOld),startOld,endOld-1);
+  RelocInfoVec relocsNew=getRelocationItemsInRange(newObj,getRelocationsForSection(newObj,scnNew),startNew,endNew-1);
+  bool identical=relocsOld.len==relocsNew.len;
+  RelocInfoVecSort(&relocsOld,cmpRelocInfoByOffset);
+  RelocInfoVecSort(&relocsNew,cmpRelocInfoByOffset);
+  for(int i=0;identical && i<relocsOld.len;i++)
+  {
+    identical=relocsOld.data[i].r_offset-startOld==relocsNew.data[i].r_offset-startNew &&
+      isRelocTargetIdentical(&relocsOld.data[i],&relocsNew.data[i]);
+  }
+  RelocInfoVecFree(&relocsOld);
+  RelocInfoVecFree(&relocsNew);
+  return identical;
+}
+
+//whether the code or data a relocation from the DWARF of the patched
+//version (a DW_AT_low_pc, DW_OP_addr and so forth) points into is the
+//same in the original version
+static bool isDescribedSymbolIdentical(ElfInfo* oldObj,ElfInfo* newObj,RelocInfo* reloc)
+{
+  idx_t scnIdx;
+  getRelocTargetName(newObj,reloc->symIdx,&scnIdx);
+  if(SHN_UNDEF==scnIdx || scnIdx>=SHN_LORESERVE)
+  {
+    return true;
+  }
+  GElf_Shdr shdr;
+  getShdr(elf_getscn(newObj->e,scnIdx),&shdr);
+  if(!(shdr.sh_flags & SHF_ALLOC))
+  {
+    //another debug section, whatever is there was compared already
+    return true;
+  }
+  GElf_Sym sym;
+  getSymbol(newObj,reloc->symIdx,&sym);
+  addr_t addr=sym.st_value+reloc->r_addend;
+  idx_t symIdx=findSymbolContainingAddress(newObj,addr,STT_FUNC,scnIdx);
+  if(STN_UNDEF==symIdx)
+  {
+    symIdx=findSymbolContainingAddress(newObj,addr,STT_OBJECT,scnIdx);
+  }
+  if(STN_UNDEF==symIdx)
+  {
+    //we can't tell what it is, so we can't tell it hasn't changed
+    return false;
+  }
+  GElf_Sym symNew;
+  GElf_Sym symOld;
+  getSymbol(newObj,symIdx,&symNew);
+  char* name=getString(newObj,symNew.st_name);
+  int oldIdx=getSymtabIdx(oldObj,name,0);
+  if(oldIdx<=0)
+  {
+    return false;
+  }
+  getSymbol(oldObj,oldIdx,&symOld);
+  if(symOld.st_info!=symNew.st_info || symOld.st_size!=symNew.st_size ||
+     SHN_UNDEF==symOld.st_shndx || symOld.st_shndx>=SHN_LORESERVE ||
+     strcmp(getSectionNameFromIdx(oldObj,symOld.st_shndx),getSectionNameFromIdx(newObj,symNew.st_shndx)))
+  {
+    return false;
+  }
+  return areRangesIdentical(oldObj,symOld.st_shndx,symOld.st_value,symOld.st_value+symOld.st_size,
+                            newObj,symNew.st_shndx,symNew.st_value,symNew.st_value+symNew.st_size);
+}
+
+bool hasCompilationUnitChanged(ElfInfo* oldObj,ElfInfo* newObj,char* cuName)
+{
+  //anything but a relocatable object may have had its relocations
+  //applied already, and what they referred to can't be told any more
+  GElf_Ehdr ehdrOld,ehdrNew;
+  if(!gelf_getehdr(oldObj->e,&ehdrOld) || !gelf_getehdr(newObj->e,&ehdrNew) ||
+     ET_REL!=ehdrOld.e_type || ET_REL!=ehdrNew.e_type)
+  {
+    return true;
+  }
+  addr_t startOld,endOld,startNew,endNew;
+  if(!getCompilationUnitExtent(oldObj->dwarfInfo,cuName,&startOld,&endOld) ||
+     !getCompilationUnitExtent(newObj->dwarfInfo,cuName,&startNew,&endNew))
+  {
+    return true;
+  }
+  idx_t infoOld=oldObj->sectionIndices[ERS_DEBUG_INFO];
+  idx_t infoNew=newObj->sectionIndices[ERS_DEBUG_INFO];
+  if(!areRangesIdentical(oldObj,infoOld,startOld,endOld,newObj,infoNew,startNew,endNew))
+  {
+    logprintf(ELL_INFO_V2,ELS_CODEDIFF,"the DWARF for compilation unit %s changed\n",cuName);
+    return true;
+  }
+  //the DWARF is the same, but code or data it describes may not be.
+  //Everything it describes is found through its relocations
+  RelocInfoVec relocs=getRelocationItemsInRange(newObj,getRelocationsForSection(newObj,infoNew),startNew,endNew-1);
+  bool changed=false;
+  for(int i=0;!changed && i<relocs.len;i++)
+  {
+    changed=!isDescribedSymbolIdentical(oldObj,newObj,&relocs.data[i]);
+  }
+  RelocInfoVecFree(&relocs);
+  if(changed)
+  {
+    logprintf(ELL_INFO_V2,ELS_CODEDIFF,"code or data described by compilation unit %s changed\n",cuName);
+  }
+  return changed;
+}
@@ -57,4 +57,10 @@
 #define codediff_h
 bool areSubprogramsIdentical(SubprogramInfo* patcheeFunc,SubprogramInfo* patchedFunc,
                              ElfInfo* oldBinary,ElfInfo* newBinary);
+//whether the named compilation unit has to be read in from both
+//versions of an object to write the patch: it is missing from one of
+//them, its DWARF differs, or code or data it describes differs. Only
+//relocatable objects can be compared, for anything else the answer is
+//always true. Both objects must have been indexed with indexDWARFTypes
+bool hasCompilationUnitChanged(ElfInfo* oldObj,ElfInfo* newObj,char* cuName);
 #endif
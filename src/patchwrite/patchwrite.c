@@ -71,13 +71,55 @@
 #include "sourcetree.h"
 #include "write_to_dwarf.h"
 #include "elfutil.h"
+#include "util/hash.h"
+#include "patchplan.h"
 
 ElfInfo* oldBinary=NULL;
 ElfInfo* newBinary=NULL;
 
 
 ElfInfo* patch;
-addr_t rodataOffset;//used to keep track of how much rodata we've used
+
+//a relocation written to .rela.text.new (for the object we're
+//currently working on) which refers to that object's .rodata. Its
+//addend can't be finalized until writeROData decides where (and
+//whether) the constant it refers to goes in .rodata.new
+typedef struct
+{
+  addr_t relaOffset;//within .rela.text.new
+  //the offset within the object's .rodata that is referred to is
+  //somewhere from lo to hi (see writeRelocationsInRange)
+  addr_t lo;
+  addr_t hi;
+  idx_t object;//the sized symbol referred to, if referred to by its
+               //own symbol rather than the section's
+  addr_t rangeStart;//start of the RODataRange it was given
+} PendingRODataReloc;
+VECTOR_DEFINE(PendingRODataRelocVec,PendingRODataReloc)
+PendingRODataRelocVec pendingRODataRelocs;
+
+//a piece of an object's .rodata which is referenced by something we wrote
+typedef struct
+{
+  addr_t start;
+  addr_t end;
+  addr_t newOffset;//within .rodata.new
+} RODataRange;
+VECTOR_DEFINE(RODataRangeVec,RODataRange)
+
+//rodata we've already put in .rodata.new, so that a constant
+//identical to one we've already written (from this object or another)
+//can share it. Keyed by content, each value is a List of the
+//RODataBlock with that content (at different alignments)
+typedef struct
+{
+  addr_t offset;//within .rodata.new
+  word_t len;
+  unsigned long hash;
+  byte* bytes;//only for a key being looked up, which isn't in
+              //.rodata.new yet
+} RODataBlock;
+Map* rodataBlocks=NULL;
 
 
 Dwarf_P_Die firstCUDie=NULL;
@@ -137,16 +179,16 @@ idx_t addSymbolFromBinaryToPatch(ElfInfo* binary,idx_t symIdx)
 void writeRelocationsInRange(addr_t lowpc,addr_t highpc,Elf_Scn* scn,
                              addr_t segmentBase,ElfInfo* binary)
 {
-  List* relocs=getRelocationItemsInRange(binary,scn,lowpc,highpc);
-  List* li=relocs;
-  idx_t rodataScnIdx=elf_ndxscn(getSectionByERS(binary,ERS_RODATA));//for special handling of rodata because lump rodata from several binaries into one section
-  for(;li;li=li->next)
+  RelocInfoVec relocs=getRelocationItemsInRange(binary,scn,lowpc,highpc);
+  //for special handling of rodata because lump rodata from several binaries into one section
+  idx_t rodataScnIdx=hasERS(binary,ERS_RODATA)?elf_ndxscn(getSectionByERS(binary,ERS_RODATA)):SHN_UNDEF;
+  for(int i=0;i<relocs.len;i++)
   {
     //we always use RELA rather than REL in the patch file
     //because having the addend recorded makes some
     //things much easier to work with
     ElfXX_Rela rela;//what we actually write to the file
-    RelocInfo* reloc=li->value;
+    RelocInfo* reloc=&relocs.data[i];
     //todo: we insert symbols so that the relocations
     //will be valid, but we need to make sure we don't insert
     //a single symbol too many times, it wastes space
@@ -209,25 +251,41 @@ void writeRelocationsInRange(addr_t lowpc,addr_t highpc,Elf_Scn* scn,
     rela.r_addend=reloc->r_addend;
 
 
+    rela.r_offset=newRelOffset;
+    logprintf(ELL_INFO_V4,ELS_RELOCATION,"adding reloc for offset 0x%x\n",rela.r_offset);
+    addr_t relaOffset=addDataToScn(getDataByERS(patch,ERS_RELA_TEXT),&rela,sizeof(ElfXX_Rela));
+
     //special handling for rodata, because each object has its own rodata
-    //and we're no lumping them all together, we have to increase the addend
-    //to fit where rodata actually goes
+    //and we're now lumping together the pieces of it we need, we have
+    //to change the addend to fit where the constant actually goes. We
+    //don't know that until we've seen everything from this object
+    //that refers to its rodata
     GElf_Sym sym;
     if(!gelf_getsym(getDataByERS(binary,ERS_SYMTAB),symIdx,&sym))
     {death("gelf_getsym failed in writeRelocationsInRange\n");}
-    if(sym.st_shndx==rodataScnIdx)
+    if(SHN_UNDEF!=rodataScnIdx && sym.st_shndx==rodataScnIdx)
     {
-      rela.r_addend+=rodataOffset;//increase it by the amount we're up to
-
+      PendingRODataReloc* pending=PendingRODataRelocVecPush(&pendingRODataRelocs);
+      pending->relaOffset=relaOffset;
+      pending->lo=pending->hi=sym.st_value+reloc->r_addend;
+      //a pc-relative reference is relative to the end of the
+      //instruction, which the addend compensates for. That's the 4
+      //bytes of the field being relocated on from its start, and up
+      //to 4 more if an immediate operand follows it, so all we know
+      //is that the constant is somewhere in between
+      if(R_386_PC32==type || R_X86_64_PC32==type)
+      {
+        pending->lo+=4;
+        pending->hi+=8;
+      }
+      //referred to by its own symbol, the object is what's referred
+      //to whatever the addend
+      bool isObject=sym.st_size && STT_SECTION!=ELFXX_ST_TYPE(sym.st_info);
+      pending->object=isObject?symIdx:STN_UNDEF;
     }
     //end special handling for rodata
-
- 
-    rela.r_offset=newRelOffset;
-    logprintf(ELL_INFO_V4,ELS_RELOCATION,"adding reloc for offset 0x%x\n",rela.r_offset);
-    addDataToScn(getDataByERS(patch,ERS_RELA_TEXT),&rela,sizeof(ElfXX_Rela));
   }
-  deleteList(relocs,free);
+  RelocInfoVecFree(&relocs);
 }
 
 
@@ -612,10 +670,10 @@ static void writeUnsafety(CompilationUnit* cuNew, List* varTransformsList)
     {
       death("Could not find symbol for variable %s\n",var->name);
     }
-    List* relocations=getRelocationItemsFor(cuNew->elf,symIdx);
-    for(List* liR=relocations;liR;liR=liR->next)
+    RelocInfoVec relocations=getRelocationItemsFor(cuNew->elf,symIdx);
+    for(int i=0;i<relocations.len;i++)
     {
-      RelocInfo* reloc=liR->value;
+      RelocInfo* reloc=&relocations.data[i];
       GElf_Shdr shdr;
       if(!gelf_getshdr(elf_getscn(reloc->e->e,reloc->scnIdx),&shdr))
       {
@@ -641,13 +699,14 @@ static void writeUnsafety(CompilationUnit* cuNew, List* varTransformsList)
         //todo: if the SubprogramInfo struct had a flag bool unsafe
         //or something like that, we could just set that
         //since we actually know this type will make things unsafe
-        List* typeLi=zmalloc(sizeof(List));
+        //the subprogram's type list lives in its DwarfInfo's arena
+        List* typeLi=arenaAlloc(cuNew->elf->dwarfInfo->arena,sizeof(List));
         typeLi->value=var->type;
         listAppend(&subprogram->typesHead,&subprogram->typesTail,typeLi);
         logprintf(ELL_INFO_V2,ELS_SAFETY,"Added type %s to types used by function %s which would make it unsafe\n",var->type->name,subprogram->name);
       }
     }
-    deleteList(relocations,free);
+    RelocInfoVecFree(&relocations);
   }
 }
 
@@ -663,25 +722,23 @@ void writeTypeAndFuncTransformationInfo(ElfInfo* patchee,ElfInfo* patched)
   //      things moving between compilation units,
   //      perhaps group global objects from all compilation units
   //      together before dealing with them.
-  List* cuLi1=diPatchee->compilationUnits;
-  for(;cuLi1;cuLi1=cuLi1->next)
+  //compilation units are only read in, from either version, when
+  //they have changed. Units only present in the patched version are
+  //never read in
+  for(int i=0;i<getNumCompilationUnits(diPatchee);i++)
   {
-    CompilationUnit* cuOld=cuLi1->value;
-    CompilationUnit* cuNew=NULL;
+    char* cuName=getCompilationUnitName(diPatchee,i);
+    if(cuName && !hasCompilationUnitChanged(patchee,patched,cuName))
+    {
+      logprintf(ELL_INFO_V2,ELS_PATCHWRITE,"compilation unit %s is unchanged, not reading it in\n",cuName);
+      continue;
+    }
+    CompilationUnit* cuOld=loadCompilationUnitAt(diPatchee,i);
     //find the corresponding compilation unit in the patched process
-    //note: we assume that the number of compilation units is not so large
-    //that using a hash table would give us much better performance than
-    //just going through a list. If working on a truly enormous project it
-    //might make sense to do this
-    List* cuLi2=diPatched->compilationUnits;
-    for(;cuLi2;cuLi2=cuLi2->next)
+    CompilationUnit* cuNew=NULL;
+    if(cuOld->name)
     {
-      cuNew=cuLi2->value;
-      if(cuOld->name && cuNew->name && !strcmp(cuOld->name,cuNew->name))
-      {
-        break;
-      }
-      cuNew=NULL;
+      cuNew=loadCompilationUnitNamed(diPatched,cuOld->name);
     }
     if(!cuNew)
     {
@@ -727,19 +784,232 @@ void writeAllTypeAndFuncTransformationInfo(ElfInfo* elf)
 
 
 
-//todo: in the future only copy rodata from object files which changed,
-//don't necessarily need *all* the rodata
+static int cmpRODataRanges(const void* a,const void* b)
+{
+  const RODataRange* ra=a;
+  const RODataRange* rb=b;
+  if(ra->start!=rb->start)
+  {
+    return ra->start<rb->start?-1:1;
+  }
+  return ra->end<rb->end?-1:(ra->end>rb->end?1:0);
+}
+
+//the sized symbol in the object's rodata covering offset, if any
+static ElfXX_Sym* getRODataObjectAt(ElfInfo* binary,idx_t rodataScnIdx,addr_t offset,ElfXX_Sym* buf)
+{
+  Elf_Data* symTabData=getDataByERS(binary,ERS_SYMTAB);
+  ElfXX_Sym* syms=getNativeSymbols(binary,symTabData);
+  int numSyms=symTabData->d_size/sizeof(ElfXX_Sym);
+  for(int i=0;i<numSyms;i++)
+  {
+    ElfXX_Sym* sym=getSymbolInTable(syms,symTabData,i,buf);
+    if(sym->st_shndx==rodataScnIdx && STT_SECTION!=ELFXX_ST_TYPE(sym->st_info) &&
+       sym->st_size && sym->st_value<=offset && offset<sym->st_value+sym->st_size)
+    {
+      return sym;
+    }
+  }
+  return NULL;
+}
+
+//the extent of the object's rodata which must be copied, all in one
+//piece, for pending to still refer to the right thing. If it refers
+//to a sized symbol, or wherever it refers to is covered by sized
+//symbols, that's the symbols. Otherwise, for a string section, it's
+//the strings it may refer to. Failing that we don't know how large
+//the constant is, and all we can do is copy the whole section
+static RODataRange getRODataRange(ElfInfo* binary,idx_t rodataScnIdx,
+                                  Elf_Data* roData,bool strings,
+                                  PendingRODataReloc* pending)
+{
+  RODataRange range={0,roData->d_size,0};
+  ElfXX_Sym loBuf,hiBuf;
+  ElfXX_Sym* lo=NULL;
+  ElfXX_Sym* hi=NULL;
+  if(STN_UNDEF!=pending->object)
+  {
+    Elf_Data* symTabData=getDataByERS(binary,ERS_SYMTAB);
+    ElfXX_Sym* syms=getNativeSymbols(binary,symTabData);
+    lo=hi=getSymbolInTable(syms,symTabData,pending->object,&loBuf);
+  }
+  else if(pending->lo>=roData->d_size)
+  {
+    range.start=range.end=roData->d_size;
+    return range;
+  }
+  else
+  {
+    lo=getRODataObjectAt(binary,rodataScnIdx,pending->lo,&loBuf);
+    hi=getRODataObjectAt(binary,rodataScnIdx,min(pending->hi,roData->d_size-1),&hiBuf);
+  }
+  if(lo && hi)
+  {
+    addr_t end=max(lo->st_value+lo->st_size,hi->st_value+hi->st_size);
+    range.start=min(lo->st_value,roData->d_size);
+    range.end=min(end,roData->d_size);
+    return range;
+  }
+  if(strings)
+  {
+    range.start=pending->lo;
+    addr_t last=min(pending->hi,roData->d_size-1);
+    char* str=(char*)roData->d_buf+last;
+    range.end=min(last+strnlen(str,roData->d_size-last)+1,roData->d_size);
+    return range;
+  }
+  logprintf(ELL_INFO_V2,ELS_PATCHWRITE,"Don't know the extent of the rodata at 0x%x in %s, copying all of it\n",(uint)pending->lo,binary->fname);
+  return range;
+}
+
+static unsigned long hashRODataBlock(void* key)
+{
+  return ((RODataBlock*)key)->hash;
+}
+
+static byte* getRODataBlockBytes(RODataBlock* block)
+{
+  return block->bytes?block->bytes:(byte*)getDataByERS(patch,ERS_RODATA)->d_buf+block->offset;
+}
+
+static int cmpRODataBlocks(void* a,void* b)
+{
+  RODataBlock* blockA=a;
+  RODataBlock* blockB=b;
+  if(blockA->len!=blockB->len)
+  {
+    return blockA->len<blockB->len?-1:1;
+  }
+  return memcmp(getRODataBlockBytes(blockA),getRODataBlockBytes(blockB),blockA->len);
+}
+
+//puts len bytes of rodata in .rodata.new at an offset congruent to
+//start modulo align (so that the constant keeps its alignment),
+//reusing an identical constant already there if there is one.
+//Returns the offset within .rodata.new
+static addr_t placeRODataRange(ElfInfo* binary,byte* bytes,addr_t start,word_t len,word_t align)
+{
+  Elf_Data* roDataPatch=getDataByERS(patch,ERS_RODATA);
+  if(!rodataBlocks)
+  {
+    rodataBlocks=mapCreate(256,hashRODataBlock,cmpRODataBlocks);
+  }
+  RODataBlock key={0,len,hashBytes(bytes,len),bytes};
+  List* identical=mapGet(rodataBlocks,&key);
+  for(List* li=identical;li;li=li->next)
+  {
+    RODataBlock* candidate=li->value;
+    if(candidate->offset%align==start%align)
+    {
+      logprintf(ELL_INFO_V3,ELS_PATCHWRITE,"rodata at 0x%x in %s is identical to rodata already in the patch, sharing it\n",(uint)start,binary->fname);
+      return candidate->offset;
+    }
+  }
+  word_t padding=(align+start%align-roDataPatch->d_size%align)%align;
+  if(padding)
+  {
+    byte* zeros=zmalloc(padding);
+    addDataToScn(roDataPatch,zeros,padding);
+    free(zeros);
+  }
+  RODataBlock* block=zmalloc(sizeof(RODataBlock));
+  block->offset=addDataToScn(roDataPatch,bytes,len);
+  block->len=len;
+  block->hash=key.hash;
+  List* li=zmalloc(sizeof(List));
+  li->value=block;
+  if(identical)
+  {
+    li->next=identical->next;
+    identical->next=li;
+  }
+  else
+  {
+    mapInsert(rodataBlocks,block,li);
+  }
+  return block->offset;
+}
+
+static void deleteRODataBlocks(void* value)
+{
+  deleteList(value,free);
+}
+
+//called once everything for a modified object has been written to
+//the patch. Copies into .rodata.new only the constants in the
+//object's rodata which something we wrote actually refers to (objects
+//routinely count as changed without any of their functions being
+//patched, and a patched function rarely needs more than a few of the
+//object's constants), or all of it if it can't tell where a constant
+//ends, sharing identical constants, and then fixes up the relocations
+//that refer to them
 void writeROData(ElfInfo* binary)
 {
-  if(hasERS(binary,ERS_RODATA))
+  if(!pendingRODataRelocs.len)
   {
-    Elf_Data* roData=getDataByERS(binary,ERS_RODATA);
-    Elf_Data* roDataPatch=getDataByERS(patch,ERS_RODATA);
-    uint len=roData->d_size;
-    rodataOffset=roDataPatch->d_size;//offset to put things off of now
-    addDataToScn(roDataPatch,roData->d_buf,len);
+    logprintf(ELL_INFO_V2,ELS_PATCHWRITE,"Nothing written from %s refers to its rodata, not copying it\n",binary->fname);
+    return;
   }
-  //sometimes objects have no rodata. Not terribly common, but it happens
+  Elf_Scn* roScn=getSectionByERS(binary,ERS_RODATA);
+  idx_t rodataScnIdx=elf_ndxscn(roScn);
+  Elf_Data* roData=getDataByERS(binary,ERS_RODATA);
+  GElf_Shdr shdr;
+  if(!gelf_getshdr(roScn,&shdr))
+  {death("gelf_getshdr failed in writeROData\n");}
+  word_t align=shdr.sh_addralign?shdr.sh_addralign:1;
+  bool strings=(shdr.sh_flags & SHF_STRINGS)!=0;
+
+  RODataRangeVec ranges={0};
+  for(int i=0;i<pendingRODataRelocs.len;i++)
+  {
+    PendingRODataReloc* pending=&pendingRODataRelocs.data[i];
+    RODataRange range=getRODataRange(binary,rodataScnIdx,roData,strings,pending);
+    pending->rangeStart=range.start;
+    *RODataRangeVecPush(&ranges)=range;
+  }
+
+  //merge overlapping ranges (a constant referred to both by symbol
+  //and through the section symbol, say) so that each byte is copied
+  //once and everything referred to as one piece stays in one piece
+  RODataRangeVecSort(&ranges,cmpRODataRanges);
+  int numMerged=0;
+  for(int i=0;i<ranges.len;i++)
+  {
+    if(numMerged && ranges.data[i].start<ranges.data[numMerged-1].end)
+    {
+      ranges.data[numMerged-1].end=max(ranges.data[numMerged-1].end,ranges.data[i].end);
+      continue;
+    }
+    ranges.data[numMerged++]=ranges.data[i];
+  }
+  ranges.len=numMerged;
+
+  word_t copied=0;
+  for(int i=0;i<ranges.len;i++)
+  {
+    RODataRange* range=&ranges.data[i];
+    range->newOffset=placeRODataRange(binary,(byte*)roData->d_buf+range->start,
+                                      range->start,range->end-range->start,align);
+    copied+=range->end-range->start;
+  }
+  logprintf(ELL_INFO_V2,ELS_PATCHWRITE,"Copied %u of %u bytes of rodata from %s\n",(uint)copied,(uint)roData->d_size,binary->fname);
+
+  //each relocation moves with the range its own range was merged into,
+  //the last one starting no later than it
+  Elf_Data* relaData=getDataByERS(patch,ERS_RELA_TEXT);
+  RODataRangeVecSpan merged=RODataRangeVecAsSpan(&ranges);
+  for(int i=0;i<pendingRODataRelocs.len;i++)
+  {
+    PendingRODataReloc* pending=&pendingRODataRelocs.data[i];
+    RODataRange key={pending->rangeStart,(addr_t)-1,0};
+    int j=RODataRangeVecLowerBound(merged,&key,cmpRODataRanges)-1;
+    assert(j>=0);
+    RODataRange* range=&ranges.data[j];
+    ElfXX_Rela* rela=(ElfXX_Rela*)((byte*)relaData->d_buf+pending->relaOffset);
+    rela->r_addend+=(sword_t)range->newOffset-(sword_t)range->start;
+  }
+  RODataRangeVecFree(&ranges);
+  PendingRODataRelocVecClear(&pendingRODataRelocs);
 }
 
 
@@ -820,8 +1090,8 @@ ElfInfo* createPatch(char* oldSourceTree,char* newSourceTree,char* oldBinName,ch
         ElfInfo* elf1=getOriginalObject(obj);
         ElfInfo* elf2=getModifiedObject(obj);
         logprintf(ELL_INFO_V1,ELS_PATCHWRITE,"Finding differences between %s and %s and writing them to the patch\n",elf1->fname,elf2->fname);
-        readDWARFTypes(elf1,oldSourceTree);
-        readDWARFTypes(elf2,newSourceTree);
+        indexDWARFTypes(elf1,oldSourceTree);
+        indexDWARFTypes(elf2,newSourceTree);
         if(!elf1->dwarfInfo && !elf2->dwarfInfo)
         {
           logprintf(ELL_WARN,ELS_PATCHWRITE,"Assuming that because %s and %s don't have Dwarf information, they will not need patching. If this assumption is incorrect, please fix your compilation process so they do contain DWARF information\n",elf1->fname,elf2->fname);
@@ -834,10 +1104,10 @@ ElfInfo* createPatch(char* oldSourceTree,char* newSourceTree,char* oldBinName,ch
         {
           //we actually got DWARF data!
           
+          writeTypeAndFuncTransformationInfo(elf1,elf2);
           //all the object files had their own roData sections
           //and now we're lumping them together
           writeROData(elf2);
-          writeTypeAndFuncTransformationInfo(elf1,elf2);
         }
         endELF(elf1);
         endELF(elf2);
@@ -854,6 +1124,12 @@ ElfInfo* createPatch(char* oldSourceTree,char* newSourceTree,char* oldBinName,ch
     }
   }
   deleteList(objFiles,(FreeFunc)deleteObjFileInfo);
+  if(rodataBlocks)
+  {
+    mapDelete(rodataBlocks,deleteRODataBlocks,NULL);
+    rodataBlocks=NULL;
+  }
+  PendingRODataRelocVecFree(&pendingRODataRelocs);
 
   dwarf_add_die_to_debug(dbg,firstCUDie,&err);
   int numSections=dwarf_transform_to_disk_form(dbg,&err);
@@ -862,22 +1138,19 @@ ElfInfo* createPatch(char* oldSourceTree,char* newSourceTree,char* oldBinName,ch
     Dwarf_Signed elfScnIdx;
     Dwarf_Unsigned length;
     Dwarf_Ptr buf=dwarf_get_section_bytes(dbg,i,&elfScnIdx,&length,&err);
-    Elf_Scn* scn=elf_getscn(patch->e,elfScnIdx);
-    Elf_Data* data=elf_newdata(scn);
-    ElfXX_Shdr* shdr=elfxx_getshdr(scn);
-    shdr->sh_size=length;
-    data->d_size=length;
-    data->d_off=0;
-    data->d_buf=zmalloc(length);
-    memcpy(data->d_buf,buf,length);
+    //the producer may hand us a section in several pieces, each of
+    //which we chain onto the section rather than copying
+    adoptScnData(patch,elf_getscn(patch->e,elfScnIdx),buf,length);
   }
+  //the buffers we just adopted belong to the producer, so it has to
+  //outlive the patch. endELF will finish it
+  patch->dwarfProducer=dbg;
+
+  //the patch is complete now, so we can work out how it will be
+  //applied to the binary it was made against
+  writePatchPlan(patch,oldBinary);
   
   finalizeModifiedElf(patch);
-  res=dwarf_producer_finish(dbg,&err);
-  if(DW_DLV_ERROR==res)
-  {
-    dwarfErrorHandler(err,NULL);
-  }
   endELF(oldBinary);
   endELF(newBinary);
 
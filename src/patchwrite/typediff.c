@@ -59,11 +59,14 @@
 #include "types.h"
 #include "util/logging.h"
 
+//type and field names are interned (see util/intern.h) so they are
+//compared by pointer throughout this file. name must be interned too
+
 int getOffsetForField(TypeInfo* type,char* name)
 {
   for(int i=0;i<type->numFields;i++)
   {
-    if(!strcmp(name,type->fields[i]))
+    if(name==type->fields[i])
     {
       int offset=type->fieldOffsets[i];
       logprintf(ELL_INFO_V4,ELS_MISC,"offset for field returning %i for field %s\n",offset,name);
@@ -77,7 +80,7 @@ int getIndexForField(TypeInfo* type,char* name)
 {
   for(int i=0;i<type->numFields;i++)
   {
-    if(!strcmp(name,type->fields[i]))
+    if(name==type->fields[i])
     {
       return i;
     }
@@ -133,7 +136,7 @@ bool compareTypesAndGenTransforms(TypeInfo* a,TypeInfo* b)
 
   a->diffAgainst=b;
   bool retval=true;
-  if(strcmp(a->name,b->name) ||
+  if(a->name!=b->name ||
      a->numFields!=b->numFields ||
      a->length != b->length)
   {
@@ -153,9 +156,9 @@ bool compareTypesAndGenTransforms(TypeInfo* a,TypeInfo* b)
       //certainly won't need to relocate. Or do we just assume
       //that if the name changes it's all different
       if(a->fieldTypes[i]->length!=b->fieldTypes[i]->length ||
-         strcmp(a->fieldTypes[i]->name,b->fieldTypes[i]->name) || strcmp(a->fields[i],b->fields[i]))
+         a->fieldTypes[i]->name!=b->fieldTypes[i]->name || a->fields[i]!=b->fields[i])
       {
-        if(!strncmp(a->fieldTypes[i]->name,"anon_",5) && !strncmp(a->fieldTypes[i]->name,"anon_",5) && a->fieldTypes[i]->type==b->fieldTypes[i]->type && !strcmp(a->fields[i],b->fields[i]) && a->fieldTypes[i]->length==b->fieldTypes[i]->length)
+        if(!strncmp(a->fieldTypes[i]->name,"anon_",5) && !strncmp(a->fieldTypes[i]->name,"anon_",5) && a->fieldTypes[i]->type==b->fieldTypes[i]->type && a->fields[i]==b->fields[i] && a->fieldTypes[i]->length==b->fieldTypes[i]->length)
         {
           logprintf(ELL_WARN,ELS_TYPEDIFF,"Struct or union %s has member %s of type %s/%s. Because this is an anonymous type, we aren't automatically assuming that a small name change means a change of type, but this may not be what you want\n",a->name,a->fields[i],a->fieldTypes[i]->name,b->fieldTypes[i]->name);
         }
@@ -225,7 +228,10 @@ bool compareTypesAndGenTransforms(TypeInfo* a,TypeInfo* b)
   transform->from=a;
   transform->to=b;
 
-  if(TT_UNION==a->type || TT_ENUM==a->type || TT_ARRAY==a->type)
+  //a one dimensional array of structs that changed is transformed element by element
+  bool arrayOfChangedStructs=TT_ARRAY==a->type && 1==a->depth &&
+    TT_STRUCT==a->pointedType->type && a->pointedType->transformer;
+  if(TT_UNION==a->type || TT_ENUM==a->type || (TT_ARRAY==a->type && !arrayOfChangedStructs))
   {
     //a straight copy is the only way we can do a union, because we don't know
     //what's inside it. If we detect that a straight copy won't work,
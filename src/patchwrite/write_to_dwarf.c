@@ -57,6 +57,7 @@
 #include <dwarf.h>
 #include "dwarf_instr.h"
 #include "util/logging.h"
+#include "util/intern.h"
 #include "leb.h"
 
 //todo: using externs is poor form, fix this
@@ -240,10 +241,11 @@ void writeOldTypeToDwarf(Dwarf_P_Debug dbg,TypeInfo* type,CompilationUnit* cuToW
   CompilationUnit* oldCu=type->cu;
   type->cu=cuToWriteIn;
   char* oldName=type->name;
-  type->name=zmalloc(strlen(type->name)+2);
-  sprintf(type->name,"%s~",oldName);
+  char* tildeName=zmalloc(strlen(type->name)+2);
+  sprintf(tildeName,"%s~",oldName);
+  type->name=internString(tildeName);//names are always interned
+  free(tildeName);
   writeTypeToDwarf(dbg,type);//detects that we're doing an old type and takes care of the rest
-  free(type->name);
   type->name=oldName;//restore the name
   type->cu=oldCu;
 
@@ -346,6 +348,46 @@ void writeTransformationToDwarf(Dwarf_P_Debug dbg,TypeTransform* trans)
     free(inst.arg2Bytes);
     free(inst.arg3Bytes);
   }
+  else if(TT_ARRAY==trans->from->type)
+  {
+    //an array of structs that changed. A single strided recursive
+    //fixup covers every element
+    TypeInfo* elemFrom=trans->from->pointedType;
+    TypeInfo* elemTo=trans->to->pointedType;
+    TypeTransform* transformer=elemFrom->transformer;
+    assert(transformer);
+    if(!transformer->onDisk)
+    {
+      writeTransformationToDwarf(dbg,transformer);
+    }
+    idx_t fdeIdx=transformer->fdeIdx;
+    //anything added to the end of the array is left zeroed
+    int count=min(trans->from->length/elemFrom->length,trans->to->length/elemTo->length);
+    logprintf(ELL_INFO_V3,ELS_DWARF_FRAME,"adding array fixup for %i elements\n",count);
+    if(count>0)
+    {
+      DwarfInstruction inst;
+      inst.opcode=DW_CFA_KATANA_fixups_array;
+      byte bytes[1+2*sizeof(int)];
+      int off=0;
+      bytes[0]=ERT_CURR_TARG_NEW;
+      memcpy(bytes+1,&elemTo->length,sizeof(int));
+      memcpy(bytes+1+sizeof(int),&off,sizeof(int));
+      inst.arg1Bytes=encodeAsLEB128NoOptimization(bytes,1+2*sizeof(int),false,&inst.arg1NumBytes);
+      bytes[0]=ERT_CURR_TARG_OLD;
+      memcpy(bytes+1,&elemFrom->length,sizeof(int));
+      inst.arg2Bytes=encodeAsLEB128NoOptimization(bytes,1+2*sizeof(int),false,&inst.arg2NumBytes);
+      inst.arg3=fdeIdx;
+      inst.arg3Bytes=encodeAsLEB128((byte*)&fdeIdx,sizeof(int),false,&inst.arg3NumBytes);
+      inst.arg4=count;
+      inst.arg4Bytes=encodeAsLEB128((byte*)&count,sizeof(int),false,&inst.arg4NumBytes);
+      addInstruction(&instrs,&inst);
+      free(inst.arg1Bytes);
+      free(inst.arg2Bytes);
+      free(inst.arg3Bytes);
+      free(inst.arg4Bytes);
+    }
+  }
   else if(TT_STRUCT==trans->from->type) //look at structure, not just straight copy
   {
     for(int i=0;i<trans->from->numFields;i++)
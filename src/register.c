@@ -61,14 +61,15 @@
 #include "symbol.h"
 #include <stdio.h>
 #include "leb.h"
+#include "dwarfexpr.h"
 
 PoReg readRegFromLEB128(byte* leb,usint* bytesRead)
 {
   PoReg result;
   usint numBytes;
-  usint numSeptets;
-  byte* bytes=decodeLEB128(leb,false,&numBytes,&numSeptets);
-  *bytesRead=numSeptets;
+  //the widest register encoding is a type byte followed by two ints
+  byte bytes[1+2*sizeof(int)+1];
+  *bytesRead=decodeLEB128ToBuffer(leb,false,bytes,sizeof(bytes),&numBytes);
   assert(numBytes>0);
   if(bytes[0] < ERT_PO_START)
   {
@@ -76,7 +77,6 @@ PoReg readRegFromLEB128(byte* leb,usint* bytesRead)
     result.type=ERT_BASIC;
     assert(numBytes<sizeof(idx_t));
     memcpy(&result.u.index,bytes,numBytes);
-    free(bytes);
     return result;
   }
   result.type=bytes[0];
@@ -106,7 +106,6 @@ PoReg readRegFromLEB128(byte* leb,usint* bytesRead)
   default:
     death("unsupported register type\n");
   }
-  free(bytes);
   return result;
 }
 
@@ -291,8 +290,9 @@ int resolveRegisterValue(PoReg* reg,SpecialRegsState* state,byte** result,int fl
     }
     break;
   case ERT_EXPR:
-    //todo: implement expression registers
-    death("expressions not supported yet. Poke the developer\n");
+    //a PoReg only carries an offset, there is nowhere to keep the
+    //expression itself
+    death("expression registers cannot be resolved, use DW_CFA_expression or DW_CFA_val_expression rules instead\n");
     break;
   case ERT_OLD_SYM_VAL:
     if(flags&ERRF_ASSIGN)
@@ -305,12 +305,25 @@ int resolveRegisterValue(PoReg* reg,SpecialRegsState* state,byte** result,int fl
     return sizeof(addr_t);
     break;
   case ERT_NEW_SYM_VAL:
-    //todo: implement NEW_SYM_VAL
-    death("ERT_NEW_SYM_VAL not supported yet. Poke the developer\n");
+    if(flags&ERRF_ASSIGN)
+    {
+      death("Cannot assign a symbol in the new version of the target\n");
+    }
+    if(!state->newBinaryElf)
+    {
+      death("No new version of the target to look up symbol %i in\n",reg->u.index);
+    }
+    addr=getSymAddress(state->newBinaryElf,reg->u.index);
+    *result=zmalloc(sizeof(addr_t));
+    memcpy(*result,&addr,sizeof(addr_t));
+    return sizeof(addr_t);
     break;
   case ERT_CFA:
-    //todo: implement NEW_SYM_VAL
-    death("ERT_CFA not supported yet. Poke the developer\n");
+    if(flags&ERRF_ASSIGN)
+    {
+      death("Cannot assign the cfa\n");
+    }
+    addr=state->cfaValue;
     break;
   default:
     death("unknown register type\n");
@@ -354,6 +367,11 @@ void printRule(FILE* file,PoRegRule rule,int regnum)
   case ERRT_CFA:
     {
       char* str;
+      if(rule.expr)
+      {
+        fprintf(file,"cfa = expression of %i operations\n",dwarfExprLength(rule.expr));
+        break;
+      }
       if(rule.regRH.type!=ERT_NONE)
       {
         str=strForReg(rule.regRH,0);
@@ -368,12 +386,21 @@ void printRule(FILE* file,PoRegRule rule,int regnum)
       fprintf(file,"cfa = %i(%s)\n",rule.offset,str);
     }
     break;
+  case ERRT_EXPR:
+    fprintf(file,"%s = [expression of %i operations]\n",regStr,dwarfExprLength(rule.expr));
+    break;
+  case ERRT_VAL_EXPR:
+    fprintf(file,"%s = expression of %i operations\n",regStr,dwarfExprLength(rule.expr));
+    break;
   case ERRT_RECURSE_FIXUP:
     fprintf(file,"%s = recurse fixup with FDE#%lu based at %s\n",regStr,(unsigned long)rule.index,strForReg(rule.regRH,0));
     break;
   case ERRT_RECURSE_FIXUP_POINTER:
     fprintf(file,"%s = recurse fixup pointer with FDE#%lu based at %s\n",regStr,(unsigned long)rule.index,strForReg(rule.regRH,0));
     break;
+  case ERRT_RECURSE_FIXUP_ARRAY:
+    fprintf(file,"%s = recurse fixup of %i elements with FDE#%lu based at %s\n",regStr,rule.count,(unsigned long)rule.index,strForReg(rule.regRH,0));
+    break;
   default:
     death("unknown rule type\n");
   }
@@ -381,13 +408,14 @@ void printRule(FILE* file,PoRegRule rule,int regnum)
 
 void printRules(FILE* file,Dictionary* rulesDict,char* tabstr)
 {
-  PoRegRule** rules=(PoRegRule**)dictValues(rulesDict);
-  for(int i=0;rules[i];i++)
+  DictIterator iter=DICT_ITERATOR_INIT;
+  PoRegRule* rule;
+  for(int i=0;dictIterNext(rulesDict,&iter,NULL,(void**)&rule);i++)
   {
-    if(rules[i]->type!=ERRT_UNDEF)
+    if(rule->type!=ERRT_UNDEF)
     {
       fprintf(file,"%s",tabstr);
-      printRule(file,*rules[i],i);
+      printRule(file,*rule,i);
     }
   }
 }
@@ -117,9 +117,11 @@ typedef enum
   ERRT_OFFSET,
   ERRT_REGISTER,
   ERRT_CFA,
-  ERRT_EXPR,
+  ERRT_EXPR,//the register is saved at the address the expression computes
+  ERRT_VAL_EXPR,//the register's value is what the expression computes
   ERRT_RECURSE_FIXUP,
   ERRT_RECURSE_FIXUP_POINTER,
+  ERRT_RECURSE_FIXUP_ARRAY,
   ERRT_UNDEFINED
 } E_REG_RULE_TYPE;
 
@@ -129,7 +131,11 @@ typedef struct
   E_REG_RULE_TYPE type;
   PoReg regRH;//not valid if type is ERRT_OFFSET
   int offset;//only valid if type is ERRT_OFFSET or ERRT_CFA or ERRT_EXPR
-  idx_t index;//only valid if type is ERRT_RECURSE_FIXUP or ERRT_RECURSE_FIXUP_POINTER
+  idx_t index;//only valid if type is one of the ERRT_RECURSE_FIXUP types
+  int count;//number of elements, only valid if type is ERRT_RECURSE_FIXUP_ARRAY
+  //only valid if type is ERRT_EXPR or ERRT_VAL_EXPR, or for ERRT_CFA
+  //set by DW_CFA_def_cfa_expression. Not owned by the rule
+  struct DwarfExprProgram* expr;
 } PoRegRule;
 
 //rules are of type PoRegRule
@@ -141,6 +147,7 @@ typedef struct
   addr_t currAddrOld;//corresponding to CURR_TARG_OLD register
   addr_t currAddrNew;//corresponding to CURR_TARG_NEW register
   struct ElfInfo* oldBinaryElf;//needed for looking up symbols
+  struct ElfInfo* newBinaryElf;//needed for ERT_NEW_SYM_VAL
   addr_t cfaValue;
 } SpecialRegsState;
 
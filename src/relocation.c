@@ -63,8 +63,7 @@
 
 void applyAllRelocations(ElfInfo* e,ElfInfo* oldElf)
 {
-  List* relocsHead=NULL;
-  List* relocsTail=NULL;
+  RelocInfoVec relocs={0};
   for(Elf_Scn* scn=elf_nextscn (e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
   {
     GElf_Shdr shdr;
@@ -73,28 +72,13 @@ void applyAllRelocations(ElfInfo* e,ElfInfo* oldElf)
     if(!strncmp("rel.",name,strlen("rel.")))
     {
       //this is a relocations section
-      Elf_Data* data=elf_getdata(scn,NULL);
-      for(int j=0;j<data->d_size/shdr.sh_entsize;j++)
-      {
-        GElf_Rel* rel=zmalloc(sizeof(GElf_Rel));
-        gelf_getrel(data,j,rel);
-        List* li=zmalloc(sizeof(List));
-        //todo: this is broken: wrong value type
-        li->value=rel;
-        if(relocsHead)
-        {
-          relocsTail->next=li;
-        }
-        else
-        {
-          relocsHead=li;
-        }
-        relocsTail=li;
-      }
+      RelocInfoVec scnRelocs=getRelocationItemsInRange(e,scn,0,(addr_t)-1);
+      RelocInfoVecAppend(&relocs,RelocInfoVecAsSpan(&scnRelocs));
+      RelocInfoVecFree(&scnRelocs);
     }
   }
-  applyRelocations(relocsHead,ON_DISK);
-  deleteList(relocsHead,free);
+  applyRelocations(RelocInfoVecAsSpan(&relocs),ON_DISK);
+  RelocInfoVecFree(&relocs);
 }
 
 addr_t getPLTEntryForSym(ElfInfo* e,int symIdx)
@@ -194,6 +178,7 @@ void setRelocationEntryAtOffset(RelocInfo* reloc,Elf_Scn* relocScn,addr_t offset
     rela.r_addend=reloc->r_addend;
     memcpy(data->d_buf+offset,&rela,sizeof(rela));
   }
+  elf_flagdata(data,ELF_C_SET,ELF_F_DIRTY);
 }
 
 RelocInfo* getRelocationEntryAtOffset(ElfInfo* e,Elf_Scn* relocScn,addr_t offset)
@@ -329,35 +314,39 @@ void applyRelocation(RelocInfo* rel,ELF_STORAGE_TYPE type)
     Elf_Data* data=elf_getdata(relScn,NULL);
     void* dataptr=data->d_buf+(addrToBeRelocated-shdr.sh_addr);
     memcpy(dataptr,&newAddrAccessed,bytesInAddr);
+    //or it won't be written out (see streamOutElf, writeELFOverlay)
+    elf_flagdata(data,ELF_C_SET,ELF_F_DIRTY);
   }
 }
 
-//apply a list of relocations (list value type is GElf_Reloc)
-void applyRelocations(List* relocs,ELF_STORAGE_TYPE type)
+//apply a batch of relocations
+void applyRelocations(RelocInfoVecSpan relocs,ELF_STORAGE_TYPE type)
 {
-  List* li=relocs;
-  for(;li;li=li->next)
+  for(int i=0;i<relocs.len;i++)
   {
-    RelocInfo* reloc=(RelocInfo*)li->value;
-    applyRelocation(reloc,type);
+    applyRelocation(&relocs.data[i],type);
   }
 }
 
+int cmpRelocInfoByOffset(const void* a,const void* b)
+{
+  addr_t offsetA=((const RelocInfo*)a)->r_offset;
+  addr_t offsetB=((const RelocInfo*)b)->r_offset;
+  return offsetA<offsetB?-1:(offsetA>offsetB?1:0);
+}
+
 
 //get relocation items that live in the given relocScn
 //that are for  in-memory addresses between lowAddr and highAddr inclusive
-//list value type is RelocInfo
-List* getRelocationItemsInRange(ElfInfo* e,Elf_Scn* relocScn,addr_t lowAddr,addr_t highAddr)
+RelocInfoVec getRelocationItemsInRange(ElfInfo* e,Elf_Scn* relocScn,addr_t lowAddr,addr_t highAddr)
 {
   assert(e);
+  RelocInfoVec relocs={0};
   if(!relocScn)
   {
-    return NULL;
+    return relocs;
   }
 
-  RelocInfo* reloc=NULL;
-  List* relocsHead=NULL;
-  List* relocsTail=NULL;
   GElf_Shdr shdr;
   if(!gelf_getshdr(relocScn,&shdr))
   {
@@ -366,69 +355,53 @@ List* getRelocationItemsInRange(ElfInfo* e,Elf_Scn* relocScn,addr_t lowAddr,addr
   assert(SHT_REL==shdr.sh_type || SHT_RELA==shdr.sh_type);
   Elf_Data* data=elf_getdata(relocScn,NULL);
   int scnIdx=shdr.sh_info;//section relocation applies to
-  GElf_Rel rel;
-  GElf_Rela rela;
+  ElfXX_Rel* rels=getNativeRels(e,data);
+  ElfXX_Rela* relas=getNativeRelas(e,data);
   for(int i=0;i<data->d_size/shdr.sh_entsize;i++)
   {
-    if(!reloc)
-    {
-      reloc=zmalloc(sizeof(RelocInfo));
-      reloc->e=e;
-      reloc->scnIdx=scnIdx;
-    }
     if(SHT_REL==shdr.sh_type)
     {
-      gelf_getrel(data,i,&rel);
-      if(rel.r_offset < lowAddr || rel.r_offset > highAddr)
+      ElfXX_Rel buf;
+      ElfXX_Rel* rel=getRelInTable(rels,data,i,&buf);
+      if(rel->r_offset < lowAddr || rel->r_offset > highAddr)
       {
         continue;
       }
-      reloc->r_offset=rel.r_offset;
-      reloc->relocType=ELF64_R_TYPE(rel.r_info);//elf64 because it's GElf
-      reloc->symIdx=ELF64_R_SYM(rel.r_info);//elf64 because it's GElf
+      RelocInfo* reloc=RelocInfoVecPush(&relocs);
+      reloc->e=e;
+      reloc->scnIdx=scnIdx;
+      reloc->r_offset=rel->r_offset;
+      reloc->relocType=ELFXX_R_TYPE(rel->r_info);
+      reloc->symIdx=ELFXX_R_SYM(rel->r_info);
       reloc->r_addend=computeAddend(e,reloc->relocType,reloc->symIdx,reloc->r_offset,reloc->scnIdx);
 
     }
     else //RELA
     {
-      gelf_getrela(data,i,&rela);
-      if(rela.r_offset < lowAddr || rela.r_offset > highAddr)
+      ElfXX_Rela buf;
+      ElfXX_Rela* rela=getRelaInTable(relas,data,i,&buf);
+      if(rela->r_offset < lowAddr || rela->r_offset > highAddr)
       {
         continue;
       }
-      reloc->r_offset=rela.r_offset;
-      reloc->r_addend=rela.r_addend;
-      reloc->relocType=ELF64_R_TYPE(rela.r_info);//elf64 because it's GElf
-      reloc->symIdx=ELF64_R_SYM(rela.r_info);//elf64 because it's GElf
-    }
-    List* li=zmalloc(sizeof(List));
-    li->value=reloc;
-    reloc=NULL;
-    if(relocsHead)
-    {
-      relocsTail->next=li;
-    }
-    else
-    {
-      relocsHead=li;
+      RelocInfo* reloc=RelocInfoVecPush(&relocs);
+      reloc->e=e;
+      reloc->scnIdx=scnIdx;
+      reloc->r_offset=rela->r_offset;
+      reloc->r_addend=rela->r_addend;
+      reloc->relocType=ELFXX_R_TYPE(rela->r_info);
+      reloc->symIdx=ELFXX_R_SYM(rela->r_info);
     }
-    relocsTail=li;
   }
-  if(reloc)
-  {
-    free(reloc);//had an extra one allocated
-  }
-  return relocsHead;
+  return relocs;
 }
 
-List* getRelocationItemsFor(ElfInfo* e,int symIdx)
+RelocInfoVec getRelocationItemsFor(ElfInfo* e,int symIdx)
 {
   GElf_Sym sym;
   getSymbol(e,symIdx,&sym);
   logprintf(ELL_INFO_V2,ELS_RELOCATION,"getting relocation items for symbol %s\n",getString(e,sym.st_name));
-  RelocInfo* reloc=NULL;
-  List* relocsHead=NULL;
-  List* relocsTail=NULL;
+  RelocInfoVec relocs={0};
   for(Elf_Scn* scn=elf_nextscn (e->e,NULL);scn;scn=elf_nextscn(e->e,scn))
   {
     GElf_Shdr shdr;
@@ -439,63 +412,48 @@ List* getRelocationItemsFor(ElfInfo* e,int symIdx)
     {
       //this is a relocations section
       Elf_Data* data=elf_getdata(scn,NULL);
+      ElfXX_Rel* rels=getNativeRels(e,data);
+      ElfXX_Rela* relas=getNativeRelas(e,data);
       for(int j=0;j<data->d_size/shdr.sh_entsize;j++)
       {
-        if(!reloc)
-        {
-          reloc=zmalloc(sizeof(RelocInfo));
-          reloc->e=e;
-        }
-        reloc->scnIdx=scnIdx;
         if(SHT_REL==shdr.sh_type)
         {
-          GElf_Rel rel;
-          gelf_getrel(data,j,&rel);
-          if(ELF64_R_SYM(rel.r_info)!=symIdx)
+          ElfXX_Rel buf;
+          ElfXX_Rel* rel=getRelInTable(rels,data,j,&buf);
+          if(ELFXX_R_SYM(rel->r_info)!=symIdx)
           {
             continue;
           }
-          reloc->r_offset=rel.r_offset;
-          reloc->relocType=ELF64_R_TYPE(rel.r_info);//elf64 because it's GElf
-          reloc->symIdx=ELF64_R_SYM(rel.r_info);//elf64 because it's GElf
-	  reloc->r_addend=computeAddend(e,reloc->relocType,reloc->symIdx,reloc->r_offset,reloc->scnIdx);
+          RelocInfo* reloc=RelocInfoVecPush(&relocs);
+          reloc->e=e;
+          reloc->scnIdx=scnIdx;
+          reloc->r_offset=rel->r_offset;
+          reloc->relocType=ELFXX_R_TYPE(rel->r_info);
+          reloc->symIdx=ELFXX_R_SYM(rel->r_info);
+          reloc->r_addend=computeAddend(e,reloc->relocType,reloc->symIdx,reloc->r_offset,reloc->scnIdx);
         }
         else //SHT_RELA
         {
-          GElf_Rela rela;
-          gelf_getrela(data,j,&rela);
-          if(ELF64_R_SYM(rela.r_info)!=symIdx)
+          ElfXX_Rela buf;
+          ElfXX_Rela* rela=getRelaInTable(relas,data,j,&buf);
+          if(ELFXX_R_SYM(rela->r_info)!=symIdx)
           {
             continue;
           }
-          reloc->r_offset=rela.r_offset;
-          reloc->relocType=ELF64_R_TYPE(rela.r_info);//elf64 because it's GElf
-          reloc->symIdx=ELF64_R_SYM(rela.r_info);//elf64 because it's GElf
-          reloc->r_addend=rela.r_addend;
-        }
-        List* li=zmalloc(sizeof(List));
-        li->value=reloc;
-        reloc=NULL;
-        if(relocsHead)
-        {
-          relocsTail->next=li;
-        }
-        else
-        {
-          relocsHead=li;
+          RelocInfo* reloc=RelocInfoVecPush(&relocs);
+          reloc->e=e;
+          reloc->scnIdx=scnIdx;
+          reloc->r_offset=rela->r_offset;
+          reloc->relocType=ELFXX_R_TYPE(rela->r_info);
+          reloc->symIdx=ELFXX_R_SYM(rela->r_info);
+          reloc->r_addend=rela->r_addend;
         }
-        relocsTail=li;
       }
     }
   }
-  if(reloc)
-  {
-    free(reloc);//had an extra one allocated
-  }
-  return relocsHead;
+  return relocs;
 }
 
-
 //compute an addend for when we have REL instead of RELA
 //type is relocation type
 //scnIdx is section the relocation refers to
@@ -58,6 +58,7 @@
 
 #include "elfparse.h"
 #include <gelf.h>
+#include "util/vector.h"
 
 //we always store the addend for relocations, it's just easier that way
 typedef struct
@@ -70,6 +71,11 @@ typedef struct
   int scnIdx;//which section this relocation applies to in e
 } RelocInfo;
 
+VECTOR_DEFINE(RelocInfoVec,RelocInfo)
+
+//orders relocations by r_offset, for RelocInfoVecSort
+int cmpRelocInfoByOffset(const void* a,const void* b);
+
 //todo: I don't think this struct is currently used
 //for anything --james
 typedef struct
@@ -80,14 +86,13 @@ typedef struct
   int newSymIdx;
 } SymMoveInfo;
 
-//List should be freed when you're finished with it
-//list value type is RelocInfo
-List* getRelocationItemsFor(ElfInfo* e,int symIdx);
+//the vector should be freed with RelocInfoVecFree when you're finished with it
+RelocInfoVec getRelocationItemsFor(ElfInfo* e,int symIdx);
 
 //get relocation items that live in the given relocScn
 //that are for  in-memory addresses between lowAddr and highAddr inclusive
-//list value type is RelocInfo
-List* getRelocationItemsInRange(ElfInfo* e,Elf_Scn* relocScn,addr_t lowAddr,addr_t highAddr);
+//the vector should be freed with RelocInfoVecFree when you're finished with it
+RelocInfoVec getRelocationItemsInRange(ElfInfo* e,Elf_Scn* relocScn,addr_t lowAddr,addr_t highAddr);
 
 //get the relocation entry at the given offset from the start of relocScn
 RelocInfo* getRelocationEntryAtOffset(ElfInfo* e,Elf_Scn* relocScn,addr_t offset);
@@ -100,8 +105,8 @@ void setRelocationEntryAtOffset(RelocInfo* reloc,Elf_Scn* relocScn,addr_t offset
 //in-memory or on-disk or both
 void applyRelocation(RelocInfo* rel,ELF_STORAGE_TYPE type);
 
-//apply a list of relocations (list value type is GElf_Reloc)
-void applyRelocations(List* relocs,ELF_STORAGE_TYPE type);
+//apply a batch of relocations
+void applyRelocations(RelocInfoVecSpan relocs,ELF_STORAGE_TYPE type);
 
 
 //apply all relocations in an executable
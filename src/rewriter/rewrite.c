@@ -17,8 +17,10 @@
 
 #include "elfparse.h"
 
-//at the moment this function merely reads in an object and rewrites it out
+//at the moment this function merely reads in an object and rewrites it
+//out. That's to exercise libelf's reading and writing, so it mustn't
+//just copy the file
 void rewrite(ElfInfo* object,char* outfname)
 {
-  writeOutElf(object,outfname,true);
+  writeOutElfWithLibelf(object,outfname,true);
 }
@@ -160,10 +160,12 @@ void DwarfscriptCommand::printFDEInfo(FILE* file,ElfInfo* elf,FDE* fde)
   {
     fprintf(file,"lsda_idx: 0x%zx\n",fde->lsdaIdx);
   }
+  int numInstructions;
+  RegInstruction* instructions=getFDEInstructions(fde,&numInstructions);
   fprintf(file,"begin INSTRUCTIONS\n");
-  for(int i=0;i<fde->numInstructions;i++)
+  for(int i=0;i<numInstructions;i++)
   {
-    printInstruction(file,fde->instructions[i],DWIPF_NO_REG_NAMES|DWIPF_DWARFSCRIPT);
+    printInstruction(file,instructions[i],DWIPF_NO_REG_NAMES|DWIPF_DWARFSCRIPT);
   }
   fprintf(file,"end INSTRUCTIONS\n");
   fprintf(file,"end FDE\n");
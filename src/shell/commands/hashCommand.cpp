@@ -55,6 +55,10 @@
 
 #include "hashCommand.h"
 #include <libelf.h>
+extern "C"
+{
+#include "elfutil.h"
+}
 
 HashCommand::HashCommand(HashType type,ShellParam* stringP)
   :type(type),stringP(stringP)
@@ -88,6 +92,37 @@ void HashCommand::execute()
       }
     }
     break;
+  case HT_GNU:
+    if(stringP->isCapable(SPC_ELF_VALUE))
+    {
+      //hash every dynamic symbol
+      ElfInfo* e=stringP->getElfObject();
+      if(!e || !hasERS(e,ERS_DYNSYM))
+      {
+        throw "ELF object has no dynamic symbols to hash";
+      }
+      Elf_Data* dynsymData=getDataByERS(e,ERS_DYNSYM);
+      ElfXX_Sym* syms=getNativeSymbols(e,dynsymData);
+      int numSyms=dynsymData->d_size/sizeof(ElfXX_Sym);
+      for(int i=1;i<numSyms;i++)
+      {
+        ElfXX_Sym buf;
+        ElfXX_Sym* sym=getSymbolInTable(syms,dynsymData,i,&buf);
+        char* name=getDynString(e,sym->st_name);
+        printf("%i. %s: 0x%08x\n",i,name,gnuHash(name));
+      }
+    }
+    else
+    {
+      char* str=stringP->getString();
+      if(!str)
+      {
+        logprintf(ELL_WARN,ELS_SHELL,"hash command parameter could not yield a string or ELF object to hash\n");
+        throw "No string given to hash";
+      }
+      printf("gnu hash yields 0x%08x\n",gnuHash(str));
+    }
+    break;
   default:
     logprintf(ELL_ERR,ELS_SHELL,"Unhandled Hash Type\n");
   }
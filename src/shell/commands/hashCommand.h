@@ -61,6 +61,7 @@
 typedef enum
 {
   HT_ELF, //the ELF symbol hash
+  HT_GNU, //the hash used by .gnu.hash
 } HashType;
 
 class HashCommand : public ShellCommand
@@ -83,9 +83,9 @@ void InfoCommand::execute()
       {
         throw "ELF object is not a patch";
       }
-      Map* fdeMap=readDebugFrame(elf,false);
+      readDebugFrame(elf,false);
       printf("*********Type and Function Info****************\n");
-      printPatchDwarfInfo(elf,fdeMap);
+      printPatchDwarfInfo(elf);
       printf("\n*********Safety Info****************\n");
       printPatchUnsafeFuncsInfo(elf);
       printf("\n*********Type Transformation Rules****************\n");
@@ -48,7 +48,7 @@ extern "C"
 %token T_LOAD T_SAVE T_TRANSLATE T_REPLACE T_SECTION T_VARIABLE T_STRING_LITERAL
 %token T_EXTRACT T_SECTION_DATA
 %token T_DATA T_DWARFSCRIPT T_COMPILE T_EMIT T_SHELL_COMMAND
-%token T_HASH T_ELF
+%token T_HASH T_ELF T_GNU
 %token T_INFO T_EXCEPTION_HANDLING
 %token T_PATCH T_GENERATE T_APPLY
 %token T_NONNEG_INT T_RAW
@@ -276,10 +276,15 @@ hashcmd : T_HASH T_ELF param
   $$.u.cmd=new HashCommand(HT_ELF,$3.u.param);
   $3.u.param->drop();
 }
+| T_HASH T_GNU param
+{
+  $$.u.cmd=new HashCommand(HT_GNU,$3.u.param);
+  $3.u.param->drop();
+}
 | T_HASH error
 {
   fprintf(stderr,"Usage: hash TYPE STRING_TO_HASH\n");
-  fprintf(stderr,"The only hash type currently supported is 'elf'\n");
+  fprintf(stderr,"The supported hash types are 'elf' and 'gnu'\n");
   YYERROR;
 }
 
@@ -60,6 +60,8 @@
 #include <string.h>
 #include "patcher/versioning.h"
 #include "elfutil.h"
+#include "util/intern.h"
+#include "elfindex.h"
 
 void getSymbol(ElfInfo* e,int symIdx,GElf_Sym* outSym)
 {
@@ -328,6 +330,67 @@ int reindexSymbol(ElfInfo* old,ElfInfo* new,int oldIdx,int flags)
   return idx;
 }
 
+//throws away the symbol name index and starts a new, empty one for
+//symTabData
+static void resetSymbolNameIndex(ElfInfo* e,Elf_Data* symTabData)
+{
+  if(e->symbolNameIndex)
+  {
+    mapDelete(e->symbolNameIndex,NULL,NULL);
+  }
+  else
+  {
+    retainInternPool();//released by endELF along with the index
+  }
+  e->symbolNameIndex=internedMapCreate(e->symTabCount);
+  e->symbolNameIndexData=symTabData;
+  e->symbolNameIndexCount=0;
+}
+
+//looks up an exact name in the static symbol table using an index from
+//interned names to the first symbol with that name. The index is
+//built up lazily, only scanning as far into the symbol table as we
+//have had to so far, and is extended as symbols are added
+static int getSymtabIdxIndexed(ElfInfo* e,char* symbolName,Elf_Data* symTabData)
+{
+  if(!e->symbolNameIndex || e->symbolNameIndexData!=symTabData ||
+     e->symbolNameIndexCount>e->symTabCount)
+  {
+    //first lookup, or the symbol table has been replaced
+    resetSymbolNameIndex(e,symTabData);
+  }
+  char* name=internString(symbolName);
+  size_t idx=(size_t)mapGet(e->symbolNameIndex,name);//index+1
+  if(idx)
+  {
+    //a symbol may have been renamed since we indexed it
+    GElf_Sym sym;
+    gelf_getsym(symTabData,idx-1,&sym);
+    if(!strcmp(getString(e,sym.st_name),name))
+    {
+      return idx-1;
+    }
+    resetSymbolNameIndex(e,symTabData);
+  }
+  ElfXX_Sym* syms=getNativeSymbols(e,symTabData);
+  while(e->symbolNameIndexCount<e->symTabCount)
+  {
+    int i=e->symbolNameIndexCount++;
+    ElfXX_Sym buf;
+    ElfXX_Sym* sym=getSymbolInTable(syms,symTabData,i,&buf);
+    char* symname=internString(getString(e,sym->st_name));
+    if(!mapExists(e->symbolNameIndex,symname))
+    {
+      mapInsert(e->symbolNameIndex,symname,(void*)(size_t)(i+1));
+    }
+    if(symname==name)
+    {
+      return i;
+    }
+  }
+  return STN_UNDEF;
+}
+
 //flags is OR'd E_SYMBOL_FIND_FLAGS
 //only ESFF_MANGLED_OK and ESFF_DYNAMIC are relevant
 int getSymtabIdx(ElfInfo* e,char* symbolName,int flags)
@@ -387,6 +450,25 @@ int getSymtabIdx(ElfInfo* e,char* symbolName,int flags)
     getstrfunc=&getString;
   }
 
+  if(!(flags & (ESFF_NEW_DYNAMIC|ESFF_MANGLED_OK)))
+  {
+    ElfIndex* index=getELFIndex(e);
+    int idx;
+    if(index && symbolName[0])
+    {
+      idx=findSymbolByNameInIndex(index,e,symbolName);
+    }
+    else
+    {
+      idx=getSymtabIdxIndexed(e,symbolName,symTabData);
+    }
+    if(STN_UNDEF==idx)
+    {
+      logprintf(ELL_INFO_V1,ELS_SYMBOL,"Symbol '%s' not defined yet. This may or may not be a problem\n",symbolName);
+    }
+    return idx;
+  }
+
   char* symbolNameUnmangled=symbolName;
   if(flags & ESFF_MANGLED_OK)
   {
@@ -398,12 +480,13 @@ int getSymtabIdx(ElfInfo* e,char* symbolName,int flags)
   bool found=false;
   //traverse the symbol table to find the symbol we're looking for. Yes this is slow
   //todo: build our own hash table since the .hash section seems incomplete
+  ElfXX_Sym* syms=getNativeSymbols(e,symTabData);
   int i;
   for (i = 0; i < e->symTabCount; ++i)
   {
-    GElf_Sym sym;
-    gelf_getsym(symTabData,i,&sym);
-    char* symname=(*getstrfunc)(e,sym.st_name);
+    ElfXX_Sym buf;
+    ElfXX_Sym* sym=getSymbolInTable(syms,symTabData,i,&buf);
+    char* symname=(*getstrfunc)(e,sym->st_name);
     char* symnameUnmangled=symname;
     if(flags & ESFF_MANGLED_OK)
     {
@@ -438,7 +521,7 @@ int getSymtabIdx(ElfInfo* e,char* symbolName,int flags)
 //addr>st_value && addr<st_value+st_size
 //only match symbols whose type is type and are for section scnIdx
 //pass SHN_UNDEF for scnIdx to accept symbols referencing any section
-//todo: this is slow. Could do smth much faster with interval tress or something
+//this is slow for big symbol tables without an index (see elfindex.h)
 idx_t findSymbolContainingAddress(ElfInfo* e,addr_t addr,byte type,idx_t scnIdx)
 {
   if(!hasERS(e, ERS_SYMTAB))
@@ -446,17 +529,22 @@ idx_t findSymbolContainingAddress(ElfInfo* e,addr_t addr,byte type,idx_t scnIdx)
     //we don't have a .symtab, can't guess a function
     return STN_UNDEF;
   }
+  ElfIndex* index=getELFIndex(e);
+  if(index)
+  {
+    return findSymbolByAddressInIndex(index,addr,type,scnIdx);
+  }
   Elf_Data* symTabData=getDataByERS(e,ERS_SYMTAB);
+  ElfXX_Sym* syms=getNativeSymbols(e,symTabData);
   for (int i = 1; i < e->symTabCount; ++i)
   {
-    GElf_Sym sym;
-    if(!gelf_getsym(symTabData,i,&sym))
-    {death("gelf_getsym failed\n");}
-    if(ELFXX_ST_TYPE(sym.st_info)==type &&
-       (sym.st_shndx==scnIdx || SHN_UNDEF==scnIdx) &&
-       (sym.st_value==addr || 
-        (sym.st_value<=addr &&
-         sym.st_value+sym.st_size > addr)))
+    ElfXX_Sym buf;
+    ElfXX_Sym* sym=getSymbolInTable(syms,symTabData,i,&buf);
+    if(ELFXX_ST_TYPE(sym->st_info)==type &&
+       (sym->st_shndx==scnIdx || SHN_UNDEF==scnIdx) &&
+       (sym->st_value==addr || 
+        (sym->st_value<=addr &&
+         sym->st_value+sym->st_size > addr)))
        
     {
       return i;
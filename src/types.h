@@ -62,7 +62,7 @@
 #include "util/list.h"
 #include "libdwarf_inc.h"
 #include <string.h>
-#include "util/refcounted.h"
+#include "util/arena.h"
 
 typedef unsigned int uint;
 //need to change these if on any machine/compiler on which an int is
@@ -104,8 +104,8 @@ typedef struct
 {
   TypeAndVarInfo* tv;
   Dictionary* subprograms;//functions in this compilation unit mapped by name. Type of SubprogramInfo
-  char* name;
-  char* id;//in case two compilation units have the same name
+  char* name;//interned, see util/intern.h
+  char* id;//in case two compilation units have the same name. Interned
   bool presentInOtherVersion;
   Dwarf_P_Die die;//for when writing out a patch
   Dwarf_P_Die lastDie;//for when writing out a patch
@@ -116,7 +116,7 @@ void freeCompilationUnit(CompilationUnit* cu);
 
 typedef struct
 {
-  char* name;
+  char* name;//interned
   addr_t lowpc;
   addr_t highpc;
   List* typesHead;//list of types used within the subprogram. Later
@@ -131,8 +131,11 @@ typedef struct
 
 typedef struct
 {
-  List* compilationUnits;
+  List* compilationUnits;//only those which have been read in so far
   List* lastCompilationUnit;
+  struct DwarfIndex* index;//non-NULL while compilation units may still
+                           //be read in on demand, see indexDWARFTypes
+  Arena* arena;//everything read in from the DWARF is allocated here
 } DwarfInfo;
 
 void freeDwarfInfo(DwarfInfo* di);
@@ -165,12 +168,7 @@ typedef enum E_TYPEDIFF_STATUS
 //not all members are used by all types (for example, structs use more)
 typedef struct TypeInfo_
 {
-  RefCounted rc;//note that when calling the grab and release methods
-                //we should pass a pointer to the whole type,
-                //cast. This will work properly because of the way C
-                //lays out memory as long as rc remains the first
-                //member of TypeInfo
-  char* name;
+  char* name;//interned, so names can be compared by pointer
   TYPE_TYPE type;
   int length;//overall length in bytes of the type
   bool incomplete;/*if true indicates that this type is in the process
@@ -202,7 +200,7 @@ typedef struct TypeInfo_
   //to the subroutine
   ///////////////////////////////////////////
   int numFields;
-  char** fields;
+  char** fields;//interned names
   int* fieldOffsets;//because of packed structs, may not be calculatable from fieldTypes[idx]->length
   struct TypeInfo_** fieldTypes;
   ///////////////////////////////////////////
@@ -230,8 +228,6 @@ typedef struct TypeInfo_
   ////////////////////////////////////////
 } TypeInfo;
 
-TypeInfo* duplicateTypeInfo(const TypeInfo* t);
-void freeTypeInfo(TypeInfo* t);
 
 #define FIELD_DELETED -2
 typedef enum
@@ -262,7 +258,7 @@ void freeTypeTransform(TypeTransform* t);
 
 typedef struct
 {
-  char* name;
+  char* name;//interned
   TypeInfo* type;
   addr_t newLocation;//used in applying the patch
   addr_t oldLocation;//used in applying the patch
@@ -271,10 +267,6 @@ typedef struct
 } VarInfo;
 
 
-void freeVarInfo(VarInfo* v);
-
-//wrapper
-void freeVarInfoVoid(void* v);
 
 
 //todo: is this type necessary, I think we could
@@ -0,0 +1,134 @@
+/*
+  File: arena.c
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: region allocator
+*/
+
+#include "arena.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_DEFAULT_CHUNK_SIZE (64*1024)
+#define ARENA_ALIGN (sizeof(long double))
+
+static size_t alignUp(size_t size)
+{
+  return (size+ARENA_ALIGN-1)&~(ARENA_ALIGN-1);
+}
+
+Arena* arenaCreate(size_t chunkSize)
+{
+  Arena* arena=zmalloc(sizeof(Arena));
+  arena->chunkSize=chunkSize?chunkSize:ARENA_DEFAULT_CHUNK_SIZE;
+  return arena;
+}
+
+void arenaDelete(Arena* arena)
+{
+  if(!arena)
+  {
+    return;
+  }
+  ArenaChunk* chunk=arena->chunks;
+  while(chunk)
+  {
+    ArenaChunk* next=chunk->next;
+    free(chunk);
+    chunk=next;
+  }
+  free(arena);
+}
+
+static ArenaChunk* addChunk(Arena* arena,size_t minSize)
+{
+  size_t size=max(arena->chunkSize,minSize);
+  ArenaChunk* chunk=malloc(sizeof(ArenaChunk)+size);
+  MALLOC_CHECK(chunk);
+  chunk->size=size;
+  chunk->used=0;
+  ArenaChunk* current=arena->chunks;
+  if(current && size>arena->chunkSize && current->size-current->used>=ARENA_DEFAULT_CHUNK_SIZE/16)
+  {
+    //an oversized allocation shouldn't waste what is left of the
+    //current chunk, put it behind it
+    chunk->next=current->next;
+    current->next=chunk;
+  }
+  else
+  {
+    chunk->next=current;
+    arena->chunks=chunk;
+  }
+  return chunk;
+}
+
+void* arenaAlloc(Arena* arena,size_t size)
+{
+  size=alignUp(size);
+  ArenaChunk* chunk=arena->chunks;
+  if(!chunk || chunk->size-chunk->used<size)
+  {
+    chunk=addChunk(arena,size);
+  }
+  void* result=(char*)chunk->data+chunk->used;
+  chunk->used+=size;
+  arena->bytesAllocated+=size;
+  memset(result,0,size);
+  arena->last=result;
+  return result;
+}
+
+void* arenaRealloc(Arena* arena,void* ptr,size_t oldSize,size_t newSize)
+{
+  if(!ptr)
+  {
+    return arenaAlloc(arena,newSize);
+  }
+  ArenaChunk* chunk=arena->chunks;
+  if(ptr==arena->last && chunk &&
+     (char*)ptr+alignUp(oldSize)==(char*)chunk->data+chunk->used)
+  {
+    size_t oldAligned=alignUp(oldSize);
+    size_t newAligned=alignUp(newSize);
+    if(newAligned<=oldAligned || chunk->used-oldAligned+newAligned<=chunk->size)
+    {
+      chunk->used=chunk->used-oldAligned+newAligned;
+      if(newSize>oldSize)
+      {
+        memset((char*)ptr+oldSize,0,newSize-oldSize);
+      }
+      return ptr;
+    }
+  }
+  if(newSize<=oldSize)
+  {
+    return ptr;
+  }
+  void* result=arenaAlloc(arena,newSize);
+  memcpy(result,ptr,oldSize);
+  return result;
+}
+
+char* arenaStrdup(Arena* arena,const char* str)
+{
+  return arenaMemdup(arena,str,strlen(str)+1);
+}
+
+void* arenaMemdup(Arena* arena,const void* data,size_t size)
+{
+  void* result=arenaAlloc(arena,size);
+  memcpy(result,data,size);
+  return result;
+}
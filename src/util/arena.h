@@ -0,0 +1,55 @@
+/*
+  File: arena.h
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: region allocator. Everything allocated from an arena is
+               released at once when the arena is deleted, individual
+               allocations are never freed
+*/
+
+#ifndef arena_h
+#define arena_h
+
+#include <stddef.h>
+
+typedef struct ArenaChunk
+{
+  struct ArenaChunk* next;
+  size_t used;
+  size_t size;
+  //aligned for anything we might put in it
+  long double data[];
+} ArenaChunk;
+
+typedef struct
+{
+  ArenaChunk* chunks;//current chunk first
+  size_t chunkSize;
+  void* last;//most recent allocation, can be resized in place
+  size_t bytesAllocated;
+} Arena;
+
+//chunkSize of 0 picks a reasonable default
+Arena* arenaCreate(size_t chunkSize);
+//frees everything ever allocated from the arena
+void arenaDelete(Arena* arena);
+//returned memory is zeroed, like zmalloc
+void* arenaAlloc(Arena* arena,size_t size);
+//ptr must have come from this arena (or be NULL). Grows or shrinks
+//in place if ptr is the most recent allocation, otherwise copies.
+//Any newly added space is zeroed
+void* arenaRealloc(Arena* arena,void* ptr,size_t oldSize,size_t newSize);
+char* arenaStrdup(Arena* arena,const char* str);
+void* arenaMemdup(Arena* arena,const void* data,size_t size);
+
+#endif
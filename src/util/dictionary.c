@@ -61,219 +61,234 @@
 #include <stdio.h>
 #include <assert.h>
 
-//! create an empty dictionary with the given number of buckets
-Dictionary* dictCreate(int bucketCnt)
+#define DICT_MIN_SLOTS 8
+//maximum load factor is DICT_LOAD_NUM/DICT_LOAD_DEN
+#define DICT_LOAD_NUM 3
+#define DICT_LOAD_DEN 4
+#define DICT_KEY_CHUNK_SIZE 4096
+
+//spreads the hash over the slot table (Fibonacci hashing)
+static inline int dictHomeSlot(const Dictionary* dict,unsigned long hash)
 {
-  Dictionary* dict=malloc(sizeof(Dictionary));
-  MALLOC_CHECK(dict);
-  BZERO(dict,sizeof(*dict));
-  dict->hash=malloc(bucketCnt*sizeof(DNODE*));
-  dict->numBuckets=bucketCnt;
-  MALLOC_CHECK(dict->hash);
-  BZERO(dict->hash,bucketCnt*sizeof(DNODE*));
-  dict->size=0;
-  dict->rc.refcount=1;
-  return dict;
+  return (int)(((uint64_t)hash*0x9E3779B97F4A7C15ULL)>>dict->slotShift);
 }
 
-//helper function
-DNODE* dictNodeDuplicate(DNODE* n,void* (*dataCP)(void*))
+//copies key into the dictionary's key storage
+static char* dictStoreKey(Dictionary* dict,const char* key,size_t len)
 {
-  if(!n)
+  DictKeyChunk* chunk=dict->keys;
+  if(!chunk || chunk->size-chunk->used<len)
   {
-    return NULL;
+    //keys longer than a chunk get a chunk to themselves
+    size_t size=max(DICT_KEY_CHUNK_SIZE,len);
+    //fill the first chunk before moving on to bigger ones so that small
+    //dictionaries stay small
+    if(!chunk && len<=256)
+    {
+      size=256;
+    }
+    chunk=malloc(sizeof(DictKeyChunk)+size);
+    MALLOC_CHECK(chunk);
+    chunk->size=size;
+    chunk->used=0;
+    chunk->next=dict->keys;
+    dict->keys=chunk;
   }
-  DNODE* new=malloc(sizeof(DNODE));
-  MALLOC_CHECK(new);
-  new->key=strdup(n->key);
-  if(dataCP)
+  char* result=chunk->data+chunk->used;
+  memcpy(result,key,len);
+  chunk->used+=len;
+  return result;
+}
+
+//(re)builds the slot table with room for at least cnt elements
+static void dictRehash(Dictionary* dict,int cnt)
+{
+  int numSlots=DICT_MIN_SLOTS;
+  int shift=64-3;
+  while(numSlots*DICT_LOAD_NUM/DICT_LOAD_DEN<cnt)
   {
-    new->data=(*dataCP)(n->data);
+    numSlots*=2;
+    shift--;
   }
-  else
+  dict->numSlots=numSlots;
+  dict->slotShift=shift;
+  dict->slots=realloc(dict->slots,numSlots*sizeof(int));
+  MALLOC_CHECK(dict->slots);
+  memset(dict->slots,0xFF,numSlots*sizeof(int));//all -1
+  dict->entriesAllocated=numSlots*DICT_LOAD_NUM/DICT_LOAD_DEN;
+  dict->entries=realloc(dict->entries,dict->entriesAllocated*sizeof(DictEntry));
+  MALLOC_CHECK(dict->entries);
+  int mask=numSlots-1;
+  for(int i=0;i<dict->size;i++)
   {
-    new->data=n->data;
+    int slot=dictHomeSlot(dict,dict->entries[i].hash);
+    while(-1!=dict->slots[slot])
+    {
+      slot=(slot+1)&mask;
+    }
+    dict->slots[slot]=i;
   }
-  new->hash=n->hash;
-  new->prev=NULL;
-  if(n->next)
+}
+
+//returns the index into dict->entries of the entry for key or -1 if
+//there isn't one. If slotOut is non-NULL it is set to the slot the
+//entry is in, or the empty slot where it would go
+static int dictFind(const Dictionary* dict,const char* key,unsigned long hash,int* slotOut)
+{
+  int mask=dict->numSlots-1;
+  int slot=dictHomeSlot(dict,hash);
+  int idx;
+  while(-1!=(idx=dict->slots[slot]))
   {
-    new->next=dictNodeDuplicate(n->next,dataCP);
-    new->next->prev=new;
+    DictEntry* entry=&dict->entries[idx];
+    if(entry->hash==hash && !strcmp(key,entry->key))
+    {
+      break;
+    }
+    slot=(slot+1)&mask;
   }
-  else
+  if(slotOut)
   {
-    new->next=NULL;
+    *slotOut=slot;
   }
-  return new;
+  return idx;
+}
+
+//adds an entry known not to exist already. slot is where dictFind
+//said it should go
+static void dictAdd(Dictionary* dict,char* key,void* value,unsigned long hash,int slot)
+{
+  if(dict->size==dict->entriesAllocated)
+  {
+    dictRehash(dict,dict->size*2);
+    dictFind(dict,key,hash,&slot);
+  }
+  DictEntry* entry=&dict->entries[dict->size];
+  entry->key=dictStoreKey(dict,key,strlen(key)+1);
+  entry->data=value;
+  entry->hash=hash;
+  dict->slots[slot]=dict->size;
+  dict->size++;
+}
+
+//! create an empty dictionary with room for about bucketCnt elements
+Dictionary* dictCreate(int bucketCnt)
+{
+  Dictionary* dict=zmalloc(sizeof(Dictionary));
+  dict->rc.refcount=1;
+  dictRehash(dict,bucketCnt);
+  return dict;
 }
 
 //If dataCP is NULL then values will simply be copied over as pointers
 Dictionary* dictDuplicate(Dictionary* dict,void* (*dataCP)(void*))
 {
-  Dictionary* new=dictCreate(dict->numBuckets);
+  Dictionary* new=zmalloc(sizeof(Dictionary));
+  new->rc.refcount=1;
+  new->numSlots=dict->numSlots;
+  new->slotShift=dict->slotShift;
+  new->entriesAllocated=dict->entriesAllocated;
   new->size=dict->size;
-  new->start=dictNodeDuplicate(dict->start,dataCP);
-  //now have to find the end. Also have to fill in the hash list
-  new->hash=malloc(new->numBuckets*sizeof(DNODE*));
-  memset(new->hash,0,new->numBuckets*sizeof(DNODE*));
-  DNODE* n=new->start;
-  DNODE* prev=NULL;
-  while(n)
+  //the slot table indexes entries by position, so it can be copied as is
+  new->slots=malloc(dict->numSlots*sizeof(int));
+  MALLOC_CHECK(new->slots);
+  memcpy(new->slots,dict->slots,dict->numSlots*sizeof(int));
+  new->entries=malloc(dict->entriesAllocated*sizeof(DictEntry));
+  MALLOC_CHECK(new->entries);
+  memcpy(new->entries,dict->entries,dict->size*sizeof(DictEntry));
+  //copy all the keys into a single chunk
+  size_t keyBytes=0;
+  for(int i=0;i<dict->size;i++)
+  {
+    keyBytes+=strlen(dict->entries[i].key)+1;
+  }
+  if(keyBytes)
   {
-    if(!new->hash[n->hash])
+    DictKeyChunk* chunk=malloc(sizeof(DictKeyChunk)+keyBytes);
+    MALLOC_CHECK(chunk);
+    chunk->size=keyBytes;
+    chunk->used=0;
+    chunk->next=NULL;
+    new->keys=chunk;
+  }
+  for(int i=0;i<dict->size;i++)
+  {
+    DictEntry* entry=&new->entries[i];
+    entry->key=dictStoreKey(new,entry->key,strlen(entry->key)+1);
+    if(dataCP)
     {
-      new->hash[n->hash]=n;
+      entry->data=(*dataCP)(entry->data);
     }
-    prev=n;
-    n=n->next;
   }
-  new->end=prev;
   return new;
 }
 
 void dictDelete(Dictionary* dict,void (*deleteData)(void*))
 {
   //clean up all items held in the hash table
-  DNODE* tmp=dict->start;
-  while(tmp)
+  if(deleteData)
   {
-    DNODE* tmp2=tmp->next;
-    if(deleteData)
+    for(int i=0;i<dict->size;i++)
     {
-      (*deleteData)(tmp->data);
+      (*deleteData)(dict->entries[i].data);
     }
-    free(tmp->key);
-    free(tmp);
-    tmp=tmp2;
+  }
+  DictKeyChunk* chunk=dict->keys;
+  while(chunk)
+  {
+    DictKeyChunk* next=chunk->next;
+    free(chunk);
+    chunk=next;
   }
   //free the memory for the table itself
-  free(dict->hash);
+  free(dict->entries);
+  free(dict->slots);
   free(dict);
 }
 
 //!check if a key exists in the dictionary
 bool dictExists(const Dictionary* dict,char* key)
 {
-  unsigned int hash=hash1(key)%dict->numBuckets;
-  //printf("check existance key %s with hash of %u\n",key,hash);
-  DNODE* node=dict->hash[hash];
-  if(node)
-  {
-    do
-    {
-      if(!strcmp(key,node->key))
-      {
-        return true;
-      }
-    }while((node=node->next) && hash==node->hash);
-  }
-  return false;
+  return -1!=dictFind(dict,key,hash1(key),NULL);
 }
 
 //! add an element to a dictionary
 void dictInsert(Dictionary* dict,char* key,void* value)
 { 
-  assert(!dictExists(dict,key));
-  DNODE* node=malloc(sizeof(DNODE));
-  MALLOC_CHECK(node);
-  BZERO(node,sizeof(DNODE));//shouldn't be necessary, but a good precaution
-  node->data=value;
-  int keySize=strlen(key)+1;
-  node->key=malloc(keySize);
-  MALLOC_CHECK(node->key);
-  strcpy(node->key,key);
-  
-  node->hash=hash1(key)%dict->numBuckets;
-  DNODE* parent=dict->hash[node->hash];
-  if(!parent)
-  {
-    dict->hash[node->hash]=node;
-    node->next=0;
-    node->prev=dict->end;
-    if(!dict->start)
-    {
-      dict->start=dict->end=node;
-    }
-    else
-    {
-      dict->end->next=node;
-      dict->end=node;
-    }
-  }
-  else
-  {
-    while(parent->next && parent->next->hash==node->hash)
-    {
-      parent=parent->next;
-      assert(strcmp(parent->key,node->key));//don't want to insert the same element into the dictionary again
-    }
-    if(parent==dict->end)
-    {
-      dict->end=node;
-    }
-    
-    
-    node->next=parent->next;
-    if(node->next)
-    {
-      node->next->prev=node;
-    }
-    node->prev=parent;
-    parent->next=node;
-  }
-  dict->size++;
+  unsigned long hash=hash1(key);
+  int slot;
+  int idx=dictFind(dict,key,hash,&slot);
+  assert(-1==idx);//don't want to insert the same element into the dictionary again
+  (void)idx;
+  dictAdd(dict,key,value,hash,slot);
 }
 
-//! insert an element if the key does not already exist, otherwise update it
 //! insert an element if the key does not already exist, otherwise set its data
 //! if deleteData is non-NULL, will be called with an old value being overwritten
 void dictSet(Dictionary* dict,char* key,void* value,void (*deleteData)(void*))
 {
   assert(dict);
-  unsigned int hash=hash1(key)%dict->numBuckets;
-  DNODE* node=dict->hash[hash];
-  if(node)
+  unsigned long hash=hash1(key);
+  int slot;
+  int idx=dictFind(dict,key,hash,&slot);
+  if(-1==idx)
   {
-    do
-    {
-      if(!strcmp(key,node->key))
-      {
-        if(deleteData)
-        {
-          (*deleteData)(node->data);
-        }
-        node->data=value;
-        return;
-      }
-    }while((node=node->next) && hash==node->hash);
+    dictAdd(dict,key,value,hash,slot);
+    return;
+  }
+  if(deleteData)
+  {
+    (*deleteData)(dict->entries[idx].data);
   }
-  
-  //since we already have the hash value computed, it would be slightly faster
-  //to replicate most of the dictInsert code here ourselves
-  //however the speed benefits are minimal so to save my time and effort,
-  //we just call dictInsert. In a production/speed-critical system
-  //I would either redo the code or construct this and dictInsert out of modular parts
-  dictInsert(dict,key,value);
+  dict->entries[idx].data=value;
 }
 
 //! return the data associated with the key. NULL if the key does not exist in the dictionary
 void* dictGet(const Dictionary* dict,char* key)
 {
   assert(dict);
-  unsigned int hash=hash1(key)%dict->numBuckets;
-  DNODE* node=dict->hash[hash];
-  if(node)
-  {
-    do
-    {
-      if(!strcmp(key,node->key))
-      {
-        return node->data;
-      }
-    }while((node=node->next) && hash==node->hash);
-  }
-  return NULL;
+  int idx=dictFind(dict,key,hash1(key),NULL);
+  return -1==idx?NULL:dict->entries[idx].data;
 }
 
 //! returns the number of elements in the dictionary
@@ -287,11 +302,11 @@ int dictSize(const Dictionary* dict)
 void dictPrint(const Dictionary* dict,void (*pfunc)(void*))
 {
   printf("Dictionary size: %i\nITEMS:\n",dict->size);
-  DNODE* node=dict->start;
-  for(;node;node=node->next)
+  for(int i=0;i<dict->size;i++)
   {
-    printf("Key: %s, hash: %u\nValue:",node->key,node->hash);
-    (*pfunc)(node->data);
+    DictEntry* entry=&dict->entries[i];
+    printf("Key: %s, hash: %lu\nValue:",entry->key,entry->hash);
+    (*pfunc)(entry->data);
     printf("\n");
   }
 }
@@ -302,10 +317,10 @@ void dictPrint(const Dictionary* dict,void (*pfunc)(void*))
 char** dictKeys(const Dictionary* dict)
 {
   char** keys=malloc(sizeof(char*)*(dict->size+1));
-  DNODE* node=dict->start;
-  for(int i=0;node;node=node->next,i++)
+  MALLOC_CHECK(keys);
+  for(int i=0;i<dict->size;i++)
   {
-    keys[i]=node->key;
+    keys[i]=dict->entries[i].key;
   }
   keys[dict->size]=0;
   return keys;
@@ -316,16 +331,34 @@ char** dictKeys(const Dictionary* dict)
 //don't free elements
 void** dictValues(const Dictionary* dict)
 {
-  void** vals=malloc(sizeof(char*)*(dict->size+1));
-  DNODE* node=dict->start;
-  for(int i=0;node;node=node->next,i++)
+  void** vals=malloc(sizeof(void*)*(dict->size+1));
+  MALLOC_CHECK(vals);
+  for(int i=0;i<dict->size;i++)
   {
-    vals[i]=node->data;
+    vals[i]=dict->entries[i].data;
   }
   vals[dict->size]=0;
   return vals;
 }
 
+bool dictIterNext(const Dictionary* dict,DictIterator* iter,char** key,void** value)
+{
+  if(iter->pos>=dict->size)
+  {
+    return false;
+  }
+  DictEntry* entry=&dict->entries[iter->pos++];
+  if(key)
+  {
+    *key=entry->key;
+  }
+  if(value)
+  {
+    *value=entry->data;
+  }
+  return true;
+}
+
 //refcounting functions
 //both return the reference count
 //release DOES NOT FREE ANY MEMORY
@@ -63,26 +63,34 @@
 #include <stdbool.h>
 #include "refcounted.h"
 
-typedef struct _DNODE {
-  struct _DNODE  *next;
-  struct _DNODE  *prev;
-  void    *data;        //  actual data 
-  char* key; //  actual (URL) key
-  unsigned int hash;//hash value for the key
-} __DNODE;
-
-typedef struct _DNODE DNODE;
-
-
+//entries are kept in insertion order in a dense array, the
+//open-addressed slot table only holds indices into it
+typedef struct
+{
+  char* key;//points into the dictionary's key storage
+  void* data;
+  unsigned long hash;//full hash value of the key
+} DictEntry;
+
+//keys are copied into chunks of storage owned by the dictionary
+//rather than being malloc'd one by one. Keys never move once copied
+typedef struct _DictKeyChunk
+{
+  struct _DictKeyChunk* next;
+  size_t used;
+  size_t size;
+  char data[];
+} DictKeyChunk;
 
 typedef struct _DICTIONARY {
   RefCounted rc;
-  DNODE **hash; //no longer a fixed-length array, allow this to be a general-purpose dictionary with user-defined size
-  int numBuckets;//size of structure hash points to. Must remain constant due to current hash implementation
-  DNODE *start;
-  DNODE *end;
+  DictEntry* entries;
+  int entriesAllocated;
+  int* slots;//index into entries or -1 for an empty slot
+  int numSlots;//always a power of 2, grows as the dictionary does
+  int slotShift;//64-log2(numSlots)
   int size; //number of elements in the dictionary
-  
+  DictKeyChunk* keys;//most recently allocated first
 } __DICTIONARY;
 
 typedef struct _DICTIONARY DICTIONARY;
@@ -90,7 +98,8 @@ typedef struct _DICTIONARY Dictionary;
 typedef void* (*DictDataCopy)(void*);
 typedef void (*DictDataDelete)(void*);
 
-//! create an empty dictionary
+//! create an empty dictionary with room for about nBuckets elements
+//! before it has to grow. It grows automatically so this is only a hint
 Dictionary* dictCreate(int nBuckets);
 
 //If dataCP is NULL then values will simply be copied over as pointers
@@ -130,6 +139,20 @@ char** dictKeys(const Dictionary* dict);
 //don't free elements
 void** dictValues(const Dictionary* dict);
 
+//! used to walk through a dictionary without allocating anything.
+//! Initialize with DICT_ITERATOR_INIT. Elements come out in the order they
+//! were inserted. The dictionary must not have elements added while
+//! iterating
+typedef struct
+{
+  int pos;
+} DictIterator;
+#define DICT_ITERATOR_INIT {0}
+
+//! advances the iterator, setting *key and *value (either may be NULL)
+//! returns false when there are no more elements
+bool dictIterNext(const Dictionary* dict,DictIterator* iter,char** key,void** value);
+
 //refcounting functions
 //both return the reference count
 //release DOES NOT FREE ANY MEMORY
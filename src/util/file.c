@@ -19,6 +19,11 @@
 #include "file.h"
 #include "logging.h"
 #include "util.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 //Note: reseeksfile to the beginning
 int getFileLength(FILE* f)
@@ -48,3 +53,94 @@ char* getFileContents(char* filename,int* flen)
   fclose(f);
   return buf;
 }
+
+bool writeAll(int fd,void* buf,size_t len)
+{
+  char* p=buf;
+  while(len)
+  {
+    ssize_t written=write(fd,p,len);
+    if(written<0)
+    {
+      if(EINTR==errno)
+      {
+        continue;
+      }
+      return false;
+    }
+    p+=written;
+    len-=written;
+  }
+  return true;
+}
+
+bool copyFileFromFd(int fd,char* fname)
+{
+  struct stat st;
+  if(fstat(fd,&st))
+  {
+    return false;
+  }
+  int outFd=open(fname,O_WRONLY|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR);
+  if(outFd<0)
+  {
+    return false;
+  }
+  char buf[65536];
+  bool ok=true;
+  for(off_t offset=0;ok && offset<st.st_size;)
+  {
+    ssize_t got=pread(fd,buf,sizeof(buf),offset);
+    if(got<0 && EINTR==errno)
+    {
+      continue;
+    }
+    ok=got>0 && writeAll(outFd,buf,got);
+    offset+=got;
+  }
+  close(outFd);
+  return ok;
+}
+
+//maps fname whole into *contents (left NULL if it's empty). Returns
+//false if it can't be opened or mapped
+static bool mapWholeFile(char* fname,void** contents,size_t* size)
+{
+  *contents=NULL;
+  *size=0;
+  int fd=open(fname,O_RDONLY);
+  if(fd<0)
+  {
+    return false;
+  }
+  struct stat st;
+  bool ok=!fstat(fd,&st);
+  if(ok && st.st_size)
+  {
+    *size=st.st_size;
+    *contents=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    ok=MAP_FAILED!=*contents;
+    *contents=ok?*contents:NULL;
+  }
+  close(fd);
+  return ok;
+}
+
+bool haveSameContents(char* fnameA,char* fnameB)
+{
+  void* a;
+  void* b;
+  size_t sizeA,sizeB;
+  bool okA=mapWholeFile(fnameA,&a,&sizeA);
+  bool okB=mapWholeFile(fnameB,&b,&sizeB);
+  bool same=okA && okB && sizeA==sizeB && (!sizeA || !memcmp(a,b,sizeA));
+  if(a)
+  {
+    munmap(a,sizeA);
+  }
+  if(b)
+  {
+    munmap(b,sizeB);
+  }
+  return same;
+}
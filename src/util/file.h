@@ -19,10 +19,20 @@
 #define file_h
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
 //Note: reseeksfile to the beginning
 int getFileLength(FILE* f);
 
 //the returned memory should be freed
 char* getFileContents(char* filename,int* flen);
+//writes all len bytes of buf, retrying short writes
+bool writeAll(int fd,void* buf,size_t len);
+//copies the whole of the file open as fd (from its start, whatever
+//its position) to a new file fname
+bool copyFileFromFd(int fd,char* fname);
+//whether the two files are byte for byte the same. False if either
+//can't be read
+bool haveSameContents(char* fnameA,char* fnameB);
 
 #endif
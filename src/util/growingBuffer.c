@@ -35,17 +35,13 @@ void addToGrowingBuffer(GrowingBuffer* buf,void* data,int dataLen)
 
 void addUlebToGrowingBuffer(GrowingBuffer* buf,word_t data)
 {
-  usint numBytesOut;
-  byte* leb=encodeAsLEB128((byte*)&data,sizeof(data),false,&numBytesOut);
-  addToGrowingBuffer(buf,leb,numBytesOut);
-  free(leb);
+  byte leb[LEB128_MAX_WORD_BYTES];
+  addToGrowingBuffer(buf,leb,encodeULEB128(data,leb));
 }
 
 void addSlebToGrowingBuffer(GrowingBuffer* buf,sword_t data)
 {
-  usint numBytesOut;
-  byte* leb=encodeAsLEB128((byte*)&data,sizeof(data),true,&numBytesOut);
-  addToGrowingBuffer(buf,leb,numBytesOut);
-  free(leb);
+  byte leb[LEB128_MAX_WORD_BYTES];
+  addToGrowingBuffer(buf,leb,encodeSLEB128(data,leb));
 }
 
@@ -50,8 +50,7 @@
 
   Project: Katana
   Date: January 10. Based on earlier versions by James Oakley
-  Description:  Map strings to arbitrary data. Some functions taken
-    from http://www.cse.yorku.ca/~oz/hash.html
+  Description:  hash functions for strings, bytes and integers
 */
 
 #include <string.h>
@@ -59,16 +58,48 @@
 #include "hash.h"
 #include <assert.h>
 
-//! this one is called djb2
-unsigned long hash1(char* str) {
-  assert(str);
-  unsigned long hash = 5381;
-  int c;
-  while ((c = *str++) != 0)
-    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+static inline uint64_t rotateLeft(uint64_t x,int bits)
+{
+  return (x<<bits)|(x>>(64-bits));
+}
+
+//hashes a word at a time rather than a byte at a time as djb2 did. Each
+//8-byte word is folded in with a rotate, xor and multiply (the same
+//step as FxHash), and the result is run through the murmur3 finalizer
+//so that every input byte affects the high bits Map and Dictionary
+//take their slot from
+unsigned long hashBytes(const void* data,size_t len)
+{
+  const unsigned char* bytes=data;
+  uint64_t hash=0x9E3779B97F4A7C15ULL^len;
+  while(len>=sizeof(uint64_t))
+  {
+    uint64_t word;
+    memcpy(&word,bytes,sizeof(uint64_t));
+    hash=(rotateLeft(hash,5)^word)*0x517CC1B727220A95ULL;
+    bytes+=sizeof(uint64_t);
+    len-=sizeof(uint64_t);
+  }
+  if(len)
+  {
+    uint64_t word=0;
+    memcpy(&word,bytes,len);
+    hash=(rotateLeft(hash,5)^word)*0x517CC1B727220A95ULL;
+  }
+  hash^=hash>>33;
+  hash*=0xFF51AFD7ED558CCDULL;
+  hash^=hash>>33;
   return hash;
 }
 
+//strlen is itself word at a time, so this is much cheaper than
+//hashing byte by byte until the NUL
+unsigned long hash1(char* str)
+{
+  assert(str);
+  return hashBytes(str,strlen(str));
+}
+
 unsigned long hashInt(int key)
 {
   unsigned int res = ~key + (key << 15);
@@ -50,8 +50,7 @@
 
   Project: Katana
   Date: January 10. Based on earlier versions by James Oakley
-  Description:  Map strings to arbitrary data. Some functions taken
-    from http://www.cse.yorku.ca/~oz/hash.html
+  Description:  hash functions for strings, bytes and integers
 */
 
 
@@ -59,6 +58,7 @@
 #define _HASH_H__
 
 #include <stdint.h> //for uint32_t and uint64_t
+#include <stddef.h> //for size_t
 
 
 #if __WORDSIZE==64
@@ -69,7 +69,10 @@
 #define hashSizeT    hash32Bit
 #endif
 
+//hashes a NUL-terminated string
 unsigned long hash1(char*);
+//hashes len arbitrary bytes. hash1(str)==hashBytes(str,strlen(str))
+unsigned long hashBytes(const void* data,size_t len);
 
 unsigned long hashInt(int);
 uint32_t hash32Bit(uint32_t key);
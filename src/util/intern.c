@@ -0,0 +1,200 @@
+/*
+  File: intern.c
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: pool of interned strings
+*/
+
+#include "intern.h"
+#include "arena.h"
+#include "hash.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#define INTERN_MIN_SLOTS 1024
+//maximum load factor is INTERN_LOAD_NUM/INTERN_LOAD_DEN
+#define INTERN_LOAD_NUM 3
+#define INTERN_LOAD_DEN 4
+
+//how an interned string is laid out in the arena. The pointer handed
+//out points at str, the hash sits just before it
+typedef struct
+{
+  unsigned long hash;
+  char str[];
+} InternedString;
+
+//the hash is kept in the slot as well so that probing past other
+//strings doesn't have to touch them
+typedef struct
+{
+  unsigned long hash;
+  InternedString* entry;//NULL for an empty slot
+} InternSlot;
+
+typedef struct
+{
+  Arena* arena;
+  InternSlot* slots;//open-addressed
+  int numSlots;//always a power of 2
+  int slotShift;//64-log2(numSlots)
+  size_t count;
+  int users;//how many owners have retained the pool
+} InternPool;
+
+static InternPool pool;
+
+static inline InternedString* getInterned(const char* str)
+{
+  return (InternedString*)(str-offsetof(InternedString,str));
+}
+
+//spreads the hash over the slot table (Fibonacci hashing)
+static inline int homeSlot(unsigned long hash)
+{
+  return (int)(((uint64_t)hash*0x9E3779B97F4A7C15ULL)>>pool.slotShift);
+}
+
+static void growPool()
+{
+  InternSlot* oldSlots=pool.slots;
+  int oldNumSlots=pool.numSlots;
+  if(!pool.numSlots)
+  {
+    pool.numSlots=INTERN_MIN_SLOTS;
+    pool.slotShift=64-10;
+    pool.arena=arenaCreate(0);
+  }
+  else
+  {
+    pool.numSlots*=2;
+    pool.slotShift--;
+  }
+  pool.slots=zmalloc(pool.numSlots*sizeof(InternSlot));
+  int mask=pool.numSlots-1;
+  for(int i=0;i<oldNumSlots;i++)
+  {
+    if(oldSlots[i].entry)
+    {
+      int slot=homeSlot(oldSlots[i].hash);
+      while(pool.slots[slot].entry)
+      {
+        slot=(slot+1)&mask;
+      }
+      pool.slots[slot]=oldSlots[i];
+    }
+  }
+  free(oldSlots);
+}
+
+//returns the slot holding str or the empty slot where it would go
+static int findSlot(const char* str,unsigned long hash)
+{
+  int mask=pool.numSlots-1;
+  int slot=homeSlot(hash);
+  InternSlot* entry;
+  while((entry=&pool.slots[slot])->entry)
+  {
+    if(entry->hash==hash && !strcmp(entry->entry->str,str))
+    {
+      break;
+    }
+    slot=(slot+1)&mask;
+  }
+  return slot;
+}
+
+void retainInternPool()
+{
+  pool.users++;
+}
+
+void releaseInternPool()
+{
+  assert(pool.users>0);
+  if(--pool.users)
+  {
+    return;
+  }
+  if(pool.arena)
+  {
+    arenaDelete(pool.arena);
+  }
+  free(pool.slots);
+  memset(&pool,0,sizeof(InternPool));
+}
+
+char* internString(const char* str)
+{
+  assert(pool.users>0);
+  if(pool.count*INTERN_LOAD_DEN>=(size_t)pool.numSlots*INTERN_LOAD_NUM)
+  {
+    growPool();
+  }
+  size_t len=strlen(str);
+  unsigned long hash=hashBytes(str,len);
+  int slot=findSlot(str,hash);
+  if(!pool.slots[slot].entry)
+  {
+    InternedString* entry=arenaAlloc(pool.arena,sizeof(InternedString)+len+1);
+    entry->hash=hash;
+    memcpy(entry->str,str,len+1);
+    pool.slots[slot].hash=hash;
+    pool.slots[slot].entry=entry;
+    pool.count++;
+  }
+  return pool.slots[slot].entry->str;
+}
+
+char* findInternedString(const char* str)
+{
+  if(!pool.count)
+  {
+    return NULL;
+  }
+  InternedString* entry=pool.slots[findSlot(str,hash1((char*)str))].entry;
+  return entry?entry->str:NULL;
+}
+
+unsigned long internedHash(const char* str)
+{
+  return getInterned(str)->hash;
+}
+
+size_t internedStringCount()
+{
+  return pool.count;
+}
+
+size_t internedStringBytes()
+{
+  return pool.arena?pool.arena->bytesAllocated:0;
+}
+
+static unsigned long internedHashVoid(void* key)
+{
+  return internedHash(key);
+}
+
+static int internedPtrCmp(void* a,void* b)
+{
+  return a==b?0:((uintptr_t)a<(uintptr_t)b?-1:1);
+}
+
+Map* internedMapCreate(int bucketCount)
+{
+  return mapCreate(bucketCount,internedHashVoid,internedPtrCmp);
+}
@@ -0,0 +1,59 @@
+/*
+  File: intern.h
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: process-wide pool of interned strings. Each distinct
+               string is stored exactly once, so two interned strings
+               are equal if and only if they are the same pointer.
+               Interned strings must not be modified. The pool is
+               owned jointly by whatever holds interned strings (each
+               DwarfInfo, and each ElfInfo's symbol name index), which
+               retain it while they exist. It is freed when the last
+               of them releases it, so a string is only good while
+               its owner is
+*/
+
+#ifndef intern_h
+#define intern_h
+
+#include <stddef.h>
+#include "map.h"
+
+//an owner of interned strings calls retainInternPool before interning
+//anything and releaseInternPool once it no longer refers to any of
+//them. Releasing the last reference frees every interned string
+void retainInternPool();
+void releaseInternPool();
+
+//returns the interned copy of str, adding it to the pool if necessary.
+//The pool must have been retained
+char* internString(const char* str);
+
+//returns the interned copy of str if there is one, NULL otherwise.
+//Never adds to the pool, so it is suitable for lookups with strings
+//that may never have been seen
+char* findInternedString(const char* str);
+
+//the hash of an interned string is computed once when it is interned.
+//str must have been returned by internString
+unsigned long internedHash(const char* str);
+
+//number of distinct strings in the pool and bytes used to hold them
+size_t internedStringCount();
+size_t internedStringBytes();
+
+//helper function for creating a map with interned string keys. Keys
+//are hashed with their cached hash and compared by pointer
+Map* internedMapCreate(int bucketCount);
+
+#endif
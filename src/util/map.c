@@ -66,18 +66,119 @@
 
 
 
-//! create an empty map with the given number of buckets
+#define MAP_MIN_SLOTS 8
+//maximum load factor is MAP_LOAD_NUM/MAP_LOAD_DEN
+#define MAP_LOAD_NUM 3
+#define MAP_LOAD_DEN 4
+
+//spreads the hash over the slot table (Fibonacci hashing) so that
+//weak hash functions don't cluster under linear probing
+static inline int mapHomeSlot(const Map* map,unsigned long hash)
+{
+  return (int)(((uint64_t)hash*0x9E3779B97F4A7C15ULL)>>map->slotShift);
+}
+
+//sets up an empty slot table big enough for at least cnt elements
+static void mapAllocSlots(Map* map,int cnt)
+{
+  int numSlots=MAP_MIN_SLOTS;
+  int shift=64-3;
+  while(numSlots*MAP_LOAD_NUM/MAP_LOAD_DEN<cnt)
+  {
+    numSlots*=2;
+    shift--;
+  }
+  map->numSlots=numSlots;
+  map->slotShift=shift;
+  map->slots=realloc(map->slots,numSlots*sizeof(int));
+  MALLOC_CHECK(map->slots);
+  memset(map->slots,0xFF,numSlots*sizeof(int));//all -1
+}
+
+//returns the index into map->entries of the entry for key or -1 if
+//there isn't one. If slotOut is non-NULL it is set to the slot the
+//entry is in, or the empty slot where it would go
+static int mapFind(const Map* map,void* key,unsigned long hash,int* slotOut)
+{
+  int mask=map->numSlots-1;
+  int slot=mapHomeSlot(map,hash);
+  int idx;
+  while(-1!=(idx=map->slots[slot]))
+  {
+    MapEntry* entry=&map->entries[idx];
+    if(entry->hash==hash && !(*(map->cmpfunc))(key,entry->key))
+    {
+      break;
+    }
+    slot=(slot+1)&mask;
+  }
+  if(slotOut)
+  {
+    *slotOut=slot;
+  }
+  return idx;
+}
+
+//drops removed entries and rebuilds the slot table for room for at
+//least cnt elements
+static void mapRehash(Map* map,int cnt)
+{
+  int j=0;
+  for(int i=0;i<map->numEntries;i++)
+  {
+    if(!map->entries[i].removed)
+    {
+      map->entries[j++]=map->entries[i];
+    }
+  }
+  map->numEntries=j;
+  mapAllocSlots(map,cnt);
+  map->entriesAllocated=map->numSlots*MAP_LOAD_NUM/MAP_LOAD_DEN;
+  map->entries=realloc(map->entries,map->entriesAllocated*sizeof(MapEntry));
+  MALLOC_CHECK(map->entries);
+  int mask=map->numSlots-1;
+  for(int i=0;i<map->numEntries;i++)
+  {
+    int slot=mapHomeSlot(map,map->entries[i].hash);
+    while(-1!=map->slots[slot])
+    {
+      slot=(slot+1)&mask;
+    }
+    map->slots[slot]=i;
+  }
+}
+
+//adds an entry known not to exist already. slot is where mapFind
+//said it should go
+static void mapAdd(Map* map,void* key,void* value,unsigned long hash,int slot)
+{
+  if(map->numEntries==map->entriesAllocated)
+  {
+    //if enough has been removed, compacting is enough to make room
+    int cnt=map->size<map->numEntries/2?map->numEntries:map->numEntries*2;
+    mapRehash(map,cnt);
+    mapFind(map,key,hash,&slot);
+  }
+  MapEntry* entry=&map->entries[map->numEntries];
+  entry->key=key;
+  entry->data=value;
+  entry->hash=hash;
+  entry->removed=false;
+  map->slots[slot]=map->numEntries;
+  map->numEntries++;
+  map->size++;
+}
+
+//! create an empty map with room for about bucketCnt elements
 //! hashfunc should be a function to has the key
 //! type cmpfunc should be a function to compare two keys, returning
 //! 0 iff they are identical
 Map* mapCreate(int bucketCnt,unsigned long (*hashfunc_)(void*),int (*cmpfunc_)(void*,void*))
 {
   Map* map=zmalloc(sizeof(Map));
-  map->hash=zmalloc(bucketCnt*sizeof(MNODE*));
-  map->numBuckets=bucketCnt;
-  map->size=0;
   map->hashfunc=hashfunc_;
   map->cmpfunc=cmpfunc_;
+  mapRehash(map,bucketCnt);
   return map;
 }
 
@@ -94,15 +195,15 @@ int uintCmp(void* a,void* b)
 {
   uint ai=*((uint*)a);
   uint bi=*((uint*)b);
-  return ai-bi;
+  return ai==bi?0:(ai<bi?-1:1);
 }
 
 //size_t comparison function
 int size_tCmp(void* a,void* b)
 {
-  size_t ai=*((uint*)a);
-  size_t bi=*((uint*)b);
-  return ai-bi;
+  size_t ai=*((size_t*)a);
+  size_t bi=*((size_t*)b);
+  return ai==bi?0:(ai<bi?-1:1);
 }
 
 
@@ -145,93 +246,43 @@ Map* size_tMapCreate(int bucketCount)
 void mapDelete(Map* map,void (*deleteData)(void*),void (*deleteKey)(void*))
 {
   //clean up all items held in the hash table
-  MNODE* tmp=map->start;
-  while(tmp)
+  for(int i=0;i<map->numEntries;i++)
   {
-    MNODE* tmp2=tmp->next;
+    MapEntry* entry=&map->entries[i];
+    if(entry->removed)
+    {
+      continue;
+    }
     if(deleteData)
     {
-      (*deleteData)(tmp->data);
+      (*deleteData)(entry->data);
     }
     if(deleteKey)
     {
-      (*deleteKey)(tmp->key);
+      (*deleteKey)(entry->key);
     }
-    free(tmp);
-    tmp=tmp2;
   }
   //free the memory for the table itself
-  free(map->hash);
+  free(map->entries);
+  free(map->slots);
   free(map);
 }
 
 //!check if a key exists in the map
 bool mapExists(const Map* map,void* key)
 {
-  unsigned int hash=(*(map->hashfunc))(key)%map->numBuckets;
-  //printf("check existance key %s with hash of %u\n",key,hash);
-  MNODE* node=map->hash[hash];
-  if(node)
-  {
-    do
-    {
-      if(!(*(map->cmpfunc))(key,node->key))
-      {
-        return true;
-      }
-    }while((node=node->next) && hash==node->hash);
-  }
-  return false;
+  return -1!=mapFind(map,key,(*(map->hashfunc))(key),NULL);
 }
 
 //! add an element to a map
 void mapInsert(Map* map,void* key,void* value)
 { 
-  assert(!mapExists(map,key));
-  MNODE* node=zmalloc(sizeof(MNODE));
-  node->data=value;
-  node->key=key;
-
-  
-  node->hash=(*(map->hashfunc))(key)%map->numBuckets;
-  MNODE* parent=map->hash[node->hash];
-  if(!parent)
-  {
-    map->hash[node->hash]=node;
-    node->next=0;
-    node->prev=map->end;
-    if(!map->start)
-    {
-      map->start=map->end=node;
-    }
-    else
-    {
-      map->end->next=node;
-      map->end=node;
-    }
-  }
-  else
-  {
-    while(parent->next && parent->next->hash==node->hash)
-    {
-      parent=parent->next;
-      assert((*(map->cmpfunc))(parent->key,node->key));//don't want to insert the same element into the map again
-    }
-    if(parent==map->end)
-    {
-      map->end=node;
-    }
-    
-    
-    node->next=parent->next;
-    if(node->next)
-    {
-      node->next->prev=node;
-    }
-    node->prev=parent;
-    parent->next=node;
-  }
-  map->size++;
+  unsigned long hash=(*(map->hashfunc))(key);
+  int slot;
+  int idx=mapFind(map,key,hash,&slot);
+  assert(-1==idx);//don't want to insert the same element into the map again
+  (void)idx;
+  mapAdd(map,key,value,hash,slot);
 }
 
 //! insert an element if the key does not already exist, otherwise
@@ -241,54 +292,33 @@ void mapInsert(Map* map,void* key,void* value)
 void mapSet(Map* map,void* key,void* value,void (*deleteData)(void*),void (*deleteKey)(void*))
 {
   assert(map);
-  unsigned int hash=(*(map->hashfunc))(key)%map->numBuckets;
-  MNODE* node=map->hash[hash];
-  if(node)
+  unsigned long hash=(*(map->hashfunc))(key);
+  int slot;
+  int idx=mapFind(map,key,hash,&slot);
+  if(-1==idx)
   {
-    do
-    {
-      if(!(*(map->cmpfunc))(key,node->key))
-      {
-        if(deleteData)
-        {
-          (*deleteData)(node->data);
-        }
-        if(deleteKey)
-        {
-          (*deleteKey)(node->key);//not actually using this key for anything
-        }
-        node->key=key;
-        node->data=value;
-        return;
-      }
-    }while((node=node->next) && hash==node->hash);
+    mapAdd(map,key,value,hash,slot);
+    return;
   }
-  
-  //since we already have the hash value computed, it would be slightly faster
-  //to replicate most of the mapInsert code here ourselves
-  //however the speed benefits are minimal so to save my time and effort,
-  //we just call mapInsert. In a production/speed-critical system
-  //I would either redo the code or construct this and mapInsert out of modular parts
-  mapInsert(map,key,value);
+  MapEntry* entry=&map->entries[idx];
+  if(deleteData)
+  {
+    (*deleteData)(entry->data);
+  }
+  if(deleteKey)
+  {
+    (*deleteKey)(entry->key);//not actually using this key for anything
+  }
+  entry->key=key;
+  entry->data=value;
 }
 
 //! return the data associated with the key. NULL if the key does not exist in the map
 void* mapGet(const Map* map,void* key)
 {
   assert(map);
-  unsigned int hash=(*(map->hashfunc))(key)%map->numBuckets;
-  MNODE* node=map->hash[hash];
-  if(node)
-  {
-    do
-    {
-      if(!(*(map->cmpfunc))(key,node->key))
-      {
-        return node->data;
-      }
-    }while((node=node->next) && hash==node->hash);
-  }
-  return NULL;
+  int idx=mapFind(map,key,(*(map->hashfunc))(key),NULL);
+  return -1==idx?NULL:map->entries[idx].data;
 }
 
 //! remove the data associated with the key
@@ -298,38 +328,49 @@ void* mapGet(const Map* map,void* key)
 bool mapRemove(Map* map,void* key,void (*deleteData)(void*),void (*deleteKey)(void*))
 {
   assert(map);
-  unsigned int hash=(*(map->hashfunc))(key)%map->numBuckets;
-  MNODE* node=map->hash[hash];
-  if(!node)
+  int slot;
+  int idx=mapFind(map,key,(*(map->hashfunc))(key),&slot);
+  if(-1==idx)
   {
     return false;
   }
+  MapEntry* entry=&map->entries[idx];
   if(deleteData)
   {
-    (*deleteData)(node->data);
+    (*deleteData)(entry->data);
   }
   if(deleteKey)
   {
-    (*deleteKey)(node->key);
-  }
-  if(node->prev)
-  {
-    node->prev->next=node->next;
-  }
-  if(node->next)
-  {
-    node->next->prev=node->prev;
-  }
-  if(node==map->start)
-  {
-    map->start=node->next;
+    (*deleteKey)(entry->key);
   }
-  if(node==map->end)
+  entry->removed=true;
+  entry->key=entry->data=NULL;
+  map->size--;
+
+  //close up the gap in the slot table (backward shift deletion) so
+  //that lookups never need tombstones
+  int mask=map->numSlots-1;
+  int hole=slot;
+  int next=slot;
+  while(1)
   {
-    map->end=node->prev;
+    next=(next+1)&mask;
+    int nextIdx=map->slots[next];
+    if(-1==nextIdx)
+    {
+      break;
+    }
+    int home=mapHomeSlot(map,map->entries[nextIdx].hash);
+    //the entry at next may move into the hole unless its home slot
+    //lies cyclically in (hole,next]
+    bool homeBetween=hole<=next?(home>hole && home<=next):(home>hole || home<=next);
+    if(!homeBetween)
+    {
+      map->slots[hole]=nextIdx;
+      hole=next;
+    }
   }
-  free(node);
-  map->size--;
+  map->slots[hole]=-1;
   return true;
 }
 
@@ -345,27 +386,49 @@ int mapSize(const Map* map)
 void** mapKeys(const Map* map)
 {
   void** keys=malloc(sizeof(void*)*(map->size+1));
-  MNODE* node=map->start;
-  for(int i=0;node;node=node->next,i++)
-  {
-    keys[i]=node->key;
-  }
+  MALLOC_CHECK(keys);
+  MapIterator iter=MAP_ITERATOR_INIT;
+  for(int i=0;mapIterNext(map,&iter,&keys[i],NULL);i++);
   keys[map->size]=0;
   return keys;
 }
 
+bool mapIterNext(const Map* map,MapIterator* iter,void** key,void** value)
+{
+  while(iter->pos<map->numEntries)
+  {
+    MapEntry* entry=&map->entries[iter->pos++];
+    if(entry->removed)
+    {
+      continue;
+    }
+    if(key)
+    {
+      *key=entry->key;
+    }
+    if(value)
+    {
+      *value=entry->data;
+    }
+    return true;
+  }
+  return false;
+}
+
 //! prints everything in a map, given user supplied print functions
 //! for keys and data
 void mapPrint(const Map* map,void (*pfuncKey)(void*),void (*pfuncData)(void*))
 {
   printf("Map size: %i\nITEMS:\n",map->size);
-  MNODE* node=map->start;
-  for(;node;node=node->next)
+  MapIterator iter=MAP_ITERATOR_INIT;
+  void* key;
+  void* data;
+  while(mapIterNext(map,&iter,&key,&data))
   {
     printf("Key: ");
-    (*pfuncKey)(node->key);
-    printf(", hash: %u\nValue:",node->hash);
-    (*pfuncData)(node->data);
+    (*pfuncKey)(key);
+    printf(", hash: %lu\nValue:",(*(map->hashfunc))(key));
+    (*pfuncData)(data);
     printf("\n");
   }
 }
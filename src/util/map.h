@@ -65,20 +65,24 @@
 #include <stdbool.h>
 
 
-typedef struct _M_DNODE {
-  struct _M_DNODE  *next;
-  struct _M_DNODE  *prev;
-  void* data;        //  actual data 
-  void* key; //  actual key
-  unsigned int hash;//hash value for the key
-} MNODE;
-
+//entries are kept in insertion order in a dense array, the
+//open-addressed slot table only holds indices into it. This keeps
+//iteration in insertion order and allocation-free
+typedef struct
+{
+  void* key;
+  void* data;
+  unsigned long hash;//full hash value of the key
+  bool removed;
+} MapEntry;
 
 typedef struct _MAP {
-  MNODE **hash; //array of all buckets
-  int numBuckets;//size of structure hash points to. Must remain constant due to current hash implementation
-  MNODE *start;
-  MNODE *end;
+  MapEntry* entries;
+  int numEntries;//entries in use, including removed ones
+  int entriesAllocated;
+  int* slots;//index into entries or -1 for an empty slot
+  int numSlots;//always a power of 2, grows as the map does
+  int slotShift;//64-log2(numSlots)
   int size; //number of elements in the map
   unsigned long (*hashfunc)(void*);//hash function on key type
   int (*cmpfunc)(void*,void*);//comparison function on key type
@@ -89,7 +93,8 @@ typedef unsigned int uint;
 typedef struct _MAP MAP;
 typedef struct _MAP Map;
 
-//! create an empty map with the given number of buckets
+//! create an empty map with room for about bucketCnt elements before it
+//! has to grow. The map grows automatically so this is only a hint
 //! hashfunc should be a function to has the key
 //! type cmpfunc should be a function to compare two keys, returning
 //! <0 if the first argument is less than the second, 0 if they are
@@ -144,6 +149,20 @@ int mapSize(const Map* map);
 //don't free elements
 void** mapKeys(const Map* map);
 
+//! used to walk through a map without allocating anything. Initialize
+//! with MAP_ITERATOR_INIT. Elements come out in the order they were
+//! inserted. The map must not be modified while iterating other than
+//! by setting the value of a key which already exists
+typedef struct
+{
+  int pos;
+} MapIterator;
+#define MAP_ITERATOR_INIT {0}
+
+//! advances the iterator, setting *key and *value (either may be NULL)
+//! returns false when there are no more elements
+bool mapIterNext(const Map* map,MapIterator* iter,void** key,void** value);
+
 //! prints everything in a map, given user supplied print functions
 //! for keys and data
 void mapPrint(const Map* map,void (*pfuncKey)(void*),void (*pfuncData)(void*));
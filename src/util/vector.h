@@ -0,0 +1,165 @@
+/*
+  File: vector.h
+  Author: James Oakley
+  Copyright (C): 2011 James Oakley
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version.
+
+  This file was not written while under employment by Dartmouth
+  College and the attribution requirements on the rest of Katana do
+  not apply to code taken from this file.
+  Project:  katana
+  Date: April 2011
+  Description: typed growable arrays. Elements are stored by value
+               in one contiguous block, which is much friendlier to
+               the cache than List when something is built up once
+               and then walked, sorted or searched.
+
+               VECTOR_DEFINE(Name,T) declares
+                 Name      {T* data; int len; int cap;}
+                 NameSpan  {T* data; int len;}, a non-owning view
+               and static inline functions NamePush, NameReserve,
+               NameAppend, NameClear, NameFree, NameSort,
+               NameAsSpan, NameSlice, NameBSearch and NameLowerBound.
+               A zero-initialized Name is a valid empty vector.
+               Comparison functions have the qsort signature.
+               The generated code is also valid C++, so the shell can
+               use the same vectors
+*/
+
+#ifndef vector_h
+#define vector_h
+
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+typedef int (*VectorCmpFunc)(const void*,const void*);
+
+#define VECTOR_MIN_CAP 8
+
+#define VECTOR_DEFINE(Name,T)                                           \
+  typedef struct                                                        \
+  {                                                                     \
+    T* data;                                                            \
+    int len;                                                            \
+    int cap;                                                            \
+  } Name;                                                               \
+                                                                        \
+  typedef struct                                                        \
+  {                                                                     \
+    T* data;                                                            \
+    int len;                                                            \
+  } Name##Span;                                                         \
+                                                                        \
+  /*make room for at least cap elements*/                              \
+  static inline void Name##Reserve(Name* v,int cap)                     \
+  {                                                                     \
+    if(cap<=v->cap)                                                     \
+    {                                                                   \
+      return;                                                           \
+    }                                                                   \
+    int newCap=v->cap?v->cap:VECTOR_MIN_CAP;                            \
+    while(newCap<cap)                                                   \
+    {                                                                   \
+      newCap*=2;                                                        \
+    }                                                                   \
+    v->data=(T*)realloc(v->data,newCap*sizeof(T));                      \
+    MALLOC_CHECK(v->data);                                              \
+    v->cap=newCap;                                                      \
+  }                                                                     \
+                                                                        \
+  /*appends a zeroed element and returns it. The pointer is only*/     \
+  /*good until the vector next grows*/                                 \
+  static inline T* Name##Push(Name* v)                                  \
+  {                                                                     \
+    if(v->len==v->cap)                                                  \
+    {                                                                   \
+      Name##Reserve(v,v->len+1);                                        \
+    }                                                                   \
+    T* elem=&v->data[v->len++];                                         \
+    memset(elem,0,sizeof(T));                                           \
+    return elem;                                                        \
+  }                                                                     \
+                                                                        \
+  static inline void Name##Append(Name* v,Name##Span s)                 \
+  {                                                                     \
+    if(!s.len)                                                          \
+    {                                                                   \
+      return;                                                           \
+    }                                                                   \
+    Name##Reserve(v,v->len+s.len);                                      \
+    memcpy(v->data+v->len,s.data,s.len*sizeof(T));                      \
+    v->len+=s.len;                                                      \
+  }                                                                     \
+                                                                        \
+  /*forgets the elements but keeps the storage*/                       \
+  static inline void Name##Clear(Name* v)                               \
+  {                                                                     \
+    v->len=0;                                                           \
+  }                                                                     \
+                                                                        \
+  /*frees the storage only, not anything the elements point to*/       \
+  static inline void Name##Free(Name* v)                                \
+  {                                                                     \
+    free(v->data);                                                      \
+    v->data=NULL;                                                       \
+    v->len=v->cap=0;                                                    \
+  }                                                                     \
+                                                                        \
+  static inline void Name##Sort(Name* v,VectorCmpFunc cmp)              \
+  {                                                                     \
+    if(v->len>1)                                                        \
+    {                                                                   \
+      qsort(v->data,v->len,sizeof(T),cmp);                              \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  static inline Name##Span Name##AsSpan(const Name* v)                  \
+  {                                                                     \
+    Name##Span s={v->data,v->len};                                      \
+    return s;                                                           \
+  }                                                                     \
+                                                                        \
+  /*elements [start,end) of s*/                                        \
+  static inline Name##Span Name##Slice(Name##Span s,int start,int end)  \
+  {                                                                     \
+    Name##Span result={s.data+start,end-start};                         \
+    return result;                                                      \
+  }                                                                     \
+                                                                        \
+  /*index of the first element of sorted s not less than key,*/        \
+  /*s.len if there is none*/                                           \
+  static inline int Name##LowerBound(Name##Span s,const T* key,VectorCmpFunc cmp) \
+  {                                                                     \
+    int low=0;                                                          \
+    int high=s.len;                                                     \
+    while(low<high)                                                     \
+    {                                                                   \
+      int middle=low+(high-low)/2;                                      \
+      if(cmp(&s.data[middle],key)<0)                                    \
+      {                                                                 \
+        low=middle+1;                                                   \
+      }                                                                 \
+      else                                                              \
+      {                                                                 \
+        high=middle;                                                    \
+      }                                                                 \
+    }                                                                   \
+    return low;                                                         \
+  }                                                                     \
+                                                                        \
+  /*returns an element of sorted s equal to key or NULL*/              \
+  static inline T* Name##BSearch(Name##Span s,const T* key,VectorCmpFunc cmp) \
+  {                                                                     \
+    int idx=Name##LowerBound(s,key,cmp);                                \
+    if(idx<s.len && !cmp(&s.data[idx],key))                             \
+    {                                                                   \
+      return &s.data[idx];                                              \
+    }                                                                   \
+    return NULL;                                                        \
+  }
+
+#endif
@@ -0,0 +1,324 @@
+/*
+  File: containerbench.c
+  Author: James Oakley
+  Copyright (C): 2011 Dartmouth College
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version. See the file COPYING
+  for the complete text of the license and the warranty disclaimer.
+
+  Project: Katana
+  Date: April, 2011
+  Description: checks and microbenchmarks for the Map and Dictionary
+    containers, the string intern pool and vectors. Takes an optional element
+    count, the default is small enough to run as part of make check
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "util/map.h"
+#include "util/dictionary.h"
+#include "util/intern.h"
+#include "util/hash.h"
+#include "util/vector.h"
+
+#define DEFAULT_COUNT 100000
+
+struct timespec startTime;
+
+void startTimer()
+{
+  clock_gettime(CLOCK_MONOTONIC,&startTime);
+}
+
+void reportTimer(char* what,int ops)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double seconds=(end.tv_sec-startTime.tv_sec)+(end.tv_nsec-startTime.tv_nsec)/1e9;
+  printf("%-28s %9i ops %8.3fms %12.0f ops/sec\n",what,ops,seconds*1000,seconds>0?ops/seconds:0.0);
+}
+
+void check(bool condition,char* what)
+{
+  if(!condition)
+  {
+    fprintf(stderr,"containerbench: %s\n",what);
+    abort();
+  }
+}
+
+void benchMap(int count)
+{
+  //keys are scattered the way addresses and DIE offsets are
+  size_t* keys=malloc(count*sizeof(size_t));
+  for(int i=0;i<count;i++)
+  {
+    keys[i]=0x400000+(size_t)i*24;
+  }
+  Map* map=size_tMapCreate(100);
+
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    mapInsert(map,&keys[i],&keys[i]);
+  }
+  reportTimer("map insert",count);
+  check(mapSize(map)==count,"map has wrong size after insertion");
+
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    check(mapGet(map,&keys[i])==&keys[i],"map lookup of present key failed");
+  }
+  reportTimer("map get (hit)",count);
+
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    size_t missing=keys[i]+1;
+    check(!mapGet(map,&missing),"map lookup of absent key succeeded");
+  }
+  reportTimer("map get (miss)",count);
+
+  startTimer();
+  MapIterator iter=MAP_ITERATOR_INIT;
+  void* key;
+  int seen=0;
+  while(mapIterNext(map,&iter,&key,NULL))
+  {
+    check(key==&keys[seen],"map iteration out of insertion order");
+    seen++;
+  }
+  reportTimer("map iterate",seen);
+  check(seen==count,"map iteration missed elements");
+
+  startTimer();
+  for(int i=0;i<count;i+=2)
+  {
+    check(mapRemove(map,&keys[i],NULL,NULL),"map removal failed");
+  }
+  reportTimer("map remove",(count+1)/2);
+  for(int i=0;i<count;i++)
+  {
+    check((0==i%2)==!mapExists(map,&keys[i]),"map has wrong contents after removal");
+  }
+  //reinserting reuses the space freed up by removal
+  for(int i=0;i<count;i+=2)
+  {
+    mapSet(map,&keys[i],&keys[i],NULL,NULL);
+  }
+  check(mapSize(map)==count,"map has wrong size after reinsertion");
+  mapDelete(map,NULL,NULL);
+  free(keys);
+}
+
+void benchDictionary(int count)
+{
+  char** keys=malloc(count*sizeof(char*));
+  for(int i=0;i<count;i++)
+  {
+    char buf[64];
+    snprintf(buf,64,"symbol_name_%i",i);
+    keys[i]=strdup(buf);
+  }
+  Dictionary* dict=dictCreate(100);
+
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    dictInsert(dict,keys[i],keys[i]);
+  }
+  reportTimer("dict insert",count);
+  check(dictSize(dict)==count,"dictionary has wrong size after insertion");
+
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    check(dictGet(dict,keys[i])==keys[i],"dictionary lookup of present key failed");
+  }
+  reportTimer("dict get (hit)",count);
+
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    check(!dictGet(dict,"no_such_symbol"),"dictionary lookup of absent key succeeded");
+  }
+  reportTimer("dict get (miss)",count);
+
+  startTimer();
+  DictIterator iter=DICT_ITERATOR_INIT;
+  char* key;
+  void* value;
+  int seen=0;
+  while(dictIterNext(dict,&iter,&key,&value))
+  {
+    check(value==keys[seen] && !strcmp(key,keys[seen]),"dictionary iteration out of insertion order");
+    seen++;
+  }
+  reportTimer("dict iterate",seen);
+  check(seen==count,"dictionary iteration missed elements");
+
+  startTimer();
+  Dictionary* copy=dictDuplicate(dict,NULL);
+  reportTimer("dict duplicate",count);
+  for(int i=0;i<count;i++)
+  {
+    check(dictGet(copy,keys[i])==keys[i],"duplicated dictionary is missing a key");
+  }
+  dictDelete(copy,NULL);
+
+  //small dictionaries are duplicated constantly (register rules)
+  Dictionary* small=dictCreate(10);
+  for(int i=0;i<16;i++)
+  {
+    dictInsert(small,keys[i],keys[i]);
+  }
+  int reps=count;
+  startTimer();
+  for(int i=0;i<reps;i++)
+  {
+    dictDelete(dictDuplicate(small,NULL),NULL);
+  }
+  reportTimer("dict duplicate (16 keys)",reps);
+  dictDelete(small,NULL);
+
+  dictDelete(dict,NULL);
+  for(int i=0;i<count;i++)
+  {
+    free(keys[i]);
+  }
+  free(keys);
+}
+
+void benchIntern(int count)
+{
+  char** keys=malloc(count*sizeof(char*));
+  for(int i=0;i<count;i++)
+  {
+    char buf[64];
+    snprintf(buf,64,"struct_type_name_%i",i);
+    keys[i]=strdup(buf);
+  }
+
+  startTimer();
+  unsigned long total=0;
+  for(int i=0;i<count;i++)
+  {
+    total+=hash1(keys[i]);
+  }
+  reportTimer("hash1",count);
+  check(total!=0,"hash1 produced only zeros");
+
+  char** interned=malloc(count*sizeof(char*));
+  retainInternPool();
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    interned[i]=internString(keys[i]);
+  }
+  reportTimer("intern (new)",count);
+  check(internedStringCount()>=count,"intern pool lost strings");
+
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    check(internString(keys[i])==interned[i],"interning the same string twice gave different pointers");
+  }
+  reportTimer("intern (existing)",count);
+  for(int i=0;i<count;i++)
+  {
+    check(!strcmp(interned[i],keys[i]),"interned string has the wrong contents");
+    check(internedHash(interned[i])==hash1(keys[i]),"interned string has the wrong cached hash");
+  }
+  check(!findInternedString("never_interned"),"found a string that was never interned");
+
+  Map* map=internedMapCreate(100);
+  for(int i=0;i<count;i++)
+  {
+    mapInsert(map,interned[i],keys[i]);
+  }
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    check(mapGet(map,interned[i])==keys[i],"interned map lookup failed");
+  }
+  reportTimer("interned map get",count);
+  mapDelete(map,NULL,NULL);
+  releaseInternPool();
+  check(!internedStringCount() && !findInternedString(keys[0]),"releasing the intern pool did not free it");
+
+  for(int i=0;i<count;i++)
+  {
+    free(keys[i]);
+  }
+  free(keys);
+  free(interned);
+}
+
+VECTOR_DEFINE(SizeVec,size_t)
+
+int cmpSize(const void* a,const void* b)
+{
+  size_t sizeA=*(const size_t*)a;
+  size_t sizeB=*(const size_t*)b;
+  return sizeA<sizeB?-1:(sizeA>sizeB?1:0);
+}
+
+void benchVector(int count)
+{
+  SizeVec vec={0};
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    //descending and spread out so the sort has work to do
+    *SizeVecPush(&vec)=0x400000+(size_t)(count-i)*24;
+  }
+  reportTimer("vector push",count);
+  check(vec.len==count,"vector lost elements");
+
+  startTimer();
+  SizeVecSort(&vec,cmpSize);
+  reportTimer("vector sort",count);
+  for(int i=1;i<vec.len;i++)
+  {
+    check(vec.data[i-1]<vec.data[i],"vector not sorted");
+  }
+
+  SizeVecSpan span=SizeVecAsSpan(&vec);
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    size_t key=0x400000+(size_t)(i+1)*24;
+    check(SizeVecBSearch(span,&key,cmpSize)==&vec.data[i],"vector binary search failed");
+  }
+  reportTimer("vector bsearch",count);
+  size_t missing=0x400000+5*24+1;
+  check(!SizeVecBSearch(span,&missing,cmpSize),"vector binary search found a missing key");
+  check(SizeVecLowerBound(span,&missing,cmpSize)==5,"vector lower bound is wrong");
+
+  SizeVecSpan half=SizeVecSlice(span,count/2,count);
+  SizeVec copy={0};
+  SizeVecAppend(&copy,half);
+  check(copy.len==count-count/2 && copy.data[0]==vec.data[count/2],"vector slice or append is wrong");
+  SizeVecFree(&copy);
+  SizeVecFree(&vec);
+  check(!vec.data && !vec.len,"vector not reset by free");
+}
+
+int main(int argc,char** argv)
+{
+  int count=DEFAULT_COUNT;
+  if(argc>1)
+  {
+    count=atoi(argv[1]);
+  }
+  check(count>16,"count must be greater than 16");
+  benchMap(count);
+  benchDictionary(count);
+  benchIntern(count);
+  benchVector(count);
+  return 0;
+}
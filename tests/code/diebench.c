@@ -0,0 +1,95 @@
+/*
+  File: diebench.c
+  Author: James Oakley
+  Copyright (C): 2011 Dartmouth College
+  License: Katana is free software: you may redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation, either version 2 of the
+  License, or (at your option) any later version. See the file COPYING
+  for the complete text of the license and the warranty disclaimer.
+
+  Project: Katana
+  Date: April, 2011
+  Description: benchmarks reading DWARF in DIEs/sec, indexing the
+    compilation units and then reading all of them in. Takes an optional
+    binary (with debug info) and repetition count, by default it reads
+    itself once, which is quick enough to run as part of make check
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include "elfparse.h"
+#include "dwarftypes.h"
+#include "katana_config.h"
+#include "util/logging.h"
+
+#define DEFAULT_REPS 1
+
+struct timespec startTime;
+
+void startTimer()
+{
+  clock_gettime(CLOCK_MONOTONIC,&startTime);
+}
+
+double elapsedSeconds()
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  return (end.tv_sec-startTime.tv_sec)+(end.tv_nsec-startTime.tv_nsec)/1e9;
+}
+
+void check(bool condition,char* what)
+{
+  if(!condition)
+  {
+    fprintf(stderr,"diebench: %s\n",what);
+    abort();
+  }
+}
+
+void benchDIEs(char* fname,char* workingDir)
+{
+  ElfInfo* elf=openELFFile(fname);
+  check(elf,"cannot open the binary");
+  findELFSections(elf);
+
+  startTimer();
+  DwarfInfo* di=indexDWARFTypes(elf,workingDir);
+  double indexSeconds=elapsedSeconds();
+  check(di,"the binary has no DWARF to read");
+  int numCUs=getNumCompilationUnits(di);
+  printf("%-28s %9i CUs %8.3fms\n","index",numCUs,indexSeconds*1000);
+
+  unsigned long diesBefore=diesWalked;
+  startTimer();
+  loadAllCompilationUnits(di);
+  double loadSeconds=elapsedSeconds();
+  unsigned long dies=diesWalked-diesBefore;
+  check(dies>0,"no DIEs were read");
+  printf("%-28s %9lu DIEs %8.3fms %12.0f DIEs/sec\n","read all compilation units",
+         dies,loadSeconds*1000,loadSeconds>0?dies/loadSeconds:0.0);
+  endELF(elf);
+}
+
+int main(int argc,char** argv)
+{
+  loggingDefaults();
+  setDefaultConfig();
+  if(elf_version(EV_CURRENT)==EV_NONE)
+  {
+    death("Failed to init ELF library\n");
+  }
+  char* fname=argc>1?argv[1]:"/proc/self/exe";
+  int reps=argc>2?atoi(argv[2]):DEFAULT_REPS;
+  char workingDir[PATH_MAX];
+  check(getcwd(workingDir,PATH_MAX),"cannot get the working directory");
+  for(int i=0;i<reps;i++)
+  {
+    benchDIEs(fname,workingDir);
+  }
+  return 0;
+}
@@ -55,10 +55,42 @@
 
 
 #include "../../src/leb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <limits.h>
 
-int slebTests[]={0,1,-1,2,-2,4093,-4093};
-uint ulebTests[]={0,1,2,3,4,5,6,7,8,254,256,257,258,510,512,550,66000};
+#define DEFAULT_COUNT 1000000
 
+int slebTests[]={0,1,-1,2,-2,63,64,-64,-65,4093,-4093,INT_MAX,INT_MIN};
+uint ulebTests[]={0,1,2,3,4,5,6,7,8,127,128,254,256,257,258,510,512,550,16383,16384,66000,UINT_MAX};
+word_t uwordTests[]={0,127,128,16383,16384,(word_t)1<<35,(word_t)1<<56,((word_t)1<<56)-1,(word_t)-1};
+sword_t swordTests[]={0,-1,63,-64,64,-65,8191,-8192,8192,-8193,(sword_t)1<<40,-((sword_t)1<<40),
+                      (sword_t)(((word_t)1)<<(sizeof(word_t)*8-1)),(sword_t)((((word_t)1)<<(sizeof(word_t)*8-1))-1)};
+
+struct timespec startTime;
+
+void startTimer()
+{
+  clock_gettime(CLOCK_MONOTONIC,&startTime);
+}
+
+void reportTimer(char* what,int ops)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double seconds=(end.tv_sec-startTime.tv_sec)+(end.tv_nsec-startTime.tv_nsec)/1e9;
+  printf("%-28s %9i ops %8.3fms %12.0f ops/sec\n",what,ops,seconds*1000,seconds>0?ops/seconds:0.0);
+}
+
+void check(bool condition,char* what)
+{
+  if(!condition)
+  {
+    fprintf(stderr,"lebtest: %s\n",what);
+    abort();
+  }
+}
 
 void testULEB(uint val)
 {
@@ -69,6 +101,7 @@ void testULEB(uint val)
     fprintf(stderr,"Passing through ULEB %u became %u",val,roundTrippedVal);
     abort();
   }
+  free(data);
 }
 
 void testSLEB(int val)
@@ -80,11 +113,149 @@ void testSLEB(int val)
     fprintf(stderr,"Passing through SLEB %i became %i",val,roundTrippedVal);
     abort();
   }
+  free(data);
+}
+
+//the direct encoders must produce exactly what the general byte-array
+//encoder does, and every decoder must agree with them, whether or
+//not it knows where the buffer ends
+void testUWord(word_t val)
+{
+  byte leb[LEB128_MAX_WORD_BYTES+8];
+  memset(leb,0xff,sizeof(leb));
+  usint len=encodeULEB128(val,leb);
+  usint oldLen;
+  byte* old=encodeAsLEB128((byte*)&val,sizeof(val),false,&oldLen);
+  check(len==oldLen && !memcmp(leb,old,len),"encodeULEB128 disagrees with encodeAsLEB128");
+  free(old);
+  word_t decoded;
+  check(decodeULEB128(leb,NULL,&decoded)==len && decoded==val,"unbounded ULEB decode failed");
+  check(decodeULEB128(leb,leb+len,&decoded)==len && decoded==val,"exactly bounded ULEB decode failed");
+  check(decodeULEB128(leb,leb+sizeof(leb),&decoded)==len && decoded==val,"word at a time ULEB decode failed");
+  check(!decodeULEB128(leb,leb+len-1,&decoded),"truncated ULEB was not rejected");
+}
+
+void testSWord(sword_t val)
+{
+  byte leb[LEB128_MAX_WORD_BYTES+8];
+  memset(leb,0xff,sizeof(leb));
+  usint len=encodeSLEB128(val,leb);
+  usint oldLen;
+  byte* old=encodeAsLEB128((byte*)&val,sizeof(val),true,&oldLen);
+  check(len==oldLen && !memcmp(leb,old,len),"encodeSLEB128 disagrees with encodeAsLEB128");
+  free(old);
+  sword_t decoded;
+  check(decodeSLEB128(leb,NULL,&decoded)==len && decoded==val,"unbounded SLEB decode failed");
+  check(decodeSLEB128(leb,leb+sizeof(leb),&decoded)==len && decoded==val,"word at a time SLEB decode failed");
+  check(!decodeSLEB128(leb,leb+len-1,&decoded),"truncated SLEB was not rejected");
+}
+
+//fills a buffer with count ULEBs sized roughly the way they are in
+//.eh_frame and .debug_info: mostly one byte, some two, a few long
+byte* makeLEBs(int count,int* lenOut,word_t* sumOut)
+{
+  byte* buf=malloc(count*LEB128_MAX_WORD_BYTES);
+  int len=0;
+  word_t sum=0;
+  srand(1);
+  for(int i=0;i<count;i++)
+  {
+    int kind=rand()%16;
+    word_t val=rand();
+    if(kind<11)
+    {
+      val&=0x7f;
+    }
+    else if(kind<14)
+    {
+      val&=0x3fff;
+    }
+    else
+    {
+      val=val<<20|rand();
+    }
+    sum+=val;
+    len+=encodeULEB128(val,buf+len);
+  }
+  *lenOut=len;
+  *sumOut=sum;
+  return buf;
+}
+
+void benchDecode(int count)
+{
+  int len;
+  word_t expectedSum;
+  byte* buf=makeLEBs(count,&len,&expectedSum);
+  byte* end=buf+len;
+
+  startTimer();
+  word_t sum=0;
+  for(byte* p=buf;p<end;)
+  {
+    byte val[sizeof(word_t)+1];
+    usint numBytes;
+    memset(val,0,sizeof(val));
+    p+=decodeLEB128ToBuffer(p,false,val,sizeof(val),&numBytes);
+    word_t w=0;
+    memcpy(&w,val,min(numBytes,sizeof(word_t)));
+    sum+=w;
+  }
+  reportTimer("decode to byte buffer",count);
+  check(sum==expectedSum,"byte buffer decode gave the wrong values");
+
+  startTimer();
+  sum=0;
+  for(byte* p=buf;p<end;)
+  {
+    usint numBytes;
+    sum+=leb128ToUWord(p,&numBytes);
+    p+=numBytes;
+  }
+  reportTimer("leb128ToUWord",count);
+  check(sum==expectedSum,"leb128ToUWord gave the wrong values");
+
+  startTimer();
+  sum=0;
+  for(byte* p=buf;p<end;)
+  {
+    word_t val;
+    p+=decodeULEB128(p,end,&val);
+    sum+=val;
+  }
+  reportTimer("decodeULEB128 bounded",count);
+  check(sum==expectedSum,"decodeULEB128 gave the wrong values");
+  free(buf);
+}
+
+void benchEncode(int count)
+{
+  byte leb[LEB128_MAX_WORD_BYTES];
+  size_t total=0;
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    word_t val=(word_t)i*2654435761u;
+    usint len;
+    byte* data=encodeAsLEB128((byte*)&val,sizeof(val),false,&len);
+    total+=len;
+    free(data);
+  }
+  reportTimer("encodeAsLEB128",count);
+  size_t directTotal=0;
+  startTimer();
+  for(int i=0;i<count;i++)
+  {
+    word_t val=(word_t)i*2654435761u;
+    directTotal+=encodeULEB128(val,leb);
+  }
+  reportTimer("encodeULEB128",count);
+  check(total==directTotal,"encoders disagree on lengths");
 }
 
 int main(int argc,char** argv)
 {
-  for(int i=0;i<sizeof(ulebTests)/sizeof(int);i++)
+  for(int i=0;i<sizeof(ulebTests)/sizeof(uint);i++)
   {
     testULEB(ulebTests[i]);
   }
@@ -92,4 +263,32 @@ int main(int argc,char** argv)
   {
     testSLEB(slebTests[i]);
   }
+  for(int i=0;i<sizeof(uwordTests)/sizeof(word_t);i++)
+  {
+    testUWord(uwordTests[i]);
+  }
+  for(int i=0;i<sizeof(swordTests)/sizeof(sword_t);i++)
+  {
+    testSWord(swordTests[i]);
+  }
+  //every value around each septet boundary
+  for(int bits=0;bits<sizeof(word_t)*8;bits++)
+  {
+    word_t val=(word_t)1<<bits;
+    testUWord(val-1);
+    testUWord(val);
+    testUWord(val+1);
+    testSWord((sword_t)val);
+    testSWord(-(sword_t)val);
+    testSWord((sword_t)val-1);
+  }
+
+  int count=DEFAULT_COUNT;
+  if(argc>1)
+  {
+    count=atoi(argv[1]);
+  }
+  benchDecode(count);
+  benchEncode(count);
+  return 0;
 }